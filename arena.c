@@ -0,0 +1,101 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+struct arena_block
+{
+	struct arena_block *next;
+	_Alignas(ARENA_ALIGN) uint8_t data[];
+};
+
+bool arena_init(struct arena *a, size_t size)
+{
+	*a = (struct arena)ARENA_EMPTY;
+
+	if ((a->buf = aligned_alloc(ARENA_ALIGN, size)) == NULL)
+		return false;
+	a->size = size;
+
+	return true;
+}
+
+void *arena_alloc_block(struct arena *a, size_t size)
+{
+	struct arena_block *b = malloc(sizeof *b + size);
+
+	if (b == NULL)
+		return NULL;
+
+	b->next = a->blocks;
+	a->blocks = b;
+	++a->overflows;
+
+	return b->data;
+}
+
+void arena_free_blocks(struct arena *a)
+{
+	while (a->blocks != NULL)
+	{
+		struct arena_block *next = a->blocks->next;
+
+		free(a->blocks);
+		a->blocks = next;
+	}
+}
+
+void arena_free(struct arena *a)
+{
+	arena_free_blocks(a);
+	free(a->buf);
+
+	*a = (struct arena)ARENA_EMPTY;
+}
+
+#ifdef ALLOC_STATS
+
+/* The allocator of glibc, which is wrapped to count allocations of every
+ * thread, including the ones made inside the C library */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+
+static __thread uint64_t arena_allocs = 0;
+
+void *malloc(size_t size)
+{
+	++arena_allocs;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	++arena_allocs;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+	++arena_allocs;
+	return __libc_realloc(p, size);
+}
+
+void free(void *p)
+{
+	__libc_free(p);
+}
+
+uint64_t arena_heap_allocs(void)
+{
+	return arena_allocs;
+}
+
+#else
+
+uint64_t arena_heap_allocs(void)
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef DHCPD_ARENA_H_
+#define DHCPD_ARENA_H_
+
+/* Bump-pointer allocator for memory, which lives only as long as one DHCP
+ * message is handled. Allocations take the next bytes of a fixed buffer and
+ * are never freed one by one, the whole arena is reset after the message
+ * instead. If the buffer runs full, further allocations come from the heap
+ * until the next reset, so an arena never fails before the heap does.
+ */
+
+#ifndef ARENA_SIZE
+#define ARENA_SIZE (64 << 10)
+#endif
+
+/* Alignment of all allocations */
+#define ARENA_ALIGN 16
+
+struct arena_block;
+
+struct arena
+{
+	uint8_t *buf;
+	size_t size;
+	size_t used;
+
+	/* Heap blocks allocated since the last reset */
+	struct arena_block *blocks;
+
+	/* Most bytes used between two resets and count of heap blocks */
+	size_t used_max;
+	uint64_t overflows;
+};
+
+#define ARENA_EMPTY {\
+		.buf = NULL,\
+		.size = 0,\
+		.used = 0,\
+		.blocks = NULL,\
+		.used_max = 0,\
+		.overflows = 0\
+	}
+
+/**
+ * Allocate buffer of an arena
+ *
+ * @param[out] a Arena
+ * @param[in] size Size of the buffer in bytes
+ */
+extern bool arena_init(struct arena *a, size_t size);
+
+/**
+ * Allocate from the heap, because the buffer is full
+ */
+extern void *arena_alloc_block(struct arena *a, size_t size);
+
+/**
+ * Allocate memory, which stays valid until the next arena_reset()
+ *
+ * @param[in] a Arena
+ * @param[in] size Size in bytes
+ * @return Memory or NULL if the heap is exhausted
+ */
+static inline void *arena_alloc(struct arena *a, size_t size)
+{
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (size > a->size - a->used)
+		return arena_alloc_block(a, size);
+
+	void *p = a->buf + a->used;
+	a->used += size;
+
+	return p;
+}
+
+/**
+ * Free all heap blocks of an arena
+ */
+extern void arena_free_blocks(struct arena *a);
+
+/**
+ * Give back all memory allocated from an arena
+ */
+static inline void arena_reset(struct arena *a)
+{
+	if (a->used > a->used_max)
+		a->used_max = a->used;
+	a->used = 0;
+
+	if (a->blocks != NULL)
+		arena_free_blocks(a);
+}
+
+/**
+ * Free buffer of an arena
+ */
+extern void arena_free(struct arena *a);
+
+/**
+ * Fetch count of heap allocations made by the calling thread, which are only
+ * counted if the daemon was built with ALLOC_STATS
+ */
+extern uint64_t arena_heap_allocs(void);
+
+#endif
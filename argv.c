@@ -13,6 +13,8 @@ enum argv_p_state
 	_ARGV_S_INTERFACE_VAL,
 	/* Value for -db */
 	_ARGV_S_DB_VAL,
+	/* Value for -cache */
+	_ARGV_S_CACHE_VAL,
 	/* Value for -user */
 	_ARGV_S_USER_VAL,
 	/* Value for -group */
@@ -21,6 +23,10 @@ enum argv_p_state
 	_ARGV_S_IPRANGE_VAL_1,
 	/* Second value for -iprange */
 	_ARGV_S_IPRANGE_VAL_2,
+	/* First value for -exclude */
+	_ARGV_S_EXCLUDE_VAL_1,
+	/* Second value for -exclude */
+	_ARGV_S_EXCLUDE_VAL_2,
 	/* Value for -router */
 	_ARGV_S_ROUTERS_VAL,
 	/* Value for -nameserver */
@@ -29,8 +35,48 @@ enum argv_p_state
 	_ARGV_S_PREFIXLEN_VAL,
 	/* Value for -leasetime */
 	_ARGV_S_LEASETIME_VAL,
+	/* Value for -leasejitter */
+	_ARGV_S_LEASEJITTER_VAL,
 	/* Value for -gc */
-	_ARGV_S_GC_VAL
+	_ARGV_S_GC_VAL,
+	/* Value for -stats */
+	_ARGV_S_STATS_VAL,
+	/* Value for -rcvbuf */
+	_ARGV_S_RCVBUF_VAL,
+	/* Value for -engine */
+	_ARGV_S_ENGINE_VAL,
+	/* Value for -maxage */
+	_ARGV_S_MAXAGE_VAL,
+	/* First value for -ratelimit */
+	_ARGV_S_RATELIMIT_VAL_1,
+	/* Second value for -ratelimit */
+	_ARGV_S_RATELIMIT_VAL_2,
+	/* First value for -relayratelimit */
+	_ARGV_S_RELAYRATELIMIT_VAL_1,
+	/* Second value for -relayratelimit */
+	_ARGV_S_RELAYRATELIMIT_VAL_2,
+	/* Value for -capture */
+	_ARGV_S_CAPTURE_VAL,
+	/* Value for -capturesample */
+	_ARGV_S_CAPTURESAMPLE_VAL,
+	/* Value for -control */
+	_ARGV_S_CONTROL_VAL,
+	/* Value for -takeover */
+	_ARGV_S_TAKEOVER_VAL,
+	/* First value for -replicate */
+	_ARGV_S_REPLICATE_VAL_1,
+	/* Second value for -replicate */
+	_ARGV_S_REPLICATE_VAL_2,
+	/* First value for -standby */
+	_ARGV_S_STANDBY_VAL_1,
+	/* Second value for -standby */
+	_ARGV_S_STANDBY_VAL_2,
+	/* Value for -repllag */
+	_ARGV_S_REPLLAG_VAL,
+	/* Value for -loadbalance */
+	_ARGV_S_LOADBALANCE_VAL,
+	/* Value for -class */
+	_ARGV_S_CLASS_VAL
 };
 
 bool argv_parse(int argc, char **argv, struct argv *out)
@@ -51,18 +97,46 @@ bool argv_parse(int argc, char **argv, struct argv *out)
 					state = _ARGV_S_INTERFACE_VAL;
 				else if (!strcmp(arg, "-db"))
 					state = _ARGV_S_DB_VAL;
+				else if (!strcmp(arg, "-cache"))
+					state = _ARGV_S_CACHE_VAL;
 				else if (!strcmp(arg, "-user"))
 					state = _ARGV_S_USER_VAL;
 				else if (!strcmp(arg, "-group"))
 					state = _ARGV_S_GROUP_VAL;
 				else if (!strcmp(arg, "-iprange"))
 					state = _ARGV_S_IPRANGE_VAL_1;
+				else if (!strcmp(arg, "-exclude"))
+					state = _ARGV_S_EXCLUDE_VAL_1;
 				else if (!strcmp(arg, "-router"))
 					state = _ARGV_S_ROUTERS_VAL;
 				else if (!strcmp(arg, "-nameserver"))
 					state = _ARGV_S_NAMESERVERS_VAL;
 				else if (!strcmp(arg, "-gc"))
 					state = _ARGV_S_GC_VAL;
+				else if (!strcmp(arg, "-stats"))
+					state = _ARGV_S_STATS_VAL;
+				else if (!strcmp(arg, "-ratelimit"))
+					state = _ARGV_S_RATELIMIT_VAL_1;
+				else if (!strcmp(arg, "-relayratelimit"))
+					state = _ARGV_S_RELAYRATELIMIT_VAL_1;
+				else if (!strcmp(arg, "-capture"))
+					state = _ARGV_S_CAPTURE_VAL;
+				else if (!strcmp(arg, "-capturesample"))
+					state = _ARGV_S_CAPTURESAMPLE_VAL;
+				else if (!strcmp(arg, "-control"))
+					state = _ARGV_S_CONTROL_VAL;
+				else if (!strcmp(arg, "-takeover"))
+					state = _ARGV_S_TAKEOVER_VAL;
+				else if (!strcmp(arg, "-replicate"))
+					state = _ARGV_S_REPLICATE_VAL_1;
+				else if (!strcmp(arg, "-standby"))
+					state = _ARGV_S_STANDBY_VAL_1;
+				else if (!strcmp(arg, "-repllag"))
+					state = _ARGV_S_REPLLAG_VAL;
+				else if (!strcmp(arg, "-loadbalance"))
+					state = _ARGV_S_LOADBALANCE_VAL;
+				else if (!strcmp(arg, "-class"))
+					state = _ARGV_S_CLASS_VAL;
 				else if (!strcmp(arg, "-allocate"))
 					out->allocate = true;
 				else if (!strncmp(arg, "-h", 2))
@@ -73,10 +147,22 @@ bool argv_parse(int argc, char **argv, struct argv *out)
 					out->debug = true;
 				else if (!strcmp(arg, "-new"))
 					out->_new = true;
+				else if (!strcmp(arg, "-broadcast"))
+					out->broadcast = true;
+				else if (!strcmp(arg, "-rxring"))
+					out->rxring = true;
 				else if (!strcmp(arg, "-prefixlen"))
 					state = _ARGV_S_PREFIXLEN_VAL;
 				else if (!strcmp(arg, "-leasetime"))
 					state = _ARGV_S_LEASETIME_VAL;
+				else if (!strcmp(arg, "-leasejitter"))
+					state = _ARGV_S_LEASEJITTER_VAL;
+				else if (!strcmp(arg, "-rcvbuf"))
+					state = _ARGV_S_RCVBUF_VAL;
+				else if (!strcmp(arg, "-engine"))
+					state = _ARGV_S_ENGINE_VAL;
+				else if (!strcmp(arg, "-maxage"))
+					state = _ARGV_S_MAXAGE_VAL;
 				else
 				{
 					out->argerror = i;
@@ -94,6 +180,11 @@ bool argv_parse(int argc, char **argv, struct argv *out)
 				state = _ARGV_S_ARGUMENT;
 				break;
 
+			case _ARGV_S_CACHE_VAL:
+				out->cache = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
 			case _ARGV_S_USER_VAL:
 				out->user = arg;
 				state = _ARGV_S_ARGUMENT;
@@ -105,13 +196,23 @@ bool argv_parse(int argc, char **argv, struct argv *out)
 				break;
 
 			case _ARGV_S_IPRANGE_VAL_1:
-				out->iprange[0] = arg;
-				state = _ARGV_S_IPRANGE_VAL_2;
+			case _ARGV_S_IPRANGE_VAL_2:
+				out->iprange = argv_realloc(
+					out->iprange,
+					++out->iprange_cnt * sizeof(char*));
+				out->iprange[out->iprange_cnt - 1] = arg;
+				state = state == _ARGV_S_IPRANGE_VAL_1 ?
+					_ARGV_S_IPRANGE_VAL_2 : _ARGV_S_ARGUMENT;
 				break;
 
-			case _ARGV_S_IPRANGE_VAL_2:
-				out->iprange[1] = arg;
-				state = _ARGV_S_ARGUMENT;
+			case _ARGV_S_EXCLUDE_VAL_1:
+			case _ARGV_S_EXCLUDE_VAL_2:
+				out->exclude = argv_realloc(
+					out->exclude,
+					++out->exclude_cnt * sizeof(char*));
+				out->exclude[out->exclude_cnt - 1] = arg;
+				state = state == _ARGV_S_EXCLUDE_VAL_1 ?
+					_ARGV_S_EXCLUDE_VAL_2 : _ARGV_S_ARGUMENT;
 				break;
 
 			case _ARGV_S_ROUTERS_VAL:
@@ -135,6 +236,11 @@ bool argv_parse(int argc, char **argv, struct argv *out)
 				state = _ARGV_S_ARGUMENT;
 				break;
 
+			case _ARGV_S_LEASEJITTER_VAL:
+				out->leasejitter = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
 			case _ARGV_S_PREFIXLEN_VAL:
 				out->prefixlen = arg;
 				state = _ARGV_S_ARGUMENT;
@@ -144,6 +250,101 @@ bool argv_parse(int argc, char **argv, struct argv *out)
 				out->gc = arg;
 				state = _ARGV_S_ARGUMENT;
 				break;
+
+			case _ARGV_S_STATS_VAL:
+				out->stats = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_RCVBUF_VAL:
+				out->rcvbuf = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_ENGINE_VAL:
+				out->engine = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_MAXAGE_VAL:
+				out->maxage = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_RATELIMIT_VAL_1:
+				out->ratelimit[0] = arg;
+				state = _ARGV_S_RATELIMIT_VAL_2;
+				break;
+
+			case _ARGV_S_RATELIMIT_VAL_2:
+				out->ratelimit[1] = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_RELAYRATELIMIT_VAL_1:
+				out->relayratelimit[0] = arg;
+				state = _ARGV_S_RELAYRATELIMIT_VAL_2;
+				break;
+
+			case _ARGV_S_RELAYRATELIMIT_VAL_2:
+				out->relayratelimit[1] = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_CAPTURE_VAL:
+				out->capture = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_CAPTURESAMPLE_VAL:
+				out->capturesample = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_CONTROL_VAL:
+				out->control = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_TAKEOVER_VAL:
+				out->takeover = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_REPLICATE_VAL_1:
+				out->replicate[0] = arg;
+				state = _ARGV_S_REPLICATE_VAL_2;
+				break;
+
+			case _ARGV_S_REPLICATE_VAL_2:
+				out->replicate[1] = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_STANDBY_VAL_1:
+				out->standby[0] = arg;
+				state = _ARGV_S_STANDBY_VAL_2;
+				break;
+
+			case _ARGV_S_STANDBY_VAL_2:
+				out->standby[1] = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_REPLLAG_VAL:
+				out->repllag = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_LOADBALANCE_VAL:
+				out->loadbalance = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
+
+			case _ARGV_S_CLASS_VAL:
+				out->class = arg;
+				state = _ARGV_S_ARGUMENT;
+				break;
 		}
 	}
 
@@ -23,13 +23,20 @@ struct argv
 	char *interface;
 	/* -db FILE */
 	char *db;
+	/* -cache FILE */
+	char *cache;
 	/* -user UID */
 	char *user;
 	/* -group GID */
 	char *group;
 
-	/* -iprange IP IP */
-	char *iprange[2];
+	/* -iprange IP IP, two values per range */
+	char **iprange;
+	size_t iprange_cnt;
+
+	/* -exclude IP IP, two values per range */
+	char **exclude;
+	size_t exclude_cnt;
 
 	/* -router IP */
 	char **routers;
@@ -45,9 +52,57 @@ struct argv
 	/* -leasetime INT */
 	char *leasetime;
 
+	/* -leasejitter PERCENT */
+	char *leasejitter;
+
 	/* -gc INT */
 	char *gc;
 
+	/* -rcvbuf BYTES */
+	char *rcvbuf;
+
+	/* -engine NAME */
+	char *engine;
+
+	/* -maxage MSEC */
+	char *maxage;
+
+	/* -stats INT */
+	char *stats;
+
+	/* -ratelimit RATE BURST */
+	char *ratelimit[2];
+
+	/* -relayratelimit RATE BURST */
+	char *relayratelimit[2];
+
+	/* -capture FILE */
+	char *capture;
+
+	/* -capturesample INT */
+	char *capturesample;
+
+	/* -control FILE */
+	char *control;
+
+	/* -takeover FILE */
+	char *takeover;
+
+	/* -replicate IP PORT */
+	char *replicate[2];
+
+	/* -standby IP PORT */
+	char *standby[2];
+
+	/* -repllag INT */
+	char *repllag;
+
+	/* -loadbalance BUCKETS */
+	char *loadbalance;
+
+	/* -class FILE */
+	char *class;
+
 	/* -allocate */
 	bool allocate;
 	/* -help */
@@ -58,6 +113,10 @@ struct argv
 	bool debug;
 	/* -new */
 	bool _new;
+	/* -broadcast */
+	bool broadcast;
+	/* -rxring */
+	bool rxring;
 };
 
 #define ARGV_EMPTY {\
@@ -66,9 +125,28 @@ struct argv
 		.arg0 = NULL,\
 		.interface = NULL,\
 		.db = NULL,\
+		.cache = NULL,\
 		.user = NULL,\
 		.group = NULL,\
-		.iprange = { NULL, NULL },\
+		.iprange = NULL,\
+		.iprange_cnt = 0,\
+		.exclude = NULL,\
+		.exclude_cnt = 0,\
+		.ratelimit = { NULL, NULL },\
+		.relayratelimit = { NULL, NULL },\
+		.capture = NULL,\
+		.capturesample = NULL,\
+		.control = NULL,\
+		.takeover = NULL,\
+		.replicate = { NULL, NULL },\
+		.standby = { NULL, NULL },\
+		.repllag = NULL,\
+		.loadbalance = NULL,\
+		.class = NULL,\
+		.leasejitter = NULL,\
+		.rcvbuf = NULL,\
+		.engine = NULL,\
+		.maxage = NULL,\
 		.routers = NULL,\
 		.routers_cnt = 0,\
 		.nameservers = NULL,\
@@ -77,7 +155,9 @@ struct argv
 		.help = false,\
 		.version = false,\
 		.debug = false,\
-		._new = false\
+		._new = false,\
+		.broadcast = false,\
+		.rxring = false\
 	}
 
 /**
@@ -101,6 +181,10 @@ extern bool argv_parse(int argc, char **argv, struct argv *out);
  */
 static inline void argv_free(struct argv *out)
 {
+	if (out->iprange)
+		out->iprange = argv_realloc(out->iprange, out->iprange_cnt = 0);
+	if (out->exclude)
+		out->exclude = argv_realloc(out->exclude, out->exclude_cnt = 0);
 	if (out->routers)
 		out->routers = argv_realloc(out->routers, out->routers_cnt = 0);
 	if (out->nameservers)
@@ -0,0 +1,250 @@
+#include "capture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "packet.h"
+
+#define PCAPNG_SHB 0x0A0D0D0A
+#define PCAPNG_IDB 0x00000001
+#define PCAPNG_EPB 0x00000006
+#define PCAPNG_BOM 0x1A2B3C4D
+
+#define PCAPNG_OPT_END 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_EPB_FLAGS 2
+
+/* Raw IPv4 without link-layer header */
+#define PCAPNG_LINKTYPE_IPV4 228
+
+#define PCAPNG_PAD(l) (((l) + 3) & ~(size_t)3)
+
+/* Fixed part of an Enhanced Packet Block and its trailing length */
+#define CAPTURE_EPB_HDRLEN (28)
+#define CAPTURE_EPB_OPTLEN (8 + 4 + PCAPNG_PAD(CAPTURE_COMMENT_MAX) + 4 + 4)
+#define CAPTURE_IPUDP_HDRLEN (PACKET_IP_HDRLEN + PACKET_UDP_HDRLEN)
+
+/* Longest DHCP message, which is captured completely */
+#define CAPTURE_SNAPLEN (CAPTURE_CHUNK_SIZE - CAPTURE_EPB_HDRLEN -\
+		CAPTURE_EPB_OPTLEN - CAPTURE_IPUDP_HDRLEN)
+
+static inline uint8_t *capture_put32(uint8_t *p, uint32_t v)
+{
+	memcpy(p, &v, 4);
+	return p + 4;
+}
+
+static inline uint8_t *capture_put16(uint8_t *p, uint16_t v)
+{
+	memcpy(p, &v, 2);
+	return p + 2;
+}
+
+/**
+ * Write option, which is padded to 32 bit
+ */
+static uint8_t *capture_putopt(uint8_t *p, uint16_t code, const void *data,
+	size_t len)
+{
+	p = capture_put16(p, code);
+	p = capture_put16(p, len);
+	memcpy(p, data, len);
+	memset(p + len, 0, PCAPNG_PAD(len) - len);
+
+	return p + PCAPNG_PAD(len);
+}
+
+/**
+ * Write whole buffer to fd, even if writev() writes it partially
+ */
+static bool capture_writev(int fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0)
+	{
+		ssize_t written = writev(fd, iov, iovcnt);
+
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		while (iovcnt > 0 && (size_t)written >= iov->iov_len)
+		{
+			written -= iov->iov_len;
+			++iov;
+			--iovcnt;
+		}
+
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (uint8_t *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+
+	return true;
+}
+
+bool capture_open(struct capture *c, const char *path, uint32_t sample)
+{
+	*c = (struct capture)CAPTURE_EMPTY;
+
+	c->buf = malloc((size_t)CAPTURE_CHUNKS * CAPTURE_CHUNK_SIZE);
+	if (c->buf == NULL)
+		return false;
+
+	for (size_t i = 0; i < CAPTURE_CHUNKS; ++i)
+		c->iov[i] = (struct iovec){
+			.iov_base = c->buf + i * CAPTURE_CHUNK_SIZE,
+			.iov_len = 0
+		};
+
+	c->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (c->fd < 0)
+		goto error;
+
+	c->sample = sample ? sample : 1;
+
+	/* Section Header Block and Interface Description Block */
+	uint8_t hdr[28 + 20];
+	uint8_t *p = hdr;
+
+	p = capture_put32(p, PCAPNG_SHB);
+	p = capture_put32(p, 28);
+	p = capture_put32(p, PCAPNG_BOM);
+	p = capture_put16(p, 1);
+	p = capture_put16(p, 0);
+	/* Section length is unknown */
+	p = capture_put32(p, UINT32_MAX);
+	p = capture_put32(p, UINT32_MAX);
+	p = capture_put32(p, 28);
+
+	p = capture_put32(p, PCAPNG_IDB);
+	p = capture_put32(p, 20);
+	p = capture_put16(p, PCAPNG_LINKTYPE_IPV4);
+	p = capture_put16(p, 0);
+	p = capture_put32(p, CAPTURE_SNAPLEN + CAPTURE_IPUDP_HDRLEN);
+	p = capture_put32(p, 20);
+
+	struct iovec iov = { .iov_base = hdr, .iov_len = sizeof hdr };
+	if (!capture_writev(c->fd, &iov, 1))
+		goto error;
+
+	return true;
+
+error:
+	{
+		int err = errno;
+		capture_close(c);
+		errno = err;
+	}
+	return false;
+}
+
+bool capture_packet(struct capture *c, enum capture_dir dir,
+	const struct timespec *ts, const struct sockaddr_in *src,
+	const struct sockaddr_in *dst, const uint8_t *data, size_t len,
+	const char *comment)
+{
+	if (c->fd < 0)
+		return false;
+
+	size_t caplen = len > CAPTURE_SNAPLEN ? CAPTURE_SNAPLEN : len;
+	size_t comment_len = comment ? strnlen(comment, CAPTURE_COMMENT_MAX) : 0;
+	size_t rec_len = CAPTURE_EPB_HDRLEN
+		+ PCAPNG_PAD(CAPTURE_IPUDP_HDRLEN + caplen)
+		+ 8
+		+ (comment_len ? 4 + PCAPNG_PAD(comment_len) : 0)
+		+ 4 + 4;
+
+	if (c->iov[c->chunk].iov_len + rec_len > CAPTURE_CHUNK_SIZE)
+	{
+		if (++c->chunk == CAPTURE_CHUNKS && !capture_flush(c))
+			return false;
+	}
+
+	uint8_t *rec = (uint8_t *)c->iov[c->chunk].iov_base + c->iov[c->chunk].iov_len;
+	uint8_t *p = rec;
+
+	uint64_t usec = (uint64_t)ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+
+	p = capture_put32(p, PCAPNG_EPB);
+	p = capture_put32(p, rec_len);
+	p = capture_put32(p, 0);
+	p = capture_put32(p, usec >> 32);
+	p = capture_put32(p, usec & UINT32_MAX);
+	p = capture_put32(p, CAPTURE_IPUDP_HDRLEN + caplen);
+	p = capture_put32(p, CAPTURE_IPUDP_HDRLEN + len);
+
+	/* IPv4 header, the UDP checksum is optional and left zero */
+	uint8_t *ip = p;
+	memset(ip, 0, CAPTURE_IPUDP_HDRLEN);
+	ip[0] = 0x45;
+	capture_put16(ip + 2, htons(CAPTURE_IPUDP_HDRLEN + len));
+	ip[8] = 64;
+	ip[9] = IPPROTO_UDP;
+	memcpy(ip + 12, &src->sin_addr, 4);
+	memcpy(ip + 16, &dst->sin_addr, 4);
+	capture_put16(ip + 10, packet_fold(packet_sum(ip, PACKET_IP_HDRLEN, 0)));
+
+	uint8_t *udp = ip + PACKET_IP_HDRLEN;
+	capture_put16(udp + 0, src->sin_port);
+	capture_put16(udp + 2, dst->sin_port);
+	capture_put16(udp + 4, htons(PACKET_UDP_HDRLEN + len));
+
+	p += CAPTURE_IPUDP_HDRLEN;
+	memcpy(p, data, caplen);
+	size_t pad = PCAPNG_PAD(CAPTURE_IPUDP_HDRLEN + caplen)
+		- (CAPTURE_IPUDP_HDRLEN + caplen);
+	memset(p + caplen, 0, pad);
+	p += caplen + pad;
+
+	uint32_t flags = dir;
+	p = capture_putopt(p, PCAPNG_OPT_EPB_FLAGS, &flags, 4);
+	if (comment_len)
+		p = capture_putopt(p, PCAPNG_OPT_COMMENT, comment, comment_len);
+	p = capture_put32(p, PCAPNG_OPT_END);
+	p = capture_put32(p, rec_len);
+
+	c->iov[c->chunk].iov_len += rec_len;
+
+	return true;
+}
+
+bool capture_flush(struct capture *c)
+{
+	if (c->fd < 0)
+		return false;
+
+	int iovcnt = c->chunk < CAPTURE_CHUNKS ? c->chunk + 1 : CAPTURE_CHUNKS;
+	bool ok = capture_writev(c->fd, c->iov, iovcnt);
+
+	/* capture_writev() advances partially written iovecs, reset all of them */
+	for (size_t i = 0; i < CAPTURE_CHUNKS; ++i)
+		c->iov[i] = (struct iovec){
+			.iov_base = c->buf + i * CAPTURE_CHUNK_SIZE,
+			.iov_len = 0
+		};
+	c->chunk = 0;
+
+	return ok;
+}
+
+void capture_close(struct capture *c)
+{
+	if (c->fd >= 0)
+	{
+		capture_flush(c);
+		close(c->fd);
+	}
+
+	free(c->buf);
+
+	c->fd = -1;
+	c->buf = NULL;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#ifndef DHCPD_CAPTURE_H_
+#define DHCPD_CAPTURE_H_
+
+/* Handled messages and their replies are written to a pcapng file. Every
+ * record is an Enhanced Packet Block, which holds the DHCP message behind a
+ * synthesized IPv4 and UDP header, the direction and a comment.
+ *
+ * Records are appended to a buffer of CAPTURE_CHUNKS chunks. A record never
+ * spans two chunks, and if no chunk is left, all of them are written out with
+ * a single writev(), so the file is touched once per megabyte instead of once
+ * per packet.
+ */
+
+#ifndef CAPTURE_CHUNK_SIZE
+#define CAPTURE_CHUNK_SIZE (1 << 16)
+#endif
+
+#ifndef CAPTURE_CHUNKS
+#define CAPTURE_CHUNKS 16
+#endif
+
+/* Longest comment of a record */
+#define CAPTURE_COMMENT_MAX 256
+
+enum capture_dir
+{
+	CAPTURE_INBOUND = 1,
+	CAPTURE_OUTBOUND = 2
+};
+
+struct capture
+{
+	int fd;
+	uint8_t *buf;
+
+	/* Chunk, which is currently filled, the length of every chunk is kept in
+	 * its iovec */
+	size_t chunk;
+	struct iovec iov[CAPTURE_CHUNKS];
+
+	/* Capture one of sample messages */
+	uint32_t sample;
+	uint32_t skipped;
+};
+
+#define CAPTURE_EMPTY {\
+		.fd = -1,\
+		.buf = NULL,\
+		.chunk = 0,\
+		.sample = 1,\
+		.skipped = 0\
+	}
+
+/**
+ * Create capture file and write section and interface headers
+ *
+ * @param[out] c Capture
+ * @param[in] path Path of the file, which is truncated
+ * @param[in] sample Capture one of sample messages
+ */
+extern bool capture_open(struct capture *c, const char *path, uint32_t sample);
+
+/**
+ * Decide whether the next message and its reply are captured
+ */
+static inline bool capture_sample(struct capture *c)
+{
+	if (c->fd < 0)
+		return false;
+
+	if (++c->skipped < c->sample)
+		return false;
+
+	c->skipped = 0;
+	return true;
+}
+
+/**
+ * Append a DHCP message to the capture
+ *
+ * @param[in] c Capture
+ * @param[in] dir Direction of the message
+ * @param[in] ts Time the message was received or sent
+ * @param[in] src Source address and port
+ * @param[in] dst Destination address and port
+ * @param[in] data DHCP message
+ * @param[in] len Length of the DHCP message
+ * @param[in] comment Comment of the record or NULL
+ */
+extern bool capture_packet(struct capture *c, enum capture_dir dir,
+	const struct timespec *ts, const struct sockaddr_in *src,
+	const struct sockaddr_in *dst, const uint8_t *data, size_t len,
+	const char *comment);
+
+/**
+ * Write all buffered records to the file
+ */
+extern bool capture_flush(struct capture *c);
+
+/**
+ * Flush and close capture
+ */
+extern void capture_close(struct capture *c);
+
+#endif
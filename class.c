@@ -0,0 +1,701 @@
+#include "class.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <arpa/inet.h>
+
+/* Match of a rule while the rules are read */
+struct class_match
+{
+	size_t rule;
+	enum class_field field;
+	/* Index of the value in the table of the field */
+	size_t value;
+};
+
+static const char *const class_fields[CLASS_FIELDS] = {
+	[CLASS_VENDOR] = "vendor",
+	[CLASS_USER] = "user",
+	[CLASS_CIRCUIT] = "circuit",
+	[CLASS_REMOTE] = "remote",
+	[CLASS_GIADDR] = "giaddr"
+};
+
+/* Sub-options of the relay agent information, RFC 3046 */
+#define CLASS_AGENT_CIRCUIT 1
+#define CLASS_AGENT_REMOTE 2
+
+static uint32_t class_hash(const uint8_t *data, uint16_t bits, bool prefix)
+{
+	uint32_t h = 2166136261U;
+	size_t bytes = bits / 8;
+
+	for (size_t i = 0; i < bytes; ++i)
+		h = (h ^ data[i]) * 16777619U;
+	if (bits % 8)
+		h = (h ^ (data[bytes] & (0xFF00 >> (bits % 8)))) * 16777619U;
+
+	h = (h ^ bits) * 16777619U;
+	return (h ^ prefix) * 16777619U;
+}
+
+/**
+ * Compare the first bits of two values
+ */
+static bool class_bits_eq(const uint8_t *a, const uint8_t *b, uint16_t bits)
+{
+	size_t bytes = bits / 8;
+
+	if (memcmp(a, b, bytes) != 0)
+		return false;
+
+	return bits % 8 == 0 ||
+		((a[bytes] ^ b[bytes]) & (0xFF00 >> (bits % 8))) == 0;
+}
+
+static const struct class_value *class_lookup(const struct class_table *t,
+	const uint8_t *data, uint16_t bits, bool prefix)
+{
+	uint32_t hash = class_hash(data, bits, prefix);
+
+	if (t->index == NULL)
+		return NULL;
+
+	for (uint32_t i = hash & t->index_mask; t->index[i]; i = (i + 1) & t->index_mask)
+	{
+		const struct class_value *v = &t->values[t->index[i] - 1];
+
+		if (v->hash == hash && v->bits == bits && v->prefix == prefix &&
+				class_bits_eq(v->data, data, bits))
+			return v;
+	}
+
+	return NULL;
+}
+
+/**
+ * Add value to the table of a field, unless it is already there
+ *
+ * @return Index of the value or SIZE_MAX on errors
+ */
+static size_t class_value_add(struct class_table *t, const uint8_t *data,
+	uint16_t bits, bool prefix)
+{
+	const struct class_value *found = class_lookup(t, data, bits, prefix);
+
+	if (found != NULL)
+		return found - t->values;
+
+	/* Keep the index at most half full */
+	if (2 * (t->values_cnt + 1) > t->index_mask + 1)
+	{
+		uint32_t mask = t->index_mask ? 2 * t->index_mask + 1 : 15;
+		uint32_t *index = calloc(mask + 1, sizeof *index);
+		struct class_value *values = realloc(t->values,
+			(mask + 1) / 2 * sizeof *values);
+
+		if (index == NULL || values == NULL)
+		{
+			free(index);
+			if (values != NULL)
+				t->values = values;
+			return SIZE_MAX;
+		}
+
+		for (size_t j = 0; j < t->values_cnt; ++j)
+		{
+			uint32_t i = values[j].hash & mask;
+
+			while (index[i])
+				i = (i + 1) & mask;
+			index[i] = j + 1;
+		}
+
+		free(t->index);
+		t->index = index;
+		t->index_mask = mask;
+		t->values = values;
+	}
+
+	struct class_value *v = &t->values[t->values_cnt];
+
+	*v = (struct class_value){
+		.bits = bits,
+		.prefix = prefix,
+		.hash = class_hash(data, bits, prefix)
+	};
+	memcpy(v->data, data, (bits + 7) / 8);
+
+	uint32_t i = v->hash & t->index_mask;
+	while (t->index[i])
+		i = (i + 1) & t->index_mask;
+	t->index[i] = ++t->values_cnt;
+
+	return t->values_cnt - 1;
+}
+
+/**
+ * Split next token off a line, a token is either a run of non-blank
+ * characters or double quoted text, which may be followed by *
+ *
+ * @param[in,out] p Position in the line
+ * @param[out] quoted Set if the token was double quoted
+ * @return Zero terminated token or NULL at the end of the line
+ */
+static char *class_token(char **p, bool *quoted)
+{
+	char *s = *p, *tok;
+
+	while (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n')
+		++s;
+
+	if (*s == 0 || *s == '#')
+		return NULL;
+
+	*quoted = *s == '"';
+	if (*quoted)
+	{
+		tok = ++s;
+		while (*s != '"' && *s != 0)
+			++s;
+		if (*s == 0)
+			return NULL;
+
+		/* The closing quote makes room for the terminator after a * */
+		if (s[1] == '*')
+		{
+			*s++ = '*';
+			*s++ = 0;
+		}
+		else
+			*s++ = 0;
+	}
+	else
+	{
+		tok = s;
+		while (*s != 0 && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n')
+			++s;
+		if (*s != 0)
+			*s++ = 0;
+	}
+
+	*p = s;
+	return tok;
+}
+
+static int class_hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+/**
+ * Parse value of a match
+ *
+ * @param[in] field Field of the match
+ * @param[in] tok Token, which is modified
+ * @param[in] quoted Set if the token was double quoted
+ * @param[out] data Value
+ * @param[out] bits Length of the value in bits
+ * @param[out] prefix Set if the value is a prefix
+ */
+static bool class_value_parse(enum class_field field, char *tok, bool quoted,
+	uint8_t *data, uint16_t *bits, bool *prefix)
+{
+	size_t len = strlen(tok);
+
+	if (field == CLASS_GIADDR)
+	{
+		char *slash = strchr(tok, '/');
+		long plen = 32;
+
+		if (slash != NULL)
+		{
+			char *end;
+
+			*slash = 0;
+			plen = strtol(slash + 1, &end, 10);
+			if (end == slash + 1 || *end != 0 || plen < 0 || plen > 32)
+				return false;
+		}
+
+		*bits = plen;
+		*prefix = true;
+		return inet_pton(AF_INET, tok, data) == 1;
+	}
+
+	*prefix = len > 0 && tok[len - 1] == '*';
+	if (*prefix)
+		tok[--len] = 0;
+
+	if (!quoted && len > 2 && tok[0] == '0' && (tok[1] == 'x' || tok[1] == 'X'))
+	{
+		if (len % 2 != 0 || (len - 2) / 2 > CLASS_VALUE_MAX)
+			return false;
+
+		for (size_t i = 2; i < len; i += 2)
+		{
+			int hi = class_hex(tok[i]), lo = class_hex(tok[i + 1]);
+
+			if (hi < 0 || lo < 0)
+				return false;
+			data[i / 2 - 1] = hi << 4 | lo;
+		}
+
+		*bits = (len - 2) / 2 * 8;
+		return true;
+	}
+
+	if (len > CLASS_VALUE_MAX)
+		return false;
+
+	memcpy(data, tok, len);
+	*bits = len * 8;
+	return true;
+}
+
+/**
+ * Parse setting of a rule
+ *
+ * @param[in,out] r Rule
+ * @param[in] tok Name of the setting
+ * @param[in,out] p Position in the line after the name
+ * @return Error message or NULL
+ */
+static const char *class_setting_parse(struct class_rule *r, const char *tok,
+	char **p)
+{
+	bool quoted;
+	char *val;
+
+	if (!strcmp(tok, "ignore"))
+	{
+		r->ignore = true;
+		return NULL;
+	}
+
+	if ((val = class_token(p, &quoted)) == NULL)
+		return "Missing value";
+
+	if (!strcmp(tok, "range") || !strcmp(tok, "exclude"))
+	{
+		char *last = class_token(p, &quoted);
+		struct in_addr range[2];
+
+		if (last == NULL || inet_pton(AF_INET, val, &range[0]) != 1 ||
+				inet_pton(AF_INET, last, &range[1]) != 1 ||
+				ntohl(range[0].s_addr) > ntohl(range[1].s_addr))
+			return "Invalid range";
+
+		if (!(tok[0] == 'r' ? range_set_add : range_set_exclude)(&r->ranges,
+				range[0], range[1]))
+			return strerror(errno);
+		return NULL;
+	}
+
+	if (!strcmp(tok, "router") || !strcmp(tok, "nameserver"))
+	{
+		bool router = tok[0] == 'r';
+		struct in_addr **list = router ? &r->routers : &r->nameservers;
+		size_t *cnt = router ? &r->routers_cnt : &r->nameservers_cnt;
+		struct in_addr *grown = realloc(*list, (*cnt + 1) * sizeof **list);
+
+		if (grown == NULL)
+			return strerror(errno);
+		*list = grown;
+
+		if (inet_pton(AF_INET, val, &grown[(*cnt)++]) != 1)
+			return "Invalid address";
+		return NULL;
+	}
+
+	if (!strcmp(tok, "leasetime") || !strcmp(tok, "prefixlen"))
+	{
+		char *end;
+		unsigned long v = strtoul(val, &end, 10);
+
+		if (end == val || *end != 0)
+			return "Invalid number";
+
+		if (tok[0] == 'l')
+		{
+			if (v == 0 || v > UINT32_MAX)
+				return "Invalid lease time";
+			r->leasetime = v;
+		}
+		else
+		{
+			if (v == 0 || v > 32)
+				return "Invalid prefix length";
+			r->prefixlen = v;
+		}
+		return NULL;
+	}
+
+	return "Unknown setting";
+}
+
+/**
+ * Compute the bitsets of all values of a field
+ */
+static void class_table_compile(struct class_set *cs, enum class_field field,
+	const struct class_match *matches, size_t matches_cnt, size_t *sets_off)
+{
+	struct class_table *t = &cs->tables[field];
+	uint64_t *any = cs->sets + *sets_off;
+
+	t->any = *sets_off;
+	*sets_off += cs->words;
+
+	/* Rules without match on the field */
+	for (size_t i = 0; i < matches_cnt; ++i)
+		if (matches[i].field == field)
+			any[matches[i].rule / 64] |= UINT64_C(1) << (matches[i].rule % 64);
+	for (size_t w = 0; w < cs->words; ++w)
+		any[w] = ~any[w];
+	if (cs->rules_cnt % 64)
+		any[cs->words - 1] &= (UINT64_C(1) << (cs->rules_cnt % 64)) - 1;
+
+	for (size_t j = 0; j < t->values_cnt; ++j)
+	{
+		struct class_value *v = &t->values[j];
+		uint64_t *set = cs->sets + *sets_off;
+
+		v->set = *sets_off;
+		*sets_off += cs->words;
+		memcpy(set, any, cs->words * sizeof *set);
+
+		/* A rule matches everything its value equals or is a prefix of */
+		for (size_t i = 0; i < matches_cnt; ++i)
+		{
+			const struct class_value *u;
+
+			if (matches[i].field != field)
+				continue;
+			u = &t->values[matches[i].value];
+
+			if (u == v || (u->prefix && u->bits <= v->bits &&
+					class_bits_eq(u->data, v->data, u->bits)))
+				set[matches[i].rule / 64] |= UINT64_C(1) << (matches[i].rule % 64);
+		}
+
+		if (!v->prefix)
+			continue;
+
+		/* Distinct prefix lengths, longest first */
+		size_t k = 0;
+		while (k < t->prefixes_cnt && t->prefixes[k] > v->bits)
+			++k;
+		if (k < t->prefixes_cnt && t->prefixes[k] == v->bits)
+			continue;
+
+		memmove(t->prefixes + k + 1, t->prefixes + k,
+			(t->prefixes_cnt - k) * sizeof *t->prefixes);
+		t->prefixes[k] = v->bits;
+		++t->prefixes_cnt;
+	}
+}
+
+bool class_load(struct class_set *cs, const char *path)
+{
+	FILE *stream = fopen(path, "r");
+	char *line = NULL;
+	size_t line_cap = 0, lineno = 0;
+	const char *err = NULL;
+
+	struct class_match *matches = NULL;
+	size_t matches_cnt = 0, matches_cap = 0, rules_cap = 0;
+
+	*cs = (struct class_set)CLASS_SET_EMPTY;
+
+	if (stream == NULL)
+	{
+		snprintf(cs->error, sizeof cs->error, "Could not open %s: %s", path,
+			strerror(errno));
+		return false;
+	}
+
+	while (getline(&line, &line_cap, stream) > 0)
+	{
+		char *p = line, *tok;
+		bool quoted;
+
+		++lineno;
+
+		if ((tok = class_token(&p, &quoted)) == NULL)
+			continue;
+
+		if (cs->rules_cnt == rules_cap)
+		{
+			size_t cap = rules_cap ? 2 * rules_cap : 16;
+			struct class_rule *rules = realloc(cs->rules, cap * sizeof *rules);
+
+			if (rules == NULL)
+				goto nomem;
+			cs->rules = rules;
+			rules_cap = cap;
+		}
+
+		struct class_rule *r = &cs->rules[cs->rules_cnt++];
+		*r = (struct class_rule){ .name = NULL };
+
+		if (strlen(tok) > CLASS_NAME_MAX)
+		{
+			err = "Name too long";
+			goto invalid;
+		}
+		if ((r->name = strdup(tok)) == NULL)
+			goto nomem;
+
+		while ((tok = class_token(&p, &quoted)) != NULL)
+		{
+			enum class_field field = 0;
+
+			while (field < CLASS_FIELDS && strcmp(tok, class_fields[field]))
+				++field;
+
+			if (field == CLASS_FIELDS)
+			{
+				if ((err = class_setting_parse(r, tok, &p)) != NULL)
+					goto invalid;
+				continue;
+			}
+
+			uint8_t data[CLASS_VALUE_MAX];
+			uint16_t bits;
+			bool prefix;
+
+			if ((tok = class_token(&p, &quoted)) == NULL)
+			{
+				err = "Missing value";
+				goto invalid;
+			}
+			if (!class_value_parse(field, tok, quoted, data, &bits, &prefix))
+			{
+				err = "Invalid value";
+				goto invalid;
+			}
+
+			if (matches_cnt == matches_cap)
+			{
+				size_t cap = matches_cap ? 2 * matches_cap : 16;
+				struct class_match *grown = realloc(matches, cap * sizeof *grown);
+
+				if (grown == NULL)
+					goto nomem;
+				matches = grown;
+				matches_cap = cap;
+			}
+
+			size_t value = class_value_add(&cs->tables[field], data, bits, prefix);
+			if (value == SIZE_MAX)
+				goto nomem;
+
+			matches[matches_cnt++] = (struct class_match){
+				.rule = cs->rules_cnt - 1,
+				.field = field,
+				.value = value
+			};
+			cs->tables[field].used = true;
+		}
+	}
+
+	if (ferror(stream))
+	{
+		snprintf(cs->error, sizeof cs->error, "Could not read %s: %s", path,
+			strerror(errno));
+		goto error;
+	}
+
+	cs->words = (cs->rules_cnt + 63) / 64;
+
+	size_t sets_cnt = 0;
+	for (enum class_field f = 0; f < CLASS_FIELDS; ++f)
+		if (cs->tables[f].used)
+			sets_cnt += cs->tables[f].values_cnt + 1;
+
+	if (sets_cnt > 0)
+	{
+		cs->sets = calloc(sets_cnt * cs->words, sizeof *cs->sets);
+		if (cs->sets == NULL)
+			goto nomem;
+	}
+
+	size_t sets_off = 0;
+	for (enum class_field f = 0; f < CLASS_FIELDS; ++f)
+	{
+		struct class_table *t = &cs->tables[f];
+
+		if (!t->used)
+			continue;
+
+		t->prefixes = calloc(t->values_cnt, sizeof *t->prefixes);
+		if (t->prefixes == NULL)
+			goto nomem;
+
+		class_table_compile(cs, f, matches, matches_cnt, &sets_off);
+	}
+
+	free(matches);
+	free(line);
+	fclose(stream);
+	return true;
+
+nomem:
+	err = strerror(ENOMEM);
+invalid:
+	snprintf(cs->error, sizeof cs->error, "%s:%zu: %s", path, lineno, err);
+error:
+	free(matches);
+	free(line);
+	fclose(stream);
+	class_free(cs);
+	return false;
+}
+
+/**
+ * Find value of a field in a message
+ *
+ * @return false if the message doesn't carry the field
+ */
+static bool class_field_value(enum class_field field, uint8_t *data,
+	const struct dhcp_opts *opts, const uint8_t **value, size_t *len)
+{
+	const struct dhcp_opt *opt;
+
+	switch (field)
+	{
+		case CLASS_VENDOR:
+			opt = dhcp_opts_get(opts, DHCP_OPT_IDX_VENDORCLASS);
+			break;
+		case CLASS_USER:
+			opt = dhcp_opts_get(opts, DHCP_OPT_IDX_USERCLASS);
+			break;
+		case CLASS_CIRCUIT:
+		case CLASS_REMOTE:
+		{
+			uint8_t code = field == CLASS_CIRCUIT ?
+				CLASS_AGENT_CIRCUIT : CLASS_AGENT_REMOTE;
+
+			opt = dhcp_opts_get(opts, DHCP_OPT_IDX_AGENTINFO);
+			if (opt == NULL)
+				return false;
+
+			const uint8_t *sub = (const uint8_t *)opt->data;
+			const uint8_t *end = sub + opt->len;
+
+			while (end - sub >= 2 && sub + 2 + sub[1] <= end)
+			{
+				if (sub[0] == code)
+				{
+					*value = sub + 2;
+					*len = sub[1];
+					return true;
+				}
+				sub += 2 + sub[1];
+			}
+			return false;
+		}
+		case CLASS_GIADDR:
+			if (*DHCP_MSG_F_GIADDR(data) == INADDR_ANY)
+				return false;
+			*value = (const uint8_t *)DHCP_MSG_F_GIADDR(data);
+			*len = 4;
+			return true;
+		default:
+			return false;
+	}
+
+	if (opt == NULL)
+		return false;
+
+	*value = (const uint8_t *)opt->data;
+	*len = opt->len;
+	return true;
+}
+
+struct class_rule *class_match(struct class_set *cs, uint8_t *data,
+	const struct dhcp_opts *opts)
+{
+	const uint64_t *sets[CLASS_FIELDS];
+	size_t sets_cnt = 0;
+
+	if (cs->rules_cnt == 0)
+		return NULL;
+
+	for (enum class_field f = 0; f < CLASS_FIELDS; ++f)
+	{
+		const struct class_table *t = &cs->tables[f];
+		const struct class_value *v = NULL;
+		const uint8_t *value;
+		size_t len;
+
+		if (!t->used)
+			continue;
+
+		if (class_field_value(f, data, opts, &value, &len))
+		{
+			uint16_t bits = len * 8;
+
+			v = class_lookup(t, value, bits, false);
+			for (size_t i = 0; v == NULL && i < t->prefixes_cnt; ++i)
+				if (t->prefixes[i] <= bits)
+					v = class_lookup(t, value, t->prefixes[i], true);
+		}
+
+		sets[sets_cnt++] = cs->sets + (v != NULL ? v->set : t->any);
+	}
+
+	for (size_t w = 0; w < cs->words; ++w)
+	{
+		uint64_t m = UINT64_MAX;
+
+		for (size_t i = 0; i < sets_cnt; ++i)
+			m &= sets[i][w];
+
+		if (m != 0)
+		{
+			struct class_rule *r = &cs->rules[w * 64 + __builtin_ctzll(m)];
+
+			++r->hits;
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
+void class_free(struct class_set *cs)
+{
+	for (size_t i = 0; i < cs->rules_cnt; ++i)
+	{
+		free(cs->rules[i].name);
+		free(cs->rules[i].routers);
+		free(cs->rules[i].nameservers);
+		range_set_free(&cs->rules[i].ranges);
+	}
+	free(cs->rules);
+	free(cs->sets);
+
+	for (enum class_field f = 0; f < CLASS_FIELDS; ++f)
+	{
+		free(cs->tables[f].values);
+		free(cs->tables[f].index);
+		free(cs->tables[f].prefixes);
+	}
+
+	/* The error message stays readable */
+	cs->rules = NULL;
+	cs->rules_cnt = 0;
+	cs->sets = NULL;
+	cs->words = 0;
+	memset(cs->tables, 0, sizeof cs->tables);
+}
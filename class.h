@@ -0,0 +1,163 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+#include "dhcp.h"
+#include "range.h"
+
+#ifndef DHCPD_CLASS_H_
+#define DHCPD_CLASS_H_
+
+/* Client classification. Rules are read from a file at startup, one rule per
+ * line, and the first rule matching a message decides its class:
+ *
+ *   NAME [MATCH]... [SETTING]...
+ *
+ * A match is a field followed by a value, several values of the same field
+ * match if any of them does, different fields must all match:
+ *
+ *   vendor VALUE   vendor class identifier (option 60)
+ *   user VALUE     user class (option 77)
+ *   circuit VALUE  circuit id of the relay agent information (option 82)
+ *   remote VALUE   remote id of the relay agent information (option 82)
+ *   giaddr IP[/PREFIX]
+ *
+ * Values are text, double quoted text or hex bytes starting with 0x, a
+ * trailing * makes the value a prefix. Settings override the command line
+ * for clients of the class:
+ *
+ *   range IP IP, exclude IP IP, router IP, nameserver IP, leasetime INT,
+ *   prefixlen INT, ignore
+ *
+ * Several ranges and exclusions of a rule make up its allocation scope,
+ * which is built by config_fill() together with the exclusions of the
+ * command line.
+ *
+ * The rules are compiled into one hash table per field, which maps every
+ * value of the rules to the bitset of rules matching it. Classifying a
+ * message costs one lookup per field, plus one per distinct prefix length,
+ * and ANDing the bitsets until the first rule remains.
+ */
+
+/* Longest value of a match */
+#define CLASS_VALUE_MAX 255
+/* Longest name of a rule */
+#define CLASS_NAME_MAX 64
+
+enum class_field
+{
+	CLASS_VENDOR,
+	CLASS_USER,
+	CLASS_CIRCUIT,
+	CLASS_REMOTE,
+	CLASS_GIADDR,
+	CLASS_FIELDS
+};
+
+struct class_rule
+{
+	char *name;
+
+	/* Allocation scope, empty if the rule doesn't set one */
+	struct range_set ranges;
+
+	struct in_addr *routers;
+	size_t routers_cnt;
+	struct in_addr *nameservers;
+	size_t nameservers_cnt;
+
+	/* Zero if not set */
+	uint32_t leasetime;
+	uint8_t prefixlen;
+
+	/* Messages of the class are not answered */
+	bool ignore;
+
+	/* Count of messages, which matched the rule */
+	uint64_t hits;
+};
+
+/* Value of a rule, all values of a field are stored in its hash table */
+struct class_value
+{
+	/* Length in bits, values are compared up to the length */
+	uint16_t bits;
+	/* Set if the value matches all values starting with it */
+	bool prefix;
+	uint8_t data[CLASS_VALUE_MAX];
+	uint32_t hash;
+	/* Offset of the bitset of matching rules in sets */
+	size_t set;
+};
+
+struct class_table
+{
+	struct class_value *values;
+	size_t values_cnt;
+
+	/* Index + 1 of a value, zero marks an empty slot */
+	uint32_t *index;
+	uint32_t index_mask;
+
+	/* Distinct lengths in bits of prefix values, longest first */
+	uint16_t *prefixes;
+	size_t prefixes_cnt;
+
+	/* Offset of the bitset of rules, which don't match on the field */
+	size_t any;
+	/* Set if any rule matches on the field */
+	bool used;
+};
+
+struct class_set
+{
+	struct class_rule *rules;
+	size_t rules_cnt;
+
+	/* Bitsets of rules, words 64-bit words each */
+	uint64_t *sets;
+	size_t words;
+
+	struct class_table tables[CLASS_FIELDS];
+
+	/* Error message of class_load() */
+	char error[128];
+};
+
+#define CLASS_SET_EMPTY {\
+		.rules = NULL,\
+		.rules_cnt = 0,\
+		.sets = NULL,\
+		.words = 0\
+	}
+
+/**
+ * Read and compile rules
+ *
+ * @param[out] cs Rules
+ * @param[in] path Rule file
+ * @return false on errors, which are described in cs->error
+ */
+extern bool class_load(struct class_set *cs, const char *path);
+
+/**
+ * Find first rule matching a message and count the hit
+ *
+ * @param[in] cs Rules
+ * @param[in] data Buffer which holds the DHCP message
+ * @param[in] opts Decoded options of the message
+ * @return Rule or NULL if none matches
+ */
+extern struct class_rule *class_match(struct class_set *cs, uint8_t *data,
+	const struct dhcp_opts *opts);
+
+/**
+ * Free all memory of the rules, the error message is kept
+ */
+extern void class_free(struct class_set *cs);
+
+#endif
@@ -1,4 +1,73 @@
 #include "config.h"
+#include "store.h"
+
+#include <limits.h>
+#include <string.h>
+
+/**
+ * Parse IP address and TCP port
+ */
+static bool config_addr(struct sockaddr_in *addr, char *const argv[2])
+{
+	int port = atoi(argv[1]);
+
+	if (port <= 0 || port > 65535)
+		return false;
+
+	addr->sin_port = htons(port);
+	return inet_pton(AF_INET, argv[0], &addr->sin_addr) == 1;
+}
+
+/**
+ * Parse pairs of first and last addresses into ranges or exclusions of a set
+ */
+static bool config_ranges(struct range_set *rs, char *const vals[],
+	size_t cnt, bool exclude)
+{
+	for (size_t i = 0; i + 1 < cnt; i += 2)
+	{
+		struct in_addr range[2];
+
+		if (inet_pton(AF_INET, vals[i], &range[0]) != 1 ||
+				inet_pton(AF_INET, vals[i + 1], &range[1]) != 1)
+			return false;
+
+		if (!(exclude ? range_set_exclude : range_set_add)(rs, range[0], range[1]))
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Build scope of a class rule, the exclusions of the command line apply to
+ * it as well and a rule, which only excludes addresses, narrows the scope
+ * of the command line
+ */
+static bool config_class_ranges(struct config *cfg, struct range_set *rs)
+{
+	bool narrow = rs->ranges_cnt == 0;
+
+	for (size_t i = 0; narrow && i < cfg->ranges.ranges_cnt; ++i)
+	{
+		const struct range *r = &cfg->ranges.ranges[i];
+
+		if (!range_set_add(rs, (struct in_addr){ htonl(r->first) },
+				(struct in_addr){ htonl(r->last) }))
+			return false;
+	}
+
+	for (size_t i = 0; i < cfg->ranges.excludes_cnt; ++i)
+	{
+		const struct range *r = &cfg->ranges.excludes[i];
+
+		if (!range_set_exclude(rs, (struct in_addr){ htonl(r->first) },
+				(struct in_addr){ htonl(r->last) }))
+			return false;
+	}
+
+	return range_set_build(rs);
+}
 
 bool config_fill(struct config *cfg, struct argv *argv)
 {
@@ -18,10 +87,18 @@ bool config_fill(struct config *cfg, struct argv *argv)
 			goto invalid_nameserver_address;
 	}
 
-	for (size_t i = 0; i < 2; ++i)
-		if (argv->iprange[i])
-			if (inet_pton(AF_INET, argv->iprange[i], &cfg->iprange[i]) != 1)
-				goto invalid_iprange_address;
+	if (!config_ranges(&cfg->ranges, argv->iprange, argv->iprange_cnt, false) ||
+			!config_ranges(&cfg->ranges, argv->exclude, argv->exclude_cnt, true))
+		goto invalid_iprange_address;
+
+	if (!range_set_build(&cfg->ranges))
+		goto invalid_iprange_address;
+
+	/* The bitmap can't track larger scopes */
+	if (argv->allocate && cfg->ranges.ranges_cnt > 0 &&
+			cfg->ranges.ranges[cfg->ranges.ranges_cnt - 1].last -
+			cfg->ranges.ranges[0].first >= STORE_RANGE_MAX)
+		goto invalid_iprange_span;
 
 	if (argv->leasetime)
 		cfg->leasetime = atoi(argv->leasetime);
@@ -29,9 +106,96 @@ bool config_fill(struct config *cfg, struct argv *argv)
 	if (argv->prefixlen)
 		cfg->prefixlen = atoi(argv->prefixlen);
 
+	if (argv->leasejitter)
+	{
+		int jitter = atoi(argv->leasejitter);
+
+		/* Half of the lease time is left at least */
+		if (jitter < 0 || jitter > 50)
+			goto invalid_leasejitter;
+		cfg->leasejitter = jitter;
+	}
+
 	if (argv->gc)
 		cfg->gc = atoi(argv->gc);
 
+	if (argv->stats)
+		cfg->stats = atoi(argv->stats);
+
+	if (argv->rcvbuf)
+	{
+		long rcvbuf = atol(argv->rcvbuf);
+
+		if (rcvbuf < 0 || rcvbuf > INT_MAX)
+			goto invalid_rcvbuf;
+		cfg->rcvbuf = rcvbuf;
+	}
+
+	if (argv->engine)
+	{
+		if (!strcmp(argv->engine, "io_uring"))
+			cfg->engine = CONFIG_ENGINE_IO_URING;
+		else if (strcmp(argv->engine, "libev"))
+			goto invalid_engine;
+	}
+
+	/* The receive ring replaces receiving from the UDP socket */
+	if (cfg->engine == CONFIG_ENGINE_IO_URING && argv->rxring)
+		goto invalid_engine_rxring;
+
+	if (argv->maxage)
+		cfg->maxage = atoi(argv->maxage);
+
+	if (argv->capturesample)
+		cfg->capturesample = atoi(argv->capturesample);
+	if (cfg->capturesample == 0)
+		cfg->capturesample = 1;
+
+	if (argv->replicate[0])
+		if (!config_addr(&cfg->replicate, argv->replicate))
+			goto invalid_replication_address;
+
+	if (argv->standby[0])
+		if (!config_addr(&cfg->standby, argv->standby))
+			goto invalid_replication_address;
+
+	if (argv->repllag)
+		cfg->repllag = atoi(argv->repllag);
+	/* Heartbeats are sent every second */
+	if (cfg->repllag < 2)
+		cfg->repllag = 2;
+
+	if (argv->loadbalance)
+		if (!dhcp_lb_parse(argv->loadbalance, &cfg->loadbalance))
+			goto invalid_loadbalance_buckets;
+
+	if (argv->class)
+	{
+		if (!class_load(&cfg->classes, argv->class))
+			goto invalid_classes;
+
+		/* Addresses are allocated from the bitmap of -iprange */
+		for (size_t i = 0; i < cfg->classes.rules_cnt; ++i)
+		{
+			struct range_set *rs = &cfg->classes.rules[i].ranges;
+
+			if (rs->ranges_cnt == 0 && rs->excludes_cnt == 0)
+				continue;
+
+			if (!config_class_ranges(cfg, rs) || rs->ranges_cnt == 0 ||
+					!range_set_covers(&cfg->ranges, rs))
+				goto invalid_class_range;
+		}
+	}
+
+	for (size_t i = 0; i < 2; ++i)
+	{
+		if (argv->ratelimit[i])
+			cfg->ratelimit[i] = atof(argv->ratelimit[i]);
+		if (argv->relayratelimit[i])
+			cfg->relayratelimit[i] = atof(argv->relayratelimit[i]);
+	}
+
 	return true;
 
 	switch (1)
@@ -47,9 +211,45 @@ invalid_iprange_address:
 			cfg->error = "Invalid IP range address";
 			break;
 
+invalid_iprange_span:
+			cfg->error = "IP ranges span more than 16777216 addresses, too many to allocate from";
+			break;
+
 invalid_router_address:
 			cfg->error = "Invalid router address";
 			break;
+
+invalid_replication_address:
+			cfg->error = "Invalid replication address";
+			break;
+
+invalid_loadbalance_buckets:
+			cfg->error = "Invalid load balancing buckets";
+			break;
+
+invalid_leasejitter:
+			cfg->error = "Invalid lease jitter, must be 0 to 50 percent";
+			break;
+
+invalid_rcvbuf:
+			cfg->error = "Invalid receive buffer size";
+			break;
+
+invalid_engine:
+			cfg->error = "Invalid engine, must be libev or io_uring";
+			break;
+
+invalid_engine_rxring:
+			cfg->error = "Engine io_uring can't be combined with -rxring";
+			break;
+
+invalid_classes:
+			cfg->error = cfg->classes.error;
+			break;
+
+invalid_class_range:
+			cfg->error = "Class range outside of IP range or without addresses";
+			break;
 	}
 
 	config_free(cfg);
@@ -7,10 +7,20 @@
 #include <arpa/inet.h>
 
 #include "argv.h"
+#include "dhcp.h"
+#include "class.h"
+#include "range.h"
 
 #ifndef DHCPD_CONFIG_H_
 #define DHCPD_CONFIG_H_
 
+/* Network engines of -engine */
+enum config_engine
+{
+	CONFIG_ENGINE_LIBEV,
+	CONFIG_ENGINE_IO_URING
+};
+
 struct config
 {
 	struct argv *argv;
@@ -22,12 +32,48 @@ struct config
 	struct in_addr *nameservers;
 	size_t nameservers_cnt;
 
-	struct in_addr iprange[2];
+	/* Allocation scope of -iprange and -exclude */
+	struct range_set ranges;
 
 	uint32_t leasetime;
 	uint8_t prefixlen;
 
+	/* Largest reduction of lease times in percent, which spreads renewals */
+	uint8_t leasejitter;
+
 	uint32_t gc;
+	uint32_t stats;
+
+	/* Largest receive buffer of the UDP socket in bytes, zero keeps the
+	 * default size */
+	uint32_t rcvbuf;
+
+	/* How messages are received and replies are sent */
+	enum config_engine engine;
+
+	/* Milliseconds a message may have waited since the kernel received it,
+	 * older ones are dropped, zero keeps all */
+	uint32_t maxage;
+
+	/* Rate and burst of the per-client and per-relay token buckets */
+	double ratelimit[2];
+	double relayratelimit[2];
+
+	/* Capture one of capturesample messages */
+	uint32_t capturesample;
+
+	/* Address to accept a standby on and address of the primary, unused
+	 * ones have port 0 */
+	struct sockaddr_in replicate;
+	struct sockaddr_in standby;
+	/* Seconds a standby may lag behind or the primary may be silent */
+	uint32_t repllag;
+
+	/* Hash buckets of RFC 3074 load balancing, which are served */
+	struct dhcp_lb loadbalance;
+
+	/* Client classes of -class */
+	struct class_set classes;
 };
 
 #define CONFIG_EMPTY {\
@@ -36,10 +82,23 @@ struct config
 		.routers_cnt = 0,\
 		.nameservers = NULL,\
 		.nameservers_cnt = 0,\
-		.iprange = {{0}, {0}},\
+		.ranges = RANGE_SET_EMPTY,\
 		.leasetime = 3600,\
 		.prefixlen = 24,\
-		.gc = 0\
+		.leasejitter = 0,\
+		.gc = 0,\
+		.stats = 0,\
+		.rcvbuf = 4 << 20,\
+		.engine = CONFIG_ENGINE_LIBEV,\
+		.maxage = 0,\
+		.ratelimit = {0, 0},\
+		.relayratelimit = {0, 0},\
+		.capturesample = 1,\
+		.replicate = { .sin_family = AF_INET, .sin_port = 0 },\
+		.standby = { .sin_family = AF_INET, .sin_port = 0 },\
+		.repllag = 5,\
+		.loadbalance = DHCP_LB_ALL,\
+		.classes = CLASS_SET_EMPTY\
 	}
 
 /**
@@ -59,6 +118,8 @@ static inline void config_free(struct config *cfg)
 		cfg->routers = realloc(cfg->routers, cfg->routers_cnt = 0);
 	if (cfg->nameservers)
 		cfg->nameservers = realloc(cfg->nameservers, cfg->nameservers_cnt = 0);
+	range_set_free(&cfg->ranges);
+	class_free(&cfg->classes);
 }
 
 #endif
@@ -0,0 +1,517 @@
+#include "control.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+static bool control_addr(const char *path, struct sockaddr_un *addr)
+{
+	*addr = (struct sockaddr_un){ .sun_family = AF_UNIX };
+
+	if (strlen(path) >= sizeof addr->sun_path)
+	{
+		errno = ENAMETOOLONG;
+		return false;
+	}
+
+	strcpy(addr->sun_path, path);
+	return true;
+}
+
+/**
+ * Check whether a process still accepts connections on a socket file. A
+ * full backlog counts as alive, the connect doesn't wait for it.
+ */
+static bool control_live(const struct sockaddr_un *addr)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+
+	bool live = connect(fd, (const struct sockaddr *)addr, sizeof *addr) == 0 ||
+		errno == EAGAIN || errno == EINPROGRESS;
+
+	close(fd);
+	return live;
+}
+
+int control_listen(const char *path, bool replace)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (!control_addr(path, &addr))
+		return -1;
+
+	/* Another daemon would lose its socket silently */
+	if (!replace && control_live(&addr))
+	{
+		errno = EADDRINUSE;
+		return -1;
+	}
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+
+	/* Only the owner may control the daemon */
+	mode_t mask = umask(0177);
+
+	unlink(path);
+	int err = bind(fd, (struct sockaddr *)&addr, sizeof addr);
+
+	umask(mask);
+
+	if (err != 0 || listen(fd, 8) != 0)
+		goto error;
+
+	return fd;
+
+error:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+int control_connect(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	if (!control_addr(path, &addr))
+		return -1;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof addr) != 0)
+	{
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+static void control_put32(uint8_t *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, 4);
+}
+
+static uint32_t control_get32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+static void control_hdr_pack(uint8_t *p, uint8_t op, uint16_t status,
+	uint32_t len)
+{
+	uint16_t s = htons(status);
+
+	p[0] = CONTROL_VERSION;
+	p[1] = op;
+	memcpy(p + 2, &s, 2);
+	control_put32(p + 4, len);
+}
+
+static void control_hdr_unpack(const uint8_t *p, struct control_hdr *hdr)
+{
+	uint16_t s;
+
+	memcpy(&s, p + 2, 2);
+	hdr->version = p[0];
+	hdr->op = p[1];
+	hdr->status = ntohs(s);
+	hdr->len = control_get32(p + 4);
+}
+
+size_t control_lease_pack(uint8_t *buf, size_t cap,
+	const struct control_lease *l)
+{
+	const char *routers = l->routers ? l->routers : "";
+	const char *nameservers = l->nameservers ? l->nameservers : "";
+	size_t routers_len = strlen(routers) + 1;
+	size_t nameservers_len = strlen(nameservers) + 1;
+	size_t lists = CONTROL_LEASELEN + l->key.len;
+	size_t len = lists + routers_len + nameservers_len;
+
+	if (len > cap)
+		return 0;
+
+	control_put32(buf, l->id);
+	memcpy(buf + 4, &l->address, 4);
+	memcpy(buf + 8, l->hwaddr, 6);
+	buf[14] = l->prefixlen;
+	buf[15] = l->allocated;
+	control_put32(buf + 16, l->leasetime);
+	control_put32(buf + 20, (uint64_t)l->allocated_at >> 32);
+	control_put32(buf + 24, (uint64_t)l->allocated_at);
+	buf[28] = l->key.len;
+	memcpy(buf + CONTROL_LEASELEN, l->key.data, l->key.len);
+	memcpy(buf + lists, routers, routers_len);
+	memcpy(buf + lists + routers_len, nameservers, nameservers_len);
+
+	return len;
+}
+
+bool control_lease_unpack(const uint8_t *buf, size_t len,
+	struct control_lease *l)
+{
+	if (len < CONTROL_LEASELEN + 2 || buf[28] > DHCP_KEY_MAX ||
+			len < CONTROL_LEASELEN + buf[28] + 2u)
+		return false;
+
+	const char *routers = (const char *)buf + CONTROL_LEASELEN + buf[28];
+	const char *end = (const char *)buf + len;
+	const char *routers_end = memchr(routers, 0, end - routers);
+
+	if (routers_end == NULL)
+		return false;
+
+	const char *nameservers = routers_end + 1;
+
+	if (nameservers == end || memchr(nameservers, 0, end - nameservers) == NULL)
+		return false;
+
+	l->id = control_get32(buf);
+	memcpy(&l->address, buf + 4, 4);
+	memcpy(l->hwaddr, buf + 8, 6);
+	l->prefixlen = buf[14];
+	l->allocated = buf[15];
+	l->leasetime = control_get32(buf + 16);
+	l->allocated_at = (int64_t)((uint64_t)control_get32(buf + 20) << 32 |
+		control_get32(buf + 24));
+	l->key.len = buf[28];
+	memcpy(l->key.data, buf + CONTROL_LEASELEN, l->key.len);
+	l->routers = *routers ? routers : NULL;
+	l->nameservers = *nameservers ? nameservers : NULL;
+
+	return true;
+}
+
+size_t control_key_pack(uint8_t *buf, const struct control_key_val *k)
+{
+	buf[0] = k->kind;
+
+	switch (k->kind)
+	{
+		case CONTROL_KEY_ID:
+			control_put32(buf + 1, k->id);
+			return 5;
+		case CONTROL_KEY_ADDRESS:
+			memcpy(buf + 1, &k->address, 4);
+			return 5;
+		case CONTROL_KEY_HWADDR:
+			memcpy(buf + 1, k->hwaddr, 6);
+			return 7;
+		case CONTROL_KEY_CLIENTID:
+			buf[1] = k->clientid.len;
+			memcpy(buf + 2, k->clientid.data, k->clientid.len);
+			return 2 + k->clientid.len;
+	}
+
+	return 1;
+}
+
+bool control_key_unpack(const uint8_t *buf, size_t len,
+	struct control_key_val *k)
+{
+	if (len < 1)
+		return false;
+
+	k->kind = buf[0];
+
+	switch (k->kind)
+	{
+		case CONTROL_KEY_ID:
+			if (len != 5)
+				return false;
+			k->id = control_get32(buf + 1);
+			return true;
+		case CONTROL_KEY_ADDRESS:
+			if (len != 5)
+				return false;
+			memcpy(&k->address, buf + 1, 4);
+			return true;
+		case CONTROL_KEY_HWADDR:
+			if (len != 7)
+				return false;
+			memcpy(k->hwaddr, buf + 1, 6);
+			return true;
+		case CONTROL_KEY_CLIENTID:
+			if (len < 3 || buf[1] > DHCP_KEY_MAX || len != 2u + buf[1])
+				return false;
+			k->clientid.len = buf[1];
+			memcpy(k->clientid.data, buf + 2, k->clientid.len);
+			return true;
+	}
+
+	return false;
+}
+
+void control_lb_pack(uint8_t *buf, const struct dhcp_lb *lb)
+{
+	for (size_t i = 0; i < CONTROL_LBLEN; ++i)
+		buf[i] = lb->buckets[i / 8] >> (i % 8 * 8);
+}
+
+bool control_lb_unpack(const uint8_t *buf, size_t len, struct dhcp_lb *lb)
+{
+	if (len != CONTROL_LBLEN)
+		return false;
+
+	*lb = (struct dhcp_lb){ .buckets = { 0, 0, 0, 0 } };
+	for (size_t i = 0; i < CONTROL_LBLEN; ++i)
+		lb->buckets[i / 8] |= (uint64_t)buf[i] << (i % 8 * 8);
+
+	return true;
+}
+
+bool control_conn_read(struct control_conn *c)
+{
+	/* Move the unhandled rest to the front */
+	if (c->in_off > 0)
+	{
+		memmove(c->in, c->in + c->in_off, c->in_len - c->in_off);
+		c->in_len -= c->in_off;
+		c->in_off = 0;
+	}
+
+	if (c->in_len == sizeof c->in)
+		return true;
+
+	ssize_t n = recv(c->fd, c->in + c->in_len, sizeof c->in - c->in_len,
+		MSG_DONTWAIT);
+
+	if (n == 0)
+		return false;
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+	c->in_len += n;
+	return true;
+}
+
+bool control_conn_next(struct control_conn *c, struct control_hdr *hdr,
+	const uint8_t **payload)
+{
+	size_t avail = c->in_len - c->in_off;
+
+	if (avail < CONTROL_HDRLEN)
+		return false;
+
+	control_hdr_unpack(c->in + c->in_off, hdr);
+
+	/* Such a request could never be buffered completely */
+	if (hdr->version != CONTROL_VERSION || hdr->len > CONTROL_PAYLOAD_MAX)
+	{
+		c->broken = true;
+		return false;
+	}
+
+	if (avail < CONTROL_HDRLEN + hdr->len)
+		return false;
+
+	*payload = c->in + c->in_off + CONTROL_HDRLEN;
+	c->in_off += CONTROL_HDRLEN + hdr->len;
+	return true;
+}
+
+bool control_conn_reply(struct control_conn *c, uint8_t op, uint16_t status,
+	const void *payload, size_t len)
+{
+	if (c->out_off > 0)
+	{
+		memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+		c->out_len -= c->out_off;
+		c->out_off = 0;
+	}
+
+	if (c->out_len + CONTROL_HDRLEN + len > sizeof c->out)
+		return false;
+
+	control_hdr_pack(c->out + c->out_len, op, status, len);
+	if (len)
+		memcpy(c->out + c->out_len + CONTROL_HDRLEN, payload, len);
+	c->out_len += CONTROL_HDRLEN + len;
+
+	return true;
+}
+
+bool control_conn_flush(struct control_conn *c)
+{
+	while (c->out_off < c->out_len)
+	{
+		ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off,
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+
+		c->out_off += n;
+	}
+
+	c->out_len = c->out_off = 0;
+	return true;
+}
+
+bool control_conn_reply_fds(struct control_conn *c, uint8_t op,
+	const int *fds, size_t fds_cnt)
+{
+	uint8_t h[CONTROL_HDRLEN];
+	union
+	{
+		struct cmsghdr align;
+		uint8_t buf[CMSG_SPACE(sizeof(int) * CONTROL_HANDOVER_FDS)];
+	} cbuf;
+
+	if (c->out_len != 0 || fds_cnt > CONTROL_HANDOVER_FDS)
+		return false;
+
+	control_hdr_pack(h, op, 0, 0);
+
+	struct iovec iov = { .iov_base = h, .iov_len = sizeof h };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf.buf,
+		.msg_controllen = CMSG_SPACE(sizeof(int) * fds_cnt)
+	};
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds_cnt);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fds_cnt);
+
+	/* The peer waits for this response, so the socket buffer is empty and
+	 * the header is sent completely */
+	ssize_t n;
+	while ((n = sendmsg(c->fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+
+	return n == sizeof h;
+}
+
+static bool control_full(int fd, void *buf, size_t len, bool out)
+{
+	uint8_t *p = buf;
+
+	while (len > 0)
+	{
+		ssize_t n = out ? send(fd, p, len, MSG_NOSIGNAL) : recv(fd, p, len, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+		{
+			if (n == 0)
+				errno = ECONNRESET;
+			return false;
+		}
+
+		p += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+bool control_request(int fd, uint8_t op, const void *payload, size_t len,
+	struct control_hdr *hdr, uint8_t *resp)
+{
+	size_t fds_cnt = 0;
+
+	return control_request_fds(fd, op, payload, len, hdr, resp, NULL, &fds_cnt);
+}
+
+bool control_request_fds(int fd, uint8_t op, const void *payload,
+	size_t len, struct control_hdr *hdr, uint8_t *resp, int *fds,
+	size_t *fds_cnt)
+{
+	uint8_t h[CONTROL_HDRLEN];
+	union
+	{
+		struct cmsghdr align;
+		uint8_t buf[CMSG_SPACE(sizeof(int) * CONTROL_HANDOVER_FDS)];
+	} cbuf;
+
+	control_hdr_pack(h, op, 0, len);
+
+	if (!control_full(fd, h, sizeof h, true) ||
+			(len && !control_full(fd, (void *)payload, len, true)))
+		return false;
+
+	/* Descriptors arrive with the first byte of the response */
+	struct iovec iov = { .iov_base = h, .iov_len = sizeof h };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf.buf,
+		.msg_controllen = sizeof cbuf.buf
+	};
+
+	ssize_t n;
+	while ((n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR)
+		;
+
+	if (n <= 0)
+	{
+		if (n == 0)
+			errno = ECONNRESET;
+		return false;
+	}
+
+	size_t max = *fds_cnt;
+	*fds_cnt = 0;
+
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		size_t cnt = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		int *data = (int *)CMSG_DATA(cmsg);
+
+		for (size_t i = 0; i < cnt; ++i)
+		{
+			if (*fds_cnt < max)
+				fds[(*fds_cnt)++] = data[i];
+			else
+				close(data[i]);
+		}
+	}
+
+	if (!control_full(fd, h + n, sizeof h - n, false))
+		return false;
+
+	control_hdr_unpack(h, hdr);
+
+	if (hdr->version != CONTROL_VERSION || hdr->len > CONTROL_PAYLOAD_MAX)
+	{
+		errno = EPROTO;
+		return false;
+	}
+
+	if (!control_full(fd, resp, hdr->len, false))
+		return false;
+	resp[hdr->len] = 0;
+
+	return true;
+}
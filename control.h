@@ -0,0 +1,289 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "dhcp.h"
+
+#ifndef DHCPD_CONTROL_H_
+#define DHCPD_CONTROL_H_
+
+/* Control socket of a running dhcpd. dhcpctl connects to a Unix stream
+ * socket and sends requests, each of which is answered with exactly one
+ * response in order. Requests may be pipelined, the daemon handles all
+ * requests of one read in a single pass of its event loop, so a batch of
+ * mutations costs one database transaction.
+ *
+ * Every message starts with a header in network byte order
+ *
+ *   0      1      2             4                      8
+ *   +------+------+-------------+----------------------+
+ *   | ver  |  op  |   status    |    payload length    |
+ *   +------+------+-------------+----------------------+
+ *
+ * where status is zero in requests and an errno value in responses.
+ *
+ * Leases are encoded as a fixed part followed by the lease key and the zero
+ * terminated router and nameserver lists:
+ *
+ *   id(4) address(4) hwaddr(6) prefixlen(1) allocated(1) leasetime(4)
+ *   allocated_at(8) keylen(1) key routers\0 nameservers\0
+ *
+ * Lease keys are a kind byte followed by the id (4), the address (4), the
+ * hardware address (6) or the length (1) and bytes of a client identifier.
+ *
+ * Load balancing buckets are a bitmap of 32 bytes, bucket b is the bit
+ * 1 << (b % 8) of byte b / 8.
+ */
+
+#define CONTROL_VERSION 2
+#define CONTROL_HDRLEN 8
+#define CONTROL_LEASELEN 29
+/* Longest encoded lease key */
+#define CONTROL_KEYLEN_MAX (2 + DHCP_KEY_MAX)
+#define CONTROL_LBLEN 32
+
+/* Largest payload of a message */
+#define CONTROL_PAYLOAD_MAX 4096
+/* Size of the receive and send buffers of a connection */
+#define CONTROL_BUF_SIZE (16 * (CONTROL_HDRLEN + CONTROL_PAYLOAD_MAX))
+
+/* Default path of the socket */
+#define CONTROL_PATH "dhcpd.ctl"
+
+enum control_op
+{
+	/* Payload: lease, response: lease with its id */
+	CONTROL_LEASE_ADD = 1,
+	/* Payload: key */
+	CONTROL_LEASE_REMOVE = 2,
+	/* Payload: key, response: lease */
+	CONTROL_LEASE_GET = 3,
+	/* Remove all allocated leases, response: count as uint32 */
+	CONTROL_FLUSH = 4,
+	/* Wait until all queued lease mutations were committed */
+	CONTROL_COMMIT = 5,
+	/* Response: "name value" lines of all counters */
+	CONTROL_STATS = 6,
+	/* Shut down after the response was sent */
+	CONTROL_SHUTDOWN = 7,
+	/* Stop handling messages and pass the UDP socket and an image of the
+	 * lease store to a new process, which sends CONTROL_SHUTDOWN when it is
+	 * ready. The response carries both descriptors as SCM_RIGHTS. */
+	CONTROL_HANDOVER = 8,
+	/* Payload: load balancing buckets to serve from now on or nothing,
+	 * response: served buckets */
+	CONTROL_LOADBALANCE = 9,
+	/* Payload: index of the first class rule as uint32 or nothing,
+	 * response: "name hits" lines of as many rules as fit */
+	CONTROL_CLASSES = 10
+};
+
+/* Descriptors of a CONTROL_HANDOVER response */
+#define CONTROL_HANDOVER_FDS 2
+
+enum control_key
+{
+	CONTROL_KEY_ID = 1,
+	CONTROL_KEY_ADDRESS = 2,
+	CONTROL_KEY_HWADDR = 3,
+	CONTROL_KEY_CLIENTID = 4
+};
+
+struct control_hdr
+{
+	uint8_t version;
+	uint8_t op;
+	uint16_t status;
+	uint32_t len;
+};
+
+struct control_lease
+{
+	uint32_t id;
+	/* Network byte order */
+	uint32_t address;
+	uint8_t hwaddr[6];
+	uint8_t prefixlen;
+	uint8_t allocated;
+	uint32_t leasetime;
+	int64_t allocated_at;
+	/* Derived from hwaddr if empty in requests */
+	struct dhcp_key key;
+	/* Comma separated lists, NULL if not set */
+	const char *routers;
+	const char *nameservers;
+};
+
+struct control_key_val
+{
+	enum control_key kind;
+	union
+	{
+		uint32_t id;
+		/* Network byte order */
+		uint32_t address;
+		uint8_t hwaddr[6];
+		struct dhcp_key clientid;
+	};
+};
+
+/* Buffered connection of the daemon */
+struct control_conn
+{
+	int fd;
+
+	uint8_t in[CONTROL_BUF_SIZE];
+	size_t in_len;
+	/* Start of the next unhandled request in in */
+	size_t in_off;
+
+	uint8_t out[CONTROL_BUF_SIZE];
+	size_t out_len;
+	/* Bytes of out, which were already sent */
+	size_t out_off;
+
+	/* Set on protocol errors, the connection must be closed */
+	bool broken;
+};
+
+/**
+ * Create listening socket, a stale socket file is replaced
+ *
+ * @param[in] path Path of the socket
+ * @param[in] replace Replace the socket of a running daemon as well, which
+ *	is taken over
+ * @return Non-blocking socket or -1 on errors, errno is EADDRINUSE if a
+ *	running daemon listens on the path
+ */
+extern int control_listen(const char *path, bool replace);
+
+/**
+ * Connect to the control socket of a daemon
+ *
+ * @param[in] path Path of the socket
+ * @return Blocking socket or -1 on errors
+ */
+extern int control_connect(const char *path);
+
+/**
+ * Encode lease as payload
+ *
+ * @return Length of the payload, 0 if it doesn't fit into buf
+ */
+extern size_t control_lease_pack(uint8_t *buf, size_t cap,
+	const struct control_lease *l);
+
+/**
+ * Decode lease payload, the lists point into buf
+ */
+extern bool control_lease_unpack(const uint8_t *buf, size_t len,
+	struct control_lease *l);
+
+/**
+ * Encode lease key as payload
+ *
+ * @return Length of the payload
+ */
+extern size_t control_key_pack(uint8_t *buf, const struct control_key_val *k);
+
+/**
+ * Decode lease key payload
+ */
+extern bool control_key_unpack(const uint8_t *buf, size_t len,
+	struct control_key_val *k);
+
+/**
+ * Encode load balancing buckets as payload of CONTROL_LBLEN bytes
+ */
+extern void control_lb_pack(uint8_t *buf, const struct dhcp_lb *lb);
+
+/**
+ * Decode load balancing buckets payload
+ */
+extern bool control_lb_unpack(const uint8_t *buf, size_t len,
+	struct dhcp_lb *lb);
+
+/**
+ * Read what the peer sent into the receive buffer
+ *
+ * @return false on end of file and errors other than EAGAIN
+ */
+extern bool control_conn_read(struct control_conn *c);
+
+/**
+ * Take next complete request out of the receive buffer
+ *
+ * @param[in] c Connection
+ * @param[out] hdr Header of the request
+ * @param[out] payload Payload, which stays valid until the next read
+ * @return false if no complete request is buffered or the connection is
+ * broken
+ */
+extern bool control_conn_next(struct control_conn *c, struct control_hdr *hdr,
+	const uint8_t **payload);
+
+/**
+ * Append response to the send buffer
+ *
+ * @return false if the send buffer is full
+ */
+extern bool control_conn_reply(struct control_conn *c, uint8_t op,
+	uint16_t status, const void *payload, size_t len);
+
+/**
+ * Send as much of the send buffer as possible without blocking
+ *
+ * @return false on errors other than EAGAIN
+ */
+extern bool control_conn_flush(struct control_conn *c);
+
+/**
+ * Send response without payload, which passes descriptors to the peer
+ *
+ * All responses before must have been sent already.
+ *
+ * @param[in] c Connection
+ * @param[in] op Request, which is answered
+ * @param[in] fds Descriptors
+ * @param[in] fds_cnt Count of descriptors
+ */
+extern bool control_conn_reply_fds(struct control_conn *c, uint8_t op,
+	const int *fds, size_t fds_cnt);
+
+/**
+ * Check whether the send buffer has room for another response
+ */
+static inline bool control_conn_writable(const struct control_conn *c)
+{
+	return c->out_len + CONTROL_HDRLEN + CONTROL_PAYLOAD_MAX <= CONTROL_BUF_SIZE;
+}
+
+/**
+ * Send request and wait for its response, used by dhcpctl
+ *
+ * @param[in] fd Connected socket
+ * @param[in] op Request
+ * @param[in] payload Payload of the request
+ * @param[in] len Length of the payload
+ * @param[out] hdr Header of the response
+ * @param[out] resp Buffer of CONTROL_PAYLOAD_MAX + 1 bytes for the payload of
+ * the response, which is zero terminated
+ */
+extern bool control_request(int fd, uint8_t op, const void *payload, size_t len,
+	struct control_hdr *hdr, uint8_t *resp);
+
+/**
+ * Same as control_request(), but also receive descriptors passed with the
+ * response
+ *
+ * @param[out] fds Received descriptors
+ * @param[in,out] fds_cnt Size of fds, count of received descriptors
+ */
+extern bool control_request_fds(int fd, uint8_t op, const void *payload,
+	size_t len, struct control_hdr *hdr, uint8_t *resp, int *fds,
+	size_t *fds_cnt);
+
+#endif
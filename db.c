@@ -21,6 +21,13 @@ void db_lease_from_stmt(sqlite3_stmt *stmt, struct db_lease *l)
 		.allocated = sqlite3_column_int(stmt, 7),
 		.allocated_at = sqlite3_column_int(stmt, 8),
 	};
+
+	int len = sqlite3_column_bytes(stmt, 9);
+	if (len <= DHCP_KEY_MAX)
+	{
+		l->clientid.len = len;
+		memcpy(l->clientid.data, sqlite3_column_blob(stmt, 9), len);
+	}
 }
 
 int db_lease_delete(sqlite3 *db, struct db_lease *lease)
@@ -35,7 +42,7 @@ int db_lease_delete(sqlite3 *db, struct db_lease *lease)
 	sqlite3_bind_int(stmt, 1, lease->id);
 
 	sqlerr = sqlite3_step(stmt);
-	if (stmt != SQLITE_OK)
+	if (sqlerr != SQLITE_DONE)
 	{
 		PRINT_ERROR(db);
 		sqlite3_finalize(stmt);
@@ -46,6 +53,21 @@ int db_lease_delete(sqlite3 *db, struct db_lease *lease)
 	return SQLITE_OK;
 }
 
+int64_t db_data_version(sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	int64_t version = -1;
+
+	if (sqlite3_prepare_v2(db, "PRAGMA data_version;", -1, &stmt, NULL) != SQLITE_OK)
+		return -1;
+
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		version = sqlite3_column_int64(stmt, 0);
+
+	sqlite3_finalize(stmt);
+	return version;
+}
+
 int db_lease_by_hwaddr(sqlite3 *db, struct db_lease *lease,
 	const char *hwaddr)
 {
@@ -126,8 +148,8 @@ int db_insert(sqlite3 *db, struct db_lease *lease)
 	int sqlerr = sqlite3_prepare_v2(db,
 		"INSERT INTO leases\n"
 		"('address', 'prefixlen', 'hwaddr', 'routers', 'nameservers',\n"
-		"'leasetime', 'allocated', 'allocated_at')\n"
-		"VALUES (?, ?, ?, ?, ?, ?, ?, ?);\n", -1, &stmt, NULL);
+		"'leasetime', 'allocated', 'allocated_at', 'clientid')\n"
+		"VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);\n", -1, &stmt, NULL);
 	if (sqlerr != SQLITE_OK)
 	{
 		PRINT_ERROR(db);
@@ -145,6 +167,8 @@ int db_insert(sqlite3 *db, struct db_lease *lease)
 	sqlite3_bind_int(stmt, 6, lease->leasetime);
 	sqlite3_bind_int(stmt, 7, lease->allocated);
 	sqlite3_bind_int(stmt, 8, lease->allocated_at);
+	sqlite3_bind_blob(stmt, 9, lease->clientid.data, lease->clientid.len,
+		SQLITE_STATIC);
 
 	sqlerr = sqlite3_step(stmt);
 	if (sqlerr != SQLITE_DONE)
@@ -160,18 +184,74 @@ int db_insert(sqlite3 *db, struct db_lease *lease)
 	return SQLITE_DONE;
 }
 
-void db_lease_from_lease(struct db_lease *dbl, struct dhcp_lease *l)
+int db_lease_replace(sqlite3 *db, sqlite3_stmt **prepared,
+	struct db_lease *lease)
+{
+	if (*prepared == NULL && sqlite3_prepare_v2(db,
+			"INSERT OR REPLACE INTO leases\n"
+			"('id', 'address', 'prefixlen', 'hwaddr', 'routers', 'nameservers',\n"
+			"'leasetime', 'allocated', 'allocated_at', 'clientid')\n"
+			"VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);\n", -1, prepared,
+			NULL) != SQLITE_OK)
+	{
+		PRINT_ERROR(db);
+		return sqlite3_errcode(db);
+	}
+
+	sqlite3_stmt *stmt = *prepared;
+	int sqlerr;
+
+	sqlite3_bind_int(stmt, 1, lease->id);
+	sqlite3_bind_text(stmt, 2, lease->address, -1, NULL);
+	sqlite3_bind_int(stmt, 3, lease->prefixlen);
+	sqlite3_bind_text(stmt, 4, lease->hwaddr, -1, NULL);
+
+	if (lease->routers)
+		sqlite3_bind_text(stmt, 5, lease->routers, -1, NULL);
+	if (lease->nameservers)
+		sqlite3_bind_text(stmt, 6, lease->nameservers, -1, NULL);
+	sqlite3_bind_int(stmt, 7, lease->leasetime);
+	sqlite3_bind_int(stmt, 8, lease->allocated);
+	sqlite3_bind_int64(stmt, 9, lease->allocated_at);
+	sqlite3_bind_blob(stmt, 10, lease->clientid.data, lease->clientid.len,
+		SQLITE_STATIC);
+
+	sqlerr = sqlite3_step(stmt);
+	if (sqlerr != SQLITE_DONE)
+	{
+		PRINT_ERROR(db);
+	}
+
+	/* The bound strings belong to the caller, nothing may refer to them
+	 * after the statement ran */
+	sqlite3_reset(stmt);
+	sqlite3_clear_bindings(stmt);
+
+	return sqlerr;
+}
+
+/**
+ * Allocate from arena or, without one, from the heap
+ */
+static void *db_alloc(struct arena *a, size_t size)
+{
+	return a != NULL ? arena_alloc(a, size) : malloc(size);
+}
+
+void db_lease_from_lease(struct db_lease *dbl, struct dhcp_lease *l,
+	struct arena *a)
 {
 	size_t routers_len = INET_ADDRSTRLEN * l->routers_cnt + l->routers_cnt;
 	size_t nameservers_len = INET_ADDRSTRLEN * l->nameservers_cnt + l->nameservers_cnt;
 
+	/* Empty lists still need room for the terminator */
 	*dbl = (struct db_lease){
 		.id = 0,
-		.address = malloc(INET_ADDRSTRLEN),
+		.address = db_alloc(a, INET_ADDRSTRLEN),
 		.prefixlen = l->prefixlen,
 		.hwaddr = NULL,
-		.routers = malloc(routers_len),
-		.nameservers = malloc(nameservers_len),
+		.routers = db_alloc(a, routers_len + 1),
+		.nameservers = db_alloc(a, nameservers_len + 1),
 		.leasetime = l->leasetime,
 		.allocated = false,
 		.allocated_at = 0
@@ -186,3 +266,79 @@ void db_lease_from_lease(struct db_lease *dbl, struct dhcp_lease *l)
 	inet_ntop(AF_INET, &l->address, dbl->address, INET_ADDRSTRLEN);
 }
 
+
+/**
+ * SQL function hwaddr_key(hwaddr), which converts a textual hardware address
+ * to its lease key, NULL for invalid addresses
+ */
+static void db_hwaddr_key(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	const char *text = (const char *)sqlite3_value_text(argv[0]);
+	uint8_t hwaddr[6];
+	struct dhcp_key key;
+
+	(void)argc;
+
+	if (text == NULL || !mac_pton(text, hwaddr))
+	{
+		sqlite3_result_null(ctx);
+		return;
+	}
+
+	dhcp_key_from_hwaddr(&key, hwaddr);
+	sqlite3_result_blob(ctx, key.data, key.len, SQLITE_TRANSIENT);
+}
+
+int db_migrate(sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+
+	/* Nothing to do for new and current databases */
+	if (sqlite3_prepare_v2(db, "SELECT hwaddr FROM leases LIMIT 0;", -1,
+			&stmt, NULL) != SQLITE_OK)
+		return SQLITE_OK;
+	sqlite3_finalize(stmt);
+
+	if (sqlite3_prepare_v2(db, "SELECT clientid FROM leases LIMIT 0;", -1,
+			&stmt, NULL) == SQLITE_OK)
+	{
+		sqlite3_finalize(stmt);
+		return SQLITE_OK;
+	}
+
+	int sqlerr = sqlite3_create_function(db, "hwaddr_key", 1,
+		SQLITE_UTF8 | SQLITE_DETERMINISTIC, NULL, db_hwaddr_key, NULL, NULL);
+	if (sqlerr != SQLITE_OK)
+		return sqlerr;
+
+	/* The old indexes move with the renamed table and would keep their
+	 * names, invalid hardware addresses stay unique as raw key */
+	sqlerr = sqlite3_exec(db,
+		"BEGIN;\n"
+		"ALTER TABLE leases RENAME TO leases_old;\n"
+		"DROP INDEX IF EXISTS leases_idx_address;\n"
+		"DROP INDEX IF EXISTS leases_idx_hwaddr;\n"
+		"DROP INDEX IF EXISTS leases_idx_allocated_at;\n", NULL, NULL, NULL);
+	if (sqlerr == SQLITE_OK)
+		sqlerr = sqlite3_exec(db, DB_SCHEMA, NULL, NULL, NULL);
+	if (sqlerr == SQLITE_OK)
+		sqlerr = sqlite3_exec(db,
+			"INSERT INTO leases (" DB_COLUMNS ")\n"
+			"SELECT id, address, prefixlen, hwaddr, routers, nameservers,\n"
+			"leasetime, allocated, allocated_at,\n"
+			"coalesce(hwaddr_key(hwaddr), CAST(hwaddr AS BLOB))\n"
+			"FROM leases_old;\n"
+			"DROP TABLE leases_old;\n"
+			"COMMIT;\n", NULL, NULL, NULL);
+
+	if (sqlerr != SQLITE_OK)
+	{
+		PRINT_ERROR(db);
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+	}
+
+	sqlite3_create_function(db, "hwaddr_key", 1, SQLITE_UTF8, NULL, NULL,
+		NULL, NULL);
+
+	return sqlerr;
+}
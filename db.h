@@ -18,12 +18,13 @@ static const char DB_SCHEMA[] =
 "  'id' INTEGER PRIMARY KEY,\n"
 "  'address' STRING NOT NULL UNIQUE,\n"
 "  'prefixlen' INTEGER,\n"
-"  'hwaddr' STRING NOT NULL UNIQUE COLLATE NOCASE,\n"
+"  'hwaddr' STRING NOT NULL COLLATE NOCASE,\n"
 "  'routers' STRING,\n"
 "  'nameservers' STRING,\n"
 "  'leasetime' INTEGER,\n"
 "  'allocated' BOOLEAN DEFAULT 0,\n"
-"  'allocated_at' INTEGER\n"
+"  'allocated_at' INTEGER,\n"
+"  'clientid' BLOB NOT NULL UNIQUE\n"
 ");\n"
 "CREATE INDEX IF NOT EXISTS leases_idx_address ON leases (\n"
 "  'address'\n"
@@ -44,11 +45,12 @@ static const char DB_SCHEMA[] =
 		.nameservers = NULL,\
 		.leasetime = 0,\
 		.allocated = false,\
-		.allocated_at = 0\
+		.allocated_at = 0,\
+		.clientid = { .len = 0 }\
 	}
 
 #define DB_COLUMNS "id, address, prefixlen, hwaddr, routers, nameservers,\n"\
-	"leasetime, allocated, allocated_at"
+	"leasetime, allocated, allocated_at, clientid"
 
 struct db_lease
 {
@@ -64,6 +66,9 @@ struct db_lease
 	uint32_t leasetime;
 	bool allocated;
 	time_t allocated_at;
+
+	/* Lease key, see struct dhcp_key */
+	struct dhcp_key clientid;
 };
 
 /**
@@ -91,6 +96,15 @@ static inline void db_lease_free(struct db_lease *lease)
  */
 extern int db_lease_delete(sqlite3 *db, struct db_lease *lease);
 
+/**
+ * Fetch data version of the database, which changes whenever another
+ * connection commits a change
+ *
+ * @param[in] db Database descriptor
+ * @return Data version or -1 on errors
+ */
+extern int64_t db_data_version(sqlite3 *db);
+
 /**
  * Fetch record by a specified hwaddr from database
  *
@@ -119,14 +133,29 @@ extern int db_lease_by_address(sqlite3 *db, struct db_lease *lease,
  */
 extern int db_insert(sqlite3 *db, struct db_lease *lease);
 
+/**
+ * Insert lease record with its id, records with the same id, address or
+ * hwaddr are replaced
+ *
+ * @param[in] db Database descriptor
+ * @param[in,out] prepared Statement, which is prepared on the first call
+ *	if it is NULL and reused by later ones, the caller finalizes it
+ * @param[in] lease Struct which holds the record
+ */
+extern int db_lease_replace(sqlite3 *db, sqlite3_stmt **prepared,
+	struct db_lease *lease);
+
 /**
  * Convert binary representation struct dhcp_lease to text representation
  * struct db_lease
  *
  * @param[out] dbl Struct which shall hold the text representation
  * @param[in] l Struct which holds the binary representation
+ * @param[in] a Arena to allocate the strings from, they are allocated on
+ * the heap and freed with db_lease_free() if it is NULL
  */
-extern void db_lease_from_lease(struct db_lease *dbl, struct dhcp_lease *l);
+extern void db_lease_from_lease(struct db_lease *dbl, struct dhcp_lease *l,
+	struct arena *a);
 
 /**
  * Put fetched row into struct db_lease from executed SQL statement
@@ -136,6 +165,15 @@ extern void db_lease_from_lease(struct db_lease *dbl, struct dhcp_lease *l);
  */
 extern void db_lease_from_stmt(sqlite3_stmt *stmt, struct db_lease *l);
 
+/**
+ * Convert leases table of a database, which was created before leases were
+ * keyed by client identifier. The hardware address becomes the key of
+ * existing leases.
+ *
+ * @param[in] db Database descriptor
+ */
+extern int db_migrate(sqlite3 *db);
+
 /**
  * Initialize database with schema
  *
@@ -143,6 +181,7 @@ extern void db_lease_from_stmt(sqlite3_stmt *stmt, struct db_lease *l);
  */
 static inline void db_init(sqlite3 *db)
 {
+	db_migrate(db);
 	sqlite3_exec(db, DB_SCHEMA, NULL, NULL, NULL);
 }
 
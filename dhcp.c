@@ -3,56 +3,190 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <stdlib.h>
 
 static uint32_t netmask_from_prefixlen(uint8_t prefixlen)
 {
 	return htonl(0xFFFFFFFFU - (1 << (32 - prefixlen)) + 1);
 }
 
-uint8_t *dhcp_opt_add_lease(uint8_t *options, size_t *_send_len, struct dhcp_lease *lease)
+const struct dhcp_opt_desc dhcp_opt_descs[DHCP_OPT_IDX_CNT] = {
+#define DHCP_OPT_DESC(name, code, str, val, min, max) \
+	[DHCP_OPT_IDX_##name] = { str, DHCP_VAL_##val, code, min, max },
+	DHCP_OPTIONS(DHCP_OPT_DESC)
+#undef DHCP_OPT_DESC
+};
+
+const uint8_t dhcp_opt_idx[256] = {
+#define DHCP_OPT_INDEX(name, code, ...) [code] = DHCP_OPT_IDX_##name + 1,
+	DHCP_OPTIONS(DHCP_OPT_INDEX)
+#undef DHCP_OPT_INDEX
+};
+
+bool dhcp_opt_valid(const struct dhcp_opt_desc *desc, uint8_t len)
+{
+	if (len < desc->min_len || len > desc->max_len)
+		return false;
+
+	return desc->val != DHCP_VAL_ADDRS || len % 4 == 0;
+}
+
+void dhcp_opts_parse(uint8_t *data, uint8_t *end, struct dhcp_opts *opts)
 {
-	size_t send_len = 0;
+	uint8_t *options = DHCP_MSG_F_OPTIONS(data);
+	struct dhcp_opt opt;
 
-	if (lease->prefixlen > 0)
+	opts->present = 0;
+
+	while (dhcp_opt_next(&options, &opt, end))
 	{
-		options[0] = DHCP_OPT_NETMASK;
-		options[1] = 4;
-		ARRAY_COPY((options + 2), (uint8_t*)((uint32_t[]){netmask_from_prefixlen(lease->prefixlen)}), 4);
-		DHCP_OPT_CONT(options, send_len);
+		unsigned idx = dhcp_opt_idx[opt.code];
+
+		if (idx-- == 0 || opts->present & (UINT32_C(1) << idx))
+			continue;
+		if (!dhcp_opt_valid(&dhcp_opt_descs[idx], opt.len))
+			continue;
+
+		opts->opt[idx] = opt;
+		opts->present |= UINT32_C(1) << idx;
 	}
+}
+
+uint8_t *dhcp_opt_put_addrs(uint8_t *options, size_t *send_len,
+	uint8_t code, const struct in_addr *addrs, size_t cnt)
+{
+	size_t max = dhcp_opt_descs[dhcp_opt_idx[code] - 1].max_len / 4;
 
-	if (lease->routers_cnt > 0)
+	return dhcp_opt_put(options, send_len, code, addrs,
+		(cnt < max ? cnt : max) * 4);
+}
+
+/**
+ * Append option with the value of a lease, nothing if the lease has none
+ */
+static uint8_t *dhcp_opt_put_lease(uint8_t *options, size_t *send_len,
+	uint8_t code, const struct dhcp_lease *lease)
+{
+	switch (code)
 	{
-		options[0] = DHCP_OPT_ROUTER;
-		options[1] = lease->routers_cnt * 4;
-		for (size_t i = 0; i < lease->routers_cnt; ++i)
-			*(struct in_addr *)(options + 2 + (i * 4)) = lease->routers[i];
-		DHCP_OPT_CONT(options, send_len);
+		case DHCP_OPT_NETMASK:
+			if (lease->prefixlen > 0)
+				options = dhcp_opt_put(options, send_len, code,
+					(uint32_t[]){netmask_from_prefixlen(lease->prefixlen)}, 4);
+			break;
+		case DHCP_OPT_ROUTER:
+			if (lease->routers_opt != NULL)
+				options = dhcp_opt_copy(options, send_len, lease->routers_opt);
+			else if (lease->routers_cnt > 0)
+				options = dhcp_opt_put_addrs(options, send_len, code,
+					lease->routers, lease->routers_cnt);
+			break;
+		case DHCP_OPT_DNS:
+			if (lease->nameservers_opt != NULL)
+				options = dhcp_opt_copy(options, send_len, lease->nameservers_opt);
+			else if (lease->nameservers_cnt > 0)
+				options = dhcp_opt_put_addrs(options, send_len, code,
+					lease->nameservers, lease->nameservers_cnt);
+			break;
+		case DHCP_OPT_LEASETIME:
+			if (lease->leasetime > 0)
+				options = dhcp_opt_put(options, send_len, code,
+					(uint32_t[]){htonl(lease->leasetime)}, 4);
+			break;
+		case DHCP_OPT_RENEWAL:
+			if (lease->renewal > 0)
+				options = dhcp_opt_put(options, send_len, code,
+					(uint32_t[]){htonl(lease->renewal)}, 4);
+			break;
+		case DHCP_OPT_REBINDING:
+			if (lease->rebinding > 0)
+				options = dhcp_opt_put(options, send_len, code,
+					(uint32_t[]){htonl(lease->rebinding)}, 4);
+			break;
 	}
 
-	if (lease->leasetime > 0)
+	return options;
+}
+
+/* Options of a lease in the order they are sent without parameter request
+ * list */
+static const uint8_t dhcp_lease_opts[] = {
+	DHCP_OPT_NETMASK, DHCP_OPT_ROUTER, DHCP_OPT_LEASETIME, DHCP_OPT_RENEWAL,
+	DHCP_OPT_REBINDING, DHCP_OPT_DNS
+};
+
+/* Options sent whether they are requested or not */
+static const uint8_t dhcp_lease_opts_always[] = {
+	DHCP_OPT_LEASETIME, DHCP_OPT_RENEWAL, DHCP_OPT_REBINDING
+};
+
+uint8_t *dhcp_opt_add_lease(uint8_t *options, size_t *send_len,
+	struct dhcp_lease *lease, const struct dhcp_opts *opts)
+{
+	const struct dhcp_opt *prl = dhcp_opts_get(opts, DHCP_OPT_IDX_PRL);
+
+	if (prl == NULL)
 	{
-		options[0] = DHCP_OPT_LEASETIME;
-		options[1] = 4;
-		*(uint32_t*)(options + 2) = htonl(lease->leasetime);
-		DHCP_OPT_CONT(options, send_len);
+		for (size_t i = 0; i < ARRAY_LEN(dhcp_lease_opts); ++i)
+			options = dhcp_opt_put_lease(options, send_len, dhcp_lease_opts[i],
+				lease);
+		return options;
 	}
 
-	if (lease->nameservers_cnt > 0)
+	/* RFC 2131 requires the lease time in DHCPOFFER and DHCPACK, T1 and T2
+	 * are sent along, so clients renew when the server wants them to */
+	uint32_t sent = 0;
+
+	for (size_t i = 0; i < ARRAY_LEN(dhcp_lease_opts_always); ++i)
 	{
-		options[0] = DHCP_OPT_DNS;
-		options[1] = lease->nameservers_cnt * 4;
-		for (size_t i = 0; i < lease->nameservers_cnt; ++i)
-			*(struct in_addr *)(options + 2 + (i * 4)) = lease->nameservers[i];
-		DHCP_OPT_CONT(options, send_len);
+		uint8_t code = dhcp_lease_opts_always[i];
+
+		options = dhcp_opt_put_lease(options, send_len, code, lease);
+		sent |= UINT32_C(1) << (dhcp_opt_idx[code] - 1);
 	}
 
-	if (_send_len != NULL)
-		*_send_len += send_len;
+	for (size_t i = 0; i < prl->len; ++i)
+	{
+		uint8_t code = prl->data[i];
+		unsigned idx = dhcp_opt_idx[code];
+
+		/* Unknown and repeated codes */
+		if (idx-- == 0 || sent & (UINT32_C(1) << idx))
+			continue;
+		sent |= UINT32_C(1) << idx;
+
+		options = dhcp_opt_put_lease(options, send_len, code, lease);
+	}
 
 	return options;
 }
 
+void dhcp_lease_spread(struct dhcp_lease *lease, uint32_t hash,
+	uint8_t percent)
+{
+	/* An infinite lease has nothing to renew */
+	if (lease->leasetime <= 0 || lease->leasetime == DHCP_LEASE_INFINITE)
+		return;
+
+	/* The upper bits of FNV-1a are mixed best */
+	lease->leasetime -= (uint64_t)lease->leasetime * percent * (hash >> 16) /
+		(100 * 65536);
+	lease->renewal = lease->leasetime / 2;
+	lease->rebinding = lease->leasetime * 7 / 8;
+}
+
+const char *dhcp_msg_type_str(enum dhcp_msg_type type)
+{
+	return (type == DHCPDISCOVER ? "DHCPDISCOVER" :
+		type == DHCPOFFER ? "DHCPOFFER" :
+		type == DHCPREQUEST ? "DHCPREQUEST" :
+		type == DHCPDECLINE ? "DHCPDECLINE" :
+		type == DHCPACK ? "DHCPACK" :
+		type == DHCPNAK ? "DHCPNAK" :
+		type == DHCPRELEASE ? "DHCPRELEASE" :
+		type == DHCPINFORM ? "DHCPINFORM" : "unknown");
+}
+
 void dhcp_msg_dump(FILE *stream, struct dhcp_msg *msg)
 {
 	fprintf(stream,
@@ -77,59 +211,282 @@ void dhcp_msg_dump(FILE *stream, struct dhcp_msg *msg)
 		msg->ciaddr, msg->yiaddr, msg->siaddr, msg->giaddr,
 		msg->chaddr,
 		*(uint32_t*)DHCP_MSG_F_MAGIC(msg->data),
-		(msg->type == DHCPDISCOVER ? "DHCPDISCOVER" :
-		 msg->type == DHCPOFFER ? "DHCPOFFER" :
-		 msg->type == DHCPREQUEST ? "DHCPREQUEST" :
-		 msg->type == DHCPDECLINE ? "DHCPDECLINE" :
-		 msg->type == DHCPACK ? "DHCPACK" :
-		 msg->type == DHCPNAK ? "DHCPNAK" :
-		 msg->type == DHCPRELEASE ? "DHCPRELEASE" :
-		 msg->type == DHCPINFORM ? "DHCPINFORM" : "unknown"));
+		dhcp_msg_type_str(msg->type));
 
 	struct dhcp_opt cur_opt;
 	uint8_t *options = DHCP_MSG_F_OPTIONS(msg->data);
 
 	while (dhcp_opt_next(&options, &cur_opt, msg->end))
 	{
-		switch (cur_opt.code)
+		unsigned idx = dhcp_opt_idx[cur_opt.code];
+
+		if (cur_opt.code == DHCP_OPT_STUB)
+		{
+			fprintf(stream, "\tOPTION STUB\n");
+			continue;
+		}
+		if (idx-- == 0)
+		{
+			fprintf(stream, "\tOPTION %02hhX(%hhu)\n", cur_opt.code, cur_opt.len);
+			continue;
+		}
+
+		const struct dhcp_opt_desc *desc = &dhcp_opt_descs[idx];
+		const uint8_t *v = (const uint8_t *)cur_opt.data;
+
+		if (!dhcp_opt_valid(desc, cur_opt.len))
+		{
+			fprintf(stream, "\tOPTION %s invalid length %hhu\n", desc->name,
+				cur_opt.len);
+			continue;
+		}
+
+		fprintf(stream, "\tOPTION %s", desc->name);
+
+		switch (desc->val)
 		{
-			case DHCP_OPT_STUB:
-				fprintf(stream, "\tOPTION STUB\n");
+			case DHCP_VAL_ADDR:
+				fprintf(stream, " %s", inet_ntop(AF_INET, v,
+					(char[]){[INET_ADDRSTRLEN] = 0}, INET_ADDRSTRLEN));
 				break;
-			case DHCP_OPT_NETMASK:
-				fprintf(stream, "\tOPTION NETMASK %s\n",
-					inet_ntop(AF_INET, cur_opt.data,
+			case DHCP_VAL_ADDRS:
+				fprintf(stream, " %u", cur_opt.len / 4);
+				for (size_t o = 0; o < cur_opt.len; o += 4)
+					fprintf(stream, "\n\t\t%s", inet_ntop(AF_INET, v + o,
 						(char[]){[INET_ADDRSTRLEN] = 0}, INET_ADDRSTRLEN));
 				break;
-			case DHCP_OPT_ROUTER:
-				fprintf(stream, "\tOPTION ROUTERS %u\n", cur_opt.len / 4);
-				for (off_t o = 0; o < cur_opt.len / 4; ++o)
-					fprintf(stream, "\t\t%s\n", inet_ntop(AF_INET, cur_opt.data+(o*4),
-							(char[]){[INET_ADDRSTRLEN] = 0}, INET_ADDRSTRLEN));
+			case DHCP_VAL_U8:
+				fprintf(stream, " %hhu", v[0]);
 				break;
-			case DHCP_OPT_DNS:
-				fprintf(stream, "\tOPTION DNS %u\n", cur_opt.len / 4);
-				for (off_t o = 0; o < cur_opt.len / 4; ++o)
-					fprintf(stream, "\t\t%s\n", inet_ntop(AF_INET, cur_opt.data+(o*4),
-							(char[]){[INET_ADDRSTRLEN] = 0}, INET_ADDRSTRLEN));
+			case DHCP_VAL_U16:
+				fprintf(stream, " %u", (unsigned)v[0] << 8 | v[1]);
 				break;
-			case DHCP_OPT_LEASETIME:
-				fprintf(stream, "\tOPTION LEASETIME %u\n", *(uint32_t*)cur_opt.data);
+			case DHCP_VAL_U32:
+				fprintf(stream, " %u", (uint32_t)v[0] << 24 |
+					(uint32_t)v[1] << 16 | (uint32_t)v[2] << 8 | v[3]);
 				break;
-			case DHCP_OPT_SERVERID:
-				fprintf(stream, "\tOPTION SERVERID %s\n",
-					inet_ntop(AF_INET, cur_opt.data,
-						(char[]){[INET_ADDRSTRLEN] = 0}, INET_ADDRSTRLEN));
+			case DHCP_VAL_STR:
+				fputc(' ', stream);
+				for (size_t i = 0; i < cur_opt.len; ++i)
+					fputc(v[i] >= 0x20 && v[i] < 0x7F ? v[i] : '.', stream);
 				break;
-			case DHCP_OPT_REQIPADDR:
-				fprintf(stream, "\tOPTION REQIPADDR %s\n",
-					inet_ntop(AF_INET, cur_opt.data,
-						(char[]){[INET_ADDRSTRLEN] = 0}, INET_ADDRSTRLEN));
+			case DHCP_VAL_BYTES:
+				for (size_t i = 0; i < cur_opt.len; ++i)
+					fprintf(stream, i ? ":%02X" : " %02X", v[i]);
 				break;
-			default:
-				fprintf(stream, "\tOPTION %02hhX(%hhu)\n", cur_opt.code, cur_opt.len);
+			case DHCP_VAL_CODES:
+				for (size_t i = 0; i < cur_opt.len; ++i)
+				{
+					unsigned code_idx = dhcp_opt_idx[v[i]];
+
+					if (code_idx != 0)
+						fprintf(stream, " %s", dhcp_opt_descs[code_idx - 1].name);
+					else
+						fprintf(stream, " %hhu", v[i]);
+				}
 				break;
 		}
+
+		fputc('\n', stream);
 	}
 }
 
+
+/* Permutation of RFC 3074, section 6 */
+static const uint8_t dhcp_lb_table[256] = {
+	251, 175, 119, 215, 81, 14, 79, 191, 103, 49, 181, 143, 186, 157, 0,
+	232, 31, 32, 55, 60, 152, 58, 17, 237, 174, 70, 160, 144, 220, 90, 57,
+	223, 59, 3, 18, 140, 111, 166, 203, 196, 134, 243, 124, 95, 222, 179,
+	197, 65, 180, 48, 36, 15, 107, 46, 233, 130, 165, 30, 123, 161, 209, 23,
+	97, 16, 40, 91, 219, 61, 100, 10, 210, 109, 250, 127, 22, 138, 29, 108,
+	244, 67, 207, 9, 178, 204, 74, 98, 126, 249, 167, 116, 34, 77, 193,
+	200, 121, 5, 20, 113, 71, 35, 128, 13, 182, 94, 25, 226, 227, 199, 75,
+	27, 41, 245, 230, 224, 43, 225, 177, 26, 155, 150, 212, 142, 218, 115,
+	241, 73, 88, 105, 39, 114, 62, 255, 192, 201, 145, 214, 168, 158, 221,
+	148, 154, 122, 12, 84, 82, 163, 44, 139, 228, 236, 205, 242, 217, 11,
+	187, 146, 159, 64, 86, 239, 195, 42, 106, 198, 118, 112, 184, 172, 87,
+	2, 173, 117, 176, 229, 247, 253, 137, 185, 99, 164, 102, 147, 45, 66,
+	231, 52, 141, 211, 194, 206, 246, 238, 56, 110, 78, 248, 63, 240, 189,
+	93, 92, 51, 53, 183, 19, 171, 72, 50, 33, 104, 101, 69, 8, 252, 83, 120,
+	76, 135, 85, 54, 202, 125, 188, 213, 96, 235, 136, 208, 162, 129, 190,
+	132, 156, 38, 47, 1, 7, 254, 24, 4, 216, 131, 89, 21, 28, 133, 37, 153,
+	149, 80, 170, 68, 6, 169, 234, 151
+};
+
+static uint8_t dhcp_lb_hash(const uint8_t *key, size_t len)
+{
+	uint8_t hash = len;
+
+	for (size_t i = len; i > 0; )
+		hash = dhcp_lb_table[hash ^ key[--i]];
+
+	return hash;
+}
+
+bool dhcp_lb_serves(const struct dhcp_lb *lb, uint8_t *data,
+	const struct dhcp_opts *opts, enum dhcp_msg_type type)
+{
+	const struct dhcp_opt *clientid = dhcp_opts_get(opts, DHCP_OPT_IDX_CLIENTID);
+	const uint8_t *key = (const uint8_t *)DHCP_MSG_F_CHADDR(data);
+	size_t key_len = *DHCP_MSG_F_HLEN(data);
+
+	if (type != DHCPDISCOVER && type != DHCPREQUEST)
+		return true;
+
+	/* The client chose a server already */
+	if (type == DHCPREQUEST && dhcp_opts_get(opts, DHCP_OPT_IDX_SERVERID))
+		return true;
+
+	if (clientid != NULL)
+	{
+		key = (const uint8_t *)clientid->data;
+		key_len = clientid->len;
+	}
+	else if (key_len > 16)
+		key_len = 16;
+
+	uint8_t bucket = dhcp_lb_hash(key, key_len);
+
+	return lb->buckets[bucket / 64] & (UINT64_C(1) << (bucket % 64));
+}
+
+bool dhcp_lb_parse(const char *src, struct dhcp_lb *lb)
+{
+	*lb = (struct dhcp_lb){ .buckets = { 0, 0, 0, 0 } };
+
+	if (!strcmp(src, "none"))
+		return true;
+	if (!strcmp(src, "all"))
+	{
+		*lb = (struct dhcp_lb)DHCP_LB_ALL;
+		return true;
+	}
+
+	while (*src)
+	{
+		char *end;
+		unsigned long first = strtoul(src, &end, 10), last = first;
+
+		if (end == src || first > 255)
+			return false;
+
+		if (*end == '-')
+		{
+			src = end + 1;
+			last = strtoul(src, &end, 10);
+			if (end == src || last > 255 || last < first)
+				return false;
+		}
+
+		for (unsigned long b = first; b <= last; ++b)
+			lb->buckets[b / 64] |= UINT64_C(1) << (b % 64);
+
+		if (*end == ',')
+			++end;
+		else if (*end != 0)
+			return false;
+		src = end;
+	}
+
+	return true;
+}
+
+void dhcp_lb_format(const struct dhcp_lb *lb, char *dst)
+{
+	char *p = dst;
+
+	if (dhcp_lb_all(lb))
+	{
+		strcpy(dst, "all");
+		return;
+	}
+
+	for (unsigned b = 0; b < 256; ++b)
+	{
+		if (!(lb->buckets[b / 64] & (UINT64_C(1) << (b % 64))))
+			continue;
+
+		unsigned last = b;
+		while (last < 255 &&
+				lb->buckets[(last + 1) / 64] & (UINT64_C(1) << ((last + 1) % 64)))
+			++last;
+
+		if (last == b)
+			p += sprintf(p, "%s%u", p == dst ? "" : ",", b);
+		else
+			p += sprintf(p, "%s%u-%u", p == dst ? "" : ",", b, last);
+		b = last;
+	}
+
+	if (p == dst)
+		strcpy(dst, "none");
+}
+
+void dhcp_key_from_chaddr(uint8_t *data, struct dhcp_key *key)
+{
+	size_t hlen = *DHCP_MSG_F_HLEN(data);
+
+	/* chaddr has room for 16 bytes */
+	if (hlen > 16)
+		hlen = 16;
+
+	key->len = hlen + 1;
+	key->data[0] = *DHCP_MSG_F_HTYPE(data);
+	memcpy(key->data + 1, DHCP_MSG_F_CHADDR(data), hlen);
+}
+
+bool dhcp_key_from_msg(uint8_t *data, const struct dhcp_opts *opts,
+	struct dhcp_key *key)
+{
+	const struct dhcp_opt *opt = dhcp_opts_get(opts, DHCP_OPT_IDX_CLIENTID);
+
+	if (opt != NULL && opt->len <= DHCP_KEY_MAX)
+	{
+		key->len = opt->len;
+		memcpy(key->data, opt->data, opt->len);
+		return true;
+	}
+
+	dhcp_key_from_chaddr(data, key);
+	return false;
+}
+
+void dhcp_key_ntop(const struct dhcp_key *key, char *dst)
+{
+	*dst = 0;
+
+	for (size_t i = 0; i < key->len; ++i)
+		dst += sprintf(dst, i ? ":%02X" : "%02X", key->data[i]);
+}
+
+static int dhcp_hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+bool dhcp_key_pton(const char *src, struct dhcp_key *key)
+{
+	key->len = 0;
+
+	while (*src)
+	{
+		int hi = dhcp_hex(src[0]), lo = hi < 0 ? -1 : dhcp_hex(src[1]);
+
+		if (lo < 0 || key->len == DHCP_KEY_MAX)
+			return false;
+
+		key->data[key->len++] = hi << 4 | lo;
+		src += 2;
+
+		if (*src == ':' && src[1] != 0)
+			++src;
+	}
+
+	return key->len > 0;
+}
@@ -70,6 +70,8 @@
 
 #define DHCP_MSG_MAGIC_CHECK(m) (m[0] == 99 && m[1] == 130 && m[2] == 83 && m[3] == 99)
 
+#define DHCP_MSG_FLAG_BROADCAST (0x8000)
+
 #define DHCP_OPT_F_CODE(o) ((uint8_t*)(o))
 #define DHCP_OPT_F_LEN(o)  ((uint8_t*)((o)+1))
 #define DHCP_OPT_F_DATA(o) ((char*)((o)+2))
@@ -86,19 +88,81 @@
 		.data = ((*DHCP_OPT_F_LEN(m)) > 0 ? DHCP_OPT_F_DATA(m) : NULL)\
 	}
 
+/* Options known to the server. Every option is declared once in DHCP_OPTIONS
+ * with its code, name, value type and the valid lengths of its value, which
+ * generates the option codes, the decoder, the validation and the dump code.
+ */
+#define DHCP_OPTIONS(X) \
+	X(NETMASK,     1,  "NETMASK",     ADDR,  4, 4) \
+	X(ROUTER,      3,  "ROUTERS",     ADDRS, 4, 252) \
+	X(DNS,         6,  "DNS",         ADDRS, 4, 252) \
+	X(HOSTNAME,    12, "HOSTNAME",    STR,   1, 255) \
+	X(DOMAINNAME,  15, "DOMAINNAME",  STR,   1, 255) \
+	X(REQIPADDR,   50, "REQIPADDR",   ADDR,  4, 4) \
+	X(LEASETIME,   51, "LEASETIME",   U32,   4, 4) \
+	X(MSGTYPE,     53, "MSGTYPE",     U8,    1, 1) \
+	X(SERVERID,    54, "SERVERID",    ADDR,  4, 4) \
+	X(PRL,         55, "PRL",         CODES, 1, 255) \
+	X(MAXMSGSIZE,  57, "MAXMSGSIZE",  U16,   2, 2) \
+	X(RENEWAL,     58, "RENEWAL",     U32,   4, 4) \
+	X(REBINDING,   59, "REBINDING",   U32,   4, 4) \
+	X(VENDORCLASS, 60, "VENDORCLASS", STR,   1, 255) \
+	X(CLIENTID,    61, "CLIENTID",    BYTES, 2, 255) \
+	X(USERCLASS,   77, "USERCLASS",   BYTES, 1, 255) \
+	X(AGENTINFO,   82, "AGENTINFO",   BYTES, 2, 255)
+
 enum dhcp_opt_type
 {
 	DHCP_OPT_STUB = 0,
-	DHCP_OPT_NETMASK = 1,
-	DHCP_OPT_ROUTER = 3,
-	DHCP_OPT_DNS = 6,
-	DHCP_OPT_REQIPADDR = 50,
-	DHCP_OPT_LEASETIME = 51,
-	DHCP_OPT_MSGTYPE = 53,
-	DHCP_OPT_SERVERID = 54,
+#define DHCP_OPT_CODE(name, code, str, val, min, max) DHCP_OPT_##name = code,
+	DHCP_OPTIONS(DHCP_OPT_CODE)
+#undef DHCP_OPT_CODE
 	DHCP_OPT_END = 255
 };
 
+/* Position of a known option in dhcp_opt_descs and struct dhcp_opts */
+enum dhcp_opt_idx
+{
+#define DHCP_OPT_IDX(name, ...) DHCP_OPT_IDX_##name,
+	DHCP_OPTIONS(DHCP_OPT_IDX)
+#undef DHCP_OPT_IDX
+	DHCP_OPT_IDX_CNT
+};
+
+/* Value types of options */
+enum dhcp_opt_val
+{
+	/* IPv4 address */
+	DHCP_VAL_ADDR,
+	/* List of IPv4 addresses */
+	DHCP_VAL_ADDRS,
+	/* Integers in network byte order */
+	DHCP_VAL_U8,
+	DHCP_VAL_U16,
+	DHCP_VAL_U32,
+	/* Text, which is not zero terminated */
+	DHCP_VAL_STR,
+	/* Opaque bytes */
+	DHCP_VAL_BYTES,
+	/* List of option codes */
+	DHCP_VAL_CODES
+};
+
+struct dhcp_opt_desc
+{
+	const char *name;
+	enum dhcp_opt_val val;
+	uint8_t code;
+	uint8_t min_len;
+	uint8_t max_len;
+};
+
+/* Descriptors of all known options, indexed by enum dhcp_opt_idx */
+extern const struct dhcp_opt_desc dhcp_opt_descs[DHCP_OPT_IDX_CNT];
+
+/* Index plus one of every known option code, 0 for unknown codes */
+extern const uint8_t dhcp_opt_idx[256];
+
 enum dhcp_msg_type
 {
 	DHCPDISCOVER = 1,
@@ -118,6 +182,36 @@ struct dhcp_opt
 	char *data;
 };
 
+/* Known options of a message, decoded in one pass over the option part */
+struct dhcp_opts
+{
+	/* Bit i is set if the option with index i is present and valid */
+	uint32_t present;
+	struct dhcp_opt opt[DHCP_OPT_IDX_CNT];
+};
+
+_Static_assert(DHCP_OPT_IDX_CNT <= 32,
+	"present of struct dhcp_opts has room for 32 options");
+
+/* Longest lease key, longer client identifiers fall back to the hardware
+ * address */
+#define DHCP_KEY_MAX 31
+/* Length of the text representation of the longest lease key */
+#define DHCP_KEY_STRLEN (DHCP_KEY_MAX * 3)
+
+/* Hardware type of Ethernet */
+#define DHCP_HTYPE_ETHER 1
+
+/* Lease key, the client identifier of option 61 or, without one, htype
+ * followed by hlen bytes of chaddr as recommended in RFC 2132, section 9.14 */
+struct dhcp_key
+{
+	uint8_t len;
+	uint8_t data[DHCP_KEY_MAX];
+};
+
+struct class_rule;
+
 struct dhcp_msg
 {
 	uint8_t *data;
@@ -132,8 +226,22 @@ struct dhcp_msg
 	char *chaddr;
 	char *srcaddr;
 
+	/* Lease key and its hash */
+	struct dhcp_key key;
+	uint32_t key_hash;
+	/* Set if the key is a client identifier */
+	bool clientid;
+
+	/* Decoded options, NULL in the logging thread */
+	const struct dhcp_opts *opts;
+	/* Class of the client, NULL if no rule matched */
+	const struct class_rule *cls;
+
 	struct sockaddr *source;
 	struct sockaddr_in *sid;
+
+	/* Time the kernel received the message, zero if unknown */
+	struct timespec stamp;
 };
 
 struct dhcp_lease
@@ -146,17 +254,33 @@ struct dhcp_lease
 	struct in_addr *nameservers;
 	size_t nameservers_cnt;
 
+	/* Options 3 and 6 with code and length, which are copied into replies
+	 * instead of being encoded from the lists, NULL if not encoded yet */
+	const uint8_t *routers_opt;
+	const uint8_t *nameservers_opt;
+
+	/* DHCP_LEASE_INFINITE for leases, which never expire */
 	time_t leasetime;
+	/* T1 and T2 of RFC 2131, section 4.4.5, zero if not sent */
+	time_t renewal;
+	time_t rebinding;
 	uint8_t prefixlen;
 };
 
+/* Lease time of infinite leases, RFC 2131, section 3.3 */
+#define DHCP_LEASE_INFINITE 0xFFFFFFFFU
+
 #define DHCP_LEASE_EMPTY {\
 		.address = {INADDR_ANY},\
 		.routers = NULL,\
 		.routers_cnt = 0,\
 		.nameservers = NULL,\
 		.nameservers_cnt = 0,\
+		.routers_opt = NULL,\
+		.nameservers_opt = NULL,\
 		.leasetime = 0,\
+		.renewal = 0,\
+		.rebinding = 0,\
 		.prefixlen = 0\
 	}
 
@@ -171,6 +295,8 @@ static inline void dhcp_msg_prepare(uint8_t *reply, uint8_t *original)
 	*DHCP_MSG_F_XID(reply) = *DHCP_MSG_F_XID(original);
 	*DHCP_MSG_F_HTYPE(reply) = *DHCP_MSG_F_HTYPE(original);
 	*DHCP_MSG_F_HLEN(reply) = *DHCP_MSG_F_HLEN(original);
+	*DHCP_MSG_F_FLAGS(reply) = *DHCP_MSG_F_FLAGS(original);
+	*DHCP_MSG_F_GIADDR(reply) = *DHCP_MSG_F_GIADDR(original);
 	*DHCP_MSG_F_OP(reply) = (*DHCP_MSG_F_OP(reply) == 2 ? 1 : 2);
 	ARRAY_COPY(DHCP_MSG_F_MAGIC(reply), DHCP_MSG_MAGIC, 4);
 	ARRAY_COPY(DHCP_MSG_F_CHADDR(reply), DHCP_MSG_F_CHADDR(original), 16);
@@ -219,10 +345,330 @@ static inline bool dhcp_opt_next(uint8_t **cur, struct dhcp_opt *opt, uint8_t *e
 	return true;
 }
 
+/**
+ * Extract message type from options
+ *
+ * @param[in] data Buffer which holds the DHCP message
+ * @param[in] end End of the DHCP message
+ */
+static inline enum dhcp_msg_type dhcp_msg_type(uint8_t *data, uint8_t *end)
+{
+	uint8_t *options = DHCP_MSG_F_OPTIONS(data);
+	struct dhcp_opt current_option;
+
+	enum dhcp_msg_type msg_type = 0;
+
+	while (dhcp_opt_next(&options, &current_option, end))
+		if (current_option.code == DHCP_OPT_MSGTYPE && current_option.len >= 1)
+			msg_type = (enum dhcp_msg_type)current_option.data[0];
+
+	return msg_type;
+}
+
+/**
+ * Decode known options of a message. Only the first occurrence of an option
+ * is kept, options with invalid lengths are ignored.
+ *
+ * @param[in] data Buffer which holds the DHCP message
+ * @param[in] end End of the DHCP message
+ * @param[out] opts Decoded options
+ */
+extern void dhcp_opts_parse(uint8_t *data, uint8_t *end, struct dhcp_opts *opts);
+
+/**
+ * Fetch decoded option
+ *
+ * @return Option or NULL if the message doesn't carry a valid one
+ */
+static inline const struct dhcp_opt *dhcp_opts_get(const struct dhcp_opts *opts,
+	enum dhcp_opt_idx idx)
+{
+	return opts->present & (UINT32_C(1) << idx) ? &opts->opt[idx] : NULL;
+}
+
+/**
+ * Extract message type from decoded options
+ */
+static inline enum dhcp_msg_type dhcp_opts_msg_type(const struct dhcp_opts *opts)
+{
+	const struct dhcp_opt *opt = dhcp_opts_get(opts, DHCP_OPT_IDX_MSGTYPE);
+
+	return opt != NULL ? (enum dhcp_msg_type)(uint8_t)opt->data[0] : 0;
+}
+
+/**
+ * Check whether the length of an option value is valid for its type
+ *
+ * @param[in] desc Descriptor of the option
+ * @param[in] len Length of the value
+ */
+extern bool dhcp_opt_valid(const struct dhcp_opt_desc *desc, uint8_t len);
+
+/**
+ * Append option to a reply
+ *
+ * @param[in] options Position of the option
+ * @param[in,out] send_len Size of the message
+ * @param[in] code Option code
+ * @param[in] data Value
+ * @param[in] len Length of the value
+ * @return Position of the next option
+ */
+static inline uint8_t *dhcp_opt_put(uint8_t *options, size_t *send_len,
+	uint8_t code, const void *data, uint8_t len)
+{
+	options[0] = code;
+	options[1] = len;
+	memcpy(options + 2, data, len);
+	*send_len += len + 2;
+
+	return options + len + 2;
+}
+
+/**
+ * Append option, which is already encoded with code and length, to a reply
+ *
+ * @param[in] options Position of the option
+ * @param[in,out] send_len Size of the message
+ * @param[in] opt Encoded option
+ * @return Position of the next option
+ */
+static inline uint8_t *dhcp_opt_copy(uint8_t *options, size_t *send_len,
+	const uint8_t *opt)
+{
+	memcpy(options, opt, opt[1] + 2);
+	*send_len += opt[1] + 2;
+
+	return options + opt[1] + 2;
+}
+
+/**
+ * Append option with a list of addresses to a reply, the list is cut off at
+ * the longest value the option may have
+ *
+ * @param[in] options Position of the option
+ * @param[in,out] send_len Size of the message
+ * @param[in] code Option code
+ * @param[in] addrs Addresses
+ * @param[in] cnt Count of addresses
+ * @return Position of the next option
+ */
+extern uint8_t *dhcp_opt_put_addrs(uint8_t *options, size_t *send_len,
+	uint8_t code, const struct in_addr *addrs, size_t cnt);
+
+/**
+ * Hash of a lease key (FNV-1a)
+ */
+static inline uint32_t dhcp_key_hash(const struct dhcp_key *key)
+{
+	uint32_t h = 2166136261U;
+
+	for (size_t i = 0; i < key->len; ++i)
+		h = (h ^ key->data[i]) * 16777619U;
+
+	return h;
+}
+
+static inline bool dhcp_key_eq(const struct dhcp_key *a,
+	const struct dhcp_key *b)
+{
+	return a->len == b->len && !memcmp(a->data, b->data, a->len);
+}
+
+/**
+ * Derive lease key of an Ethernet hardware address
+ */
+static inline void dhcp_key_from_hwaddr(struct dhcp_key *key,
+	const uint8_t hwaddr[6])
+{
+	key->len = 7;
+	key->data[0] = DHCP_HTYPE_ETHER;
+	memcpy(key->data + 1, hwaddr, 6);
+}
+
+/**
+ * Derive lease key of a message from htype and chaddr
+ *
+ * @param[in] data Buffer which holds the DHCP message
+ * @param[out] key Lease key
+ */
+extern void dhcp_key_from_chaddr(uint8_t *data, struct dhcp_key *key);
+
+/**
+ * Derive lease key of a message, from option 61 if it is present
+ *
+ * @param[in] data Buffer which holds the DHCP message
+ * @param[in] opts Decoded options of the message
+ * @param[out] key Lease key
+ * @return true if the key is a client identifier
+ */
+extern bool dhcp_key_from_msg(uint8_t *data, const struct dhcp_opts *opts,
+	struct dhcp_key *key);
+
+/**
+ * Convert lease key to colon separated hex bytes like 01:AB:CD
+ *
+ * @param[in] key Binary representation
+ * @param[out] dst Buffer of DHCP_KEY_STRLEN bytes
+ */
+extern void dhcp_key_ntop(const struct dhcp_key *key, char *dst);
+
+/**
+ * Convert lease key from text representation, colons are optional
+ *
+ * @param[in] src Text representation
+ * @param[out] key Binary representation
+ */
+extern bool dhcp_key_pton(const char *src, struct dhcp_key *key);
+
+#define MAC_ADDRSTRLEN 18
+
+/**
+ * Convert MAC address from binary representation to text representation
+ *
+ * @param[in] addr Binary representation
+ * @param[out] dst Buffer to write text presentation
+ * @param[in] s Size of dst
+ */
+static inline int mac_ntop(const char *addr, char *dst, size_t s)
+{
+	return snprintf(dst, s,
+		"%02hhX:%02hhX:%02hhX:%02hhX:%02hhX:%02hhX",
+		addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+}
+
+/**
+ * Convert MAC address from text representation to binary representation,
+ * upper and lower case digits are accepted
+ *
+ * @param[in] src Text representation
+ * @param[out] addr Buffer of 6 bytes to write binary representation
+ * @return true if src is a valid MAC address
+ */
+static inline bool mac_pton(const char *src, uint8_t *addr)
+{
+	for (size_t i = 0; i < 6; ++i)
+	{
+		uint8_t v = 0;
+
+		for (size_t j = 0; j < 2; ++j, ++src)
+		{
+			char c = *src;
+			v <<= 4;
+
+			if (c >= '0' && c <= '9')
+				v |= c - '0';
+			else if (c >= 'a' && c <= 'f')
+				v |= c - 'a' + 10;
+			else if (c >= 'A' && c <= 'F')
+				v |= c - 'A' + 10;
+			else
+				return false;
+		}
+
+		addr[i] = v;
+
+		if (*src != (i < 5 ? ':' : 0))
+			return false;
+		++src;
+	}
+
+	return true;
+}
+
+/* Hash buckets of RFC 3074 load balancing, which this server serves */
+struct dhcp_lb
+{
+	uint64_t buckets[4];
+};
+
+#define DHCP_LB_ALL {\
+		.buckets = { UINT64_MAX, UINT64_MAX, UINT64_MAX, UINT64_MAX }\
+	}
+
+/* Longest text representation of a bucket set */
+#define DHCP_LB_STRLEN (128 * 8)
+
+/**
+ * Check whether all buckets are served, i.e. load balancing is off
+ */
+static inline bool dhcp_lb_all(const struct dhcp_lb *lb)
+{
+	return (lb->buckets[0] & lb->buckets[1] & lb->buckets[2] &
+		lb->buckets[3]) == UINT64_MAX;
+}
+
+/**
+ * Check whether a message is answered, as described in RFC 3074, section 5.
+ * DHCPDISCOVER and DHCPREQUEST without server identifier are only answered
+ * if the Pearson hash of the client identifier, or of chaddr without one,
+ * falls into a served bucket.
+ *
+ * @param[in] lb Served buckets
+ * @param[in] data Buffer which holds the DHCP message
+ * @param[in] opts Decoded options of the message
+ * @param[in] type Type of the message
+ */
+extern bool dhcp_lb_serves(const struct dhcp_lb *lb, uint8_t *data,
+	const struct dhcp_opts *opts, enum dhcp_msg_type type);
+
+/**
+ * Parse bucket set, a comma separated list of buckets and ranges like
+ * "0-127,200", "all" or "none"
+ *
+ * @param[in] src Text representation
+ * @param[out] lb Bucket set
+ */
+extern bool dhcp_lb_parse(const char *src, struct dhcp_lb *lb);
+
+/**
+ * Convert bucket set to its shortest text representation
+ *
+ * @param[in] lb Bucket set
+ * @param[out] dst Buffer of DHCP_LB_STRLEN bytes
+ */
+extern void dhcp_lb_format(const struct dhcp_lb *lb, char *dst);
+
+/**
+ * Name of a message type, "unknown" for invalid types
+ */
+extern const char *dhcp_msg_type_str(enum dhcp_msg_type type);
+
+/**
+ * Spread renewals of clients, which got their leases at the same time. The
+ * lease time is shortened by up to percent percent, by an amount chosen by
+ * the hash of the client, and T1 and T2 are set to the default fractions
+ * 1/2 and 7/8 of the result. Infinite leases are left as they are.
+ *
+ * @param[in,out] lease Lease, which is sent
+ * @param[in] hash Hash of the lease key
+ * @param[in] percent Largest reduction of the lease time
+ */
+extern void dhcp_lease_spread(struct dhcp_lease *lease, uint32_t hash,
+	uint8_t percent);
+
+/**
+ * Write message and all of its options in readable form
+ */
 extern void dhcp_msg_dump(FILE *stream, struct dhcp_msg *msg);
+
+/**
+ * Append options of a lease to a reply. If the request carries a parameter
+ * request list (option 55), only the requested options are appended in the
+ * order of the list as described in RFC 2131, section 4.3.1, otherwise all
+ * options of the lease. The lease time, T1 and T2 are always appended if
+ * they are set.
+ *
+ * @param[in] options Position of the first option
+ * @param[in,out] send_len Size of the message
+ * @param[in] lease Lease
+ * @param[in] opts Decoded options of the request
+ * @return Position of the next option
+ */
 extern uint8_t *dhcp_opt_add_lease(uint8_t *options,
 	size_t *send_len,
-	struct dhcp_lease *lease);
+	struct dhcp_lease *lease,
+	const struct dhcp_opts *opts);
 
 #endif
 
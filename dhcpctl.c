@@ -6,23 +6,38 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+
+#include <arpa/inet.h>
 
 #include <sqlite3.h>
 
 #include "db.h"
 #include "error.h"
+#include "leaseio.h"
+#include "control.h"
 
 sqlite3 *db = NULL;
+/* Control socket of a running daemon, leases are changed through it if set */
+char *control_path = NULL;
 extern char **environ;
 
 static int main_lease(int argc, char **argv);
 static int main_lease_add(int argc, char **argv);
 static int main_lease_show(int argc, char **argv);
 static int main_lease_remove(int argc, char **argv);
+static int main_lease_import(int argc, char **argv);
+static int control_lease_get(int argc, char **argv);
+static int control_lease_remove(int argc, char **argv);
+static int main_lease_export(int argc, char **argv);
 static int main_start(int argc, char **argv);
 static int main_stop(int argc, char **argv);
 static int main_restart(int argc, char **argv);
 static int main_flush(int argc, char **argv);
+static int main_commit(int argc, char **argv);
+static int main_stats(int argc, char **argv);
+static int main_loadbalance(int argc, char **argv);
+static int main_classes(int argc, char **argv);
 static int main_help(int argc, char **argv);
 static int main_mkdb(int argc, char **argv);
 
@@ -45,6 +60,14 @@ int main(int argc, char **argv)
 			command = main_restart;
 		else if (!strcmp(arg, "flush"))
 			command = main_flush;
+		else if (!strcmp(arg, "commit"))
+			command = main_commit;
+		else if (!strcmp(arg, "stats"))
+			command = main_stats;
+		else if (!strcmp(arg, "loadbalance"))
+			command = main_loadbalance;
+		else if (!strcmp(arg, "classes"))
+			command = main_classes;
 		else if (!strcmp(arg, "help"))
 			command = main_help;
 		else if (!strcmp(arg, "mkdb"))
@@ -92,10 +115,12 @@ static int main_lease(int argc, char **argv)
 	struct {
 		char *db;
 		char *interface;
+		char *control;
 		char *command;
 	} dhcpctl_lease = {
 		.db = NULL,
 		.interface = NULL,
+		.control = NULL,
 		.command = NULL
 	};
 
@@ -120,6 +145,10 @@ static int main_lease(int argc, char **argv)
 						state = 2;
 					else if (!strcmp(arg, "-if"))
 						state = 2;
+					else if (!strcmp(arg, "-control"))
+						state = 3;
+					else
+						dhcpd_error(1, 0, "Unknown option %s", arg);
 					break;
 				case 1:
 					dhcpctl_lease.db = arg;
@@ -129,6 +158,10 @@ static int main_lease(int argc, char **argv)
 					dhcpctl_lease.interface = arg;
 					state = 0;
 					break;
+				case 3:
+					dhcpctl_lease.control = arg;
+					state = 0;
+					break;
 			}
 			continue;
 end_loop:
@@ -146,6 +179,30 @@ end_loop:
 			command = main_lease_show;
 		else if (!strcmp(dhcpctl_lease.command, "remove"))
 			command = main_lease_remove;
+		else if (!strcmp(dhcpctl_lease.command, "import"))
+			command = main_lease_import;
+		else if (!strcmp(dhcpctl_lease.command, "export"))
+			command = main_lease_export;
+		else
+			dhcpd_error(1, 0, "Unknown command leases %s", dhcpctl_lease.command);
+	}
+
+	/* A running daemon applies changes to its own state */
+	if (dhcpctl_lease.control && dhcpctl_lease.command)
+	{
+		control_path = dhcpctl_lease.control;
+
+		if (!strcmp(dhcpctl_lease.command, "add"))
+			command = main_lease_add;
+		else if (!strcmp(dhcpctl_lease.command, "get"))
+			command = control_lease_get;
+		else if (!strcmp(dhcpctl_lease.command, "remove"))
+			command = control_lease_remove;
+		else
+			dhcpd_error(1, 0, "leases %s isn't supported with -control",
+				dhcpctl_lease.command);
+
+		return command(argc - i, argv + i);
 	}
 
 	if (dhcpctl_lease.db)
@@ -176,6 +233,66 @@ end_loop:
 	return main_help(argc, argv);
 }
 
+/**
+ * Join list with commas
+ *
+ * @return Allocated string or NULL for empty lists
+ */
+static char *lease_join(char **list, size_t cnt)
+{
+	size_t len = 0;
+
+	if (cnt == 0)
+		return NULL;
+
+	for (size_t i = 0; i < cnt; ++i)
+		len += strlen(list[i]) + 1;
+
+	char *out = malloc(len);
+	if (out == NULL)
+		dhcpd_error(1, errno, "Could not allocate list");
+
+	char *p = out;
+	for (size_t i = 0; i < cnt; ++i)
+		p += sprintf(p, i ? ",%s" : "%s", list[i]);
+
+	return out;
+}
+
+/**
+ * Connect to the control socket or exit
+ */
+static int control_open(void)
+{
+	int fd = control_connect(control_path);
+
+	if (fd < 0)
+		dhcpd_error(1, errno, "Could not connect to %s", control_path);
+	return fd;
+}
+
+/**
+ * Send request to the daemon and receive the response or exit
+ */
+static void control_call(int fd, uint8_t op, const void *payload, size_t len,
+	struct control_hdr *hdr, uint8_t *resp)
+{
+	if (!control_request(fd, op, payload, len, hdr, resp))
+		dhcpd_error(1, errno, "Control request to %s failed", control_path);
+}
+
+/**
+ * Parse [socket FILE] arguments of the daemon commands
+ */
+static void control_args(int argc, char **argv)
+{
+	control_path = CONTROL_PATH;
+
+	for (int i = 1; i + 1 < argc && strcmp(argv[i], "--"); ++i)
+		if (!strcmp(argv[i], "socket"))
+			control_path = argv[++i];
+}
+
 static int main_lease_add(int argc, char **argv)
 {
 	struct {
@@ -187,6 +304,7 @@ static int main_lease_add(int argc, char **argv)
 		size_t nameservers_cnt;
 		uint32_t leasetime;
 		uint8_t prefix;
+		char *clientid;
 	} dhcpctl_lease_add = {
 		.hwaddr = NULL,
 		.ipaddr = NULL,
@@ -195,7 +313,8 @@ static int main_lease_add(int argc, char **argv)
 		.nameservers = NULL,
 		.nameservers_cnt = 0,
 		.leasetime = 3600,
-		.prefix = 24
+		.prefix = 24,
+		.clientid = NULL
 	};
 
 	(void)dhcpctl_lease_add;
@@ -222,6 +341,8 @@ static int main_lease_add(int argc, char **argv)
 						state = 3;
 					else if (!strcmp(arg, "prefix"))
 						state = 4;
+					else if (!strcmp(arg, "clientid"))
+						state = 5;
 					break;
 				case 1:
 					dhcpctl_lease_add.routers = realloc(dhcpctl_lease_add.routers,
@@ -243,34 +364,584 @@ static int main_lease_add(int argc, char **argv)
 					dhcpctl_lease_add.prefix = atoi(arg);
 					state = 0;
 					break;
+				case 5:
+					dhcpctl_lease_add.clientid = arg;
+					state = 0;
+					break;
 			}
 		}
 	}
 
-	struct db_lease db_lease = {
-		.id = 0,
-		.address = dhcpctl_lease_add.ipaddr,
-		.prefixlen = dhcpctl_lease_add.prefix,
-		.hwaddr = dhcpctl_lease_add.hwaddr,
-		.routers = (dhcpctl_lease_add.routers_cnt > 0) ?
-			dhcpctl_lease_add.routers[0] : NULL,
-		.nameservers = (dhcpctl_lease_add.nameservers_cnt > 0) ? 
-			dhcpctl_lease_add.nameservers[0] : NULL,
-		.leasetime = dhcpctl_lease_add.leasetime,
-		.allocated = 0,
-		.allocated_at = 0
-	};
+	uint8_t hwaddr[6];
+	struct dhcp_key key;
 
-	int sqlerr;
-	if ((sqlerr = db_insert(db, &db_lease)) != SQLITE_DONE)
-		dhcpd_error(1, 0, "sqlite3: %s\n", sqlite3_errstr(sqlerr));
+	if (!mac_pton(dhcpctl_lease_add.hwaddr, hwaddr))
+		dhcpd_error(1, 0, "Invalid hardware address %s", dhcpctl_lease_add.hwaddr);
+
+	if (dhcpctl_lease_add.clientid == NULL)
+		dhcp_key_from_hwaddr(&key, hwaddr);
+	else if (!dhcp_key_pton(dhcpctl_lease_add.clientid, &key))
+		dhcpd_error(1, 0, "Invalid client identifier %s", dhcpctl_lease_add.clientid);
+
+	char *routers = lease_join(dhcpctl_lease_add.routers,
+		dhcpctl_lease_add.routers_cnt);
+	char *nameservers = lease_join(dhcpctl_lease_add.nameservers,
+		dhcpctl_lease_add.nameservers_cnt);
+
+	if (control_path)
+	{
+		struct control_lease cl = {
+			.id = 0,
+			.prefixlen = dhcpctl_lease_add.prefix,
+			.allocated = 0,
+			.leasetime = dhcpctl_lease_add.leasetime,
+			.allocated_at = 0,
+			.key = key,
+			.routers = routers,
+			.nameservers = nameservers
+		};
+		uint8_t payload[CONTROL_PAYLOAD_MAX];
+		size_t len;
+
+		ARRAY_COPY(cl.hwaddr, hwaddr, 6);
+		if (inet_pton(AF_INET, dhcpctl_lease_add.ipaddr, &cl.address) != 1)
+			dhcpd_error(1, 0, "Invalid address %s", dhcpctl_lease_add.ipaddr);
+		if ((len = control_lease_pack(payload, sizeof payload, &cl)) == 0)
+			dhcpd_error(1, 0, "Router or nameserver list too long");
+
+		int fd = control_open();
+		struct control_hdr hdr;
+		uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+
+		control_call(fd, CONTROL_LEASE_ADD, payload, len, &hdr, resp);
+		if (hdr.status != 0)
+			dhcpd_error(1, hdr.status, "Could not add lease");
+
+		if (control_lease_unpack(resp, hdr.len, &cl))
+			printf("%u\n", cl.id);
+		close(fd);
+	}
+	else
+	{
+		struct db_lease db_lease = {
+			.id = 0,
+			.address = dhcpctl_lease_add.ipaddr,
+			.prefixlen = dhcpctl_lease_add.prefix,
+			.hwaddr = dhcpctl_lease_add.hwaddr,
+			.routers = routers,
+			.nameservers = nameservers,
+			.leasetime = dhcpctl_lease_add.leasetime,
+			.allocated = 0,
+			.allocated_at = 0,
+			.clientid = key
+		};
+
+		int sqlerr;
+		if ((sqlerr = db_insert(db, &db_lease)) != SQLITE_DONE)
+			dhcpd_error(1, 0, "sqlite3: %s\n", sqlite3_errstr(sqlerr));
+	}
+
+	free(routers);
+	free(nameservers);
+	free(dhcpctl_lease_add.routers);
+	free(dhcpctl_lease_add.nameservers);
 
 	return 0;
 }
 
+/**
+ * Parse lease key, which is a hardware address, an IP address, a client
+ * identifier with colons or an id
+ */
+static bool lease_key_parse(const char *arg, struct control_key_val *key)
+{
+	char *end;
+
+	if (mac_pton(arg, key->hwaddr) && arg[17] == 0)
+		key->kind = CONTROL_KEY_HWADDR;
+	else if (inet_pton(AF_INET, arg, &key->address) == 1)
+		key->kind = CONTROL_KEY_ADDRESS;
+	else if (strchr(arg, ':') && dhcp_key_pton(arg, &key->clientid))
+		key->kind = CONTROL_KEY_CLIENTID;
+	else
+	{
+		unsigned long id = strtoul(arg, &end, 10);
+
+		if (end == arg || *end != 0 || id == 0 || id > UINT32_MAX)
+			return false;
+
+		key->kind = CONTROL_KEY_ID;
+		key->id = id;
+	}
+
+	return true;
+}
+
+static int control_lease_get(int argc, char **argv)
+{
+	int fd = control_open();
+	int ret = 0;
+
+	printf("id,address,prefixlen,hwaddr,routers,nameservers,leasetime,"
+		"allocated,allocated_at,clientid\n");
+
+	for (int i = 1; i < argc; ++i)
+	{
+		struct control_key_val key;
+		struct control_lease cl;
+		struct control_hdr hdr;
+		uint8_t payload[CONTROL_KEYLEN_MAX];
+		uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+
+		if (!lease_key_parse(argv[i], &key))
+			dhcpd_error(1, 0, "Invalid lease %s", argv[i]);
+
+		control_call(fd, CONTROL_LEASE_GET, payload, control_key_pack(payload, &key),
+			&hdr, resp);
+
+		if (hdr.status != 0 || !control_lease_unpack(resp, hdr.len, &cl))
+		{
+			dhcpd_error(0, hdr.status, "%s", argv[i]);
+			ret = 1;
+			continue;
+		}
+
+		char address[INET_ADDRSTRLEN];
+		char hwaddr[MAC_ADDRSTRLEN];
+		char clientid[DHCP_KEY_STRLEN];
+		inet_ntop(AF_INET, &cl.address, address, sizeof address);
+		mac_ntop((const char *)cl.hwaddr, hwaddr, sizeof hwaddr);
+		dhcp_key_ntop(&cl.key, clientid);
+
+		printf("%u,%s,%u,%s,\"%s\",\"%s\",%u,%u,%lld,%s\n", cl.id, address,
+			cl.prefixlen, hwaddr, cl.routers ? cl.routers : "",
+			cl.nameservers ? cl.nameservers : "", cl.leasetime, cl.allocated,
+			(long long)cl.allocated_at, clientid);
+	}
+
+	close(fd);
+	return ret;
+}
+
+static int control_lease_remove(int argc, char **argv)
+{
+	int fd = control_open();
+	int ret = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		struct control_key_val key;
+		struct control_hdr hdr;
+		uint8_t payload[CONTROL_KEYLEN_MAX];
+		uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+
+		if (!lease_key_parse(argv[i], &key))
+			dhcpd_error(1, 0, "Invalid lease %s", argv[i]);
+
+		control_call(fd, CONTROL_LEASE_REMOVE, payload,
+			control_key_pack(payload, &key), &hdr, resp);
+
+		if (hdr.status != 0)
+		{
+			dhcpd_error(0, hdr.status, "%s", argv[i]);
+			ret = 1;
+		}
+	}
+
+	close(fd);
+	return ret;
+}
+
+/**
+ * Guess format from file name extension, CSV by default
+ */
+static enum leaseio_format lease_format(const char *file)
+{
+	const char *ext = file ? strrchr(file, '.') : NULL;
+
+	if (ext && (!strcmp(ext, ".jsonl") || !strcmp(ext, ".json")))
+		return LEASEIO_JSONL;
+	return LEASEIO_CSV;
+}
+
+static bool lease_format_parse(const char *arg, enum leaseio_format *format)
+{
+	if (!strcmp(arg, "csv"))
+		*format = LEASEIO_CSV;
+	else if (!strcmp(arg, "jsonl") || !strcmp(arg, "json"))
+		*format = LEASEIO_JSONL;
+	else
+		return false;
+	return true;
+}
+
+static void lease_exec(const char *sql)
+{
+	char *errmsg = NULL;
+
+	if (sqlite3_exec(db, sql, NULL, NULL, &errmsg) != SQLITE_OK)
+		dhcpd_error(1, 0, "sqlite3: %s: %s", sql, errmsg);
+}
+
+/* Rows of one page and ids scanned by one statement of leases show, every
+ * statement runs in its own read transaction, so that a running daemon is
+ * never blocked for long */
+#define LEASE_SHOW_PAGE 1000
+#define LEASE_SHOW_SCAN 65536
+
+/**
+ * SQL function ip4(address), which converts an address to an integer in
+ * host byte order, NULL for invalid addresses
+ */
+static void lease_show_ip4(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	const char *text = (const char *)sqlite3_value_text(argv[0]);
+	struct in_addr in;
+
+	(void)argc;
+
+	if (text && inet_pton(AF_INET, text, &in) == 1)
+		sqlite3_result_int64(ctx, ntohl(in.s_addr));
+	else
+		sqlite3_result_null(ctx);
+}
+
+/**
+ * Parse decimal number of an argument, exit if it is invalid or out of
+ * range
+ *
+ * @param[in] arg Argument
+ * @param[in] min Smallest valid number
+ * @param[in] what Meaning of the argument for the error message
+ */
+static int64_t lease_number(const char *arg, int64_t min,
+	const char *what)
+{
+	char *end;
+
+	errno = 0;
+	long long n = strtoll(arg, &end, 10);
+
+	if (errno != 0 || end == arg || *end != 0 || n < min)
+		dhcpd_error(1, 0, "Invalid %s %s", what, arg);
+
+	return n;
+}
+
+/**
+ * Parse address filter, which is a single address, CIDR or FIRST-LAST
+ *
+ * @return false on invalid filters
+ */
+static bool lease_show_range(char *arg, uint32_t *first, uint32_t *last)
+{
+	char *sep = strpbrk(arg, "/-");
+	char c = sep ? *sep : 0;
+	struct in_addr in;
+
+	if (sep)
+		*sep = 0;
+
+	bool valid = inet_pton(AF_INET, arg, &in) == 1;
+	*first = *last = ntohl(in.s_addr);
+
+	if (sep)
+		*sep = c;
+
+	if (!valid)
+		return false;
+
+	if (c == '/')
+	{
+		char *end;
+		unsigned long prefixlen = strtoul(sep + 1, &end, 10);
+
+		if (end == sep + 1 || *end != 0 || prefixlen > 32)
+			return false;
+
+		uint32_t mask = prefixlen ? UINT32_MAX << (32 - prefixlen) : 0;
+		*first &= mask;
+		*last = *first | ~mask;
+	}
+	else if (c == '-')
+	{
+		if (inet_pton(AF_INET, sep + 1, &in) != 1)
+			return false;
+		*last = ntohl(in.s_addr);
+	}
+
+	return *first <= *last;
+}
+
 static int main_lease_show(int argc, char **argv)
 {
-	(void)argc, (void)argv;
+	struct {
+		char **ids;
+		size_t ids_cnt;
+		char *hwaddr;
+		bool clientid_set;
+		struct dhcp_key clientid;
+		char *address;
+		bool range;
+		uint32_t first;
+		uint32_t last;
+		int allocated;
+		bool expiring_set;
+		int64_t now;
+		int64_t expiring;
+		int64_t after;
+		unsigned long limit;
+		enum leaseio_format format;
+	} dhcpctl_lease_show = {
+		.ids = NULL,
+		.ids_cnt = 0,
+		.hwaddr = NULL,
+		.clientid_set = false,
+		.address = NULL,
+		.range = false,
+		.first = 0,
+		.last = 0,
+		.allocated = -1,
+		.expiring_set = false,
+		.now = 0,
+		.expiring = 0,
+		.after = 0,
+		.limit = 0,
+		.format = LEASEIO_CSV
+	};
+
+	char hwaddr[MAC_ADDRSTRLEN];
+
+	{
+		int state = 0;
+		for (int i = 1; i < argc; ++i)
+		{
+			char *arg = argv[i];
+			switch (state)
+			{
+				case 0:
+					if (!strcmp(arg, "hwaddr"))
+						state = 1;
+					else if (!strcmp(arg, "address"))
+						state = 2;
+					else if (!strcmp(arg, "expiring"))
+						state = 3;
+					else if (!strcmp(arg, "after"))
+						state = 4;
+					else if (!strcmp(arg, "limit"))
+						state = 5;
+					else if (!strcmp(arg, "format"))
+						state = 6;
+					else if (!strcmp(arg, "clientid"))
+						state = 7;
+					else if (!strcmp(arg, "allocated"))
+						dhcpctl_lease_show.allocated = 1;
+					else if (!strcmp(arg, "unallocated"))
+						dhcpctl_lease_show.allocated = 0;
+					else
+					{
+						/* Anything else must be a lease id */
+						if (strspn(arg, "0123456789") != strlen(arg))
+							dhcpd_error(1, 0, "Unknown argument %s", arg);
+						lease_number(arg, 1, "lease id");
+
+						dhcpctl_lease_show.ids = realloc(dhcpctl_lease_show.ids,
+							++dhcpctl_lease_show.ids_cnt * sizeof(char*));
+						dhcpctl_lease_show.ids[dhcpctl_lease_show.ids_cnt-1] = arg;
+					}
+					break;
+				case 1:
+				{
+					uint8_t bin[6];
+					if (!mac_pton(arg, bin))
+						dhcpd_error(1, 0, "Invalid hardware address %s", arg);
+					mac_ntop((const char *)bin, hwaddr, sizeof hwaddr);
+					dhcpctl_lease_show.hwaddr = hwaddr;
+					state = 0;
+					break;
+				}
+				case 2:
+					if (!lease_show_range(arg, &dhcpctl_lease_show.first,
+							&dhcpctl_lease_show.last))
+						dhcpd_error(1, 0, "Invalid address filter %s", arg);
+					/* A single address can be looked up in the address index */
+					if (strpbrk(arg, "/-"))
+						dhcpctl_lease_show.range = true;
+					else
+						dhcpctl_lease_show.address = arg;
+					state = 0;
+					break;
+				case 3:
+				{
+					int64_t now = time(NULL);
+					int64_t seconds = lease_number(arg, 0, "expiry");
+
+					if (seconds > INT64_MAX - now)
+						dhcpd_error(1, 0, "Invalid expiry %s", arg);
+
+					dhcpctl_lease_show.expiring_set = true;
+					dhcpctl_lease_show.now = now;
+					dhcpctl_lease_show.expiring = now + seconds;
+					state = 0;
+					break;
+				}
+				case 4:
+					dhcpctl_lease_show.after = lease_number(arg, 0, "lease id");
+					state = 0;
+					break;
+				case 5:
+					dhcpctl_lease_show.limit = lease_number(arg, 0, "limit");
+					state = 0;
+					break;
+				case 6:
+					if (!lease_format_parse(arg, &dhcpctl_lease_show.format))
+						dhcpd_error(1, 0, "Unknown format %s", arg);
+					state = 0;
+					break;
+				case 7:
+					if (!dhcp_key_pton(arg, &dhcpctl_lease_show.clientid))
+						dhcpd_error(1, 0, "Invalid client identifier %s", arg);
+					dhcpctl_lease_show.clientid_set = true;
+					state = 0;
+					break;
+			}
+		}
+
+		if (state != 0)
+			dhcpd_error(1, 0, "Missing value for %s", argv[argc - 1]);
+	}
+
+	if (sqlite3_create_function(db, "ip4", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+			NULL, lease_show_ip4, NULL, NULL) != SQLITE_OK)
+		dhcpd_error(1, 0, "sqlite3: %s", sqlite3_errmsg(db));
+
+	/* Every statement covers the ids in (?1, ?2], filters are appended with
+	 * fixed parameter numbers */
+	char sql[512] = "SELECT " DB_COLUMNS " FROM leases WHERE id > ?1 AND id <= ?2";
+
+	if (dhcpctl_lease_show.hwaddr)
+		strcat(sql, " AND hwaddr = ?3");
+	if (dhcpctl_lease_show.clientid_set)
+		strcat(sql, " AND clientid = ?10");
+	if (dhcpctl_lease_show.address)
+		strcat(sql, " AND address = ?4");
+	if (dhcpctl_lease_show.range)
+		strcat(sql, " AND ip4(address) BETWEEN ?5 AND ?6");
+	if (dhcpctl_lease_show.allocated >= 0)
+		strcat(sql, " AND allocated = ?7");
+	/* allocated_at <= expiry holds for every match, which lets the
+	 * allocated_at index narrow the scan, leases, which expired already,
+	 * are left out */
+	if (dhcpctl_lease_show.expiring_set)
+		strcat(sql, " AND allocated = 1 AND allocated_at <= ?8"
+			" AND allocated_at + leasetime <= ?8"
+			" AND allocated_at + leasetime > ?11");
+	strcat(sql, " ORDER BY id LIMIT ?9");
+
+	sqlite3_stmt *stmt;
+	int sqlerr;
+
+	if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+		dhcpd_error(1, 0, "sqlite3: %s", sqlite3_errmsg(db));
+
+	if (dhcpctl_lease_show.hwaddr)
+		sqlite3_bind_text(stmt, 3, dhcpctl_lease_show.hwaddr, -1, SQLITE_STATIC);
+	if (dhcpctl_lease_show.clientid_set)
+		sqlite3_bind_blob(stmt, 10, dhcpctl_lease_show.clientid.data,
+			dhcpctl_lease_show.clientid.len, SQLITE_STATIC);
+	if (dhcpctl_lease_show.address)
+		sqlite3_bind_text(stmt, 4, dhcpctl_lease_show.address, -1, SQLITE_STATIC);
+	if (dhcpctl_lease_show.range)
+	{
+		sqlite3_bind_int64(stmt, 5, dhcpctl_lease_show.first);
+		sqlite3_bind_int64(stmt, 6, dhcpctl_lease_show.last);
+	}
+	if (dhcpctl_lease_show.allocated >= 0)
+		sqlite3_bind_int(stmt, 7, dhcpctl_lease_show.allocated);
+	if (dhcpctl_lease_show.expiring_set)
+	{
+		sqlite3_bind_int64(stmt, 8, dhcpctl_lease_show.expiring);
+		sqlite3_bind_int64(stmt, 11, dhcpctl_lease_show.now);
+	}
+
+	int64_t max_id = 0;
+	{
+		sqlite3_stmt *max;
+
+		if (sqlite3_prepare_v2(db, "SELECT max(id) FROM leases", -1, &max, NULL) != SQLITE_OK)
+			dhcpd_error(1, 0, "sqlite3: %s", sqlite3_errmsg(db));
+		if (sqlite3_step(max) == SQLITE_ROW)
+			max_id = sqlite3_column_int64(max, 0);
+		sqlite3_finalize(max);
+	}
+
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+	leaseio_write_header(stdout, dhcpctl_lease_show.format);
+
+	unsigned long shown = 0;
+	bool done = false;
+
+	/* Explicit ids are looked up one by one, everything else is a scan over
+	 * windows of ids */
+	for (size_t i = 0; i < dhcpctl_lease_show.ids_cnt || !dhcpctl_lease_show.ids_cnt; ++i)
+	{
+		int64_t cursor, end;
+
+		if (dhcpctl_lease_show.ids_cnt)
+		{
+			end = strtoll(dhcpctl_lease_show.ids[i], NULL, 10);
+			cursor = end - 1;
+		}
+		else
+		{
+			cursor = dhcpctl_lease_show.after;
+			end = max_id;
+		}
+
+		while (cursor < end && !done)
+		{
+			int64_t window = end - cursor < LEASE_SHOW_SCAN ?
+				end : cursor + LEASE_SHOW_SCAN;
+			unsigned long page = LEASE_SHOW_PAGE;
+			unsigned long rows = 0;
+
+			if (dhcpctl_lease_show.limit && dhcpctl_lease_show.limit - shown < page)
+				page = dhcpctl_lease_show.limit - shown;
+
+			sqlite3_bind_int64(stmt, 1, cursor);
+			sqlite3_bind_int64(stmt, 2, window);
+			sqlite3_bind_int64(stmt, 9, page);
+
+			while ((sqlerr = sqlite3_step(stmt)) == SQLITE_ROW)
+			{
+				leaseio_write_row(stdout, dhcpctl_lease_show.format, stmt);
+				cursor = sqlite3_column_int64(stmt, 0);
+				++rows;
+			}
+
+			if (sqlerr != SQLITE_DONE)
+				dhcpd_error(1, 0, "sqlite3: %s", sqlite3_errmsg(db));
+			sqlite3_reset(stmt);
+
+			/* A short page means that the window is exhausted */
+			if (rows < page)
+				cursor = window;
+
+			shown += rows;
+			if (dhcpctl_lease_show.limit && shown >= dhcpctl_lease_show.limit)
+				done = true;
+		}
+
+		if (done || !dhcpctl_lease_show.ids_cnt)
+			break;
+	}
+
+	sqlite3_finalize(stmt);
+	free(dhcpctl_lease_show.ids);
+
+	if (fflush(stdout) == EOF)
+		dhcpd_error(1, errno, "Writing output failed");
+
 	return 0;
 }
 
@@ -285,6 +956,360 @@ static int main_lease_remove(int argc, char **argv)
 	return 0;
 }
 
+/* Rows inserted by one statement, per-row overhead of SQLite dominates
+ * otherwise */
+#define LEASE_IMPORT_GROUP 64
+
+struct lease_import_row
+{
+	char *line;
+	size_t line_cap;
+	unsigned long lineno;
+	struct leaseio_lease lease;
+};
+
+struct lease_import
+{
+	/* Insert statements for one row and for LEASE_IMPORT_GROUP rows */
+	sqlite3_stmt *single;
+	sqlite3_stmt *group;
+
+	/* Validated rows, which weren't inserted yet */
+	struct lease_import_row rows[LEASE_IMPORT_GROUP];
+	size_t cnt;
+
+	unsigned long imported;
+	unsigned long conflicts;
+};
+
+static void lease_import_bind(sqlite3_stmt *stmt, int col,
+	const struct leaseio_lease *lease)
+{
+	if (lease->id)
+		sqlite3_bind_int64(stmt, col + 1, lease->id);
+	else
+		sqlite3_bind_null(stmt, col + 1);
+	sqlite3_bind_text(stmt, col + 2, lease->address, -1, SQLITE_STATIC);
+	sqlite3_bind_int(stmt, col + 3, lease->prefixlen);
+	sqlite3_bind_text(stmt, col + 4, lease->hwaddr, -1, SQLITE_STATIC);
+	if (lease->routers)
+		sqlite3_bind_text(stmt, col + 5, lease->routers, -1, SQLITE_STATIC);
+	else
+		sqlite3_bind_null(stmt, col + 5);
+	if (lease->nameservers)
+		sqlite3_bind_text(stmt, col + 6, lease->nameservers, -1, SQLITE_STATIC);
+	else
+		sqlite3_bind_null(stmt, col + 6);
+	sqlite3_bind_int64(stmt, col + 7, lease->leasetime);
+	sqlite3_bind_int(stmt, col + 8, lease->allocated);
+	sqlite3_bind_int64(stmt, col + 9, lease->allocated_at);
+	sqlite3_bind_blob(stmt, col + 10, lease->clientid.data, lease->clientid.len,
+		SQLITE_STATIC);
+}
+
+/**
+ * Insert pending rows, a full group at once and row by row otherwise
+ *
+ * A conflict aborts the whole group statement, in that case the group is
+ * inserted again row by row to find and skip the conflicting rows.
+ */
+static void lease_import_flush(struct lease_import *import)
+{
+	int sqlerr;
+
+	if (import->cnt == LEASE_IMPORT_GROUP)
+	{
+		for (size_t i = 0; i < import->cnt; ++i)
+			lease_import_bind(import->group, i * LEASEIO_COLS, &import->rows[i].lease);
+
+		sqlerr = sqlite3_step(import->group);
+		sqlite3_reset(import->group);
+
+		if (sqlerr == SQLITE_DONE)
+		{
+			import->imported += import->cnt;
+			import->cnt = 0;
+			return;
+		}
+		else if (sqlerr != SQLITE_CONSTRAINT)
+			dhcpd_error(1, 0, "line %lu: sqlite3: %s",
+				import->rows[0].lineno, sqlite3_errmsg(db));
+	}
+
+	for (size_t i = 0; i < import->cnt; ++i)
+	{
+		lease_import_bind(import->single, 0, &import->rows[i].lease);
+
+		sqlerr = sqlite3_step(import->single);
+		sqlite3_reset(import->single);
+
+		if (sqlerr == SQLITE_CONSTRAINT)
+		{
+			fprintf(stderr, "line %lu: Conflict: %s\n",
+				import->rows[i].lineno, sqlite3_errmsg(db));
+			++import->conflicts;
+		}
+		else if (sqlerr != SQLITE_DONE)
+			dhcpd_error(1, 0, "line %lu: sqlite3: %s",
+				import->rows[i].lineno, sqlite3_errmsg(db));
+		else
+			++import->imported;
+	}
+
+	import->cnt = 0;
+}
+
+static int main_lease_import(int argc, char **argv)
+{
+	struct {
+		char *file;
+		bool format_set;
+		enum leaseio_format format;
+		bool dryrun;
+		bool replace;
+		unsigned long batch;
+	} dhcpctl_lease_import = {
+		.file = NULL,
+		.format_set = false,
+		.format = LEASEIO_CSV,
+		.dryrun = false,
+		.replace = false,
+		.batch = 100000
+	};
+
+	{
+		int state = 0;
+		for (int i = 1; i < argc; ++i)
+		{
+			char *arg = argv[i];
+			switch (state)
+			{
+				case 0:
+					if (!strcmp(arg, "format"))
+						state = 1;
+					else if (!strcmp(arg, "batch"))
+						state = 2;
+					else if (!strcmp(arg, "dryrun"))
+						dhcpctl_lease_import.dryrun = true;
+					else if (!strcmp(arg, "replace"))
+						dhcpctl_lease_import.replace = true;
+					else
+						dhcpctl_lease_import.file = arg;
+					break;
+				case 1:
+					if (!lease_format_parse(arg, &dhcpctl_lease_import.format))
+						dhcpd_error(1, 0, "Unknown format %s", arg);
+					dhcpctl_lease_import.format_set = true;
+					state = 0;
+					break;
+				case 2:
+					dhcpctl_lease_import.batch = lease_number(arg, 1, "batch size");
+					state = 0;
+					break;
+			}
+		}
+
+		if (state != 0)
+			dhcpd_error(1, 0, "Missing value for %s", argv[argc - 1]);
+	}
+
+	if (!dhcpctl_lease_import.format_set)
+		dhcpctl_lease_import.format = lease_format(dhcpctl_lease_import.file);
+
+	FILE *in = stdin;
+	if (dhcpctl_lease_import.file && strcmp(dhcpctl_lease_import.file, "-"))
+	{
+		in = fopen(dhcpctl_lease_import.file, "r");
+		if (!in)
+			dhcpd_error(1, errno, "Opening %s failed", dhcpctl_lease_import.file);
+	}
+	setvbuf(in, NULL, _IOFBF, 1 << 20);
+
+	/* The database is only durable at the end of each batch anyway, so there
+	 * is no use in syncing the journal more often */
+	lease_exec("PRAGMA cache_size = -65536");
+	lease_exec("PRAGMA synchronous = NORMAL");
+
+	struct lease_import import = {
+		.single = NULL,
+		.group = NULL,
+		.cnt = 0,
+		.imported = 0,
+		.conflicts = 0
+	};
+
+	{
+		const char *verb = dhcpctl_lease_import.replace ?
+			"INSERT OR REPLACE" : "INSERT";
+		static const char values[] = "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?)";
+		size_t sql_len = strlen(verb) + sizeof " INTO leases (" DB_COLUMNS ") VALUES " +
+			LEASE_IMPORT_GROUP * (sizeof values + 1);
+		char sql[sql_len];
+
+		int len = sprintf(sql, "%s INTO leases (" DB_COLUMNS ") VALUES %s", verb, values);
+		if (sqlite3_prepare_v2(db, sql, -1, &import.single, NULL) != SQLITE_OK)
+			dhcpd_error(1, 0, "sqlite3: %s", sqlite3_errmsg(db));
+
+		for (size_t i = 1; i < LEASE_IMPORT_GROUP; ++i)
+			len += sprintf(sql + len, ",%s", values);
+		if (sqlite3_prepare_v2(db, sql, -1, &import.group, NULL) != SQLITE_OK)
+			dhcpd_error(1, 0, "sqlite3: %s", sqlite3_errmsg(db));
+	}
+
+	for (size_t i = 0; i < LEASE_IMPORT_GROUP; ++i)
+		import.rows[i] = (struct lease_import_row){ .line = NULL, .line_cap = 0 };
+
+	unsigned long lineno = 0, invalid = 0, pending = 0;
+
+	int map[LEASEIO_CSV_COLS_MAX];
+	size_t map_cnt = 0;
+	bool header = dhcpctl_lease_import.format == LEASEIO_CSV;
+
+	lease_exec("BEGIN");
+
+	for (;;)
+	{
+		struct lease_import_row *r = &import.rows[import.cnt];
+		struct leaseio_row row;
+		const char *err;
+		ssize_t len;
+
+		if ((len = getline(&r->line, &r->line_cap, in)) == -1)
+			break;
+
+		r->lineno = ++lineno;
+
+		/* Skip blank lines */
+		if (strspn(r->line, " \t\r\n") == (size_t)len)
+			continue;
+
+		if (header)
+		{
+			if (!leaseio_csv_header(r->line, map, &map_cnt, &err))
+				dhcpd_error(1, 0, "line %lu: %s", lineno, err);
+			header = false;
+			continue;
+		}
+
+		if (!(dhcpctl_lease_import.format == LEASEIO_CSV ?
+				leaseio_csv_row(r->line, map, map_cnt, &row, &err) :
+				leaseio_jsonl_row(r->line, &row, &err)) ||
+				!leaseio_validate(&row, &r->lease, &err))
+		{
+			fprintf(stderr, "line %lu: %s\n", lineno, err);
+			++invalid;
+			continue;
+		}
+
+		if (++import.cnt < LEASE_IMPORT_GROUP)
+			continue;
+
+		lease_import_flush(&import);
+		pending += LEASE_IMPORT_GROUP;
+
+		/* A dry run keeps everything in one transaction, so that conflicts
+		 * between rows of the input are found as well */
+		if (!dhcpctl_lease_import.dryrun && pending >= dhcpctl_lease_import.batch)
+		{
+			lease_exec("COMMIT");
+			lease_exec("BEGIN");
+			pending = 0;
+		}
+	}
+
+	if (ferror(in))
+		dhcpd_error(1, errno, "Reading input failed");
+
+	lease_import_flush(&import);
+
+	lease_exec(dhcpctl_lease_import.dryrun ? "ROLLBACK" : "COMMIT");
+
+	for (size_t i = 0; i < LEASE_IMPORT_GROUP; ++i)
+		free(import.rows[i].line);
+	sqlite3_finalize(import.single);
+	sqlite3_finalize(import.group);
+	if (in != stdin)
+		fclose(in);
+
+	fprintf(stderr, "%s %lu, invalid %lu, conflicts %lu\n",
+		dhcpctl_lease_import.dryrun ? "valid" : "imported",
+		import.imported, invalid, import.conflicts);
+
+	return invalid || import.conflicts ? 1 : 0;
+}
+
+static int main_lease_export(int argc, char **argv)
+{
+	struct {
+		char *file;
+		bool format_set;
+		enum leaseio_format format;
+	} dhcpctl_lease_export = {
+		.file = NULL,
+		.format_set = false,
+		.format = LEASEIO_CSV
+	};
+
+	{
+		int state = 0;
+		for (int i = 1; i < argc; ++i)
+		{
+			char *arg = argv[i];
+			switch (state)
+			{
+				case 0:
+					if (!strcmp(arg, "format"))
+						state = 1;
+					else
+						dhcpctl_lease_export.file = arg;
+					break;
+				case 1:
+					if (!lease_format_parse(arg, &dhcpctl_lease_export.format))
+						dhcpd_error(1, 0, "Unknown format %s", arg);
+					dhcpctl_lease_export.format_set = true;
+					state = 0;
+					break;
+			}
+		}
+	}
+
+	if (!dhcpctl_lease_export.format_set)
+		dhcpctl_lease_export.format = lease_format(dhcpctl_lease_export.file);
+
+	FILE *out = stdout;
+	if (dhcpctl_lease_export.file && strcmp(dhcpctl_lease_export.file, "-"))
+	{
+		out = fopen(dhcpctl_lease_export.file, "w");
+		if (!out)
+			dhcpd_error(1, errno, "Opening %s failed", dhcpctl_lease_export.file);
+	}
+	setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+	sqlite3_stmt *stmt;
+	int sqlerr;
+
+	if (sqlite3_prepare_v2(db, "SELECT " DB_COLUMNS " FROM leases ORDER BY id",
+			-1, &stmt, NULL) != SQLITE_OK)
+		dhcpd_error(1, 0, "sqlite3: %s", sqlite3_errmsg(db));
+
+	leaseio_write_header(out, dhcpctl_lease_export.format);
+
+	while ((sqlerr = sqlite3_step(stmt)) == SQLITE_ROW)
+		leaseio_write_row(out, dhcpctl_lease_export.format, stmt);
+
+	if (sqlerr != SQLITE_DONE)
+		dhcpd_error(1, 0, "sqlite3: %s", sqlite3_errmsg(db));
+
+	sqlite3_finalize(stmt);
+
+	if (fflush(out) == EOF || ferror(out))
+		dhcpd_error(1, errno, "Writing output failed");
+	if (out != stdout)
+		fclose(out);
+
+	return 0;
+}
+
 static int main_start(int argc, char **argv)
 {
 	struct {
@@ -384,19 +1409,182 @@ loop_end:
 
 static int main_stop(int argc, char **argv)
 {
-	(void)argc, (void)argv;
+	control_args(argc, argv);
+
+	int fd = control_open();
+	struct control_hdr hdr;
+	uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+
+	control_call(fd, CONTROL_SHUTDOWN, NULL, 0, &hdr, resp);
+	if (hdr.status != 0)
+		dhcpd_error(1, hdr.status, "Could not stop daemon");
+
+	/* The daemon closes the connection when it exits */
+	while (recv(fd, resp, sizeof resp, 0) > 0)
+		;
+	close(fd);
+
 	return 0;
 }
 
 static int main_restart(int argc, char **argv)
 {
-	(void)argc, (void)argv;
-	return 0;
+	bool graceful = false, have_args = false;
+
+	for (int i = 1; i < argc && !have_args; ++i)
+		if (!strcmp(argv[i], "graceful"))
+			graceful = true;
+		else if (!strcmp(argv[i], "--"))
+			have_args = true;
+
+	if (!graceful)
+	{
+		main_stop(argc, argv);
+		return main_start(argc, argv);
+	}
+
+	/* The new daemon stops the old one, once it took over */
+	control_args(argc, argv);
+
+	char **startargv = malloc(sizeof(char *) * (argc + 4));
+	if (!startargv)
+		dhcpd_error(1, errno, "Could not allocate arguments");
+
+	int startargc = argc;
+	memcpy(startargv, argv, sizeof(char *) * argc);
+	if (!have_args)
+		startargv[startargc++] = "--";
+	startargv[startargc++] = "-takeover";
+	startargv[startargc++] = control_path;
+	startargv[startargc] = NULL;
+
+	return main_start(startargc, startargv);
 }
 
 static int main_flush(int argc, char **argv)
 {
-	(void)argc, (void)argv;
+	control_args(argc, argv);
+
+	int fd = control_open();
+	struct control_hdr hdr;
+	uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+	uint32_t cnt;
+
+	control_call(fd, CONTROL_FLUSH, NULL, 0, &hdr, resp);
+	if (hdr.status != 0 || hdr.len != sizeof cnt)
+		dhcpd_error(1, hdr.status, "Could not flush leases");
+
+	memcpy(&cnt, resp, sizeof cnt);
+	printf("%u\n", ntohl(cnt));
+
+	control_call(fd, CONTROL_COMMIT, NULL, 0, &hdr, resp);
+	if (hdr.status != 0)
+		dhcpd_error(1, hdr.status, "Could not commit");
+	close(fd);
+
+	return 0;
+}
+
+static int main_commit(int argc, char **argv)
+{
+	control_args(argc, argv);
+
+	int fd = control_open();
+	struct control_hdr hdr;
+	uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+
+	control_call(fd, CONTROL_COMMIT, NULL, 0, &hdr, resp);
+	if (hdr.status != 0)
+		dhcpd_error(1, hdr.status, "Could not commit");
+	close(fd);
+
+	return 0;
+}
+
+static int main_stats(int argc, char **argv)
+{
+	control_args(argc, argv);
+
+	int fd = control_open();
+	struct control_hdr hdr;
+	uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+
+	control_call(fd, CONTROL_STATS, NULL, 0, &hdr, resp);
+	if (hdr.status != 0)
+		dhcpd_error(1, hdr.status, "Could not fetch statistics");
+	fputs((char *)resp, stdout);
+	close(fd);
+
+	return 0;
+}
+
+static int main_loadbalance(int argc, char **argv)
+{
+	const char *spec = NULL;
+
+	for (int i = 1; i < argc; ++i)
+		if (!strcmp(argv[i], "socket"))
+			++i;
+		else if (spec == NULL)
+			spec = argv[i];
+		else
+			return main_help(argc, argv);
+
+	control_args(argc, argv);
+
+	struct dhcp_lb lb;
+	uint8_t payload[CONTROL_LBLEN];
+
+	if (spec != NULL)
+	{
+		if (!dhcp_lb_parse(spec, &lb))
+			dhcpd_error(1, 0, "Invalid load balancing buckets %s", spec);
+		control_lb_pack(payload, &lb);
+	}
+
+	int fd = control_open();
+	struct control_hdr hdr;
+	uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+
+	control_call(fd, CONTROL_LOADBALANCE, payload, spec ? sizeof payload : 0,
+		&hdr, resp);
+	if (hdr.status != 0 || !control_lb_unpack(resp, hdr.len, &lb))
+		dhcpd_error(1, hdr.status, "Could not set load balancing buckets");
+	close(fd);
+
+	char buckets[DHCP_LB_STRLEN];
+	dhcp_lb_format(&lb, buckets);
+	puts(buckets);
+
+	return 0;
+}
+
+static int main_classes(int argc, char **argv)
+{
+	control_args(argc, argv);
+
+	int fd = control_open();
+	struct control_hdr hdr;
+	uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+	uint32_t first = 0;
+
+	/* Every response holds as many rules as fit, the last one is empty */
+	do
+	{
+		uint32_t payload = htonl(first);
+
+		control_call(fd, CONTROL_CLASSES, &payload, sizeof payload, &hdr, resp);
+		if (hdr.status != 0)
+			dhcpd_error(1, hdr.status, "Could not fetch class hits");
+
+		for (uint32_t i = 0; i < hdr.len; ++i)
+			if (resp[i] == '\n')
+				++first;
+		fputs((char *)resp, stdout);
+	}
+	while (hdr.len > 0);
+	close(fd);
+
 	return 0;
 }
 
@@ -404,14 +1592,26 @@ static int main_help(int argc, char **argv)
 {
 	(void)argc, (void)argv;
 	printf(
-		"dhcpctl leases [-db FILE] [-if IF] show [ID]...\n"
+		"dhcpctl leases [-db FILE] [-if IF] show [ID]... [hwaddr HWADDR]\n"
+		"\t[clientid KEY] [address IPADDR|IPADDR/PREFIX|IPADDR-IPADDR]\n"
+		"\t[allocated|unallocated]\n"
+		"\t[expiring SECONDS] [after ID] [limit INT] [format csv|jsonl]\n"
 		"dhcpctl leases [-db FILE] [-if IF] add HWADDR IPADDR [router IPADDR]...\n"
-		"\t[namserver IPADDR]... [leasetime INT] [prefix INT]\n"
+		"\t[namserver IPADDR]... [leasetime INT] [prefix INT] [clientid KEY]\n"
 		"dhcpctl leases [-db FILE] [-if IF] remove ID...\n"
+		"dhcpctl leases [-db FILE] [-if IF] import [format csv|jsonl] [dryrun]\n"
+		"\t[replace] [batch INT] [FILE]\n"
+		"dhcpctl leases [-db FILE] [-if IF] export [format csv|jsonl] [FILE]\n"
 		"dhcpctl start [nodaemon] [binary FILE] [pidfile FILE] [config FILE] [-- [ARG]...]\n"
-		"dhcpctl stop [pidfile FILE]\n"
-		"dhcpctl restart [nodaemon] [binary FILE] [pidfile FILE] [config FILE] [-- [ARG]...]\n"
-		"dhcpctl flush [pidfile FILE]\n"
+		"dhcpctl leases -control FILE add|get|remove ...\n"
+		"dhcpctl stop [socket FILE]\n"
+		"dhcpctl restart [graceful] [socket FILE] [nodaemon] [binary FILE] [pidfile FILE]\n"
+		"\t[config FILE] [-- [ARG]...]\n"
+		"dhcpctl flush [socket FILE]\n"
+		"dhcpctl commit [socket FILE]\n"
+		"dhcpctl stats [socket FILE]\n"
+		"dhcpctl loadbalance [socket FILE] [all|none|BUCKET[-BUCKET][,...]]\n"
+		"dhcpctl classes [socket FILE]\n"
 		"dhcpctl mkdb [interface IF|file FILE]\n"
 		"dhcpctl help\n");
 	return 0;
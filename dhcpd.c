@@ -18,9 +18,11 @@
 #include <arpa/inet.h>
 #include <ifaddrs.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #ifdef __linux__
 #include <cap-ng.h>
+#include <linux/if_packet.h>
 #endif
 
 #include <pwd.h>
@@ -36,10 +38,20 @@
 #include "db.h"
 #include "config.h"
 #include "iplist.h"
-
-#ifndef RECV_BUF_LEN
-#define RECV_BUF_LEN 4096
-#endif
+#include "packet.h"
+#include "ring.h"
+#include "filter.h"
+#include "stats.h"
+#include "ratelimit.h"
+#include "log.h"
+#include "capture.h"
+#include "store.h"
+#include "control.h"
+#include "repl.h"
+#include "ingress.h"
+#include "persist.h"
+#include "uring.h"
+#include "arena.h"
 
 #ifndef SEND_BUF_LEN
 #define SEND_BUF_LEN 4096
@@ -55,7 +67,94 @@ struct sockaddr_in broadcast = {
 	.sin_addr = {INADDR_BROADCAST},
 };
 
-uint8_t recv_buffer[RECV_BUF_LEN];
+struct packet_tx packet_tx = PACKET_TX_EMPTY;
+struct ring_rx ring_rx = RING_RX_EMPTY;
+struct uring uring = URING_EMPTY;
+/* Receive timestamps of replies queued on io_uring, their latency is counted
+ * once they were submitted */
+struct timespec uring_stamps[URING_SENDS];
+size_t uring_stamps_cnt = 0;
+
+struct ratelimit client_rl = RATELIMIT_EMPTY;
+struct ratelimit relay_rl = RATELIMIT_EMPTY;
+
+struct capture capture = CAPTURE_EMPTY;
+
+struct store store = STORE_EMPTY;
+
+/* Memory of the message, which is handled, reset after every message */
+struct arena msg_arena = ARENA_EMPTY;
+
+struct ingress ingress = INGRESS_EMPTY;
+struct ingress_rx ingress_rx = INGRESS_RX_EMPTY;
+/* Handles queued messages, while there is nothing else to do */
+ev_idle ingress_watch;
+
+/* Replication to a standby or from the primary, see repl.h */
+struct repl_node
+{
+	/* Set while following a primary, DHCP messages are ignored then */
+	bool standby;
+
+	struct repl_conn conn;
+	ev_io conn_watch;
+	/* Set until a connection to the primary is established */
+	bool connecting;
+
+	/* Primary: log, which is empty if replication is disabled */
+	struct repl_log log;
+	int listen_fd;
+	ev_io listen_watch;
+	/* Set once the standby said hello */
+	bool streaming;
+	/* Next record to send and first one the standby didn't apply */
+	uint64_t sent_seq;
+	uint64_t acked_seq;
+	/* Since when records up to lag_seq wait for their acknowledgement, 0 if
+	 * there are none */
+	ev_tstamp lag_since;
+	uint64_t lag_seq;
+
+	/* Standby: epoch of the primary, zero until a snapshot is complete */
+	uint64_t epoch;
+	uint64_t snapshot_epoch;
+	uint64_t next_seq;
+	/* When the primary sent something the last time */
+	ev_tstamp last_rx;
+
+	/* Heartbeats and reconnects */
+	ev_timer timer_watch;
+	/* Sends the records of a loop iteration as one batch */
+	ev_prepare prepare_watch;
+} repl_node = {
+	.standby = false,
+	.conn = { .fd = -1, .msg_off = SIZE_MAX },
+	.connecting = false,
+	.log = REPL_LOG_EMPTY,
+	.listen_fd = -1,
+	.streaming = false,
+	.sent_seq = 0,
+	.acked_seq = 0,
+	.lag_since = 0,
+	.lag_seq = 0,
+	.epoch = 0,
+	.snapshot_epoch = 0,
+	.next_seq = 1,
+	.last_rx = 0
+};
+
+/* Reply to the message, which is currently handled, if that is captured */
+struct capture_reply
+{
+	bool active;
+	struct timespec ts;
+	const uint8_t *data;
+	size_t len;
+	enum dhcp_msg_type type;
+	struct sockaddr_in dst;
+	bool unicast;
+} capture_reply;
+
 uint8_t send_buffer[SEND_BUF_LEN];
 
 struct config cfg = CONFIG_EMPTY;
@@ -65,187 +164,436 @@ bool debug = false;
 static const char BROKEN_SOFTWARE_NOTIFICATION[] = 
 "#################################### ALERT ####################################\n"
 "  BROKEN SOFTWARE NOTIFICATION - SOMETHING SENDS INVALID DHCP MESSAGES IN YOUR\n"
-"                                    NETWORK\n";
+"                                    NETWORK";
 static const char USAGE[] =
 "%s [-h[elp]] [-v[ersion]] [-d[ebug]] [-user UID] [-group GID]\n"
-"\t[-interface IF] [-db FILE]\n"
-"\t[-new] [-allocate] [-iprange IP IP] [-router IP]... [-nameserver IP]...\n";
+"\t[-interface IF] [-db FILE] [-cache FILE] [-broadcast] [-rxring]\n"
+"\t[-new] [-allocate] [-iprange IP IP]... [-exclude IP IP]...\n"
+"\t[-router IP]... [-nameserver IP]...\n"
+"\t[-stats INT] [-ratelimit RATE BURST] [-relayratelimit RATE BURST]\n"
+"\t[-capture FILE] [-capturesample INT] [-control FILE] [-takeover FILE]\n"
+"\t[-replicate IP PORT] [-standby IP PORT] [-repllag INT]\n"
+"\t[-loadbalance BUCKETS] [-class FILE] [-leasejitter PERCENT]\n"
+"\t[-rcvbuf BYTES] [-engine libev|io_uring] [-maxage MSEC]\n";
+
+/**
+ * Remember reply for the capture, if the handled message is captured
+ */
+static void capture_note_reply(const uint8_t *reply, size_t len,
+	enum dhcp_msg_type type, const struct sockaddr_in *dst, bool unicast)
+{
+	if (!capture_reply.active)
+		return;
 
+	clock_gettime(CLOCK_REALTIME, &capture_reply.ts);
+	capture_reply.data = reply;
+	capture_reply.len = len;
+	capture_reply.type = type;
+	capture_reply.dst = *dst;
+	capture_reply.unicast = unicast;
+}
 
-#define MAC_ADDRSTRLEN 18
 
 /**
- * Convert MAC address from binary representation to text representation
+ * Set router and nameserver lists of a lease to the ones of the profile of
+ * an in-memory lease record, which point into the store
  *
- * @param[in] addr Binary representation
- * @param[out] dst Buffer to write text presentation
- * @param[in] s Size of dst
+ * @param[in] sl Lease record
+ * @param[out] lease Lease to fill
+ * @return false if the lists of the record are invalid
  */
-static int mac_ntop(char *addr, char *dst, size_t s)
+static bool lease_profile(const struct store_lease *sl,
+	struct dhcp_lease *lease)
 {
-	return snprintf(dst, s,
-		"%02hhX:%02hhX:%02hhX:%02hhX:%02hhX:%02hhX", 
-		addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+	const struct store_profile *p = store_profile(&store, sl);
+
+	lease->routers = p->routers_addrs;
+	lease->routers_cnt = p->routers_cnt;
+	lease->routers_opt = p->routers_opt;
+	lease->nameservers = p->nameservers_addrs;
+	lease->nameservers_cnt = p->nameservers_cnt;
+	lease->nameservers_opt = p->nameservers_opt;
+
+	return p->valid;
 }
 
 /**
- * Print debugging information with preamble marking incoming and
- * outgoing packets
+ * Fill lease from an in-memory lease record
  *
- * @param[in] msg Message to dump
- * @param[in] dir Direction of traffic, 0 for incoming and 1 for outgoing
+ * @param[in] sl Lease record
+ * @param[out] lease Lease to fill
+ * @return false if the lists of the record are invalid
  */
-static void msg_debug(struct dhcp_msg *msg, int dir)
+static bool lease_from_store(struct store_lease *sl, struct dhcp_lease *lease)
 {
-	if (dir == 0)
-		fprintf(stderr, "--- INCOMING ---\n");
-	else if (dir == 1)
-		fprintf(stderr, "--- OUTGOING ---\n");
+	lease->address.s_addr = sl->address;
+	lease->leasetime = sl->leasetime;
+	lease->prefixlen = sl->prefixlen;
 
-	dhcp_msg_dump(stderr, msg);
+	return lease_profile(sl, lease);
 }
 
 /**
- * Handle DHCPDISCOVER request and reply to that
+ * Convert lease record to the encoding of the control socket, the lists
+ * point into the store
  */
-static void discover_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+static void lease_to_control(const struct store_lease *sl,
+	struct control_lease *cl)
 {
-	(void)EV_A;
+	*cl = (struct control_lease){
+		.id = sl->id,
+		.address = sl->address,
+		.prefixlen = sl->prefixlen,
+		.allocated = sl->allocated,
+		.leasetime = sl->leasetime,
+		.allocated_at = sl->allocated_at,
+		.routers = store_routers(&store, sl),
+		.nameservers = store_nameservers(&store, sl),
+		.key = sl->key
+	};
+	ARRAY_COPY(cl->hwaddr, sl->hwaddr, 6);
+}
 
-	int sqlerr;
-	struct db_lease db_lease = DB_LEASE_EMPTY;
+/**
+ * Append lease, which was stored, to the replication log
+ */
+static void repl_lease_put(const struct store_lease *sl)
+{
+	struct control_lease cl;
 
-	struct dhcp_lease lease = DHCP_LEASE_EMPTY;
-	bool unalloc_lease = false;
+	if (repl_node.log.buf == NULL)
+		return;
 
-	sqlerr = db_lease_by_hwaddr(leasedb, &db_lease, msg->chaddr);
+	lease_to_control(sl, &cl);
 
-	if (sqlerr != SQLITE_OK)
+	if (!repl_log_put(&repl_node.log, &cl))
+		dhcpd_error(0, errno, "Could not log lease %u for replication", sl->id);
+	else
+		++stats.repl_records;
+}
+
+/**
+ * Append lease, which is about to be removed, to the replication log
+ */
+static void repl_lease_del(const struct store_lease *sl)
+{
+	if (repl_node.log.buf == NULL)
+		return;
+
+	if (!repl_log_del(&repl_node.log, sl->id, &sl->key))
+		dhcpd_error(0, errno, "Could not log lease %u for replication", sl->id);
+	else
+		++stats.repl_records;
+}
+
+/**
+ * Find lease of a client by its key. Leases, which were added by hardware
+ * address, are found for clients with a client identifier as well.
+ *
+ * @param[in] data Buffer which holds the DHCP message of the client
+ * @param[in] key Key of the client
+ * @param[in] key_hash Hash of key
+ * @param[in] clientid Set if key is the client identifier
+ */
+static struct store_lease *lease_find(uint8_t *data,
+	const struct dhcp_key *key, uint32_t key_hash, bool clientid)
+{
+	struct store_lease *sl = store_by_key(&store, key, key_hash);
+
+	if (sl == NULL && clientid)
 	{
-		dhcpd_error(0, 0, "sqlite3: %s", sqlite3_errstr(sqlerr));
-		goto finalize;
+		struct dhcp_key hwkey;
+		dhcp_key_from_chaddr(data, &hwkey);
+		sl = store_by_key(&store, &hwkey, dhcp_key_hash(&hwkey));
 	}
 
-	if (!db_lease.id)
+	return sl;
+}
+
+/**
+ * Find lease of the client, which sent msg
+ */
+static struct store_lease *lease_lookup(struct dhcp_msg *msg)
+{
+	return lease_find(msg->data, &msg->key, msg->key_hash, msg->clientid);
+}
+
+/**
+ * Fill settings of a new lease from the class of the client, settings the
+ * class doesn't override are taken from the command line
+ */
+static void lease_defaults(struct dhcp_msg *msg, struct dhcp_lease *lease)
+{
+	const struct class_rule *c = msg->cls;
+
+	*lease = (struct dhcp_lease){
+		.routers = cfg.routers,
+		.routers_cnt = cfg.routers_cnt,
+		.nameservers = cfg.nameservers,
+		.nameservers_cnt = cfg.nameservers_cnt,
+		.leasetime = cfg.leasetime,
+		.prefixlen = cfg.prefixlen
+	};
+
+	if (c == NULL)
+		return;
+
+	if (c->routers_cnt > 0)
 	{
-		if (!cfg.argv->allocate)
-			goto finalize;
-		lease = (struct dhcp_lease){
-			.routers = cfg.routers,
-			.routers_cnt = cfg.routers_cnt,
-			.nameservers = cfg.nameservers,
-			.nameservers_cnt = cfg.nameservers_cnt,
-			.leasetime = cfg.leasetime,
-			.prefixlen = cfg.prefixlen
-		};
+		lease->routers = c->routers;
+		lease->routers_cnt = c->routers_cnt;
+	}
+	if (c->nameservers_cnt > 0)
+	{
+		lease->nameservers = c->nameservers;
+		lease->nameservers_cnt = c->nameservers_cnt;
+	}
+	if (c->leasetime > 0)
+		lease->leasetime = c->leasetime;
+	if (c->prefixlen > 0)
+		lease->prefixlen = c->prefixlen;
+}
 
-		/* TODO optimize this */
-		uint32_t ip;
+/**
+ * Allocation scope of the client, which sent msg
+ */
+static const struct range_set *lease_ranges(struct dhcp_msg *msg)
+{
+	const struct class_rule *c = msg->cls;
 
-		sqlite3_stmt *stmt;
-		sqlite3_prepare_v2(leasedb,
-			"SELECT COUNT(*)\n"
-			"FROM leases\n"
-			"WHERE address = ?;", -1, &stmt, NULL);
+	if (c != NULL && c->ranges.ranges_cnt > 0)
+		return &c->ranges;
 
-		IPRANGE_FOREACH(cfg.iprange[0], cfg.iprange[1], ip)
-		{
-			lease.address.s_addr = htonl(ip);
-			char ip_str[INET_ADDRSTRLEN];
+	return &cfg.ranges;
+}
 
-			inet_ntop(AF_INET, &lease.address, ip_str, INET_ADDRSTRLEN);
-			sqlite3_bind_text(stmt, 1, ip_str, -1, NULL);
+/**
+ * Check whether an address may be allocated to the client, which sent msg
+ */
+static bool lease_in_range(struct dhcp_msg *msg, struct in_addr address)
+{
+	return range_set_has(lease_ranges(msg), address);
+}
 
-			if (sqlite3_step(stmt) == SQLITE_ERROR)
-			{
-				dhcpd_error(0, 0, "sqlite3: %s", sqlite3_errmsg(leasedb));
-				sqlite3_finalize(stmt);
-				goto finalize;
-			}
+/**
+ * Log lease record, which couldn't be used
+ */
+static void lease_invalid(struct dhcp_msg *msg, struct store_lease *sl)
+{
+	char address[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &sl->address, address, sizeof address);
+
+	log_printf("Invalid lease entry for %s:\n"
+			"\tAddress: %s\n"
+			"\tRouters: %s\n"
+			"\tNameservers: %s\n"
+			"\tPrefix Length: %hhu\n"
+			"\tLease Time: %u",
+			msg->chaddr,
+			address,
+			store_routers(&store, sl),
+			store_nameservers(&store, sl),
+			sl->prefixlen,
+			sl->leasetime);
+}
 
-			if (sqlite3_column_int(stmt, 0) == 0)
-			{
-				sqlite3_finalize(stmt);
-				goto offer;
-			}
+/**
+ * Count time from the kernel receiving a message until now in the latency
+ * histogram
+ */
+static void stamp_latency(const struct timespec *stamp,
+	const struct timespec *now)
+{
+	int64_t usec = (int64_t)(now->tv_sec - stamp->tv_sec) * 1000000 +
+		(now->tv_nsec - stamp->tv_nsec) / 1000;
+
+	/* The clock may have been stepped back in between */
+	stats_latency(usec > 0 ? usec : 0);
+}
+
+/**
+ * Count time since the kernel received msg in the latency histogram
+ */
+static void reply_latency(const struct dhcp_msg *msg)
+{
+	struct timespec now;
+
+	if (msg->stamp.tv_sec == 0)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	stamp_latency(&msg->stamp, &now);
+}
+
+/**
+ * Count latency of a reply queued on io_uring once reply_submit() submitted
+ * it
+ */
+static void uring_reply_latency(const struct dhcp_msg *msg)
+{
+	if (msg->stamp.tv_sec == 0)
+		return;
+
+	if (uring_stamps_cnt == URING_SENDS)
+		reply_latency(msg);
+	else
+		uring_stamps[uring_stamps_cnt++] = msg->stamp;
+}
+
+/**
+ * Submit replies queued on io_uring and count their latency
+ */
+static void reply_submit(void)
+{
+	struct timespec now;
+
+	uring_submit(&uring);
+
+	if (uring_stamps_cnt == 0)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	for (size_t i = 0; i < uring_stamps_cnt; ++i)
+		stamp_latency(&uring_stamps[i], &now);
+	uring_stamps_cnt = 0;
+}
+
+/**
+ * Send reply to the client or relay agent, which sent msg, as described in
+ * RFC 2131, section 4.1
+ *
+ * Clients without an IP address, which don't request broadcast replies, get
+ * their reply unicast to chaddr through the AF_PACKET socket, if the reply
+ * assigns an address. Broadcast is the fallback, if that isn't possible.
+ *
+ * @param[in] fd UDP socket
+ * @param[in] msg Message, which is answered
+ * @param[in] reply Buffer which holds the reply
+ * @param[in] len Length of the reply
+ * @param[in] type Type of the reply
+ */
+static ssize_t reply_send(int fd, struct dhcp_msg *msg, uint8_t *reply,
+	size_t len, enum dhcp_msg_type type)
+{
+	struct sockaddr_in dst = broadcast;
+
+	uint32_t giaddr = *DHCP_MSG_F_GIADDR(msg->data);
+	uint32_t ciaddr = *DHCP_MSG_F_CIADDR(msg->data);
+	uint16_t flags = ntohs(*DHCP_MSG_F_FLAGS(msg->data));
+
+	if (giaddr != INADDR_ANY)
+	{
+		dst.sin_addr.s_addr = giaddr;
+		dst.sin_port = htons(67);
+	}
+	else if (type == DHCPNAK)
+		;
+	else if (ciaddr != INADDR_ANY)
+		dst.sin_addr.s_addr = ciaddr;
+	else if (!(flags & DHCP_MSG_FLAG_BROADCAST) && packet_tx.fd >= 0 &&
+			*DHCP_MSG_F_HTYPE(msg->data) == 1 && *DHCP_MSG_F_HLEN(msg->data) == 6 &&
+			*DHCP_MSG_F_YIADDR(reply) != INADDR_ANY)
+	{
+		struct in_addr yiaddr = { *DHCP_MSG_F_YIADDR(reply) };
+		ssize_t err = packet_tx_send(&packet_tx,
+			(uint8_t *)DHCP_MSG_F_CHADDR(msg->data), yiaddr, reply, len);
+
+		if (err >= 0)
+		{
+			++stats.tx_packets;
+			++stats.tx_unicast;
+			reply_latency(msg);
 
-			sqlite3_reset(stmt);
+			dst.sin_addr = yiaddr;
+			capture_note_reply(reply, len, type, &dst, true);
+
+			return err;
 		}
+	}
 
-		sqlite3_finalize(stmt);
-		goto finalize;
+	/* Queued replies are submitted together at the end of ingress_run() */
+	if (uring_send(&uring, reply, len, &dst))
+	{
+		++stats.tx_packets;
+		uring_reply_latency(msg);
+		capture_note_reply(reply, len, type, &dst, false);
+		return len;
 	}
 
-	lease.leasetime = db_lease.leasetime;
-	lease.prefixlen = db_lease.prefixlen;
+	ssize_t err = sendto(fd, reply, len, MSG_DONTWAIT,
+		(struct sockaddr *)&dst, sizeof dst);
+
+	if (err < 0)
+		++stats.tx_errors;
+	else
+	{
+		++stats.tx_packets;
+		reply_latency(msg);
+		capture_note_reply(reply, len, type, &dst, false);
+	}
 
-	unalloc_lease = true;
+	return err;
+}
 
-	if (!inet_pton(AF_INET, db_lease.address, &lease.address))
-		goto invalid_lease_entry;
+/**
+ * Handle DHCPDISCOVER request and reply to that
+ */
+static void discover_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+{
+	(void)EV_A;
 
-	if (db_lease.routers)
-		if (!iplist_parse(db_lease.routers, &lease.routers, &lease.routers_cnt))
-			goto invalid_lease_entry;
+	struct dhcp_lease lease = DHCP_LEASE_EMPTY;
 
-	if (db_lease.nameservers)
-		if (!iplist_parse(db_lease.nameservers, &lease.nameservers, &lease.nameservers_cnt))
-			goto invalid_lease_entry;
+	struct store_lease *sl = lease_lookup(msg);
 
-	if (0)
+	if (sl == NULL)
 	{
-invalid_lease_entry:
-		fprintf(stderr, "Invalid lease entry for %s:\n"
-				"\tAddress: %s\n"
-				"\tRouters: %s\n"
-				"\tNameservers: %s\n"
-				"\tPrefix Length: %hhu\n"
-				"\tLease Time: %u\n",
-				msg->chaddr,
-				db_lease.address,
-				db_lease.routers,
-				db_lease.nameservers,
-				db_lease.prefixlen,
-				db_lease.leasetime);
-		goto finalize;
+		if (!cfg.argv->allocate)
+			return;
+		lease_defaults(msg, &lease);
+
+		const struct range_set *ranges = lease_ranges(msg);
+
+		if (ranges != &cfg.ranges)
+		{
+			if (!store_free_address_in(&store, ranges, &lease.address))
+				return;
+		}
+		else if (!store_free_address(&store, &lease.address))
+			return;
+
+		goto offer;
+	}
+
+	if (!lease_from_store(sl, &lease))
+	{
+		lease_invalid(msg, sl);
+		return;
 	}
 
 	size_t send_len;
 	uint8_t *options;
 offer:
 	dhcp_msg_reply(send_buffer, &options, &send_len, msg, DHCPOFFER);
+	dhcp_lease_spread(&lease, msg->key_hash, cfg.leasejitter);
 
 	ARRAY_COPY(DHCP_MSG_F_YIADDR(send_buffer), &lease.address, 4);
 
-	options[0] = DHCP_OPT_SERVERID;
-	options[1] = 4;
-	ARRAY_COPY((options + 2), &msg->sid->sin_addr, 4);
-	DHCP_OPT_CONT(options, send_len);
+	options = dhcp_opt_put(options, &send_len, DHCP_OPT_SERVERID,
+		&msg->sid->sin_addr, 4);
 
-	options = dhcp_opt_add_lease(options, &send_len, &lease);
+	options = dhcp_opt_add_lease(options, &send_len, &lease, msg->opts);
 
 	*options = DHCP_OPT_END;
 	DHCP_OPT_CONT(options, send_len);
 
 	if (debug)
-		msg_debug(&((struct dhcp_msg){.data = send_buffer, .length = send_len }), 1);
-	int err = sendto(w->fd,
-		send_buffer, send_len,
-		MSG_DONTWAIT, (struct sockaddr *)&broadcast, sizeof broadcast);
+		log_msg(LOG_OUTGOING, send_buffer, send_len);
+	ssize_t err = reply_send(w->fd, msg, send_buffer, send_len, DHCPOFFER);
 
 	if (err < 0)
-		dhcpd_error(errno, 1, "Could not send DHCPOFFER");
-
-finalize:
-	if (unalloc_lease)
-	{
-		if (lease.routers)
-			free(lease.routers);
-		if (lease.nameservers)
-			free(lease.nameservers);
-	}
-
-	db_lease_free(&db_lease);
+		dhcpd_error(0, errno, "Could not send DHCPOFFER");
 }
 
 /**
@@ -257,105 +605,72 @@ static void request_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
 	(void)EV_A;
 
 	struct in_addr *requested_addr, *requested_server;
+	const struct dhcp_opt *opt;
 	uint8_t *options;
-	struct dhcp_opt current_opt;
 
-	requested_addr = NULL;
-	requested_server = (struct in_addr *)DHCP_MSG_F_SIADDR(msg->data);
-	options = DHCP_MSG_F_OPTIONS(msg->data);
+	/* Without option 50 the client is renewing or rebinding ciaddr */
+	opt = dhcp_opts_get(msg->opts, DHCP_OPT_IDX_REQIPADDR);
+	requested_addr = (struct in_addr *)(opt != NULL ? (uint8_t *)opt->data :
+		(uint8_t *)DHCP_MSG_F_CIADDR(msg->data));
 
-	while (dhcp_opt_next(&options, &current_opt, msg->end))
-		switch (current_opt.code)
-		{
-			case DHCP_OPT_REQIPADDR:
-				requested_addr = (struct in_addr *)current_opt.data;
-				break;
-			case DHCP_OPT_SERVERID:
-				requested_server = (struct in_addr *)current_opt.data;
-				break;
-		}
+	opt = dhcp_opts_get(msg->opts, DHCP_OPT_IDX_SERVERID);
+	requested_server = (struct in_addr *)(opt != NULL ? (uint8_t *)opt->data :
+		(uint8_t *)DHCP_MSG_F_SIADDR(msg->data));
 
 	if (requested_server->s_addr != msg->sid->sin_addr.s_addr)
 		return;
 
-	int sqlerr, err;
+	ssize_t err;
 
 	struct dhcp_lease lease = DHCP_LEASE_EMPTY;
-	bool unalloc_lease = false;
 
 	struct db_lease db_lease = DB_LEASE_EMPTY;
-	sqlerr = db_lease_by_hwaddr(leasedb, &db_lease, msg->chaddr);
-
-	if (sqlerr != SQLITE_OK)
-	{
-		dhcpd_error(0, 0, "sqlite3: %s", sqlite3_errstr(sqlerr));
-		return;
-	}
+	struct store_lease *sl = lease_lookup(msg);
 
-	if (!db_lease.id)
+	if (sl == NULL)
 	{
 		if (!cfg.argv->allocate)
 			goto nack;
-		if (!IPRANGE_IN2(cfg.iprange, *requested_addr))
+		if (!lease_in_range(msg, *requested_addr))
 			goto nack;
-		lease = (struct dhcp_lease){
-			.address = *requested_addr,
-			.routers = cfg.routers,
-			.routers_cnt = cfg.routers_cnt,
-			.nameservers = cfg.nameservers,
-			.nameservers_cnt = cfg.nameservers_cnt,
-			.leasetime = cfg.leasetime,
-			.prefixlen = cfg.prefixlen
-		};
-		db_lease_from_lease(&db_lease, &lease);
+		if (store_by_address(&store, *requested_addr) != NULL)
+			goto nack;
+		lease_defaults(msg, &lease);
+		lease.address = *requested_addr;
+		db_lease_from_lease(&db_lease, &lease, &msg_arena);
+		db_lease.id = store.next_id;
 		db_lease.hwaddr = msg->chaddr;
+		db_lease.clientid = msg->key;
 		db_lease.allocated = 1;
 		db_lease.allocated_at = (time_t)ev_now(EV_A);
 
-		sqlerr = db_insert(leasedb, &db_lease);
-
-		db_lease.hwaddr = NULL;
+		struct store_lease new_sl = {
+			.id = db_lease.id,
+			.address = lease.address.s_addr,
+			.prefixlen = lease.prefixlen,
+			.allocated = 1,
+			.leasetime = lease.leasetime,
+			.allocated_at = db_lease.allocated_at,
+			.key = msg->key
+		};
+		ARRAY_COPY(new_sl.hwaddr, DHCP_MSG_F_CHADDR(msg->data), 6);
 
-		if (sqlerr != SQLITE_DONE)
+		if ((sl = store_insert(&store, &new_sl, db_lease.routers, db_lease.nameservers)) == NULL)
 		{
-			dhcpd_error(0, 0, "sqlite3: %s", sqlite3_errstr(sqlerr));
+			dhcpd_error(0, errno, "Could not add lease for %s to store", msg->chaddr);
 			goto nack;
 		}
 
+		/* The database is written behind, the store already has the lease */
+		persist_put(&db_lease);
+		repl_lease_put(sl);
+
 		goto ack;
 	}
 
-	lease.leasetime = db_lease.leasetime;
-	lease.prefixlen = db_lease.prefixlen;
-
-	unalloc_lease = true;
-
-	if (!inet_pton(AF_INET, db_lease.address, &lease.address))
-		goto invalid_lease_entry;
-
-	if (db_lease.routers)
-		if (!iplist_parse(db_lease.routers, &lease.routers, &lease.routers_cnt))
-			goto invalid_lease_entry;
-
-	if (db_lease.nameservers)
-		if (!iplist_parse(db_lease.nameservers, &lease.nameservers, &lease.nameservers_cnt))
-			goto invalid_lease_entry;
-
-	if (0)
+	if (!lease_from_store(sl, &lease))
 	{
-invalid_lease_entry:
-		fprintf(stderr, "Invalid lease entry for %s:\n"
-				"\tAddress: %s\n"
-				"\tRouters: %s\n"
-				"\tNameservers: %s\n"
-				"\tPrefix Length: %hhu\n"
-				"\tLease Time: %u\n",
-				msg->chaddr,
-				db_lease.address,
-				db_lease.routers,
-				db_lease.nameservers,
-				db_lease.prefixlen,
-				db_lease.leasetime);
+		lease_invalid(msg, sl);
 		goto nack;
 	}
 
@@ -369,366 +684,1693 @@ nack:
 		DHCP_OPT_CONT(options, send_len);
 
 		if (debug)
-			msg_debug(&((struct dhcp_msg){.data = send_buffer, .length = send_len }), 1);
-		err = sendto(w->fd,
-			send_buffer, send_len,
-			MSG_DONTWAIT, (struct sockaddr *)&broadcast, sizeof broadcast);
+			log_msg(LOG_OUTGOING, send_buffer, send_len);
+		err = reply_send(w->fd, msg, send_buffer, send_len, DHCPNAK);
 
 		if (err < 0)
-			dhcpd_error(0, 1, "Could not send DHCPNAK");
+			dhcpd_error(0, errno, "Could not send DHCPNAK");
 
-		goto finalize;
+		return;
 	}
 
 	size_t send_len;
 ack:
 	dhcp_msg_reply(send_buffer, &options, &send_len, msg, DHCPACK);
+	dhcp_lease_spread(&lease, msg->key_hash, cfg.leasejitter);
 
 	ARRAY_COPY(DHCP_MSG_F_YIADDR(send_buffer), &lease.address, 4);
 
-	options[0] = DHCP_OPT_SERVERID;
-	options[1] = 4;
-	ARRAY_COPY((options + 2), &msg->sid->sin_addr, 4);
+	options = dhcp_opt_put(options, &send_len, DHCP_OPT_SERVERID,
+		&msg->sid->sin_addr, 4);
+
+	options = dhcp_opt_add_lease(options, &send_len, &lease, msg->opts);
+
+	*options = DHCP_OPT_END;
+	DHCP_OPT_CONT(options, send_len);
+
+	if (debug)
+		log_msg(LOG_OUTGOING, send_buffer, send_len);
+	err = reply_send(w->fd, msg, send_buffer, send_len, DHCPACK);
+
+	if (err < 0)
+		dhcpd_error(0, errno, "Could not send DHCPACK");
+}
+
+/**
+ * Handle DHCPRELEASE request and release the lease if it was allocated
+ */
+static void release_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+{
+	(void)EV_A;
+	(void)w;
+
+	struct store_lease *sl = lease_lookup(msg);
+
+	if (sl == NULL || !sl->allocated)
+		return;
+
+	persist_del(sl->id);
+	repl_lease_del(sl);
+	store_remove(&store, sl);
+}
+
+/**
+ * Handle DHCPDECLINE request and do nothing at the moment
+ */
+static void decline_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+{
+	(void)EV_A;
+	(void)w;
+	(void)msg;
+}
+
+/**
+ * Handle DHCPINFORM request and reply with the correct information
+ */
+static void inform_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+{
+	(void)EV_A;
+
+	struct store_lease *sl = lease_lookup(msg);
+
+	struct dhcp_lease lease = DHCP_LEASE_EMPTY;
+
+	if (sl == NULL)
+	{
+no_specific_lease:
+		if (!cfg.argv->allocate)
+			return;
+		/* DHCPINFORM doesn't assign an address */
+		lease_defaults(msg, &lease);
+		lease.prefixlen = 0;
+		lease.leasetime = 0;
+		goto ack;
+	}
+
+	if (!lease_profile(sl, &lease))
+		goto no_specific_lease;
+
+	size_t send_len;
+	uint8_t *options;
+ack:
+	dhcp_msg_reply(send_buffer, &options, &send_len, msg, DHCPACK);
+
+	options = dhcp_opt_add_lease(options, &send_len, &lease, msg->opts);
+
+	*options = DHCP_OPT_END;
 	DHCP_OPT_CONT(options, send_len);
 
-	options = dhcp_opt_add_lease(options, &send_len, &lease);
+	if (debug)
+		log_msg(LOG_OUTGOING, send_buffer, send_len);
+
+	/* The client has an address, so the reply goes to ciaddr unless it was
+	 * relayed, RFC 2131, section 4.3.5 */
+	ssize_t err = reply_send(w->fd, msg, send_buffer, send_len, DHCPACK);
+
+	if (err < 0)
+		dhcpd_error(0, errno, "Could not send DHCPACK");
+}
+
+/**
+ * Check and decode received DHCP message and choose its ingress class. The
+ * decoded options and key are kept with the message for msg_handle().
+ *
+ * @param[in,out] p Received message
+ */
+static enum ingress_class msg_classify(struct ingress_pkt *p)
+{
+	uint8_t *data = p->data;
+
+	/* Detect too small messages and check magic value */
+	p->valid = p->len >= DHCP_MSG_HDRLEN &&
+		DHCP_MSG_MAGIC_CHECK(DHCP_MSG_F_MAGIC(data));
+	if (!p->valid)
+		return INGRESS_DISCOVER;
+
+	dhcp_opts_parse(data, data + p->len, &p->opts);
+	p->type = dhcp_opts_msg_type(&p->opts);
+	p->clientid = dhcp_key_from_msg(data, &p->opts, &p->key);
+	p->key_hash = dhcp_key_hash(&p->key);
+
+	bool known = lease_find(data, &p->key, p->key_hash, p->clientid) != NULL;
+
+	if (p->type == DHCPDISCOVER)
+		return known ? INGRESS_KNOWN : INGRESS_DISCOVER;
+
+	return known ? INGRESS_RENEW : INGRESS_REQUEST;
+}
+
+/**
+ * Check received DHCP message and call the correct message type handler.
+ *
+ * @param[in] w IO watcher of the UDP socket, which is used for replies
+ * @param[in] p Message decoded by msg_classify()
+ */
+static void msg_handle(EV_P_ ev_io *w, struct ingress_pkt *p)
+{
+	const char *outcome = NULL;
+	enum dhcp_msg_type msg_type = 0;
+	struct timespec rx_ts;
+	uint8_t *data = p->data;
+	size_t len = p->len;
+	struct sockaddr_in *src_addr = &p->src;
+
+	/* The primary answers as long as it is alive */
+	if (repl_node.standby)
+		return;
+
+	capture_reply = (struct capture_reply){
+		.active = capture_sample(&capture)
+	};
+	if (capture_reply.active)
+	{
+		rx_ts = p->stamp;
+		if (rx_ts.tv_sec == 0)
+			clock_gettime(CLOCK_REALTIME, &rx_ts);
+	}
+
+	if (!p->valid)
+		goto invalid;
+
+	if (0)
+	{
+invalid:
+		++stats.rx_invalid;
+		outcome = "dropped as invalid";
+		goto done;
+	}
+
+	++stats.rx_packets;
+
+	const struct dhcp_opts *opts = &p->opts;
+	msg_type = p->type;
+
+	/* Messages of clients, which are served by a peer, are ignored before
+	 * they count against rate limits */
+	if (!dhcp_lb_all(&cfg.loadbalance) &&
+			!dhcp_lb_serves(&cfg.loadbalance, data, opts, msg_type))
+	{
+		++stats.rx_loadbalanced;
+		outcome = "ignored by load balancing";
+		goto done;
+	}
+
+	/* Classes are matched before rate limiting, so ignored classes don't use
+	 * up tokens */
+	struct class_rule *cls = class_match(&cfg.classes, data, opts);
+
+	if (cls != NULL && cls->ignore)
+	{
+		++stats.rx_class_ignored;
+		outcome = "ignored by class";
+		goto done;
+	}
+
+	/* Admission control, before any expensive work is done */
+	if (!ratelimit_admit(&client_rl, (uint8_t *)DHCP_MSG_F_CHADDR(data),
+			*DHCP_MSG_F_HLEN(data), ev_now(EV_A)))
+	{
+		++stats.rx_ratelimited_client;
+		outcome = "dropped by client rate limit";
+		goto done;
+	}
+
+	if (*DHCP_MSG_F_GIADDR(data) != INADDR_ANY &&
+			!ratelimit_admit(&relay_rl, (uint8_t *)DHCP_MSG_F_GIADDR(data), 4,
+				ev_now(EV_A)))
+	{
+		++stats.rx_ratelimited_relay;
+		outcome = "dropped by relay rate limit";
+		goto done;
+	}
+
+	/* The textual hardware address is the lease key, all other addresses are
+	 * only converted by the logging thread */
+	char chaddr[MAC_ADDRSTRLEN];
+	mac_ntop(DHCP_MSG_F_CHADDR(data), chaddr, sizeof chaddr);
+
+	struct dhcp_msg msg = {
+		.data = data,
+		.end = data + len,
+		.length = len,
+		.type = msg_type,
+		.chaddr = chaddr,
+		.source = (struct sockaddr *)src_addr,
+		.sid = (struct sockaddr_in *)&server_id,
+		.opts = opts,
+		.cls = cls,
+		/* The key is hashed once, all lookups of the message use the hash */
+		.key = p->key,
+		.key_hash = p->key_hash,
+		.clientid = p->clientid,
+		.stamp = p->stamp
+	};
+
+	if (debug)
+		log_msg(LOG_INCOMING, data, len);
+
+	switch (msg_type)
+	{
+		case DHCPDISCOVER:
+			discover_cb(EV_A_ w, &msg);
+			break;
+
+		case DHCPREQUEST:
+			request_cb(EV_A_ w, &msg);
+			break;
+
+		case DHCPRELEASE:
+			release_cb(EV_A_ w, &msg);
+			break;
+
+		case DHCPDECLINE:
+			decline_cb(EV_A_ w, &msg);
+			break;
+
+		case DHCPINFORM:
+			inform_cb(EV_A_ w, &msg);
+			break;
+
+		default:
+			log_printf("%s", BROKEN_SOFTWARE_NOTIFICATION);
+			log_msg(LOG_INCOMING, data, len);
+			outcome = "unknown message type";
+			break;
+	}
+
+done:
+	if (!capture_reply.active)
+		return;
+
+	char comment[CAPTURE_COMMENT_MAX];
+	struct sockaddr_in dst = server_id;
+	dst.sin_port = htons(67);
+
+	/* The destination of the message isn't known, assume broadcast for
+	 * clients without an address */
+	if (src_addr->sin_addr.s_addr == INADDR_ANY)
+		dst.sin_addr.s_addr = INADDR_BROADCAST;
+
+	if (outcome == NULL && capture_reply.data != NULL)
+	{
+		char dst_str[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &capture_reply.dst.sin_addr, dst_str, sizeof dst_str);
+
+		snprintf(comment, sizeof comment, "%s answered with %s to %s%s",
+			dhcp_msg_type_str(msg_type),
+			dhcp_msg_type_str(capture_reply.type),
+			dst_str, capture_reply.unicast ? " through packet socket" : "");
+	}
+	else if (outcome == NULL)
+		snprintf(comment, sizeof comment, "%s not answered",
+			dhcp_msg_type_str(msg_type));
+	else
+		snprintf(comment, sizeof comment, "%s", outcome);
+
+	bool ok = capture_packet(&capture, CAPTURE_INBOUND, &rx_ts, src_addr, &dst,
+		data, len, comment);
+
+	if (ok && capture_reply.data != NULL)
+	{
+		struct sockaddr_in src = server_id;
+		src.sin_port = htons(67);
+
+		ok = capture_packet(&capture, CAPTURE_OUTBOUND, &capture_reply.ts, &src,
+			&capture_reply.dst, capture_reply.data, capture_reply.len, NULL);
+	}
+
+	if (!ok)
+	{
+		dhcpd_error(0, errno, "Could not write capture, capturing stopped");
+		capture_close(&capture);
+	}
+
+	capture_reply.active = false;
+}
+
+/**
+ * Check whether a message is older than -maxage, its client has most likely
+ * retransmitted it already
+ *
+ * @param[in] p Message
+ * @param[in] now Current time in seconds
+ */
+static bool msg_stale(const struct ingress_pkt *p, double now)
+{
+	if (cfg.maxage == 0 || p->stamp.tv_sec == 0)
+		return false;
+
+	double stamp = p->stamp.tv_sec + p->stamp.tv_nsec / 1e9;
+
+	return (now - stamp) * 1000 > cfg.maxage;
+}
+
+/**
+ * Handle queued messages in the order of their class, at most INGRESS_BUDGET
+ * per loop iteration. Stale messages are dropped without counting against
+ * the budget.
+ *
+ * @param[in] w IO watcher of the UDP socket, which is used for replies
+ */
+static void ingress_run(EV_P_ ev_io *w)
+{
+	double now = ev_time();
+	struct ingress_pkt *p;
+	size_t handled = 0;
+
+	while (handled < INGRESS_BUDGET && (p = ingress_pop(&ingress, now)) != NULL)
+	{
+		if (msg_stale(p, now))
+			++stats.rx_stale;
+		else
+		{
+			msg_handle(EV_A_ w, p);
+			arena_reset(&msg_arena);
+			++handled;
+		}
+
+		ingress_put(&ingress, p);
+	}
+
+	reply_submit();
+
+	/* The rest is handled when the loop has nothing else to do */
+	if (ingress_pending(&ingress))
+		ev_idle_start(EV_A_ &ingress_watch);
+	else
+		ev_idle_stop(EV_A_ &ingress_watch);
+}
+
+/**
+ * Handle messages, which are left in the queues. The data pointer of the
+ * watcher refers to the IO watcher of the UDP socket.
+ */
+static void ingress_cb(EV_P_ ev_idle *w, int revents)
+{
+	(void)revents;
+
+	ingress_run(EV_A_ w->data);
+}
+
+/**
+ * Handle libev IO event to socket, queue all received messages by class and
+ * handle as many as the budget allows
+ */
+static void req_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)revents;
+
+	double now = ev_time();
+	struct ingress_pkt *p;
+
+	for (size_t i = 0; i < INGRESS_BATCH &&
+			(p = ingress_get(&ingress)) != NULL; ++i)
+	{
+		/* Detect errors, mostly the socket being empty */
+		if (!ingress_rx_recv(&ingress_rx, p))
+		{
+			ingress_put(&ingress, p);
+			break;
+		}
+
+		ingress_push(&ingress, msg_classify(p), p, now);
+	}
+
+	ingress_run(EV_A_ w);
+}
+
+/**
+ * Handle libev IO event to the receive ring, copy up to INGRESS_BATCH
+ * messages of the blocks, which were handed over by the kernel, into the
+ * ingress queues and handle as many as the budget allows. The copy lets a
+ * block go back to the kernel, while its messages still wait in the queues.
+ * The data pointer of the watcher refers to the IO watcher of the UDP
+ * socket.
+ */
+static void ring_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)revents;
+
+	ev_io *udp_w = w->data;
+	double now = ev_time();
+	struct ingress_pkt *p;
+	uint8_t *data;
+	size_t len;
+
+	for (size_t i = 0; i < INGRESS_BATCH &&
+			(p = ingress_get(&ingress)) != NULL; ++i)
+	{
+		if ((data = ring_rx_next(&ring_rx, &len, &p->src, &p->stamp)) == NULL)
+		{
+			ingress_put(&ingress, p);
+			break;
+		}
+
+		p->len = len < INGRESS_MSG_LEN ? len : INGRESS_MSG_LEN;
+		memcpy(p->data, data, p->len);
+		ingress_push(&ingress, msg_classify(p), p, now);
+	}
+
+	ingress_run(EV_A_ udp_w);
+}
+
+/**
+ * Queue messages, which the multishot receive completed, until the ingress
+ * queues are full
+ *
+ * @return false if no further message is pending
+ */
+static bool uring_queue(void)
+{
+	double now = ev_time();
+	struct ingress_pkt *p;
+	uint8_t *data;
+	size_t len;
+
+	while ((p = ingress_get(&ingress)) != NULL)
+	{
+		if ((data = uring_next(&uring, &len, &p->src, &p->stamp)) == NULL)
+		{
+			ingress_put(&ingress, p);
+			return false;
+		}
+
+		p->len = len < INGRESS_MSG_LEN ? len : INGRESS_MSG_LEN;
+		memcpy(p->data, data, p->len);
+		ingress_push(&ingress, msg_classify(p), p, now);
+	}
+
+	return true;
+}
+
+/**
+ * Handle libev IO event to the io_uring instance, queue all messages, which
+ * the multishot receive completed, and handle as many as the budget allows.
+ * The data pointer of the watcher refers to the IO watcher of the UDP
+ * socket.
+ */
+static void uring_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)revents;
+
+	uring_queue();
+	ingress_run(EV_A_ w->data);
+}
+
+/**
+ * Break event loop to force a shutdown
+ */
+static void sigint_cb(EV_P_ ev_signal *sig, int revents)
+{
+	(void)revents;
+	(void)EV_A;
+	(void)sig;
+
+	ev_break(EV_A_ EVBREAK_ALL);
+}
+
+/**
+ * Wait until all lease mutations were committed
+ */
+static void sigusr1_cb(EV_P_ ev_signal *sig, int revents)
+{
+	(void)revents;
+	(void)EV_A;
+	(void)sig;
+
+	persist_sync();
+}
+
+/**
+ * Reload leases from the database, after all lease mutations were written
+ */
+static void sigusr2_cb(EV_P_ ev_signal *sig, int revents)
+{
+	(void)revents;
+	(void)EV_A;
+	(void)sig;
+
+	persist_sync();
+
+	struct store fresh;
+	int sqlerr;
+
+	if (!store_init(&fresh, &cfg.ranges, cfg.gc))
+	{
+		dhcpd_error(0, errno, "Could not allocate lease store");
+		return;
+	}
+
+	persist_lock();
+	sqlerr = store_load(&fresh, leasedb);
+	persist_unlock();
+
+	if (sqlerr != SQLITE_OK)
+	{
+		dhcpd_error(0, 0, "Could not reload leases: %s", sqlite3_errstr(sqlerr));
+		store_free(&fresh);
+	}
+	else
+	{
+		store_free(&store);
+		store = fresh;
+	}
+}
+
+/**
+ * Update counters, which are kept outside of struct stats
+ *
+ * @param[in] sock UDP socket
+ */
+static void stats_collect(int sock)
+{
+	stats.rx_kernel_drops = stats_sock_drops(sock);
+	stats.rx_queue_drops = uring.fd >= 0 ? uring.drops : ingress_rx.drops;
+	stats.rx_burst_max = ingress_rx.burst_max;
+	stats.rx_rcvbuf = ingress_rx.rcvbuf;
+	stats.rx_ring_drops += ring_rx_drops(&ring_rx);
+	stats.tx_errors += uring_send_errors(&uring);
+	stats.tx_submits = uring.submits;
+	stats.log_drops = log_drops();
+	stats.heap_allocs = arena_heap_allocs();
+	stats.arena_overflows = msg_arena.overflows;
+	stats.rx_shed_renew = ingress.shed[INGRESS_RENEW];
+	stats.rx_shed_known = ingress.shed[INGRESS_KNOWN];
+	stats.rx_shed_request = ingress.shed[INGRESS_REQUEST];
+	stats.rx_shed_discover = ingress.shed[INGRESS_DISCOVER];
+
+	struct persist_stats ps;
+	persist_stats(&ps);
+	stats.db_queued = ps.queued;
+	stats.db_queued_max = ps.queued_max;
+	stats.db_stalls = ps.stalls;
+	stats.db_batches = ps.batches;
+	stats.db_written = ps.written;
+	stats.db_errors = ps.errors;
+}
+
+/**
+ * Collect kernel counters and dump statistics to stderr. The data pointer of
+ * the timer refers to the UDP socket.
+ */
+static void stats_cb(EV_P_ ev_timer *timer, int revents)
+{
+	(void)revents;
+	(void)EV_A;
+
+	stats_collect(*(int *)timer->data);
+	stats_dump(stderr);
+}
+
+/**
+ * Write buffered capture records, so the file can be followed while running
+ */
+static void capture_cb(EV_P_ ev_timer *timer, int revents)
+{
+	(void)revents;
+	(void)EV_A;
+	(void)timer;
+
+	if (!capture_flush(&capture))
+	{
+		dhcpd_error(0, errno, "Could not write capture, capturing stopped");
+		capture_close(&capture);
+	}
+}
+
+/**
+ * Garbage collection for old leases
+ */
+static void leasegc_cb(EV_P_ ev_timer *timer, int revents)
+{
+	(void)revents;
+	(void)timer;
+
+	struct store_lease *l;
+
+	/* The primary sends the leases it collected */
+	if (repl_node.standby)
+		return;
+
+	/* The expiry heap yields leases in the order they may be collected */
+	while ((l = store_next_expiry(&store)) != NULL &&
+			ev_now(EV_A) > store_expiry(&store, l))
+	{
+		if (debug)
+		{
+			char address[INET_ADDRSTRLEN];
+			inet_ntop(AF_INET, &l->address, address, sizeof address);
+			log_printf("Removing lease %u for %s", l->id, address);
+		}
+
+		persist_del(l->id);
+		repl_lease_del(l);
+		store_remove(&store, l);
+	}
+}
+
+/**
+ * Stop watching and close the connection to the peer
+ */
+static void repl_close(EV_P)
+{
+	if (repl_node.conn.fd < 0)
+		return;
+
+	ev_io_stop(EV_A_ &repl_node.conn_watch);
+	repl_conn_close(&repl_node.conn);
+
+	repl_node.connecting = false;
+	repl_node.streaming = false;
+	repl_node.lag_since = 0;
+}
+
+/**
+ * Stop replication, e.g. because another process takes over
+ */
+static void repl_stop(EV_P)
+{
+	repl_close(EV_A);
+
+	if (repl_node.listen_fd >= 0)
+	{
+		ev_io_stop(EV_A_ &repl_node.listen_watch);
+		close(repl_node.listen_fd);
+		repl_node.listen_fd = -1;
+	}
+
+	ev_timer_stop(EV_A_ &repl_node.timer_watch);
+	ev_prepare_stop(EV_A_ &repl_node.prepare_watch);
+	repl_log_free(&repl_node.log);
+}
+
+/**
+ * Watch the connection for the events it waits for
+ */
+static void repl_watch(EV_P)
+{
+	int events = EV_READ;
+
+	if (repl_node.connecting)
+		events = EV_WRITE;
+	else if (repl_conn_pending(&repl_node.conn))
+		events |= EV_WRITE;
+
+	if (events != (repl_node.conn_watch.events & (EV_READ | EV_WRITE)))
+	{
+		ev_io_stop(EV_A_ &repl_node.conn_watch);
+		ev_io_set(&repl_node.conn_watch, repl_node.conn.fd, events);
+		ev_io_start(EV_A_ &repl_node.conn_watch);
+	}
+}
+
+/**
+ * Queue snapshot of the whole store for the standby
+ */
+static bool repl_snapshot(void)
+{
+	struct control_lease cl;
+
+	if (!repl_conn_hello(&repl_node.conn, REPL_SNAPSHOT, repl_node.log.epoch,
+			repl_node.log.next_seq))
+		return false;
+
+	for (uint32_t i = 0; i < store.leases_cnt; ++i)
+	{
+		lease_to_control(&store.leases[i], &cl);
+		if (!repl_conn_load(&repl_node.conn, &cl))
+			return false;
+	}
+
+	repl_node.sent_seq = repl_node.log.next_seq;
+	++stats.repl_snapshots;
+
+	return true;
+}
+
+/**
+ * Handle message of the standby
+ */
+static void repl_primary_handle(const struct repl_hdr *hdr,
+	const uint8_t *payload)
+{
+	uint64_t epoch;
+
+	switch (hdr->type)
+	{
+		case REPL_HELLO:
+			if (!repl_epoch_unpack(payload, hdr->len, &epoch))
+				break;
+
+			/* Catch up from the log if it still has the records */
+			if (epoch == repl_node.log.epoch &&
+					repl_log_has(&repl_node.log, hdr->seq))
+				repl_node.sent_seq = hdr->seq;
+			else if (!repl_snapshot())
+				break;
+
+			if (debug)
+				log_printf("Standby connected, sending %s from %llu",
+					repl_node.sent_seq == hdr->seq ? "log" : "snapshot",
+					(unsigned long long)repl_node.sent_seq);
+
+			repl_node.acked_seq = repl_node.sent_seq;
+			repl_node.streaming = true;
+			return;
+
+		case REPL_ACK:
+			if (!repl_node.streaming || hdr->seq > repl_node.log.next_seq)
+				break;
+
+			repl_node.acked_seq = hdr->seq;
+			if (repl_node.lag_since != 0 && hdr->seq >= repl_node.lag_seq)
+				repl_node.lag_since = 0;
+			return;
+	}
+
+	repl_node.conn.broken = true;
+}
+
+/**
+ * Store lease of the primary, leases it conflicts with were deleted on the
+ * primary before
+ */
+static void repl_apply_put(const struct control_lease *cl)
+{
+	struct store_lease *sl;
+
+	if ((sl = store_by_key(&store, &cl->key, dhcp_key_hash(&cl->key))) != NULL)
+		store_remove(&store, sl);
+	if ((sl = store_by_address(&store, (struct in_addr){ cl->address })) != NULL)
+		store_remove(&store, sl);
+
+	char address[INET_ADDRSTRLEN];
+	char hwaddr[MAC_ADDRSTRLEN];
+	inet_ntop(AF_INET, &cl->address, address, sizeof address);
+	mac_ntop((const char *)cl->hwaddr, hwaddr, sizeof hwaddr);
+
+	struct db_lease db_lease = {
+		.id = cl->id,
+		.address = address,
+		.prefixlen = cl->prefixlen,
+		.hwaddr = hwaddr,
+		.routers = (char *)cl->routers,
+		.nameservers = (char *)cl->nameservers,
+		.leasetime = cl->leasetime,
+		.allocated = cl->allocated,
+		.allocated_at = cl->allocated_at,
+		.clientid = cl->key
+	};
+
+	persist_put(&db_lease);
+
+	struct store_lease new_sl = {
+		.id = cl->id,
+		.address = cl->address,
+		.prefixlen = cl->prefixlen,
+		.allocated = cl->allocated,
+		.leasetime = cl->leasetime,
+		.allocated_at = cl->allocated_at,
+		.key = cl->key
+	};
+	ARRAY_COPY(new_sl.hwaddr, cl->hwaddr, 6);
+
+	if (!store_insert(&store, &new_sl, cl->routers, cl->nameservers))
+		dhcpd_error(0, errno, "Could not add lease %u to store", cl->id);
+}
+
+/**
+ * Delete lease, which the primary deleted
+ */
+static void repl_apply_del(uint32_t id, const struct dhcp_key *key)
+{
+	persist_del(id);
+
+	struct store_lease *sl = store_by_key(&store, key, dhcp_key_hash(key));
+	if (sl != NULL && sl->id == id)
+		store_remove(&store, sl);
+}
+
+/**
+ * Apply records of REPL_BATCH or REPL_LOAD
+ *
+ * @param[in] hdr Header of the message
+ * @param[in] payload Records
+ * @param[in] skip Count of leading records, which were applied already
+ */
+static bool repl_apply(const struct repl_hdr *hdr, const uint8_t *payload,
+	uint64_t skip)
+{
+	size_t off = 0;
+	uint8_t kind;
+	const uint8_t *body;
+	size_t body_len;
+
+	struct control_lease cl;
+	uint32_t id;
+	struct dhcp_key key;
+
+	for (uint32_t i = 0; i < hdr->count; ++i)
+	{
+		if (!repl_record_next(payload, hdr->len, &off, &kind, &body, &body_len))
+			return false;
+
+		if (i < skip)
+			continue;
+
+		switch (kind)
+		{
+			case REPL_PUT:
+				if (!control_lease_unpack(body, body_len, &cl))
+					return false;
+				repl_apply_put(&cl);
+				break;
+			case REPL_DEL:
+				if (!repl_del_unpack(body, body_len, &id, &key))
+					return false;
+				repl_apply_del(id, &key);
+				break;
+			default:
+				return false;
+		}
+
+		++stats.repl_applied;
+	}
+
+	return off == hdr->len;
+}
+
+/**
+ * Handle message of the primary
+ */
+static void repl_standby_handle(const struct repl_hdr *hdr,
+	const uint8_t *payload)
+{
+	uint64_t epoch;
+
+	switch (hdr->type)
+	{
+		case REPL_SNAPSHOT:
+			if (!repl_epoch_unpack(payload, hdr->len, &epoch))
+				break;
+
+			if (debug)
+				log_printf("Loading snapshot of the primary");
+
+			persist_clear();
+			store_free(&store);
+			if (!store_init(&store, &cfg.ranges, cfg.gc))
+				dhcpd_error(1, errno, "Could not allocate lease store");
+
+			/* Until the snapshot is complete, only a new one helps */
+			repl_node.epoch = 0;
+			repl_node.snapshot_epoch = epoch;
+			repl_node.next_seq = hdr->seq;
+			return;
+
+		case REPL_LOAD:
+			if (repl_node.snapshot_epoch == 0 || !repl_apply(hdr, payload, 0))
+				break;
+			return;
+
+		case REPL_BATCH:
+			if (hdr->seq > repl_node.next_seq)
+				break;
+			if (!repl_apply(hdr, payload, repl_node.next_seq - hdr->seq))
+				break;
+			if (hdr->seq + hdr->count > repl_node.next_seq)
+				repl_node.next_seq = hdr->seq + hdr->count;
+			/* Fall through */
+		case REPL_HEARTBEAT:
+			/* Everything after the snapshot arrives after its leases */
+			if (repl_node.epoch == 0)
+				repl_node.epoch = repl_node.snapshot_epoch;
+			return;
+	}
+
+	repl_node.conn.broken = true;
+}
+
+/**
+ * Handle libev IO event of the connection between primary and standby
+ */
+static void repl_cb(EV_P_ ev_io *w, int revents)
+{
+	struct repl_hdr hdr;
+	const uint8_t *payload;
+	bool handled = false;
+
+	if (repl_node.connecting)
+	{
+		if (!repl_connected(w->fd))
+		{
+			if (debug)
+				dhcpd_error(0, errno, "Could not connect to primary");
+			repl_close(EV_A);
+			return;
+		}
+
+		if (debug)
+			log_printf("Connected to primary");
+
+		repl_node.connecting = false;
+		repl_node.last_rx = ev_now(EV_A);
+		repl_conn_hello(&repl_node.conn, REPL_HELLO, repl_node.epoch,
+			repl_node.next_seq);
+	}
+	else if (revents & EV_READ)
+	{
+		if (!repl_conn_read(&repl_node.conn))
+		{
+			log_printf("Replication peer closed the connection");
+			repl_close(EV_A);
+			return;
+		}
+
+		if (repl_node.standby)
+			repl_node.last_rx = ev_now(EV_A);
+
+		while (!repl_node.conn.broken &&
+				repl_conn_next(&repl_node.conn, &hdr, &payload))
+		{
+			if (repl_node.standby)
+				repl_standby_handle(&hdr, payload);
+			else
+				repl_primary_handle(&hdr, payload);
+			handled = true;
+		}
+
+		if (repl_node.conn.broken)
+		{
+			dhcpd_error(0, 0, "Invalid replication message, closing connection");
+			repl_close(EV_A);
+			return;
+		}
+
+		if (handled && repl_node.standby)
+			repl_conn_send(&repl_node.conn, REPL_ACK, repl_node.next_seq);
+	}
+
+	if (!repl_conn_flush(&repl_node.conn))
+	{
+		repl_close(EV_A);
+		return;
+	}
+
+	repl_watch(EV_A);
+}
+
+/**
+ * Send records logged during this loop iteration to the standby
+ */
+static void repl_prepare_cb(EV_P_ ev_prepare *w, int revents)
+{
+	(void)w;
+	(void)revents;
+
+	if (!repl_node.streaming)
+		return;
+
+	if (repl_node.sent_seq == repl_node.log.next_seq &&
+			!repl_conn_pending(&repl_node.conn))
+		return;
+
+	if (!repl_log_has(&repl_node.log, repl_node.sent_seq))
+	{
+		dhcpd_error(0, 0, "Standby fell behind the replication log");
+		++stats.repl_lag_drops;
+		repl_close(EV_A);
+		return;
+	}
+
+	if (!repl_conn_fill(&repl_node.conn, &repl_node.log, &repl_node.sent_seq) ||
+			!repl_conn_flush(&repl_node.conn))
+	{
+		repl_close(EV_A);
+		return;
+	}
+
+	repl_watch(EV_A);
+}
+
+/**
+ * Accept connection of a standby, which replaces the one before
+ */
+static void repl_accept_cb(EV_P_ ev_io *w, int revents)
+{
+	(void)revents;
+
+	int fd;
+
+	while ((fd = repl_accept(w->fd)) >= 0)
+	{
+		repl_close(EV_A);
+		repl_conn_init(&repl_node.conn, fd);
+
+		ev_io_init(&repl_node.conn_watch, repl_cb, fd, EV_READ);
+		ev_io_start(EV_A_ &repl_node.conn_watch);
+	}
+}
+
+/**
+ * Start logging mutations and accept a standby
+ */
+static bool repl_primary_start(EV_P)
+{
+	if (!repl_log_init(&repl_node.log, REPL_LOG_BYTES, REPL_LOG_RECORDS))
+		return false;
+
+	if ((repl_node.listen_fd = repl_listen(&cfg.replicate)) < 0)
+		return false;
+
+	ev_io_init(&repl_node.listen_watch, repl_accept_cb, repl_node.listen_fd,
+		EV_READ);
+	ev_io_start(EV_A_ &repl_node.listen_watch);
+
+	return true;
+}
+
+/**
+ * Start replication again after repl_stop() in the role it had before
+ */
+static void repl_restart(EV_P)
+{
+	if (cfg.standby.sin_port == 0 && cfg.replicate.sin_port == 0)
+		return;
+
+	if (!repl_node.standby && !repl_primary_start(EV_A))
+		dhcpd_error(0, errno, "Could not listen for a standby");
+
+	ev_timer_again(EV_A_ &repl_node.timer_watch);
+	ev_prepare_start(EV_A_ &repl_node.prepare_watch);
+}
+
+/**
+ * Take over from a primary, which stopped sending heartbeats
+ */
+static void repl_promote(EV_P)
+{
+	log_printf("Primary was silent for %u seconds, taking over",
+		cfg.repllag);
+
+	repl_close(EV_A);
+	repl_node.standby = false;
+
+	if (cfg.replicate.sin_port != 0 && !repl_primary_start(EV_A))
+		dhcpd_error(0, errno, "Could not accept a standby");
+}
+
+/**
+ * Send heartbeats and drop a lagging standby as primary, connect and detect
+ * failure of the primary as standby
+ */
+static void repl_timer_cb(EV_P_ ev_timer *timer, int revents)
+{
+	(void)timer;
+	(void)revents;
+
+	ev_tstamp now = ev_now(EV_A);
+
+	if (repl_node.standby)
+	{
+		/* Only a standby, which has all leases, may take over */
+		if (repl_node.epoch != 0 && now - repl_node.last_rx > cfg.repllag)
+		{
+			repl_promote(EV_A);
+			return;
+		}
+
+		if (repl_node.conn.fd >= 0)
+			return;
+
+		int fd = repl_connect(&cfg.standby);
+		if (fd < 0)
+		{
+			if (debug)
+				dhcpd_error(0, errno, "Could not connect to primary");
+			return;
+		}
+
+		repl_conn_init(&repl_node.conn, fd);
+		repl_node.connecting = true;
+
+		ev_io_init(&repl_node.conn_watch, repl_cb, fd, EV_WRITE);
+		ev_io_start(EV_A_ &repl_node.conn_watch);
+		return;
+	}
+
+	if (!repl_node.streaming)
+		return;
+
+	if (repl_node.acked_seq < repl_node.log.next_seq)
+	{
+		if (repl_node.lag_since == 0)
+		{
+			repl_node.lag_since = now;
+			repl_node.lag_seq = repl_node.log.next_seq;
+		}
+		else if (now - repl_node.lag_since > cfg.repllag)
+		{
+			dhcpd_error(0, 0, "Standby lags behind for more than %u seconds",
+				cfg.repllag);
+			++stats.repl_lag_drops;
+			repl_close(EV_A);
+			return;
+		}
+	}
+
+	repl_conn_send(&repl_node.conn, REPL_HEARTBEAT, repl_node.log.next_seq);
+}
+
+/* State of the daemon, which control requests act on besides the store */
+struct control_server
+{
+	/* UDP socket */
+	int sock;
+	/* Watcher, which consumes DHCP messages */
+	ev_io *rx_watch;
+	/* Lease garbage collection, NULL if disabled */
+	ev_timer *gc_watch;
+	/* Watcher of the listening control socket and its path */
+	ev_io *accept_watch;
+	const char *path;
+	const char *db_path;
+	/* Set after the UDP socket was handed over to a new process */
+	bool handed_over;
+} control_server = {
+	.sock = -1,
+	.rx_watch = NULL,
+	.gc_watch = NULL,
+	.accept_watch = NULL,
+	.path = NULL,
+	.db_path = NULL,
+	.handed_over = false
+};
+
+/* Connection to the control socket */
+struct control_client
+{
+	ev_io watch;
+	/* Shut down as soon as all responses were sent */
+	bool shutdown;
+	/* The socket was handed over to the process at the other end */
+	bool handover;
+	struct control_conn conn;
+};
+
+/**
+ * Find lease by a control key, ids and hardware addresses of leases with a
+ * client identifier are looked up by a linear scan
+ */
+static struct store_lease *control_find(const struct control_key_val *k)
+{
+	switch (k->kind)
+	{
+		case CONTROL_KEY_HWADDR:
+			return store_by_hwaddr(&store, k->hwaddr);
+		case CONTROL_KEY_CLIENTID:
+			return store_by_key(&store, &k->clientid, dhcp_key_hash(&k->clientid));
+		case CONTROL_KEY_ADDRESS:
+			return store_by_address(&store, (struct in_addr){ k->address });
+		case CONTROL_KEY_ID:
+			for (uint32_t i = 0; i < store.leases_cnt; ++i)
+				if (store.leases[i].id == k->id)
+					return &store.leases[i];
+			break;
+	}
+
+	return NULL;
+}
+
+/**
+ * Delete lease from the store and queue its deletion from the database
+ */
+static void control_remove(struct store_lease *sl)
+{
+	persist_del(sl->id);
+	repl_lease_del(sl);
+	store_remove(&store, sl);
+}
+
+/**
+ * Check comma separated address list, NULL is valid
+ */
+static bool control_iplist_valid(const char *in)
+{
+	struct in_addr *list = NULL;
+	size_t list_cnt = 0;
 
-	*options = DHCP_OPT_END;
-	DHCP_OPT_CONT(options, send_len);
+	if (in == NULL)
+		return true;
 
-	if (debug)
-		msg_debug(&((struct dhcp_msg){.data = send_buffer, .length = send_len }), 1);
-	err = sendto(w->fd,
-		send_buffer, send_len,
-		MSG_DONTWAIT, (struct sockaddr *)&broadcast, sizeof broadcast);
+	bool valid = iplist_parse(in, &list, &list_cnt, NULL);
+	free(list);
+	return valid;
+}
 
-	if (err < 0)
-		dhcpd_error(0, 1, "Could not send DHCPACK");
+/**
+ * Add lease to the database and the store
+ *
+ * @return 0 or errno value
+ */
+static int control_add(EV_P_ struct control_lease *cl)
+{
+	if (cl->key.len == 0)
+		dhcp_key_from_hwaddr(&cl->key, cl->hwaddr);
+
+	if (cl->prefixlen > 32 || cl->address == INADDR_ANY)
+		return EINVAL;
+
+	/* Leases with broken lists would be rejected on every request */
+	if (!control_iplist_valid(cl->routers) ||
+			!control_iplist_valid(cl->nameservers))
+		return EINVAL;
+
+	if (store_by_key(&store, &cl->key, dhcp_key_hash(&cl->key)) != NULL ||
+			store_by_address(&store, (struct in_addr){ cl->address }) != NULL)
+		return EEXIST;
+
+	if (cl->allocated && cl->allocated_at == 0)
+		cl->allocated_at = (time_t)ev_now(EV_A);
+
+	char address[INET_ADDRSTRLEN];
+	char hwaddr[MAC_ADDRSTRLEN];
+	inet_ntop(AF_INET, &cl->address, address, sizeof address);
+	mac_ntop((const char *)cl->hwaddr, hwaddr, sizeof hwaddr);
+
+	cl->id = store.next_id;
+
+	struct db_lease db_lease = {
+		.id = cl->id,
+		.address = address,
+		.prefixlen = cl->prefixlen,
+		.hwaddr = hwaddr,
+		.routers = (char *)cl->routers,
+		.nameservers = (char *)cl->nameservers,
+		.leasetime = cl->leasetime,
+		.allocated = cl->allocated,
+		.allocated_at = cl->allocated_at,
+		.clientid = cl->key
+	};
 
+	struct store_lease sl = {
+		.id = cl->id,
+		.address = cl->address,
+		.prefixlen = cl->prefixlen,
+		.allocated = cl->allocated,
+		.leasetime = cl->leasetime,
+		.allocated_at = cl->allocated_at,
+		.key = cl->key
+	};
+	ARRAY_COPY(sl.hwaddr, cl->hwaddr, 6);
 
-finalize:
-	if (unalloc_lease)
+	struct store_lease *inserted = store_insert(&store, &sl, cl->routers,
+		cl->nameservers);
+	if (inserted == NULL)
 	{
-		if (lease.routers)
-			free(lease.routers);
-		if (lease.nameservers)
-			free(lease.nameservers);
+		dhcpd_error(0, errno, "Could not add lease %u to store", cl->id);
+		return ENOMEM;
 	}
-	db_lease_free(&db_lease);
 
-	return;
+	persist_put(&db_lease);
+	repl_lease_put(inserted);
+
+	return 0;
 }
 
 /**
- * Handle DHCPRELEASE request and release the lease if it was allocated
+ * Stop taking DHCP messages from the socket and handle all messages, which
+ * were taken already, so that an image of the store written next holds
+ * every lease they changed
  */
-static void release_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+static void control_rx_stop(EV_P)
 {
-	(void)EV_A;
-	(void)w;
-
-	int sqlerr;
-
-	struct db_lease db_lease = DB_LEASE_EMPTY;
+	ev_io_stop(EV_A_ control_server.rx_watch);
 
-	sqlerr = db_lease_by_hwaddr(leasedb, &db_lease, msg->chaddr);
+	/* The multishot receive would keep taking messages from the shared
+	 * socket, the ones it took already are queued as well */
+	bool more = false;
 
-	if (sqlerr != SQLITE_OK)
+	if (uring.fd >= 0)
 	{
-		dhcpd_error(0, 0, "sqlite3: %s", sqlite3_errstr(sqlerr));
-		goto finalize;
+		uring_stop(&uring);
+		more = uring_queue();
 	}
 
-	if (db_lease.allocated == false)
-		goto finalize;
-
-	sqlerr = db_lease_delete(leasedb, &db_lease);
-	if (sqlerr != SQLITE_OK)
+	while (more || ingress_pending(&ingress))
 	{
-		dhcpd_error(0, 0, "sqlite3: %s", sqlite3_errstr(sqlerr));
-		goto finalize;
+		ingress_run(EV_A_ ingress_watch.data);
+		if (more)
+			more = uring_queue();
 	}
-
-finalize:
-	db_lease_free(&db_lease);
+	ev_idle_stop(EV_A_ &ingress_watch);
 }
 
 /**
- * Handle DHCPDECLINE request and do nothing at the moment
+ * Take DHCP messages from the socket again after control_rx_stop()
  */
-static void decline_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+static void control_rx_start(EV_P)
 {
-	(void)EV_A;
-	(void)w;
-	(void)msg;
+	if (uring.fd >= 0)
+		uring_start(&uring);
+	ev_io_start(EV_A_ control_server.rx_watch);
 }
 
 /**
- * Handle DHCPINFORM request and reply with the correct information
+ * Pass UDP socket and an image of the store to the process at the other end
+ * of a control connection and stop handling messages. Messages, which arrive
+ * from now on, queue up in the socket until the new process reads them.
+ *
+ * @return 0 if the response was sent or errno value
  */
-static void inform_cb(EV_P_ ev_io *w, struct dhcp_msg *msg)
+static int control_handover(EV_P_ struct control_client *cc)
 {
-	(void)EV_A;
+	/* Responses to earlier requests must be sent before the descriptors */
+	if (!control_conn_flush(&cc->conn) || cc->conn.out_len != 0)
+		return EAGAIN;
 
-	int sqlerr;
+	control_rx_stop(EV_A);
 
-	struct db_lease db_lease = DB_LEASE_EMPTY;
+	int err = 0;
+	FILE *image = NULL;
 
-	sqlerr = db_lease_by_hwaddr(leasedb, &db_lease, msg->chaddr);
-	if (sqlerr  != SQLITE_OK)
+	/* The image is only valid together with the committed database */
+	if (!persist_sync())
 	{
-		dhcpd_error(0, 0, "sqlite3: %s", sqlite3_errstr(sqlerr));
-		return;
+		err = EIO;
+		goto error;
 	}
 
-	struct dhcp_lease lease = DHCP_LEASE_EMPTY;
-	bool unalloc_lease = false;
-
-	if (!db_lease.id)
+	if ((image = tmpfile()) == NULL)
 	{
-no_specific_lease:
-		if (!cfg.argv->allocate)
-			goto finalize;
-		lease = (struct dhcp_lease){
-			.routers = cfg.routers,
-			.routers_cnt = cfg.routers_cnt,
-			.nameservers = cfg.nameservers,
-			.nameservers_cnt = cfg.nameservers_cnt,
-			.prefixlen = 0,
-			.leasetime = 0
-		};
-		goto ack;
+		err = errno;
+		goto error;
 	}
 
-	unalloc_lease = true;
-
-	if (db_lease.routers)
-		if (!iplist_parse(db_lease.routers, &lease.routers, &lease.routers_cnt))
-			goto no_specific_lease;
-
-	if (db_lease.nameservers)
-		if (!iplist_parse(db_lease.nameservers, &lease.nameservers, &lease.nameservers_cnt))
-			goto no_specific_lease;
+	if (!store_save_fd(&store, fileno(image), control_server.db_path))
+	{
+		err = errno ? errno : EIO;
+		goto error;
+	}
 
-	size_t send_len;
-	uint8_t *options;
-ack:
-	dhcp_msg_reply(send_buffer, &options, &send_len, msg, DHCPACK);
+	int fds[CONTROL_HANDOVER_FDS] = { control_server.sock, fileno(image) };
+	if (!control_conn_reply_fds(&cc->conn, CONTROL_HANDOVER, fds,
+			CONTROL_HANDOVER_FDS))
+	{
+		err = EIO;
+		goto error;
+	}
 
-	options = dhcp_opt_add_lease(options, &send_len, &lease);
+	fclose(image);
 
-	*options = DHCP_OPT_END;
-	DHCP_OPT_CONT(options, send_len);
+	if (control_server.gc_watch)
+		ev_timer_stop(EV_A_ control_server.gc_watch);
+	/* The new process accepts the standby or follows the primary */
+	repl_stop(EV_A);
+	control_server.handed_over = true;
+	cc->handover = true;
 
 	if (debug)
-		msg_debug(&((struct dhcp_msg){.data = send_buffer, .length = send_len }), 1);
-	int err = sendto(w->fd,
-		send_buffer, send_len,
-		MSG_DONTWAIT, msg->source, sizeof(struct sockaddr_in));
+		log_printf("Handed over %u leases, waiting for the new process",
+			store.leases_cnt);
 
-	if (err < 0)
-		dhcpd_error(0, 1, "Could not send DHCPACK");
+	return 0;
 
-finalize:
-	if (unalloc_lease)
-	{
-		if (lease.routers)
-			free(lease.routers);
-		if (lease.nameservers)
-			free(lease.nameservers);
-	}
-	
-	db_lease_free(&db_lease);
+error:
+	if (image != NULL)
+		fclose(image);
+	control_rx_start(EV_A);
+	return err;
 }
 
 /**
- * Handle libev IO event to socket and call the correct message type
- * handler.
+ * Handle one request of a control connection and queue its response
  */
-static void req_cb(EV_P_ ev_io *w, int revents)
+static void control_handle(EV_P_ struct control_client *cc,
+	const struct control_hdr *hdr, const uint8_t *payload)
 {
-	(void)revents;
+	uint8_t resp[CONTROL_PAYLOAD_MAX];
+	size_t resp_len = 0;
+	int status = 0;
 
-	sqlite3_exec(leasedb, "BEGIN;", NULL, NULL, NULL);
+	struct control_lease cl;
+	struct control_key_val key;
+	struct store_lease *sl;
 
-	/* Initialize address struct passed to recvfrom */
-	struct sockaddr_in src_addr = {
-		.sin_addr = {INADDR_ANY}
-	};
-	socklen_t src_addrlen = AF_INET;
-
-	/* Receive data from socket */
-	ssize_t recvd = recvfrom(
-		w->fd,
-		recv_buffer,
-		RECV_BUF_LEN,
-		MSG_DONTWAIT,
-		(struct sockaddr * restrict)&src_addr, &src_addrlen);
-
-	/* Detect errors */
-	if (recvd < 0)
-		return;
-	/* Detect too small messages */
-	if (recvd < DHCP_MSG_HDRLEN)
+	/* The new process owns the leases after a handover */
+	if (control_server.handed_over && hdr->op != CONTROL_SHUTDOWN &&
+			hdr->op != CONTROL_STATS)
+	{
+		control_conn_reply(&cc->conn, hdr->op, EBUSY, NULL, 0);
 		return;
-	/* Check magic value */
-	uint8_t *magic = DHCP_MSG_F_MAGIC(recv_buffer);
-	if (!DHCP_MSG_MAGIC_CHECK(magic))
+	}
+
+	/* A standby only changes leases as the primary says */
+	if (repl_node.standby && (hdr->op == CONTROL_LEASE_ADD ||
+			hdr->op == CONTROL_LEASE_REMOVE || hdr->op == CONTROL_FLUSH))
+	{
+		control_conn_reply(&cc->conn, hdr->op, EROFS, NULL, 0);
 		return;
+	}
 
-	/* Convert addresses to strings */
-	char ciaddr[INET_ADDRSTRLEN],
-			 yiaddr[INET_ADDRSTRLEN],
-			 siaddr[INET_ADDRSTRLEN],
-			 giaddr[INET_ADDRSTRLEN],
-			 chaddr[MAC_ADDRSTRLEN],
-			 srcaddr[INET_ADDRSTRLEN];
-
-	inet_ntop(AF_INET, DHCP_MSG_F_CIADDR(recv_buffer), ciaddr, sizeof ciaddr);
-	inet_ntop(AF_INET, DHCP_MSG_F_YIADDR(recv_buffer), yiaddr, sizeof yiaddr);
-	inet_ntop(AF_INET, DHCP_MSG_F_SIADDR(recv_buffer), siaddr, sizeof siaddr);
-	inet_ntop(AF_INET, DHCP_MSG_F_GIADDR(recv_buffer), giaddr, sizeof giaddr);
-	inet_ntop(AF_INET, &src_addr.sin_addr, srcaddr, sizeof srcaddr);
-	mac_ntop(DHCP_MSG_F_CHADDR(recv_buffer), chaddr, sizeof chaddr);
-
-	/* Extract message type from options */
-	uint8_t *options = DHCP_MSG_F_OPTIONS(recv_buffer);
-	struct dhcp_opt current_option;
+	switch (hdr->op)
+	{
+		case CONTROL_LEASE_ADD:
+			if (!control_lease_unpack(payload, hdr->len, &cl))
+			{
+				status = EINVAL;
+				break;
+			}
+			if ((status = control_add(EV_A_ &cl)) == 0)
+				resp_len = control_lease_pack(resp, sizeof resp, &cl);
+			break;
 
-	enum dhcp_msg_type msg_type = 0;
+		case CONTROL_LEASE_REMOVE:
+		case CONTROL_LEASE_GET:
+			if (!control_key_unpack(payload, hdr->len, &key))
+				status = EINVAL;
+			else if ((sl = control_find(&key)) == NULL)
+				status = ENOENT;
+			else if (hdr->op == CONTROL_LEASE_REMOVE)
+				control_remove(sl);
+			else
+			{
+				lease_to_control(sl, &cl);
+				resp_len = control_lease_pack(resp, sizeof resp, &cl);
+			}
+			break;
 
-	while (dhcp_opt_next(&options, &current_option, (uint8_t*)(recv_buffer + recvd)))
-		if (current_option.code == 53)
-			msg_type = (enum dhcp_msg_type)current_option.data[0];
+		case CONTROL_FLUSH:
+		{
+			uint32_t cnt = 0;
 
-	struct dhcp_msg msg = {
-		.data = recv_buffer,
-		.end = recv_buffer + recvd,
-		.length = recvd,
-		.type = msg_type,
-		.ciaddr = ciaddr,
-		.yiaddr = yiaddr,
-		.siaddr = siaddr,
-		.giaddr = giaddr,
-		.chaddr = chaddr,
-		.srcaddr = srcaddr,
-		.source = (struct sockaddr *)&src_addr,
-		.sid = (struct sockaddr_in *)&server_id
-	};
+			/* Exactly the allocated leases are on the expiry heap */
+			while ((sl = store_next_expiry(&store)) != NULL)
+			{
+				control_remove(sl);
+				++cnt;
+			}
 
-	if (debug)
-		msg_debug(&msg, 0);
+			cnt = htonl(cnt);
+			memcpy(resp, &cnt, sizeof cnt);
+			resp_len = sizeof cnt;
+			break;
+		}
 
-	switch (msg_type)
-	{
-		case DHCPDISCOVER:
-			discover_cb(EV_A_ w, &msg);
+		case CONTROL_COMMIT:
+			if (!persist_sync())
+				status = EIO;
 			break;
 
-		case DHCPREQUEST:
-			request_cb(EV_A_ w, &msg);
+		case CONTROL_STATS:
+		{
+			stats_collect(control_server.sock);
+
+			FILE *stream = fmemopen(resp, sizeof resp, "w");
+			if (stream == NULL)
+			{
+				status = errno;
+				break;
+			}
+			stats_dump(stream);
+			resp_len = ftell(stream);
+			fclose(stream);
 			break;
+		}
 
-		case DHCPRELEASE:
-			release_cb(EV_A_ w, &msg);
+		case CONTROL_SHUTDOWN:
+			cc->shutdown = true;
 			break;
 
-		case DHCPDECLINE:
-			decline_cb(EV_A_ w, &msg);
+		case CONTROL_HANDOVER:
+			if ((status = control_handover(EV_A_ cc)) == 0)
+				return;
 			break;
 
-		case DHCPINFORM:
-			inform_cb(EV_A_ w, &msg);
+		case CONTROL_LOADBALANCE:
+			if (hdr->len > 0 &&
+					!control_lb_unpack(payload, hdr->len, &cfg.loadbalance))
+			{
+				status = EINVAL;
+				break;
+			}
+			control_lb_pack(resp, &cfg.loadbalance);
+			resp_len = CONTROL_LBLEN;
+			break;
+
+		case CONTROL_CLASSES:
+		{
+			uint32_t first = 0;
+
+			if (hdr->len == sizeof first)
+				memcpy(&first, payload, sizeof first);
+			else if (hdr->len != 0)
+			{
+				status = EINVAL;
+				break;
+			}
+
+			for (size_t i = ntohl(first); i < cfg.classes.rules_cnt; ++i)
+			{
+				const struct class_rule *r = &cfg.classes.rules[i];
+				int n = snprintf((char *)resp + resp_len, sizeof resp - resp_len,
+					"%s %llu\n", r->name, (unsigned long long)r->hits);
+
+				if (n < 0 || (size_t)n >= sizeof resp - resp_len)
+					break;
+				resp_len += n;
+			}
 			break;
+		}
 
 		default:
-			fprintf(stderr, BROKEN_SOFTWARE_NOTIFICATION);
-			msg_debug(&msg, 0);
+			status = EOPNOTSUPP;
 			break;
 	}
+
+	if (status != 0)
+		resp_len = 0;
+
+	control_conn_reply(&cc->conn, hdr->op, status, resp, resp_len);
 }
 
 /**
- * Break event loop to force a shutdown
+ * Serve again after a handover, whose new process went away without asking
+ * for the shutdown, e.g. because it failed to start
  */
-static void sigint_cb(EV_P_ ev_signal *sig, int revents)
+static void control_handback(EV_P)
 {
-	(void)revents;
-	(void)EV_A;
-	(void)sig;
+	control_server.handed_over = false;
 
-	ev_break(EV_A_ EVBREAK_ALL);
+	/* The new process may have bound the path already */
+	int fd = control_listen(control_server.path, false);
+	if (fd >= 0)
+	{
+		ev_io_stop(EV_A_ control_server.accept_watch);
+		close(control_server.accept_watch->fd);
+		ev_io_set(control_server.accept_watch, fd, EV_READ);
+		ev_io_start(EV_A_ control_server.accept_watch);
+	}
+	else
+		dhcpd_error(0, errno, "Could not create control socket %s",
+			control_server.path);
+
+	control_rx_start(EV_A);
+	if (control_server.gc_watch)
+		ev_timer_again(EV_A_ control_server.gc_watch);
+	repl_restart(EV_A);
+
+	log_printf("Handover aborted, serving %u leases again", store.leases_cnt);
 }
 
-/**
- * Commit current transaction
- */
-static void sigusr1_cb(EV_P_ ev_signal *sig, int revents)
+static void control_close(EV_P_ struct control_client *cc)
 {
-	(void)revents;
-	(void)EV_A;
-	(void)sig;
+	if (cc->handover && !cc->shutdown && control_server.handed_over)
+		control_handback(EV_A);
 
-	sqlite3_exec(leasedb, "COMMIT;", NULL, NULL, NULL);
+	ev_io_stop(EV_A_ &cc->watch);
+	close(cc->conn.fd);
+	free(cc);
 }
 
 /**
- * Rollback current transaction
+ * Handle libev IO event of a control connection. All buffered requests are
+ * handled in one go, their lease mutations are queued for the persistence
+ * thread like the ones of DHCP messages and written in its batches.
+ * Reading pauses while responses can't be sent.
  */
-static void sigusr2_cb(EV_P_ ev_signal *sig, int revents)
+static void control_client_cb(EV_P_ ev_io *w, int revents)
 {
-	(void)revents;
-	(void)EV_A;
-	(void)sig;
+	struct control_client *cc = (struct control_client *)w;
+	struct control_hdr hdr;
+	const uint8_t *payload;
+	bool writable;
+
+	if ((revents & EV_READ) && !control_conn_read(&cc->conn))
+	{
+		control_close(EV_A_ cc);
+		return;
+	}
+
+	/* Pipelined requests, which didn't fit into the output buffer, are
+	 * handled as soon as the responses before them were sent, either
+	 * right away or when the connection becomes writable */
+	do
+	{
+		while ((writable = control_conn_writable(&cc->conn)) &&
+				control_conn_next(&cc->conn, &hdr, &payload))
+			control_handle(EV_A_ cc, &hdr, payload);
+
+		if (cc->conn.broken || !control_conn_flush(&cc->conn))
+		{
+			control_close(EV_A_ cc);
+			return;
+		}
+	}
+	while (!writable && cc->conn.out_len == 0);
+
+	int events = cc->conn.out_len > 0 ? EV_WRITE : EV_READ;
+
+	if (events != (cc->watch.events & (EV_READ | EV_WRITE)))
+	{
+		ev_io_stop(EV_A_ &cc->watch);
+		ev_io_set(&cc->watch, cc->conn.fd, events);
+		ev_io_start(EV_A_ &cc->watch);
+	}
 
-	sqlite3_exec(leasedb, "ROLLBACK;", NULL, NULL, NULL);
+	if (cc->shutdown && cc->conn.out_len == 0)
+		ev_break(EV_A_ EVBREAK_ALL);
 }
 
 /**
- * Garbage collection for old leases
+ * Accept connections to the control socket
  */
-static void leasegc_cb(EV_P_ ev_timer *timer, int revents)
+static void control_accept_cb(EV_P_ ev_io *w, int revents)
 {
 	(void)revents;
 
-	sqlite3_stmt *stmt, *drop_stmt;
-	int sqlerr = 0;
-	struct db_lease lease;
-
-	sqlerr = sqlite3_prepare_v2(leasedb,
-		"DELETE FROM leases\n"
-		"WHERE id = ?;\n", -1, &drop_stmt, NULL);
-	if (sqlerr != SQLITE_OK)
-		return;
-
-	sqlerr = sqlite3_prepare_v2(leasedb,
-		"SELECT " DB_COLUMNS "\n"
-		"FROM leases\n"
-		"WHERE allocated = 1;\n", -1, &stmt, NULL);
-	if (sqlerr != SQLITE_OK)
-		return;
+	int fd;
 
-	while ((sqlerr = sqlite3_step(stmt)) == SQLITE_ROW)
+	while ((fd = accept(w->fd, NULL, NULL)) >= 0)
 	{
-		db_lease_from_stmt(stmt, &lease);
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
 
-		time_t expired_after = lease.allocated_at + lease.leasetime +
-			((lease.leasetime > timer->repeat) ? timer->repeat : lease.leasetime);
-		if (ev_now(EV_A) > expired_after)
+		struct control_client *cc = malloc(sizeof *cc);
+		if (cc == NULL)
 		{
-			if (debug)
-				fprintf(stderr, "Removing lease %d for %s\n", lease.id, lease.address);
-			sqlite3_bind_int(drop_stmt, 1, lease.id);
-			sqlite3_step(drop_stmt);
-			sqlite3_reset(drop_stmt);
+			dhcpd_error(0, errno, "Could not allocate control connection");
+			close(fd);
+			continue;
 		}
-	}
 
-	if (sqlerr != SQLITE_DONE)
-		dhcpd_error(0, 0, "sqlite3: %s", sqlite3_errmsg(leasedb));
-	
-	sqlite3_finalize(stmt);
-	sqlite3_finalize(drop_stmt);
+		cc->shutdown = false;
+		cc->handover = false;
+		cc->conn = (struct control_conn){ .fd = fd };
+
+		ev_io_init(&cc->watch, control_client_cb, fd, EV_READ);
+		ev_io_start(EV_A_ &cc->watch);
+	}
 }
 
 int main(int argc, char **argv)
@@ -757,7 +2399,7 @@ int main(int argc, char **argv)
 	}
 
 	if (!config_fill(&cfg, &argv_cfg))
-		dhcpd_error(1, 0, cfg.error);
+		dhcpd_error(1, 0, "%s", cfg.error);
 
 	if (argv_cfg.user != NULL)
 	{
@@ -807,7 +2449,6 @@ int main(int argc, char **argv)
 	broadcast.sin_port = htons(68);
 	/* Clear IO buffers */
 	memset(send_buffer, 0, ARRAY_LEN(send_buffer));
-	memset(recv_buffer, 0, ARRAY_LEN(recv_buffer));
 
 	if (argv_cfg._new && !argv_cfg.allocate)
 		dhcpd_error(0, 0, "Hint: -new doesn't make any sense without -allocate");
@@ -828,14 +2469,95 @@ int main(int argc, char **argv)
 	if (argv_cfg.debug)
 		debug = true;
 
+	if (!log_init(stderr))
+		dhcpd_error(1, errno, "Could not start logging thread");
+
+	if (cfg.ratelimit[0] > 0)
+		if (!ratelimit_init(&client_rl, cfg.ratelimit[0], cfg.ratelimit[1]))
+			dhcpd_error(1, errno, "Could not allocate client rate limiter");
+
+	if (cfg.relayratelimit[0] > 0)
+		if (!ratelimit_init(&relay_rl, cfg.relayratelimit[0], cfg.relayratelimit[1]))
+			dhcpd_error(1, errno, "Could not allocate relay rate limiter");
+
 	if (sqlite3_open(argv_cfg.db, &leasedb) != SQLITE_OK)
 		dhcpd_error(1, 0, "Error while opening lease database: %s", sqlite3_errmsg(leasedb));
 
 	if (argv_cfg._new)
 		db_init(leasedb);
+	else if (db_migrate(leasedb) != SQLITE_OK)
+		dhcpd_error(1, 0, "Could not migrate lease database: %s", sqlite3_errmsg(leasedb));
 
-	int sock;
-	if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+	/* The receive ring has to exist before the old process stops reading */
+	if (argv_cfg.rxring)
+		if (!ring_rx_open(&ring_rx, if_nametoindex(argv_cfg.interface)))
+			dhcpd_error(1, errno, "Could not set up receive ring on %s", argv_cfg.interface);
+
+	int sock = -1, image = -1, takeover = -1;
+	if (argv_cfg.takeover)
+	{
+		if ((takeover = control_connect(argv_cfg.takeover)) < 0)
+			dhcpd_error(1, errno, "Could not connect to %s", argv_cfg.takeover);
+
+		struct control_hdr hdr;
+		static uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+		int fds[CONTROL_HANDOVER_FDS];
+		size_t fds_cnt = CONTROL_HANDOVER_FDS;
+
+		if (!control_request_fds(takeover, CONTROL_HANDOVER, NULL, 0, &hdr, resp,
+				fds, &fds_cnt))
+			dhcpd_error(1, errno, "Could not take over from %s", argv_cfg.takeover);
+		if (hdr.status != 0)
+			dhcpd_error(1, hdr.status, "Could not take over from %s", argv_cfg.takeover);
+		if (fds_cnt != CONTROL_HANDOVER_FDS)
+			dhcpd_error(1, 0, "Could not take over from %s: Got %zu descriptors",
+				argv_cfg.takeover, fds_cnt);
+
+		sock = fds[0];
+		image = fds[1];
+	}
+
+	if (!store_init(&store, &cfg.ranges, cfg.gc))
+		dhcpd_error(1, errno, "Could not allocate lease store");
+
+	if (!ingress_init(&ingress))
+		dhcpd_error(1, errno, "Could not allocate ingress queues");
+
+	if (!arena_init(&msg_arena, ARENA_SIZE))
+		dhcpd_error(1, errno, "Could not allocate message arena");
+
+	if (image >= 0 && store_load_fd(&store, image, argv_cfg.db))
+	{
+		if (debug)
+			log_printf("Took over %u leases", store.leases_cnt);
+	}
+	else if (argv_cfg.cache && store_load_cache(&store, argv_cfg.cache, argv_cfg.db))
+	{
+		if (debug)
+			log_printf("Loaded %u leases from %s", store.leases_cnt, argv_cfg.cache);
+	}
+	else
+	{
+		int sqlerr = store_load(&store, leasedb);
+		if (sqlerr != SQLITE_OK)
+			dhcpd_error(1, 0, "Could not load leases: %s", sqlite3_errstr(sqlerr));
+	}
+
+	/* Changes of other processes invalidate the cache file */
+	int64_t data_version = db_data_version(leasedb);
+
+	/* From now on, the database is written by the persistence thread */
+	if (!persist_init(leasedb))
+		dhcpd_error(1, errno, "Could not start persistence thread");
+
+	if (image >= 0)
+		close(image);
+
+	if (argv_cfg.capture)
+		if (!capture_open(&capture, argv_cfg.capture, cfg.capturesample))
+			dhcpd_error(1, errno, "Could not create capture file %s", argv_cfg.capture);
+
+	if (sock < 0 && (sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
 		dhcpd_error(1, errno, "Could not create socket");
 
 	struct sockaddr_in bind_addr = {
@@ -845,6 +2567,8 @@ int main(int argc, char **argv)
 	};
 
 	struct ifaddrs *ifaddrs, *ifa;
+	bool have_server_id = false, have_hwaddr = false;
+	uint8_t hwaddr[6];
 
 	if (getifaddrs(&ifaddrs) == -1)
 		dhcpd_error(1, errno, "Could not get interface information");
@@ -854,38 +2578,100 @@ int main(int argc, char **argv)
 		if (ifa->ifa_addr == NULL)
 			continue;
 
-		if (ifa->ifa_addr->sa_family == AF_INET &&
-				strcmp(ifa->ifa_name, argv_cfg.interface) == 0)
+		if (strcmp(ifa->ifa_name, argv_cfg.interface) != 0)
+			continue;
+
+		if (ifa->ifa_addr->sa_family == AF_INET && !have_server_id)
 		{
 			struct sockaddr_in *ifa_addr_in = (struct sockaddr_in *)ifa->ifa_addr;
 			server_id = *ifa_addr_in;
-			break;
+			have_server_id = true;
+		}
+#ifdef __linux__
+		else if (ifa->ifa_addr->sa_family == AF_PACKET && !have_hwaddr)
+		{
+			struct sockaddr_ll *ifa_addr_ll = (struct sockaddr_ll *)ifa->ifa_addr;
+			if (ifa_addr_ll->sll_halen == 6)
+			{
+				ARRAY_COPY(hwaddr, ifa_addr_ll->sll_addr, 6);
+				have_hwaddr = true;
+			}
 		}
+#endif
 	}
 
 	freeifaddrs(ifaddrs);
 
-	if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (int[]){1}, sizeof(int)) != 0)
-		dhcpd_error(1, errno, "Could not set socket to reuse address");
+	/* A socket, which was taken over, is set up already */
+	if (takeover < 0)
+	{
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (int[]){1}, sizeof(int)) != 0)
+			dhcpd_error(1, errno, "Could not set socket to reuse address");
+
+		if (bind(sock, (const struct sockaddr *)&bind_addr, sizeof(struct sockaddr_in)) < 0)
+			dhcpd_error(1, errno, "Could not bind to 0.0.0.0:67");
 
-	if (bind(sock, (const struct sockaddr *)&bind_addr, sizeof(struct sockaddr_in)) < 0)
-		dhcpd_error(1, errno, "Could not bind to 0.0.0.0:67");
+		if (!filter_attach_udp(sock))
+			dhcpd_error(0, errno, "Could not attach socket filter");
 
-	if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (int[]){1}, sizeof(int)) != 0)
-		dhcpd_error(1, errno, "Could not set broadcast socket option");
+		if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, (int[]){1}, sizeof(int)) != 0)
+			dhcpd_error(1, errno, "Could not set broadcast socket option");
 #ifdef __linux__
-	if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, argv_cfg.interface, strlen(argv_cfg.interface)) != 0)
-		dhcpd_error(1, errno, "Could not bind to device %s", argv_cfg.interface);
+		if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, argv_cfg.interface, strlen(argv_cfg.interface)) != 0)
+			dhcpd_error(1, errno, "Could not bind to device %s", argv_cfg.interface);
 #endif
+	}
+
+	if (!argv_cfg.broadcast)
+	{
+		if (!have_hwaddr)
+			dhcpd_error(0, 0, "Hint: %s has no hardware address, replies will be broadcast",
+				argv_cfg.interface);
+		else if (!packet_tx_open(&packet_tx, if_nametoindex(argv_cfg.interface),
+				hwaddr, server_id.sin_addr))
+			dhcpd_error(0, errno, "Could not open packet socket, replies will be broadcast");
+	}
 
 	struct ev_loop *loop = EV_DEFAULT;
 
-	ev_io read_watch;
+	ev_io read_watch, ring_watch, uring_watch, control_watch;
 	ev_signal sigint_watch, sigusr1_watch, sigusr2_watch, sigterm_watch;
-	ev_timer leasegc_watch;
+	ev_timer leasegc_watch, stats_watch, capture_watch;
 
 	ev_io_init(&read_watch, req_cb, sock, EV_READ);
-	ev_io_start(loop, &read_watch);
+
+	/* With the receive ring, the UDP socket only sends */
+	if (!ingress_rx_open(&ingress_rx, sock, argv_cfg.rxring ? 0 : cfg.rcvbuf))
+		dhcpd_error(0, errno, "Could not enable drop reports of the socket");
+
+	ev_idle_init(&ingress_watch, ingress_cb);
+	ingress_watch.data = &read_watch;
+
+	if (argv_cfg.rxring)
+	{
+		/* The UDP socket is only used for sending now, keep its queue small */
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (int[]){1}, sizeof(int));
+
+		ev_io_init(&ring_watch, ring_cb, ring_rx.fd, EV_READ);
+		ring_watch.data = &read_watch;
+		ev_io_start(loop, &ring_watch);
+	}
+	else if (cfg.engine == CONFIG_ENGINE_IO_URING)
+	{
+		if (!uring_open(&uring, sock))
+			dhcpd_error(1, errno, "Could not set up io_uring");
+
+		/* The receive buffer only has to hold messages while the multishot
+		 * receive is out of provided buffers */
+		if (cfg.rcvbuf > 0)
+			setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (int[]){cfg.rcvbuf / 2}, sizeof(int));
+
+		ev_io_init(&uring_watch, uring_cb, uring.fd, EV_READ);
+		uring_watch.data = &read_watch;
+		ev_io_start(loop, &uring_watch);
+	}
+	else
+		ev_io_start(loop, &read_watch);
 
 	ev_signal_init(&sigint_watch, sigint_cb, SIGINT);
 	ev_signal_start(loop, &sigint_watch);
@@ -904,16 +2690,110 @@ int main(int argc, char **argv)
 		ev_timer_init(&leasegc_watch, leasegc_cb, 0., cfg.gc);
 		ev_timer_again(loop, &leasegc_watch);
 	}
-	
+
+	if (cfg.stats > 0)
+	{
+		ev_timer_init(&stats_watch, stats_cb, 0., cfg.stats);
+		stats_watch.data = &sock;
+		ev_timer_again(loop, &stats_watch);
+	}
+
+	if (capture.fd >= 0)
+	{
+		ev_timer_init(&capture_watch, capture_cb, 0., 1.);
+		ev_timer_again(loop, &capture_watch);
+	}
+
+	if (argv_cfg.control)
+	{
+		/* Only the socket of the process, which is taken over, may be
+		 * replaced */
+		int control_sock = control_listen(argv_cfg.control, takeover >= 0);
+		if (control_sock < 0)
+			dhcpd_error(1, errno, "Could not create control socket %s", argv_cfg.control);
+
+		ev_io_init(&control_watch, control_accept_cb, control_sock, EV_READ);
+		ev_io_start(loop, &control_watch);
+
+		control_server.sock = sock;
+		control_server.rx_watch = argv_cfg.rxring ? &ring_watch :
+			uring.fd >= 0 ? &uring_watch : &read_watch;
+		control_server.gc_watch = cfg.gc > 0 ? &leasegc_watch : NULL;
+		control_server.accept_watch = &control_watch;
+		control_server.path = argv_cfg.control;
+		control_server.db_path = argv_cfg.db;
+	}
+
+	if (cfg.standby.sin_port != 0 || cfg.replicate.sin_port != 0)
+	{
+		repl_node.standby = cfg.standby.sin_port != 0;
+
+		if (!repl_node.standby && !repl_primary_start(EV_A))
+			dhcpd_error(1, errno, "Could not listen for a standby");
+
+		ev_timer_init(&repl_node.timer_watch, repl_timer_cb, 0., REPL_INTERVAL);
+		ev_timer_again(loop, &repl_node.timer_watch);
+
+		ev_prepare_init(&repl_node.prepare_watch, repl_prepare_cb);
+		ev_prepare_start(loop, &repl_node.prepare_watch);
+	}
+
+	/* Everything is set up, let the old process go */
+	if (takeover >= 0)
+	{
+		struct control_hdr hdr;
+		static uint8_t resp[CONTROL_PAYLOAD_MAX + 1];
+
+		if (!control_request(takeover, CONTROL_SHUTDOWN, NULL, 0, &hdr, resp))
+			dhcpd_error(0, errno, "Could not shut down %s", argv_cfg.takeover);
+
+		close(takeover);
+	}
+
 	ev_run(loop, 0);
 
-	sqlite3_exec(leasedb, "COMMIT;", NULL, NULL, NULL);
+	if (cfg.stats > 0)
+		stats_cb(EV_A_ &stats_watch, 0);
+
+	packet_tx_close(&packet_tx);
+	ring_rx_close(&ring_rx);
+	uring_close(&uring);
+	capture_close(&capture);
+	repl_stop(EV_A);
+
+	if (control_server.accept_watch)
+	{
+		close(control_watch.fd);
+		/* The new process listens on the same path */
+		if (!control_server.handed_over)
+			unlink(argv_cfg.control);
+	}
+
+	/* Write all queued lease mutations */
+	persist_shutdown();
+
+	/* After a handover the cache file belongs to the new process */
+	bool save_cache = argv_cfg.cache != NULL && !control_server.handed_over &&
+		db_data_version(leasedb) == data_version;
 
 	if (sqlite3_close(leasedb) != SQLITE_OK)
 	{
 		dhcpd_error(0, 0, "sqlite3: %s", sqlite3_errmsg(leasedb));
+		save_cache = false;
 	}
 
+	if (save_cache && !store_save_cache(&store, argv_cfg.cache, argv_cfg.db))
+		dhcpd_error(0, errno, "Could not write cache file %s", argv_cfg.cache);
+
+	store_free(&store);
+	ingress_free(&ingress);
+	arena_free(&msg_arena);
+
+	log_shutdown();
+
+	ratelimit_free(&client_rl);
+	ratelimit_free(&relay_rl);
+
 	config_free(&cfg);
 	argv_free(&argv_cfg);
 	if (alloc_db)
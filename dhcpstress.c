@@ -273,6 +273,7 @@ struct config cfg = CONFIG_EMPTY;
 /* Stress definitions */
 static void stress_inval_lenmsgs(int sock);
 static void stress_request_all(int sock);
+static void stress_renewal_spread(int sock);
 
 int main(int argc, char **argv)
 {
@@ -295,7 +296,9 @@ int main(int argc, char **argv)
 			"id  function              description\n"
 			"1   inval_lenmsgs         Send messages which are longer than the trans-\n"
 			"                          mitted byte coud\n"
-			"2   request_all           Send DHCPREQUESTs for any possible IPv4 address\n");
+			"2   request_all           Send DHCPREQUESTs for any possible IPv4 address\n"
+			"3   renewal_spread        Send DHCPDISCOVERs of many clients at once and\n"
+			"                          print the histogram of the offered T1\n");
 		exit(0);
 	}
 
@@ -337,6 +340,9 @@ int main(int argc, char **argv)
 		case 2:
 			stress_request_all(sock);
 			break;
+		case 3:
+			stress_renewal_spread(sock);
+			break;
 	}
 
 	exit(0);
@@ -432,3 +438,151 @@ static void stress_inval_lenmsgs(int sock)
 	}
 }
 
+
+/**
+ * Extract T1 of an offer, half the lease time without option 58
+ *
+ * @return 0 if the offer has neither
+ */
+static uint32_t offer_renewal(uint8_t *data, uint8_t *end)
+{
+	uint8_t *options = DHCP_MSG_F_OPTIONS(data);
+	struct dhcp_opt opt;
+	uint32_t leasetime = 0, renewal = 0;
+
+	while (dhcp_opt_next(&options, &opt, end))
+	{
+		if (opt.len != 4)
+			continue;
+		if (opt.code == DHCP_OPT_RENEWAL)
+			renewal = ntohl(*(uint32_t *)opt.data);
+		else if (opt.code == DHCP_OPT_LEASETIME)
+			leasetime = ntohl(*(uint32_t *)opt.data);
+	}
+
+	return renewal ? renewal : leasetime / 2;
+}
+
+#define RENEWAL_SPREAD_BUCKETS 20
+
+static void stress_renewal_spread(int sock)
+{
+	if (cfg.argv->subargc < 1)
+		dhcpd_error(1, 0, "Usage: ... -- CLIENTS");
+
+	uint32_t clients = atoi(cfg.argv->subargv[0]);
+	if (clients == 0)
+		dhcpd_error(1, 0, "Invalid count of clients: %s", cfg.argv->subargv[0]);
+
+	uint32_t *renewals = calloc(clients, sizeof *renewals);
+	if (renewals == NULL)
+		dhcpd_error(1, errno, "Could not allocate renewal times");
+
+	/* Wait at most a second for outstanding offers */
+	struct timeval timeout = { .tv_sec = 1 };
+	if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout) != 0)
+		dhcpd_error(1, errno, "Could not set receive timeout");
+
+	size_t send_len = DHCP_MSG_HDRLEN;
+	memset(send_buffer, 0, DHCP_MSG_LEN);
+	*DHCP_MSG_F_OP(send_buffer) = cfg.type;
+	*DHCP_MSG_F_HLEN(send_buffer) = 6;
+	*DHCP_MSG_F_HTYPE(send_buffer) = 1;
+	*DHCP_MSG_F_FLAGS(send_buffer) = htons(DHCP_MSG_FLAG_BROADCAST);
+	ARRAY_COPY(DHCP_MSG_F_MAGIC(send_buffer), DHCP_MSG_MAGIC, 4);
+
+	uint8_t *options = DHCP_MSG_F_OPTIONS(send_buffer);
+
+	options[0] = DHCP_OPT_MSGTYPE;
+	options[1] = 1;
+	options[2] = DHCPDISCOVER;
+	DHCP_OPT_CONT(options, send_len);
+
+	options[0] = DHCP_OPT_END;
+	DHCP_OPT_CONT(options, send_len);
+
+	uint8_t recv_buffer[SEND_BUF_LEN];
+	uint32_t received = 0;
+
+	/* Clients are numbered from the seed, replies are matched by xid */
+	for (uint32_t i = 0; i < clients || received < clients; )
+	{
+		if (i < clients)
+		{
+			uint32_t id = cfg.seed + i++;
+
+			*DHCP_MSG_F_XID(send_buffer) = htonl(id);
+			((uint8_t *)DHCP_MSG_F_CHADDR(send_buffer))[0] = 0x02;
+			ARRAY_COPY((DHCP_MSG_F_CHADDR(send_buffer) + 2), &id, 4);
+
+			sendto(sock, send_buffer, send_len, 0,
+				(struct sockaddr *)&cfg.remote, sizeof cfg.remote);
+		}
+
+		ssize_t len = recv(sock, recv_buffer, sizeof recv_buffer,
+			i < clients ? MSG_DONTWAIT : 0);
+
+		if (len < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+			{
+				if (i < clients)
+					continue;
+				break;
+			}
+			dhcpd_error(1, errno, "Could not receive offer");
+		}
+
+		if (len < DHCP_MSG_HDRLEN || *DHCP_MSG_F_OP(recv_buffer) != 2 ||
+				!DHCP_MSG_MAGIC_CHECK(DHCP_MSG_F_MAGIC(recv_buffer)))
+			continue;
+
+		uint32_t idx = ntohl(*DHCP_MSG_F_XID(recv_buffer)) - cfg.seed;
+		if (idx >= clients || renewals[idx] != 0)
+			continue;
+
+		renewals[idx] = offer_renewal(recv_buffer, recv_buffer + len);
+		if (renewals[idx] != 0)
+			++received;
+	}
+
+	if (received == 0)
+		dhcpd_error(1, 0, "No offers received");
+
+	uint32_t lo = UINT32_MAX, hi = 0;
+	for (uint32_t i = 0; i < clients; ++i)
+		if (renewals[i] != 0)
+		{
+			lo = renewals[i] < lo ? renewals[i] : lo;
+			hi = renewals[i] > hi ? renewals[i] : hi;
+		}
+
+	uint32_t buckets[RENEWAL_SPREAD_BUCKETS] = {0}, peak = 0;
+	uint32_t width = (hi - lo) / RENEWAL_SPREAD_BUCKETS + 1;
+
+	for (uint32_t i = 0; i < clients; ++i)
+		if (renewals[i] != 0)
+		{
+			uint32_t *b = &buckets[(renewals[i] - lo) / width];
+
+			if (++*b > peak)
+				peak = *b;
+		}
+
+	printf("%u of %u clients got offers, T1 from %u to %u seconds\n",
+		received, clients, lo, hi);
+	printf("T1           clients\n");
+
+	for (uint32_t b = 0; b < RENEWAL_SPREAD_BUCKETS && lo + b * width <= hi; ++b)
+	{
+		printf("%-12u %-7u ", lo + b * width, buckets[b]);
+		for (uint32_t j = 0; j < buckets[b] * 50 / peak; ++j)
+			putchar('#');
+		putchar('\n');
+	}
+
+	/* A burst renews in one bucket, evenly spread renewals reach 1 / buckets */
+	printf("Largest burst: %.1f%% of the clients\n", 100. * peak / received);
+
+	free(renewals);
+}
@@ -5,7 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 #ifdef DHCP_DHCPD
-#include <sqlite3.h>
+#include "log.h"
+#include "persist.h"
 #endif
 
 #ifndef DHCPD_ERROR_H_
@@ -13,21 +14,31 @@
 
 static inline void dhcpd_error(int _exit, int _errno, const char *fmt, ...)
 {
-#ifdef DHCP_DHCPD
-	extern sqlite3 *leasedb;
-
-	if (leasedb)
-		sqlite3_exec(leasedb, "COMMIT;", NULL, NULL, NULL);
-#endif
-
 	va_list ap;
 	va_start(ap, fmt);
 
+#ifdef DHCP_DHCPD
+	/* Non-fatal errors must not block the event loop, fatal ones are written
+	 * after all pending records */
+	if (_exit <= 0)
+	{
+		log_vprintf(_errno, fmt, ap);
+		va_end(ap);
+		return;
+	}
+
+	/* The database belongs to the persistence thread, it writes the queued
+	 * mutations before the process exits */
+	persist_shutdown();
+	log_shutdown();
+#endif
+
 	if (_errno != 0)
 		fprintf(stderr, "%s: ", strerror(_errno));
 
 	vfprintf(stderr, fmt, ap);
 	fputc('\n', stderr);
+	va_end(ap);
 
 	if (_exit > 0)
 		exit(_exit);
@@ -0,0 +1,139 @@
+#include "filter.h"
+
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef __linux__
+#include <linux/filter.h>
+#include <net/ethernet.h>
+#endif
+
+#include "dhcp.h"
+
+#define FILTER_MAGIC 0x63825363
+
+#ifdef __linux__
+
+/* UDP socket filters see the datagram starting with the UDP header:
+ *
+ *   ld len
+ *   jlt #248, drop
+ *   ldb [8]
+ *   jne #1, drop
+ *   ldb [10]
+ *   jeq #0, drop
+ *   jgt #16, drop
+ *   ld [244]
+ *   jne #0x63825363, drop
+ *   ret #-1
+ * drop:
+ *   ret #0
+ */
+static struct sock_filter filter_udp[] = {
+	BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+	BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 8 + DHCP_MSG_HDRLEN, 0, 8),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8 + 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, 6),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 8 + 2),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 4, 0),
+	BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 16, 3, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 8 + 236),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, FILTER_MAGIC, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+/* AF_PACKET socket filters see the whole Ethernet frame, the offset of the
+ * DHCP message depends on the IP header length in X:
+ *
+ *   ldh [12]
+ *   jne #0x800, drop
+ *   ldb [23]
+ *   jne #17, drop
+ *   ldh [20]
+ *   jset #0x1fff, drop
+ *   ldxb 4*([14]&0xf)
+ *   ldh [x + 16]
+ *   jne #67, drop
+ *   ldb [x + 22]
+ *   jne #1, drop
+ *   ldb [x + 24]
+ *   jeq #0, drop
+ *   jgt #16, drop
+ *   ld [x + 258]
+ *   jne #0x63825363, drop
+ *   txa
+ *   add #262
+ *   tax
+ *   ld len
+ *   jlt x, drop
+ *   ret #-1
+ * drop:
+ *   ret #0
+ */
+static struct sock_filter filter_packet[] = {
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_IP, 0, 20),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 18),
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+	BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1FFF, 16, 0),
+	BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+	BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 67, 0, 13),
+	BPF_STMT(BPF_LD | BPF_B | BPF_IND, 14 + 8 + 0),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 1, 0, 11),
+	BPF_STMT(BPF_LD | BPF_B | BPF_IND, 14 + 8 + 2),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 9, 0),
+	BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 16, 8, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_IND, 14 + 8 + 236),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, FILTER_MAGIC, 0, 6),
+	BPF_STMT(BPF_MISC | BPF_TXA, 0),
+	BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 14 + 8 + DHCP_MSG_HDRLEN),
+	BPF_STMT(BPF_MISC | BPF_TAX, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+	BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+static bool filter_attach(int sock, struct sock_filter *filter, unsigned short len)
+{
+	struct sock_fprog fprog = {
+		.len = len,
+		.filter = filter
+	};
+
+	return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof fprog) == 0;
+}
+
+bool filter_attach_udp(int sock)
+{
+	return filter_attach(sock, filter_udp, ARRAY_LEN(filter_udp));
+}
+
+bool filter_attach_packet(int sock)
+{
+	return filter_attach(sock, filter_packet, ARRAY_LEN(filter_packet));
+}
+
+#else
+
+bool filter_attach_udp(int sock)
+{
+	(void)sock;
+	errno = ENOTSUP;
+	return false;
+}
+
+bool filter_attach_packet(int sock)
+{
+	(void)sock;
+	errno = ENOTSUP;
+	return false;
+}
+
+#endif
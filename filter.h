@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+
+#ifndef DHCPD_FILTER_H_
+#define DHCPD_FILTER_H_
+
+/* Socket filters drop anything, which can't be a DHCP request, before it is
+ * queued to our sockets. A message is accepted, if it
+ *
+ *  - has op 1 (BOOTREQUEST),
+ *  - has a hardware address length between 1 and 16,
+ *  - carries the magic cookie at offset 236 and
+ *  - is at least DHCP_MSG_HDRLEN bytes long.
+ *
+ * Everything else costs neither a syscall nor a context switch. The kernel
+ * counts the dropped messages as socket drops.
+ */
+
+/**
+ * Attach DHCP request filter to an UDP socket
+ *
+ * @param[in] sock UDP socket
+ */
+extern bool filter_attach_udp(int sock);
+
+/**
+ * Attach filter to an AF_PACKET socket, which accepts only DHCP requests in
+ * unfragmented IPv4 UDP datagrams to port 67
+ *
+ * @param[in] sock AF_PACKET socket
+ */
+extern bool filter_attach_packet(int sock);
+
+#endif
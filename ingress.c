@@ -0,0 +1,290 @@
+#include "ingress.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define INGRESS_POOL (INGRESS_CLASSES * INGRESS_QUEUE_LEN + 2)
+
+bool ingress_init(struct ingress *in)
+{
+	*in = (struct ingress)INGRESS_EMPTY;
+
+	/* Every queue may be full while one message is received and another one
+	 * is handled */
+	in->pool = calloc(INGRESS_POOL, sizeof *in->pool);
+	if (in->pool == NULL)
+		return false;
+
+	for (size_t i = INGRESS_POOL; i > 0; --i)
+		ingress_put(in, &in->pool[i - 1]);
+
+	return true;
+}
+
+bool ingress_push(struct ingress *in, enum ingress_class cls,
+	struct ingress_pkt *p, double now)
+{
+	struct ingress_queue *q = &in->queues[cls];
+
+	if (q->tail - q->head == INGRESS_QUEUE_LEN)
+	{
+		++in->shed[cls];
+		ingress_put(in, p);
+		return false;
+	}
+
+	p->enqueued = now;
+	q->ring[q->tail++ & (INGRESS_QUEUE_LEN - 1)] = p;
+
+	return true;
+}
+
+/**
+ * Take oldest message of a queue and check whether CoDel may drop it
+ *
+ * @param[in] q Queue
+ * @param[in] now Current time in seconds
+ * @param[out] drop Set if the delay stayed above the target for an interval
+ * @return Message or NULL if the queue is empty
+ */
+static struct ingress_pkt *ingress_dequeue(struct ingress_queue *q, double now,
+	bool *drop)
+{
+	*drop = false;
+
+	if (q->head == q->tail)
+	{
+		q->first_above = 0;
+		return NULL;
+	}
+
+	struct ingress_pkt *p = q->ring[q->head++ & (INGRESS_QUEUE_LEN - 1)];
+
+	/* A queue, which just became empty, has no standing delay */
+	if (now - p->enqueued < INGRESS_TARGET || q->head == q->tail)
+		q->first_above = 0;
+	else if (q->first_above == 0)
+		q->first_above = now + INGRESS_INTERVAL;
+	else if (now >= q->first_above)
+		*drop = true;
+
+	return p;
+}
+
+/**
+ * Time of the next drop, which comes sooner the more were dropped
+ */
+static double ingress_control_law(double t, uint32_t count)
+{
+	return t + INGRESS_INTERVAL / sqrt(count);
+}
+
+/**
+ * Dequeue message of one class, which CoDel doesn't drop
+ */
+static struct ingress_pkt *ingress_codel(struct ingress *in,
+	enum ingress_class cls, double now)
+{
+	struct ingress_queue *q = &in->queues[cls];
+	bool drop;
+	struct ingress_pkt *p = ingress_dequeue(q, now, &drop);
+
+	if (q->dropping)
+	{
+		if (!drop)
+			q->dropping = false;
+
+		while (q->dropping && now >= q->drop_next)
+		{
+			++in->shed[cls];
+			ingress_put(in, p);
+			++q->drop_count;
+
+			p = ingress_dequeue(q, now, &drop);
+			if (!drop)
+				q->dropping = false;
+			else
+				q->drop_next = ingress_control_law(q->drop_next, q->drop_count);
+		}
+	}
+	else if (drop)
+	{
+		++in->shed[cls];
+		ingress_put(in, p);
+
+		p = ingress_dequeue(q, now, &drop);
+		q->dropping = true;
+
+		/* Continue near the drop rate of the last dropping state, if that
+		 * ended recently */
+		if (q->drop_count > 2 && now - q->drop_next < 16 * INGRESS_INTERVAL)
+			q->drop_count -= 2;
+		else
+			q->drop_count = 1;
+
+		q->drop_next = ingress_control_law(now, q->drop_count);
+	}
+
+	if (p == NULL)
+		q->dropping = false;
+
+	return p;
+}
+
+struct ingress_pkt *ingress_pop(struct ingress *in, double now)
+{
+	for (size_t cls = 0; cls < INGRESS_CLASSES; ++cls)
+	{
+		struct ingress_pkt *p = ingress_codel(in, cls, now);
+
+		if (p != NULL)
+			return p;
+	}
+
+	return NULL;
+}
+
+bool ingress_pending(const struct ingress *in)
+{
+	for (size_t cls = 0; cls < INGRESS_CLASSES; ++cls)
+		if (in->queues[cls].head != in->queues[cls].tail)
+			return true;
+
+	return false;
+}
+
+void ingress_free(struct ingress *in)
+{
+	free(in->pool);
+	*in = (struct ingress)INGRESS_EMPTY;
+}
+
+/**
+ * Fetch size of the receive buffer, which is twice the requested one on
+ * Linux
+ */
+static int ingress_rx_rcvbuf(int fd)
+{
+	int size = 0;
+	socklen_t len = sizeof size;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, &len) != 0)
+		return 0;
+
+	return size;
+}
+
+bool ingress_rx_open(struct ingress_rx *rx, int fd, int rcvbuf_max)
+{
+	*rx = (struct ingress_rx)INGRESS_RX_EMPTY;
+	rx->fd = fd;
+	rx->rcvbuf = ingress_rx_rcvbuf(fd);
+	rx->rcvbuf_max = rcvbuf_max;
+
+#ifdef SO_TIMESTAMPNS
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, (int[]){1}, sizeof(int)) != 0)
+		return false;
+#endif
+
+#ifdef SO_RXQ_OVFL
+	return setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, (int[]){1}, sizeof(int)) == 0;
+#else
+	return true;
+#endif
+}
+
+/**
+ * Grow the receive buffer after a burst, which filled half of it or
+ * overflowed it. The drop counter includes messages rejected by the socket
+ * filter, so drops with short bursts don't count.
+ */
+static void ingress_rx_adapt(struct ingress_rx *rx)
+{
+	uint64_t need = rx->burst * INGRESS_RCVBUF_MSG;
+	bool dropped = rx->drops != rx->burst_drops;
+
+	if (rx->burst > rx->burst_max)
+		rx->burst_max = rx->burst;
+	rx->burst = 0;
+	rx->burst_drops = rx->drops;
+
+	if (rx->rcvbuf >= rx->rcvbuf_max)
+		return;
+	if (need * 2 < (uint64_t)rx->rcvbuf &&
+			!(dropped && need * 4 >= (uint64_t)rx->rcvbuf))
+		return;
+
+	uint64_t size = 2 * (uint64_t)rx->rcvbuf;
+	if (size < 2 * need)
+		size = 2 * need;
+	if (size > (uint64_t)rx->rcvbuf_max)
+		size = rx->rcvbuf_max;
+
+	setsockopt(rx->fd, SOL_SOCKET, SO_RCVBUF, (int[]){size / 2}, sizeof(int));
+
+	/* The kernel caps the size at net.core.rmem_max, stop trying there */
+	int rcvbuf = ingress_rx_rcvbuf(rx->fd);
+	if (rcvbuf <= rx->rcvbuf)
+		rx->rcvbuf_max = rx->rcvbuf;
+	else
+		rx->rcvbuf = rcvbuf;
+}
+
+bool ingress_rx_recv(struct ingress_rx *rx, struct ingress_pkt *p)
+{
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(sizeof(struct timespec))];
+		struct cmsghdr align;
+	} control;
+	struct iovec iov = {
+		.iov_base = p->data,
+		.iov_len = INGRESS_MSG_LEN
+	};
+	struct msghdr mh = {
+		.msg_name = &p->src,
+		.msg_namelen = sizeof p->src,
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof control.buf
+	};
+
+	p->src = (struct sockaddr_in){
+		.sin_addr = {INADDR_ANY}
+	};
+
+	ssize_t recvd = recvmsg(rx->fd, &mh, MSG_DONTWAIT);
+
+	if (recvd < 0)
+	{
+		if (rx->burst > 0)
+			ingress_rx_adapt(rx);
+		return false;
+	}
+
+	p->len = recvd;
+	p->stamp = (struct timespec){0};
+	++rx->burst;
+
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm != NULL;
+			cm = CMSG_NXTHDR(&mh, cm))
+	{
+		if (cm->cmsg_level != SOL_SOCKET)
+			continue;
+#ifdef SO_RXQ_OVFL
+		if (cm->cmsg_type == SO_RXQ_OVFL)
+			memcpy(&rx->drops, CMSG_DATA(cm), sizeof rx->drops);
+#endif
+#ifdef SCM_TIMESTAMPNS
+		if (cm->cmsg_type == SCM_TIMESTAMPNS)
+			memcpy(&p->stamp, CMSG_DATA(cm), sizeof p->stamp);
+#endif
+	}
+
+	return true;
+}
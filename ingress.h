@@ -0,0 +1,256 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <netinet/in.h>
+
+#include "dhcp.h"
+
+#ifndef DHCPD_INGRESS_H_
+#define DHCPD_INGRESS_H_
+
+/* Admission control under overload. Received messages are decoded once,
+ * sorted into one queue per class and handled in the order of the classes,
+ * at most INGRESS_BUDGET messages per loop iteration. Reading the socket is
+ * cheaper than answering, so when more messages arrive than can be answered,
+ * the queues of the lower classes fill up instead of the socket buffer,
+ * which drops regardless of the class.
+ *
+ * Every queue is managed by CoDel: a message, which waited longer than
+ * INGRESS_TARGET, is dropped when it is dequeued if the queue delay stayed
+ * above the target for INGRESS_INTERVAL, and further messages are dropped at
+ * a rate increasing with the square root of the drops until the delay falls
+ * below the target again. A client retransmits after a few seconds anyway,
+ * answering it late only wastes the work.
+ */
+
+#ifndef INGRESS_QUEUE_LEN
+#define INGRESS_QUEUE_LEN 256
+#endif
+
+/* Longest message, the rest of longer ones is cut off */
+#ifndef INGRESS_MSG_LEN
+#define INGRESS_MSG_LEN 2048
+#endif
+
+/* Messages read from the socket and handled per loop iteration */
+#ifndef INGRESS_BATCH
+#define INGRESS_BATCH 256
+#endif
+
+#ifndef INGRESS_BUDGET
+#define INGRESS_BUDGET 16
+#endif
+
+/* Estimated kernel memory of a queued message, the receive buffer is sized
+ * for the deepest burst of messages seen so far */
+#ifndef INGRESS_RCVBUF_MSG
+#define INGRESS_RCVBUF_MSG 2304
+#endif
+
+/* CoDel target queue delay and interval in seconds */
+#ifndef INGRESS_TARGET
+#define INGRESS_TARGET 0.005
+#endif
+
+#ifndef INGRESS_INTERVAL
+#define INGRESS_INTERVAL 0.1
+#endif
+
+/* Classes from highest to lowest priority */
+enum ingress_class
+{
+	/* Clients holding a lease, mostly renewing it */
+	INGRESS_RENEW,
+	/* DISCOVER of a client, which holds a lease */
+	INGRESS_KNOWN,
+	/* Other messages of clients without a lease, mostly REQUEST after an
+	 * OFFER, which would be wasted otherwise */
+	INGRESS_REQUEST,
+	/* DISCOVER of new clients and invalid messages */
+	INGRESS_DISCOVER,
+	INGRESS_CLASSES
+};
+
+struct ingress_pkt
+{
+	/* Next free message */
+	struct ingress_pkt *next;
+	/* When the message was queued in seconds */
+	double enqueued;
+
+	struct sockaddr_in src;
+	size_t len;
+	/* Time the kernel received the message, zero if unknown */
+	struct timespec stamp;
+
+	/* Decoded by the classifier and used by the message handler, opts points
+	 * into data */
+	bool valid;
+	enum dhcp_msg_type type;
+	struct dhcp_opts opts;
+	struct dhcp_key key;
+	uint32_t key_hash;
+	bool clientid;
+
+	uint8_t data[INGRESS_MSG_LEN];
+};
+
+struct ingress_queue
+{
+	/* Ring of messages, head and tail count up and wrap around */
+	struct ingress_pkt *ring[INGRESS_QUEUE_LEN];
+	uint32_t head;
+	uint32_t tail;
+
+	/* CoDel state: when the delay stayed above the target long enough, or
+	 * zero, whether messages are being dropped, when the next one is and how
+	 * many were dropped since dropping started */
+	double first_above;
+	double drop_next;
+	uint32_t drop_count;
+	bool dropping;
+};
+
+struct ingress
+{
+	struct ingress_pkt *pool;
+	struct ingress_pkt *free;
+
+	struct ingress_queue queues[INGRESS_CLASSES];
+
+	/* Messages dropped per class, because the queue was full or by CoDel */
+	uint64_t shed[INGRESS_CLASSES];
+};
+
+#define INGRESS_EMPTY {\
+		.pool = NULL,\
+		.free = NULL\
+	}
+
+/* Receiving from the UDP socket. The kernel reports its drop counter of the
+ * socket and its receive timestamp with every message (SO_RXQ_OVFL and
+ * SO_TIMESTAMPNS), and whenever the socket ran empty
+ * after a burst, the receive buffer is grown if the burst filled half of it
+ * or messages were dropped.
+ */
+struct ingress_rx
+{
+	int fd;
+
+	/* Receive buffer in bytes as reported by the kernel and its limit */
+	int rcvbuf;
+	int rcvbuf_max;
+
+	/* Drop counter of the socket reported with the last message and at the
+	 * end of the last burst */
+	uint32_t drops;
+	uint32_t burst_drops;
+
+	/* Messages received since the socket was empty and most of any burst */
+	uint64_t burst;
+	uint64_t burst_max;
+};
+
+#define INGRESS_RX_EMPTY {\
+		.fd = -1,\
+		.rcvbuf = 0,\
+		.rcvbuf_max = 0,\
+		.drops = 0,\
+		.burst_drops = 0,\
+		.burst = 0,\
+		.burst_max = 0\
+	}
+
+_Static_assert((INGRESS_QUEUE_LEN & (INGRESS_QUEUE_LEN - 1)) == 0,
+	"INGRESS_QUEUE_LEN must be a power of two");
+
+/**
+ * Allocate messages for all queues
+ *
+ * @param[out] in Queues
+ */
+extern bool ingress_init(struct ingress *in);
+
+/**
+ * Take free message to receive into
+ *
+ * @return Message or NULL if all are queued
+ */
+static inline struct ingress_pkt *ingress_get(struct ingress *in)
+{
+	struct ingress_pkt *p = in->free;
+
+	if (p != NULL)
+		in->free = p->next;
+
+	return p;
+}
+
+/**
+ * Give message back after it was handled
+ */
+static inline void ingress_put(struct ingress *in, struct ingress_pkt *p)
+{
+	p->next = in->free;
+	in->free = p;
+}
+
+/**
+ * Queue message, which is given back and counted as shed if the queue is
+ * full
+ *
+ * @param[in] in Queues
+ * @param[in] cls Class of the message
+ * @param[in] p Message taken with ingress_get()
+ * @param[in] now Current time in seconds
+ * @return false if the message was shed
+ */
+extern bool ingress_push(struct ingress *in, enum ingress_class cls,
+	struct ingress_pkt *p, double now);
+
+/**
+ * Dequeue message of the highest class, messages CoDel drops on the way are
+ * given back and counted as shed
+ *
+ * @param[in] in Queues
+ * @param[in] now Current time in seconds
+ * @return Message, which must be given back with ingress_put(), or NULL if
+ * all queues are empty
+ */
+extern struct ingress_pkt *ingress_pop(struct ingress *in, double now);
+
+/**
+ * Check whether any message is queued
+ */
+extern bool ingress_pending(const struct ingress *in);
+
+/**
+ * Free all messages
+ */
+extern void ingress_free(struct ingress *in);
+
+/**
+ * Enable drop reports and receive timestamps on a UDP socket
+ *
+ * @param[out] rx Receiver
+ * @param[in] fd UDP socket
+ * @param[in] rcvbuf_max Largest receive buffer in bytes, the buffer isn't
+ * grown if it is zero
+ */
+extern bool ingress_rx_open(struct ingress_rx *rx, int fd, int rcvbuf_max);
+
+/**
+ * Receive message without blocking, grow the receive buffer if needed when
+ * the socket is empty
+ *
+ * @param[in] rx Receiver
+ * @param[out] p Message, data, len, src and stamp are set
+ * @return false if the socket is empty or on errors
+ */
+extern bool ingress_rx_recv(struct ingress_rx *rx, struct ingress_pkt *p);
+
+#endif
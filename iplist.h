@@ -8,6 +8,8 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "arena.h"
+
 #ifndef DHCPD_IPLIST_H_
 #define DHCPD_IPLIST_H_
 
@@ -51,10 +53,38 @@ static inline size_t iplist_dump(const struct in_addr in[], size_t in_cnt, char
 }
 
 /**
- * Convert ip list text representation to binary representation
+ * Convert ip list text representation to binary representation, the
+ * addresses are appended to out
+ *
+ * @param[in] in Comma separated addresses
+ * @param[in,out] out List, which is grown once for all addresses
+ * @param[in,out] cnt Count of addresses in the list
+ * @param[in] a Arena to allocate the list from or NULL to reallocate it on
+ * the heap
  */
-static inline bool iplist_parse(const char *in, struct in_addr **out, size_t *cnt)
+static inline bool iplist_parse(const char *in, struct in_addr **out, size_t *cnt,
+	struct arena *a)
 {
+	size_t n = *in != 0;
+	for (const char *c = in; *c; ++c)
+		n += *c == ',';
+
+	if (n == 0)
+		return true;
+
+	struct in_addr *list;
+	if (a != NULL)
+	{
+		if ((list = arena_alloc(a, sizeof *list * (*cnt + n))) != NULL && *cnt > 0)
+			memcpy(list, *out, sizeof *list * *cnt);
+	}
+	else
+		list = realloc(*out, sizeof *list * (*cnt + n));
+
+	if (list == NULL)
+		return false;
+	*out = list;
+
 	size_t off = 0;
 	char addr[INET_ADDRSTRLEN];
 	memset(addr, 0, INET_ADDRSTRLEN);
@@ -64,8 +94,7 @@ static inline bool iplist_parse(const char *in, struct in_addr **out, size_t *cn
 
 		if (*in == ',' || *in == 0)
 		{
-			*out = realloc(*out, sizeof **out * ++(*cnt));
-			if (inet_pton(AF_INET, addr, &(*out)[(*cnt)-1]) == 0)
+			if (inet_pton(AF_INET, addr, &(*out)[(*cnt)++]) == 0)
 				goto return_false;
 
 			off = 0;
@@ -79,7 +108,8 @@ static inline bool iplist_parse(const char *in, struct in_addr **out, size_t *cn
 	if (!(off < INET_ADDRSTRLEN-1))
 	{
 return_false:
-		free(*out);
+		if (a == NULL)
+			free(*out);
 		*out = NULL;
 		*cnt = 0;
 		return false;
@@ -88,18 +118,5 @@ return_false:
 	return true;
 }
 
-/**
- * Generate comparision code, which checks whether a is part of the IP range
- * [l, u].
- *
- * IP ranges are full-inclusive ranges, which means, that l and u, the lower
- * and upper boundaries, are part of the range.
- */
-#define IPRANGE_IN(l, u, a) (ntohl((l).s_addr) <= ntohl((a).s_addr) &&\
-	ntohl((u).s_addr) >= ntohl((a).s_addr))
-#define IPRANGE_IN2(r, a) IPRANGE_IN(r[0], r[1], a)
-
-#define IPRANGE_FOREACH(l, u, v) for ((v) = ntohl(l.s_addr); (v) <= ntohl(u.s_addr); ++(v))
-
 #endif
 
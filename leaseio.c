@@ -0,0 +1,617 @@
+#include "leaseio.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include <arpa/inet.h>
+
+static const char *const leaseio_names[LEASEIO_COLS] = {
+	[LEASEIO_ID] = "id",
+	[LEASEIO_ADDRESS] = "address",
+	[LEASEIO_PREFIXLEN] = "prefixlen",
+	[LEASEIO_HWADDR] = "hwaddr",
+	[LEASEIO_ROUTERS] = "routers",
+	[LEASEIO_NAMESERVERS] = "nameservers",
+	[LEASEIO_LEASETIME] = "leasetime",
+	[LEASEIO_ALLOCATED] = "allocated",
+	[LEASEIO_ALLOCATED_AT] = "allocated_at",
+	[LEASEIO_CLIENTID] = "clientid"
+};
+
+static char leaseio_true[] = "1";
+static char leaseio_false[] = "0";
+
+/**
+ * Column of a field name, -1 if unknown
+ */
+static int leaseio_col(const char *name)
+{
+	for (int i = 0; i < LEASEIO_COLS; ++i)
+		if (!strcmp(name, leaseio_names[i]))
+			return i;
+
+	return -1;
+}
+
+/**
+ * Remove trailing line break
+ */
+static void leaseio_chomp(char *line)
+{
+	size_t len = strlen(line);
+
+	while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+		line[--len] = 0;
+}
+
+/**
+ * Split CSV line into zero terminated fields in place
+ */
+static bool leaseio_csv_split(char *line, char **fields, size_t max,
+	size_t *cnt, const char **err)
+{
+	char *p = line;
+	size_t n = 0;
+
+	leaseio_chomp(line);
+
+	for (;;)
+	{
+		if (n == max)
+		{
+			*err = "Too many fields";
+			return false;
+		}
+
+		char *out = p;
+		fields[n++] = p;
+
+		if (*p == '"')
+		{
+			++p;
+			for (;;)
+			{
+				if (*p == 0)
+				{
+					*err = "Unterminated quoted field";
+					return false;
+				}
+
+				if (*p == '"')
+				{
+					if (p[1] != '"')
+					{
+						++p;
+						break;
+					}
+					++p;
+				}
+
+				*(out++) = *(p++);
+			}
+
+			if (*p != ',' && *p != 0)
+			{
+				*err = "Unexpected character after quoted field";
+				return false;
+			}
+		}
+		else
+		{
+			while (*p && *p != ',')
+				*(out++) = *(p++);
+		}
+
+		/* out never passes p, so the delimiter is read before it is
+		 * overwritten */
+		char c = *p;
+		*out = 0;
+
+		if (c == 0)
+			break;
+		++p;
+	}
+
+	*cnt = n;
+	return true;
+}
+
+bool leaseio_csv_header(char *line, int map[LEASEIO_CSV_COLS_MAX],
+	size_t *cnt, const char **err)
+{
+	char *fields[LEASEIO_CSV_COLS_MAX];
+
+	if (!leaseio_csv_split(line, fields, LEASEIO_CSV_COLS_MAX, cnt, err))
+		return false;
+
+	bool seen[LEASEIO_COLS] = {false};
+
+	for (size_t i = 0; i < *cnt; ++i)
+	{
+		map[i] = leaseio_col(fields[i]);
+
+		if (map[i] < 0)
+			continue;
+
+		if (seen[map[i]])
+		{
+			*err = "Duplicate column in header";
+			return false;
+		}
+		seen[map[i]] = true;
+	}
+
+	if (!seen[LEASEIO_ADDRESS] || !seen[LEASEIO_HWADDR])
+	{
+		*err = "Header lacks address or hwaddr column";
+		return false;
+	}
+
+	return true;
+}
+
+bool leaseio_csv_row(char *line, const int *map, size_t cnt,
+	struct leaseio_row *row, const char **err)
+{
+	char *fields[LEASEIO_CSV_COLS_MAX];
+	size_t n;
+
+	if (!leaseio_csv_split(line, fields, LEASEIO_CSV_COLS_MAX, &n, err))
+		return false;
+
+	if (n != cnt)
+	{
+		*err = "Field count differs from header";
+		return false;
+	}
+
+	*row = (struct leaseio_row){ .fields = {NULL} };
+
+	for (size_t i = 0; i < n; ++i)
+		if (map[i] >= 0 && fields[i][0] != 0)
+			row->fields[map[i]] = fields[i];
+
+	return true;
+}
+
+static char *leaseio_json_ws(char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		++p;
+	return p;
+}
+
+/**
+ * Unescape JSON string in place, p points behind the opening quote
+ *
+ * @return Position behind the closing quote or NULL on errors
+ */
+static char *leaseio_json_str(char *p, char **str)
+{
+	char *out = p;
+	*str = p;
+
+	for (;;)
+	{
+		char c = *(p++);
+
+		if (c == 0 || (uint8_t)c < 0x20)
+			return NULL;
+
+		if (c == '"')
+			break;
+
+		if (c != '\\')
+		{
+			*(out++) = c;
+			continue;
+		}
+
+		switch (*(p++))
+		{
+			case '"': *(out++) = '"'; break;
+			case '\\': *(out++) = '\\'; break;
+			case '/': *(out++) = '/'; break;
+			case 'b': *(out++) = '\b'; break;
+			case 'f': *(out++) = '\f'; break;
+			case 'n': *(out++) = '\n'; break;
+			case 'r': *(out++) = '\r'; break;
+			case 't': *(out++) = '\t'; break;
+			case 'u':
+			{
+				unsigned int cp;
+				char hex[5] = {0};
+
+				memcpy(hex, p, 4);
+				if (strlen(hex) != 4 || sscanf(hex, "%4x", &cp) != 1)
+					return NULL;
+				p += 4;
+
+				/* Surrogate pairs never occur in lease data */
+				if (cp >= 0xD800 && cp <= 0xDFFF)
+					return NULL;
+
+				if (cp < 0x80)
+					*(out++) = cp;
+				else if (cp < 0x800)
+				{
+					*(out++) = 0xC0 | cp >> 6;
+					*(out++) = 0x80 | (cp & 0x3F);
+				}
+				else
+				{
+					*(out++) = 0xE0 | cp >> 12;
+					*(out++) = 0x80 | (cp >> 6 & 0x3F);
+					*(out++) = 0x80 | (cp & 0x3F);
+				}
+				break;
+			}
+			default:
+				return NULL;
+		}
+	}
+
+	*out = 0;
+	return p;
+}
+
+bool leaseio_jsonl_row(char *line, struct leaseio_row *row, const char **err)
+{
+	/* Numbers are terminated after the whole line was parsed, because their
+	 * terminator is still needed as delimiter */
+	char *num_end[LEASEIO_COLS];
+	size_t num_cnt = 0;
+
+	char *p = leaseio_json_ws(line);
+
+	*row = (struct leaseio_row){ .fields = {NULL} };
+	*err = "Invalid JSON object";
+
+	if (*(p++) != '{')
+		return false;
+
+	p = leaseio_json_ws(p);
+
+	if (*p == '}')
+	{
+		++p;
+		goto end;
+	}
+
+	for (;;)
+	{
+		char *key, *value = NULL;
+
+		if (*(p++) != '"' || (p = leaseio_json_str(p, &key)) == NULL)
+			return false;
+
+		p = leaseio_json_ws(p);
+		if (*(p++) != ':')
+			return false;
+		p = leaseio_json_ws(p);
+
+		if (*p == '"')
+		{
+			if ((p = leaseio_json_str(p + 1, &value)) == NULL)
+				return false;
+		}
+		else if (!strncmp(p, "null", 4))
+			p += 4;
+		else if (!strncmp(p, "true", 4))
+		{
+			value = leaseio_true;
+			p += 4;
+		}
+		else if (!strncmp(p, "false", 5))
+		{
+			value = leaseio_false;
+			p += 5;
+		}
+		else if (*p == '-' || (*p >= '0' && *p <= '9'))
+		{
+			value = p;
+			while (*p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E' ||
+					(*p >= '0' && *p <= '9'))
+				++p;
+		}
+		else
+			return false;
+
+		int col = leaseio_col(key);
+		if (col >= 0)
+		{
+			if (value != NULL && value != leaseio_true && value != leaseio_false &&
+					value[-1] != '"' && num_cnt < LEASEIO_COLS)
+				num_end[num_cnt++] = p;
+			row->fields[col] = value;
+		}
+
+		p = leaseio_json_ws(p);
+
+		if (*p == '}')
+		{
+			++p;
+			break;
+		}
+
+		if (*(p++) != ',')
+			return false;
+
+		p = leaseio_json_ws(p);
+	}
+
+end:
+	p = leaseio_json_ws(p);
+	if (*p != 0)
+		return false;
+
+	for (size_t i = 0; i < num_cnt; ++i)
+		*num_end[i] = 0;
+
+	for (int i = 0; i < LEASEIO_COLS; ++i)
+		if (row->fields[i] != NULL && row->fields[i][0] == 0)
+			row->fields[i] = NULL;
+
+	return true;
+}
+
+/**
+ * Parse integer, which must span the whole field
+ */
+static bool leaseio_int(const char *s, int64_t min, int64_t max, int64_t *out)
+{
+	char *end;
+
+	errno = 0;
+	long long v = strtoll(s, &end, 10);
+
+	if (errno != 0 || end == s || *end != 0 || v < min || v > max)
+		return false;
+
+	*out = v;
+	return true;
+}
+
+/**
+ * Check comma separated list of IPv4 addresses
+ */
+static bool leaseio_iplist(const char *s)
+{
+	while (*s)
+	{
+		char addr[INET_ADDRSTRLEN];
+		size_t len = strcspn(s, ",");
+		struct in_addr in;
+
+		if (len == 0 || len >= sizeof addr)
+			return false;
+
+		memcpy(addr, s, len);
+		addr[len] = 0;
+
+		if (inet_pton(AF_INET, addr, &in) != 1)
+			return false;
+
+		s += len;
+		if (*s == ',')
+			++s;
+	}
+
+	return true;
+}
+
+bool leaseio_validate(const struct leaseio_row *row,
+	struct leaseio_lease *lease, const char **err)
+{
+	char *const *f = row->fields;
+	int64_t v;
+	struct in_addr in;
+	uint8_t hwaddr[6];
+
+	*lease = (struct leaseio_lease){
+		.id = 0,
+		.address = f[LEASEIO_ADDRESS],
+		.prefixlen = 24,
+		.routers = f[LEASEIO_ROUTERS],
+		.nameservers = f[LEASEIO_NAMESERVERS],
+		.leasetime = 3600,
+		.allocated = false,
+		.allocated_at = 0
+	};
+
+	if (f[LEASEIO_ADDRESS] == NULL || inet_pton(AF_INET, f[LEASEIO_ADDRESS], &in) != 1)
+	{
+		*err = "Invalid or missing address";
+		return false;
+	}
+
+	if (f[LEASEIO_HWADDR] == NULL || !mac_pton(f[LEASEIO_HWADDR], hwaddr))
+	{
+		*err = "Invalid or missing hwaddr";
+		return false;
+	}
+	mac_ntop((const char *)hwaddr, lease->hwaddr, sizeof lease->hwaddr);
+
+	if (f[LEASEIO_CLIENTID] == NULL)
+		dhcp_key_from_hwaddr(&lease->clientid, hwaddr);
+	else if (!dhcp_key_pton(f[LEASEIO_CLIENTID], &lease->clientid))
+	{
+		*err = "Invalid clientid";
+		return false;
+	}
+
+	if (f[LEASEIO_ID])
+	{
+		if (!leaseio_int(f[LEASEIO_ID], 1, UINT32_MAX, &lease->id))
+		{
+			*err = "Invalid id";
+			return false;
+		}
+	}
+
+	if (f[LEASEIO_PREFIXLEN])
+	{
+		if (!leaseio_int(f[LEASEIO_PREFIXLEN], 0, 32, &v))
+		{
+			*err = "Invalid prefixlen";
+			return false;
+		}
+		lease->prefixlen = v;
+	}
+
+	if (f[LEASEIO_ROUTERS] && !leaseio_iplist(f[LEASEIO_ROUTERS]))
+	{
+		*err = "Invalid routers";
+		return false;
+	}
+
+	if (f[LEASEIO_NAMESERVERS] && !leaseio_iplist(f[LEASEIO_NAMESERVERS]))
+	{
+		*err = "Invalid nameservers";
+		return false;
+	}
+
+	if (f[LEASEIO_LEASETIME] &&
+			!leaseio_int(f[LEASEIO_LEASETIME], 0, UINT32_MAX, &lease->leasetime))
+	{
+		*err = "Invalid leasetime";
+		return false;
+	}
+
+	if (f[LEASEIO_ALLOCATED])
+	{
+		const char *a = f[LEASEIO_ALLOCATED];
+
+		if (!strcmp(a, "1") || !strcmp(a, "true"))
+			lease->allocated = true;
+		else if (!strcmp(a, "0") || !strcmp(a, "false"))
+			lease->allocated = false;
+		else
+		{
+			*err = "Invalid allocated";
+			return false;
+		}
+	}
+
+	if (f[LEASEIO_ALLOCATED_AT] &&
+			!leaseio_int(f[LEASEIO_ALLOCATED_AT], 0, INT64_MAX, &lease->allocated_at))
+	{
+		*err = "Invalid allocated_at";
+		return false;
+	}
+
+	return true;
+}
+
+void leaseio_write_header(FILE *stream, enum leaseio_format format)
+{
+	if (format != LEASEIO_CSV)
+		return;
+
+	for (int i = 0; i < LEASEIO_COLS; ++i)
+		fprintf(stream, i ? ",%s" : "%s", leaseio_names[i]);
+	fputc('\n', stream);
+}
+
+/**
+ * Write string as CSV field, quoted if necessary
+ */
+static void leaseio_csv_str(FILE *stream, const char *s)
+{
+	if (strpbrk(s, ",\"\r\n") == NULL)
+	{
+		fputs(s, stream);
+		return;
+	}
+
+	fputc('"', stream);
+	for (; *s; ++s)
+	{
+		if (*s == '"')
+			fputc('"', stream);
+		fputc(*s, stream);
+	}
+	fputc('"', stream);
+}
+
+/**
+ * Write string as JSON string
+ */
+static void leaseio_json_strout(FILE *stream, const char *s)
+{
+	fputc('"', stream);
+	for (; *s; ++s)
+	{
+		if (*s == '"' || *s == '\\')
+			fprintf(stream, "\\%c", *s);
+		else if ((uint8_t)*s < 0x20)
+			fprintf(stream, "\\u%04x", (uint8_t)*s);
+		else
+			fputc(*s, stream);
+	}
+	fputc('"', stream);
+}
+
+void leaseio_write_row(FILE *stream, enum leaseio_format format,
+	sqlite3_stmt *stmt)
+{
+	if (format == LEASEIO_JSONL)
+		fputc('{', stream);
+
+	for (int i = 0; i < LEASEIO_COLS; ++i)
+	{
+		bool null = sqlite3_column_type(stmt, i) == SQLITE_NULL;
+		bool text = i == LEASEIO_ADDRESS || i == LEASEIO_HWADDR ||
+			i == LEASEIO_ROUTERS || i == LEASEIO_NAMESERVERS;
+
+		char key[DHCP_KEY_STRLEN];
+
+		/* Keys are written as hex like hardware addresses */
+		if (i == LEASEIO_CLIENTID && !null)
+		{
+			struct dhcp_key k = { .len = 0 };
+			int len = sqlite3_column_bytes(stmt, i);
+
+			if (len <= DHCP_KEY_MAX)
+			{
+				k.len = len;
+				memcpy(k.data, sqlite3_column_blob(stmt, i), len);
+			}
+			dhcp_key_ntop(&k, key);
+		}
+
+		if (format == LEASEIO_CSV)
+		{
+			if (i)
+				fputc(',', stream);
+			if (null)
+				continue;
+
+			if (i == LEASEIO_CLIENTID)
+				fputs(key, stream);
+			else if (text)
+				leaseio_csv_str(stream, (const char *)sqlite3_column_text(stmt, i));
+			else
+				fprintf(stream, "%" PRId64, (int64_t)sqlite3_column_int64(stmt, i));
+		}
+		else
+		{
+			fprintf(stream, i ? ",\"%s\":" : "\"%s\":", leaseio_names[i]);
+
+			if (null)
+				fputs("null", stream);
+			else if (i == LEASEIO_CLIENTID)
+				fprintf(stream, "\"%s\"", key);
+			else if (text)
+				leaseio_json_strout(stream, (const char *)sqlite3_column_text(stmt, i));
+			else if (i == LEASEIO_ALLOCATED)
+				fputs(sqlite3_column_int(stmt, i) ? "true" : "false", stream);
+			else
+				fprintf(stream, "%" PRId64, (int64_t)sqlite3_column_int64(stmt, i));
+		}
+	}
+
+	fputs(format == LEASEIO_JSONL ? "}\n" : "\n", stream);
+}
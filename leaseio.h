@@ -0,0 +1,133 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <sqlite3.h>
+
+#include "dhcp.h"
+
+#ifndef DHCPD_LEASEIO_H_
+#define DHCPD_LEASEIO_H_
+
+/* Line based lease formats for bulk import and export. Every line holds one
+ * lease, so input and output can be streamed with bounded memory:
+ *
+ *  - CSV with a header line, which names the columns of DB_COLUMNS in any
+ *    order, fields containing commas or quotes are quoted as in RFC 4180
+ *  - JSON Lines, one flat object per line with the column names as keys
+ *
+ * Parsing happens in place, the fields of a row point into the line buffer.
+ */
+
+enum leaseio_format
+{
+	LEASEIO_CSV,
+	LEASEIO_JSONL
+};
+
+/* Columns in the order of DB_COLUMNS */
+enum leaseio_col
+{
+	LEASEIO_ID,
+	LEASEIO_ADDRESS,
+	LEASEIO_PREFIXLEN,
+	LEASEIO_HWADDR,
+	LEASEIO_ROUTERS,
+	LEASEIO_NAMESERVERS,
+	LEASEIO_LEASETIME,
+	LEASEIO_ALLOCATED,
+	LEASEIO_ALLOCATED_AT,
+	LEASEIO_CLIENTID,
+	LEASEIO_COLS
+};
+
+/* Most columns a CSV header may have */
+#define LEASEIO_CSV_COLS_MAX 32
+
+struct leaseio_row
+{
+	/* Zero terminated field values, NULL if missing or null */
+	char *fields[LEASEIO_COLS];
+};
+
+/* Validated lease of a row */
+struct leaseio_lease
+{
+	/* Zero if the database shall choose the id */
+	int64_t id;
+	const char *address;
+	int prefixlen;
+	/* Canonical upper case form */
+	char hwaddr[MAC_ADDRSTRLEN];
+	const char *routers;
+	const char *nameservers;
+	int64_t leasetime;
+	bool allocated;
+	int64_t allocated_at;
+	/* Derived from hwaddr if the row has none */
+	struct dhcp_key clientid;
+};
+
+/**
+ * Parse CSV header line
+ *
+ * @param[in] line Header line, which is modified
+ * @param[out] map Column of every CSV field, -1 for unknown ones
+ * @param[out] cnt Count of CSV fields
+ * @param[out] err Error message
+ */
+extern bool leaseio_csv_header(char *line, int map[LEASEIO_CSV_COLS_MAX],
+	size_t *cnt, const char **err);
+
+/**
+ * Parse CSV line
+ *
+ * @param[in] line Line, which is modified
+ * @param[in] map Column map of the header
+ * @param[in] cnt Count of CSV fields of the header
+ * @param[out] row Fields of the line
+ * @param[out] err Error message
+ */
+extern bool leaseio_csv_row(char *line, const int *map, size_t cnt,
+	struct leaseio_row *row, const char **err);
+
+/**
+ * Parse JSON Lines line
+ *
+ * @param[in] line Line, which is modified
+ * @param[out] row Fields of the line
+ * @param[out] err Error message
+ */
+extern bool leaseio_jsonl_row(char *line, struct leaseio_row *row,
+	const char **err);
+
+/**
+ * Check and convert fields of a row, missing fields get the defaults of
+ * dhcpctl leases add
+ *
+ * @param[in] row Parsed row
+ * @param[out] lease Validated lease, which refers to the row
+ * @param[out] err Error message
+ */
+extern bool leaseio_validate(const struct leaseio_row *row,
+	struct leaseio_lease *lease, const char **err);
+
+/**
+ * Write CSV header line
+ */
+extern void leaseio_write_header(FILE *stream, enum leaseio_format format);
+
+/**
+ * Write the current row of a statement, which selects DB_COLUMNS
+ *
+ * @param[in] stream Destination stream
+ * @param[in] format Output format
+ * @param[in] stmt Statement with a fetched row
+ */
+extern void leaseio_write_row(FILE *stream, enum leaseio_format format,
+	sqlite3_stmt *stmt);
+
+#endif
@@ -0,0 +1,412 @@
+#include "log.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <arpa/inet.h>
+
+#include "dhcp.h"
+
+enum log_type
+{
+	LOG_T_PAD = 0,
+	LOG_T_MSG = 1,
+	LOG_T_TEXT = 2
+};
+
+struct log_hdr
+{
+	/* Length of the record including this header, multiple of 16 */
+	uint32_t len;
+	/* Length of the payload */
+	uint32_t size;
+	uint16_t type;
+	/* Direction for messages, error number for text */
+	uint16_t arg;
+	uint32_t _pad;
+};
+
+#define LOG_ALIGN(l) (((l) + 15) & ~(size_t)15)
+
+struct log_ring
+{
+	/* Written by the producer only */
+	_Alignas(64) uint64_t head;
+	uint64_t drops;
+
+	/* Written by the background thread only */
+	_Alignas(64) uint64_t tail;
+
+	struct log_ring *next;
+	uint8_t *buf;
+};
+
+static __thread struct log_ring *log_self = NULL;
+static struct log_ring *log_rings = NULL;
+
+static FILE *log_stream = NULL;
+static pthread_t log_thread;
+static bool log_running = false;
+static bool log_stop = false;
+
+/* Set by the background thread before it waits for new records */
+static int log_sleeping = 0;
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Write DHCP message in human readable form
+ */
+static void log_format_msg(FILE *stream, enum log_dir dir, uint8_t *data, size_t len)
+{
+	char ciaddr[INET_ADDRSTRLEN],
+			 yiaddr[INET_ADDRSTRLEN],
+			 siaddr[INET_ADDRSTRLEN],
+			 giaddr[INET_ADDRSTRLEN],
+			 chaddr[MAC_ADDRSTRLEN];
+
+	if (len < DHCP_MSG_HDRLEN)
+		return;
+
+	inet_ntop(AF_INET, DHCP_MSG_F_CIADDR(data), ciaddr, sizeof ciaddr);
+	inet_ntop(AF_INET, DHCP_MSG_F_YIADDR(data), yiaddr, sizeof yiaddr);
+	inet_ntop(AF_INET, DHCP_MSG_F_SIADDR(data), siaddr, sizeof siaddr);
+	inet_ntop(AF_INET, DHCP_MSG_F_GIADDR(data), giaddr, sizeof giaddr);
+	mac_ntop(DHCP_MSG_F_CHADDR(data), chaddr, sizeof chaddr);
+
+	struct dhcp_msg msg = {
+		.data = data,
+		.end = data + len,
+		.length = len,
+		.type = dhcp_msg_type(data, data + len),
+		.ciaddr = ciaddr,
+		.yiaddr = yiaddr,
+		.siaddr = siaddr,
+		.giaddr = giaddr,
+		.chaddr = chaddr
+	};
+
+	if (dir == LOG_INCOMING)
+		fprintf(stream, "--- INCOMING ---\n");
+	else
+		fprintf(stream, "--- OUTGOING ---\n");
+
+	dhcp_msg_dump(stream, &msg);
+}
+
+/**
+ * Write text record
+ */
+static void log_format_text(FILE *stream, int _errno, const char *text)
+{
+	if (_errno != 0)
+		fprintf(stream, "%s: ", strerror(_errno));
+
+	fputs(text, stream);
+	fputc('\n', stream);
+}
+
+/**
+ * Get ring of the calling thread, create it on first use
+ */
+static struct log_ring *log_ring_self(void)
+{
+	if (log_self)
+		return log_self;
+
+	struct log_ring *r = aligned_alloc(64, sizeof *r);
+	if (r == NULL)
+		return NULL;
+
+	*r = (struct log_ring){
+		.head = 0,
+		.drops = 0,
+		.tail = 0,
+		.next = NULL,
+		.buf = malloc(LOG_RING_SIZE)
+	};
+
+	if (r->buf == NULL)
+	{
+		free(r);
+		return NULL;
+	}
+
+	r->next = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+	while (!__atomic_compare_exchange_n(&log_rings, &r->next, r, false,
+			__ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+		;
+
+	return log_self = r;
+}
+
+/**
+ * Reserve len bytes for a record, returns NULL if the ring is full
+ *
+ * @param[in] r Ring of the calling thread
+ * @param[in] len Length of the record including header
+ * @param[out] head Value of head after committing the record
+ */
+static struct log_hdr *log_reserve(struct log_ring *r, size_t len, uint64_t *head)
+{
+	uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	size_t off = r->head % LOG_RING_SIZE;
+	size_t contiguous = LOG_RING_SIZE - off;
+	size_t need = (contiguous < len) ? contiguous + len : len;
+
+	if (LOG_RING_SIZE - (r->head - tail) < need)
+	{
+		__atomic_add_fetch(&r->drops, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+
+	*head = r->head + need;
+
+	if (contiguous < len)
+	{
+		/* Records never wrap around, skip the end of the buffer */
+		*(struct log_hdr *)(r->buf + off) = (struct log_hdr){
+			.len = contiguous,
+			.type = LOG_T_PAD
+		};
+		off = 0;
+	}
+
+	return (struct log_hdr *)(r->buf + off);
+}
+
+/**
+ * Publish reserved record and wake up background thread, if it sleeps
+ */
+static void log_commit(struct log_ring *r, uint64_t head)
+{
+	__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+
+	if (__atomic_load_n(&log_sleeping, __ATOMIC_ACQUIRE) &&
+			__atomic_exchange_n(&log_sleeping, 0, __ATOMIC_ACQ_REL))
+	{
+		pthread_mutex_lock(&log_mutex);
+		pthread_cond_signal(&log_cond);
+		pthread_mutex_unlock(&log_mutex);
+	}
+}
+
+void log_msg(enum log_dir dir, const uint8_t *data, size_t len)
+{
+	struct log_ring *r;
+
+	if (!log_running || (r = log_ring_self()) == NULL)
+	{
+		log_format_msg(stderr, dir, (uint8_t *)data, len);
+		return;
+	}
+
+	uint64_t head;
+	size_t rec_len = LOG_ALIGN(sizeof(struct log_hdr) + len);
+	struct log_hdr *hdr = log_reserve(r, rec_len, &head);
+
+	if (hdr == NULL)
+		return;
+
+	*hdr = (struct log_hdr){
+		.len = rec_len,
+		.size = len,
+		.type = LOG_T_MSG,
+		.arg = dir
+	};
+	memcpy(hdr + 1, data, len);
+
+	log_commit(r, head);
+}
+
+void log_vprintf(int _errno, const char *fmt, va_list ap)
+{
+	struct log_ring *r;
+
+	if (!log_running || (r = log_ring_self()) == NULL)
+	{
+		if (_errno != 0)
+			fprintf(stderr, "%s: ", strerror(_errno));
+		vfprintf(stderr, fmt, ap);
+		fputc('\n', stderr);
+		return;
+	}
+
+	char text[LOG_TEXT_MAX];
+	int text_len = vsnprintf(text, sizeof text, fmt, ap);
+
+	if (text_len < 0)
+		return;
+	if ((size_t)text_len >= sizeof text)
+		text_len = sizeof text - 1;
+
+	uint64_t head;
+	size_t rec_len = LOG_ALIGN(sizeof(struct log_hdr) + text_len + 1);
+	struct log_hdr *hdr = log_reserve(r, rec_len, &head);
+
+	if (hdr == NULL)
+		return;
+
+	*hdr = (struct log_hdr){
+		.len = rec_len,
+		.size = text_len + 1,
+		.type = LOG_T_TEXT,
+		.arg = _errno
+	};
+	memcpy(hdr + 1, text, text_len + 1);
+
+	log_commit(r, head);
+}
+
+void log_printf(const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	log_vprintf(0, fmt, ap);
+	va_end(ap);
+}
+
+/**
+ * Format and write all published records of all rings
+ *
+ * @return Count of records written
+ */
+static size_t log_drain(void)
+{
+	size_t cnt = 0;
+
+	for (struct log_ring *r = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+			r != NULL; r = r->next)
+	{
+		uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		uint64_t tail = r->tail;
+
+		while (tail != head)
+		{
+			struct log_hdr *hdr = (struct log_hdr *)(r->buf + tail % LOG_RING_SIZE);
+
+			switch (hdr->type)
+			{
+				case LOG_T_MSG:
+					log_format_msg(log_stream, hdr->arg, (uint8_t *)(hdr + 1),
+						hdr->size);
+					++cnt;
+					break;
+				case LOG_T_TEXT:
+					log_format_text(log_stream, hdr->arg, (const char *)(hdr + 1));
+					++cnt;
+					break;
+			}
+
+			tail += hdr->len;
+		}
+
+		__atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	if (cnt)
+		fflush(log_stream);
+
+	return cnt;
+}
+
+static void *log_thread_main(void *arg)
+{
+	(void)arg;
+
+	for (;;)
+	{
+		if (log_drain())
+			continue;
+
+		if (__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE))
+			break;
+
+		__atomic_store_n(&log_sleeping, 1, __ATOMIC_RELEASE);
+
+		/* A record might have been published before the flag was visible */
+		if (log_drain())
+		{
+			__atomic_store_n(&log_sleeping, 0, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 100 * 1000 * 1000;
+		if (ts.tv_nsec >= 1000 * 1000 * 1000)
+		{
+			ts.tv_nsec -= 1000 * 1000 * 1000;
+			++ts.tv_sec;
+		}
+
+		pthread_mutex_lock(&log_mutex);
+		if (__atomic_load_n(&log_sleeping, __ATOMIC_ACQUIRE) &&
+				!__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE))
+			pthread_cond_timedwait(&log_cond, &log_mutex, &ts);
+		pthread_mutex_unlock(&log_mutex);
+
+		__atomic_store_n(&log_sleeping, 0, __ATOMIC_RELEASE);
+	}
+
+	log_drain();
+
+	return NULL;
+}
+
+bool log_init(FILE *stream)
+{
+	if (log_running)
+		return true;
+
+	log_stream = stream;
+	log_stop = false;
+
+	/* Signals are handled by the event loop, never by this thread */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	int err = pthread_create(&log_thread, NULL, log_thread_main, NULL);
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err != 0)
+	{
+		errno = err;
+		return false;
+	}
+
+	log_running = true;
+	return true;
+}
+
+uint64_t log_drops(void)
+{
+	uint64_t drops = 0;
+
+	for (struct log_ring *r = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE);
+			r != NULL; r = r->next)
+		drops += __atomic_load_n(&r->drops, __ATOMIC_RELAXED);
+
+	return drops;
+}
+
+void log_shutdown(void)
+{
+	if (!log_running)
+		return;
+
+	__atomic_store_n(&log_stop, true, __ATOMIC_RELEASE);
+
+	pthread_mutex_lock(&log_mutex);
+	pthread_cond_signal(&log_cond);
+	pthread_mutex_unlock(&log_mutex);
+
+	pthread_join(log_thread, NULL);
+	log_running = false;
+}
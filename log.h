@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#ifndef DHCPD_LOG_H_
+#define DHCPD_LOG_H_
+
+/* Logging must never block packet processing. Every thread, which logs
+ * something, gets its own single-producer ring, where compact binary records
+ * are appended without any lock. DHCP messages are stored as raw bytes, and
+ * only text messages are formatted by the producer. A background thread
+ * drains all rings, formats the records and writes them out.
+ *
+ * If a ring is full, the record is dropped and counted.
+ */
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE (1 << 20)
+#endif
+
+/* Longest text record */
+#define LOG_TEXT_MAX 1024
+
+enum log_dir
+{
+	LOG_INCOMING = 0,
+	LOG_OUTGOING = 1
+};
+
+/**
+ * Start background thread, which writes all records to stream
+ *
+ * Until this is called, every record is written synchronously to stderr.
+ *
+ * @param[in] stream Destination stream
+ */
+extern bool log_init(FILE *stream);
+
+/**
+ * Log a DHCP message
+ *
+ * @param[in] dir Direction of traffic
+ * @param[in] data Buffer which holds the DHCP message
+ * @param[in] len Length of the DHCP message
+ */
+extern void log_msg(enum log_dir dir, const uint8_t *data, size_t len);
+
+/**
+ * Log text message, a newline is appended
+ */
+extern void log_printf(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+/**
+ * Log text message with argument list, a newline is appended
+ *
+ * @param[in] _errno Error number, which is prepended as text, if not zero
+ * @param[in] fmt Format string
+ * @param[in] ap Arguments
+ */
+extern void log_vprintf(int _errno, const char *fmt, va_list ap);
+
+/**
+ * Count of records dropped, because a ring was full
+ */
+extern uint64_t log_drops(void);
+
+/**
+ * Write all pending records and stop background thread
+ */
+extern void log_shutdown(void);
+
+#endif
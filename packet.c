@@ -0,0 +1,121 @@
+#include "packet.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#ifdef __linux__
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#endif
+
+#include "array.h"
+
+bool packet_tx_open(struct packet_tx *tx, int ifindex,
+	const uint8_t hwaddr[6], struct in_addr src)
+{
+#ifdef __linux__
+	/* Protocol 0 means we never receive anything on this socket */
+	int fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (fd < 0)
+		return false;
+
+	struct sockaddr_ll ll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = 0,
+		.sll_ifindex = ifindex
+	};
+
+	if (bind(fd, (struct sockaddr *)&ll, sizeof ll) < 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	*tx = (struct packet_tx)PACKET_TX_EMPTY;
+	tx->fd = fd;
+	tx->ifindex = ifindex;
+
+	uint8_t *hdr = tx->hdr;
+
+	ARRAY_COPY(PACKET_F_ETH_SRC(hdr), hwaddr, 6);
+	packet_put16(PACKET_F_ETH_TYPE(hdr), htons(ETHERTYPE_IP));
+
+	uint8_t *ip = PACKET_F_IP(hdr);
+	ip[0] = 0x45; /* Version 4, 5 words header */
+	ip[1] = 0x10; /* Low delay */
+	ip[8] = 64;   /* TTL */
+	ip[9] = IPPROTO_UDP;
+	packet_put32(PACKET_F_IP_SRC(hdr), src.s_addr);
+
+	packet_put16(PACKET_F_UDP_SPORT(hdr), htons(67));
+	packet_put16(PACKET_F_UDP_DPORT(hdr), htons(68));
+
+	/* Length, destination and checksum are still zero, therefore the sum
+	 * covers exactly the static fields */
+	tx->ip_sum = packet_sum(ip, PACKET_IP_HDRLEN, 0);
+
+	tx->udp_sum = packet_sum(PACKET_F_IP_SRC(hdr), 4, 0);
+	tx->udp_sum += IPPROTO_UDP;
+	tx->udp_sum = packet_sum(PACKET_F_UDP(hdr), PACKET_UDP_HDRLEN, tx->udp_sum);
+
+	return true;
+#else
+	(void)tx, (void)ifindex, (void)hwaddr, (void)src;
+	errno = ENOTSUP;
+	return false;
+#endif
+}
+
+ssize_t packet_tx_send(struct packet_tx *tx, const uint8_t dst_hw[6],
+	struct in_addr dst, const uint8_t *payload, size_t len)
+{
+	uint8_t *hdr = tx->hdr;
+	uint16_t ip_len = PACKET_IP_HDRLEN + PACKET_UDP_HDRLEN + len;
+	uint16_t udp_len = PACKET_UDP_HDRLEN + len;
+
+	ARRAY_COPY(PACKET_F_ETH_DST(hdr), dst_hw, 6);
+
+	packet_put16(PACKET_F_IP_LEN(hdr), htons(ip_len));
+	packet_put32(PACKET_F_IP_DST(hdr), dst.s_addr);
+	packet_put16(PACKET_F_UDP_LEN(hdr), htons(udp_len));
+
+	uint32_t sum = tx->ip_sum + ip_len;
+	sum = packet_sum(PACKET_F_IP_DST(hdr), 4, sum);
+	packet_put16(PACKET_F_IP_SUM(hdr), packet_fold(sum));
+
+	/* UDP length is part of both the pseudo header and the UDP header */
+	sum = tx->udp_sum + 2 * (uint32_t)udp_len;
+	sum = packet_sum(PACKET_F_IP_DST(hdr), 4, sum);
+	sum = packet_sum(payload, len, sum);
+	uint16_t udp_sum = packet_fold(sum);
+	packet_put16(PACKET_F_UDP_SUM(hdr), udp_sum ? udp_sum : 0xFFFF);
+
+	struct iovec iov[2] = {
+		{ .iov_base = hdr, .iov_len = PACKET_FRAME_HDRLEN },
+		{ .iov_base = (void *)payload, .iov_len = len }
+	};
+	struct msghdr mh = {
+		.msg_iov = iov,
+		.msg_iovlen = 2
+	};
+
+	ssize_t err = sendmsg(tx->fd, &mh, MSG_DONTWAIT);
+
+	packet_put16(PACKET_F_IP_SUM(hdr), 0);
+	packet_put16(PACKET_F_UDP_SUM(hdr), 0);
+
+	return err;
+}
+
+void packet_tx_close(struct packet_tx *tx)
+{
+	if (tx->fd >= 0)
+		close(tx->fd);
+	tx->fd = -1;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef DHCPD_PACKET_H_
+#define DHCPD_PACKET_H_
+
+/* Replies to clients without an IP address can't be sent through the UDP
+ * socket, because the kernel would have to resolve the destination with ARP,
+ * which the client can't answer yet. Therefore we build the whole frame on
+ * our own and send it through an AF_PACKET socket directly to chaddr.
+ *
+ * A frame consists of a prebuilt header, which is the same for every reply
+ * on an interface, and the DHCP message as payload:
+ *
+ * +------------------+-----------------+-------------+-------------------+
+ * | Ethernet (14)    | IPv4 (20)       | UDP (8)     | DHCP message      |
+ * +------------------+-----------------+-------------+-------------------+
+ *
+ * Only the destination addresses, the lengths and the checksums are patched
+ * per reply. Multi-byte fields aren't aligned in the frame, so they're
+ * stored with packet_put16() and packet_put32().
+ */
+
+#define PACKET_ETH_HDRLEN (14)
+#define PACKET_IP_HDRLEN  (20)
+#define PACKET_UDP_HDRLEN (8)
+#define PACKET_FRAME_HDRLEN     (PACKET_ETH_HDRLEN + PACKET_IP_HDRLEN + PACKET_UDP_HDRLEN)
+
+#define PACKET_F_ETH_DST(f)   ((uint8_t*)((f)+0))
+#define PACKET_F_ETH_SRC(f)   ((uint8_t*)((f)+6))
+#define PACKET_F_ETH_TYPE(f)  ((uint8_t*)((f)+12))
+#define PACKET_F_IP(f)        ((uint8_t*)((f)+PACKET_ETH_HDRLEN))
+#define PACKET_F_IP_LEN(f)    ((uint8_t*)((f)+PACKET_ETH_HDRLEN+2))
+#define PACKET_F_IP_SUM(f)    ((uint8_t*)((f)+PACKET_ETH_HDRLEN+10))
+#define PACKET_F_IP_SRC(f)    ((uint8_t*)((f)+PACKET_ETH_HDRLEN+12))
+#define PACKET_F_IP_DST(f)    ((uint8_t*)((f)+PACKET_ETH_HDRLEN+16))
+#define PACKET_F_UDP(f)       ((uint8_t*)((f)+PACKET_ETH_HDRLEN+PACKET_IP_HDRLEN))
+#define PACKET_F_UDP_SPORT(f) ((uint8_t*)((f)+PACKET_ETH_HDRLEN+PACKET_IP_HDRLEN+0))
+#define PACKET_F_UDP_DPORT(f) ((uint8_t*)((f)+PACKET_ETH_HDRLEN+PACKET_IP_HDRLEN+2))
+#define PACKET_F_UDP_LEN(f)   ((uint8_t*)((f)+PACKET_ETH_HDRLEN+PACKET_IP_HDRLEN+4))
+#define PACKET_F_UDP_SUM(f)   ((uint8_t*)((f)+PACKET_ETH_HDRLEN+PACKET_IP_HDRLEN+6))
+
+struct packet_tx
+{
+	int fd;
+	int ifindex;
+
+	/* Prebuilt header template */
+	uint8_t hdr[PACKET_FRAME_HDRLEN];
+
+	/* Partial checksums over the static parts of the IP header and the UDP
+	 * pseudo header */
+	uint32_t ip_sum;
+	uint32_t udp_sum;
+};
+
+#define PACKET_TX_EMPTY {\
+		.fd = -1,\
+		.ifindex = 0,\
+		.hdr = {0},\
+		.ip_sum = 0,\
+		.udp_sum = 0\
+	}
+
+/**
+ * Store 16 bit value, which is in network byte order already, at an
+ * unaligned field
+ */
+static inline void packet_put16(uint8_t *field, uint16_t value)
+{
+	memcpy(field, &value, sizeof value);
+}
+
+/**
+ * Store 32 bit value, which is in network byte order already, at an
+ * unaligned field
+ */
+static inline void packet_put32(uint8_t *field, uint32_t value)
+{
+	memcpy(field, &value, sizeof value);
+}
+
+/**
+ * Add data to a 32 bit ones' complement accumulator
+ *
+ * @param[in] data Data to sum up in network byte order
+ * @param[in] len Length of data
+ * @param[in] sum Previous value of the accumulator
+ */
+static inline uint32_t packet_sum(const void *data, size_t len, uint32_t sum)
+{
+	const uint8_t *p = data;
+
+	for (; len > 1; len -= 2, p += 2)
+		sum += (uint32_t)p[0] << 8 | p[1];
+	if (len)
+		sum += (uint32_t)p[0] << 8;
+
+	return sum;
+}
+
+/**
+ * Fold accumulator into a final internet checksum in network byte order
+ */
+static inline uint16_t packet_fold(uint32_t sum)
+{
+	while (sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return htons((uint16_t)~sum);
+}
+
+/**
+ * Open AF_PACKET socket on interface and prebuild frame header
+ *
+ * @param[out] tx Transmit context
+ * @param[in] ifindex Index of the interface
+ * @param[in] hwaddr Hardware address of the interface
+ * @param[in] src IPv4 address used as source for all frames
+ */
+extern bool packet_tx_open(struct packet_tx *tx, int ifindex,
+	const uint8_t hwaddr[6], struct in_addr src);
+
+/**
+ * Send DHCP message to client with hardware address dst_hw and IP address dst
+ *
+ * @param[in] tx Transmit context
+ * @param[in] dst_hw Hardware address of the client
+ * @param[in] dst IP address of the client
+ * @param[in] payload DHCP message
+ * @param[in] len Length of the DHCP message
+ */
+extern ssize_t packet_tx_send(struct packet_tx *tx, const uint8_t dst_hw[6],
+	struct in_addr dst, const uint8_t *payload, size_t len);
+
+/**
+ * Close AF_PACKET socket of transmit context
+ */
+extern void packet_tx_close(struct packet_tx *tx);
+
+#endif
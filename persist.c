@@ -0,0 +1,524 @@
+#include "persist.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+
+enum persist_op
+{
+	PERSIST_PUT = 1,
+	PERSIST_DEL = 2,
+	PERSIST_CLEAR = 3,
+	/* Commit and report the ticket as done */
+	PERSIST_SYNC = 4
+};
+
+/* Bytes of the strings of a lease, which are stored in the record itself */
+#ifndef PERSIST_STRS_LEN
+#define PERSIST_STRS_LEN 256
+#endif
+
+/* Offset of a string, which is NULL */
+#define PERSIST_STR_NULL UINT16_MAX
+
+enum persist_str
+{
+	PERSIST_STR_ADDRESS,
+	PERSIST_STR_HWADDR,
+	PERSIST_STR_ROUTERS,
+	PERSIST_STR_NAMESERVERS,
+	PERSIST_STRS
+};
+
+struct persist_rec
+{
+	enum persist_op op;
+	/* Ticket of PERSIST_SYNC */
+	uint64_t ticket;
+	/* The strings of the lease are copied into strs, records are copied
+	 * around, so the pointers are only set up again by persist_unpack().
+	 * Strings, which don't fit, are duplicated and owned by the record. */
+	struct db_lease lease;
+	bool owned;
+	uint16_t strs_off[PERSIST_STRS];
+	char strs[PERSIST_STRS_LEN];
+};
+
+struct persist_slot
+{
+	/* Position + 1 once the record at position is published, position +
+	 * PERSIST_QUEUE_LEN once the slot may be reused */
+	uint64_t seq;
+	struct persist_rec rec;
+};
+
+static struct persist_slot *persist_ring = NULL;
+
+/* Claimed by producers */
+static _Alignas(64) uint64_t persist_tail = 0;
+/* Consumed by the thread */
+static _Alignas(64) uint64_t persist_head = 0;
+
+static sqlite3 *persist_db = NULL;
+/* Statement of the thread, which stores leases */
+static sqlite3_stmt *persist_replace = NULL;
+static pthread_t persist_thread;
+static bool persist_running = false;
+static bool persist_stop = false;
+
+/* Held by the thread while it writes a batch */
+static pthread_mutex_t persist_db_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Sleeping of the thread on an empty queue and of producers on a full one
+ * or a pending sync */
+static int persist_sleeping = 0;
+static int persist_waiting = 0;
+static pthread_mutex_t persist_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t persist_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t persist_space_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t persist_ticket = 0;
+static uint64_t persist_synced = 0;
+
+static struct persist_stats persist_counters = {0};
+/* Value of errors at the last persist_sync() */
+static uint64_t persist_sync_errors = 0;
+
+/**
+ * Wait on a condition for at most 100ms, so a lost wakeup only delays
+ */
+static void persist_wait(pthread_cond_t *cond, int *flag)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += 100 * 1000 * 1000;
+	if (ts.tv_nsec >= 1000 * 1000 * 1000)
+	{
+		ts.tv_nsec -= 1000 * 1000 * 1000;
+		++ts.tv_sec;
+	}
+
+	pthread_mutex_lock(&persist_mutex);
+	if (__atomic_load_n(flag, __ATOMIC_ACQUIRE))
+		pthread_cond_timedwait(cond, &persist_mutex, &ts);
+	pthread_mutex_unlock(&persist_mutex);
+}
+
+/**
+ * Wake up whoever sleeps on a condition with flag set
+ */
+static void persist_wake(pthread_cond_t *cond, int *flag)
+{
+	if (__atomic_load_n(flag, __ATOMIC_ACQUIRE) &&
+			__atomic_exchange_n(flag, 0, __ATOMIC_ACQ_REL))
+	{
+		pthread_mutex_lock(&persist_mutex);
+		pthread_cond_broadcast(cond);
+		pthread_mutex_unlock(&persist_mutex);
+	}
+}
+
+/**
+ * Append record to the queue, wait while it is full
+ */
+static void persist_push(const struct persist_rec *rec)
+{
+	struct persist_slot *slot;
+	uint64_t pos = __atomic_load_n(&persist_tail, __ATOMIC_RELAXED);
+	bool stalled = false;
+
+	for (;;)
+	{
+		slot = &persist_ring[pos & (PERSIST_QUEUE_LEN - 1)];
+		int64_t diff = (int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&persist_tail, &pos, pos + 1, true,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+		{
+			/* The slot still holds a record from one round before */
+			if (!stalled)
+				__atomic_add_fetch(&persist_counters.stalls, 1, __ATOMIC_RELAXED);
+			stalled = true;
+
+			__atomic_store_n(&persist_waiting, 1, __ATOMIC_RELEASE);
+			if ((int64_t)(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos) < 0)
+				persist_wait(&persist_space_cond, &persist_waiting);
+			pos = __atomic_load_n(&persist_tail, __ATOMIC_RELAXED);
+		}
+		else
+			pos = __atomic_load_n(&persist_tail, __ATOMIC_RELAXED);
+	}
+
+	slot->rec = *rec;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+
+	uint64_t queued = pos + 1 - __atomic_load_n(&persist_head, __ATOMIC_ACQUIRE);
+	uint64_t max = __atomic_load_n(&persist_counters.queued_max, __ATOMIC_RELAXED);
+	while (queued > max && !__atomic_compare_exchange_n(
+			&persist_counters.queued_max, &max, queued, true,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	persist_wake(&persist_cond, &persist_sleeping);
+}
+
+/**
+ * Take next published record, only called by the thread
+ *
+ * @return false if the queue is empty
+ */
+static bool persist_pop(struct persist_rec *rec)
+{
+	struct persist_slot *slot = &persist_ring[persist_head & (PERSIST_QUEUE_LEN - 1)];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != persist_head + 1)
+		return false;
+
+	*rec = slot->rec;
+	__atomic_store_n(&slot->seq, persist_head + PERSIST_QUEUE_LEN,
+		__ATOMIC_RELEASE);
+	__atomic_store_n(&persist_head, persist_head + 1, __ATOMIC_RELEASE);
+
+	persist_wake(&persist_space_cond, &persist_waiting);
+	return true;
+}
+
+/**
+ * Point the strings of the lease into the record
+ */
+static void persist_unpack(struct persist_rec *rec)
+{
+	if (rec->owned)
+		return;
+
+	char **strs[PERSIST_STRS] = {
+		[PERSIST_STR_ADDRESS] = &rec->lease.address,
+		[PERSIST_STR_HWADDR] = &rec->lease.hwaddr,
+		[PERSIST_STR_ROUTERS] = &rec->lease.routers,
+		[PERSIST_STR_NAMESERVERS] = &rec->lease.nameservers
+	};
+
+	for (size_t i = 0; i < PERSIST_STRS; ++i)
+		*strs[i] = rec->strs_off[i] == PERSIST_STR_NULL ? NULL :
+			rec->strs + rec->strs_off[i];
+}
+
+/**
+ * Apply one mutation
+ *
+ * @return false if it failed
+ */
+static bool persist_apply(struct persist_rec *rec)
+{
+	int sqlerr;
+
+	switch (rec->op)
+	{
+		case PERSIST_PUT:
+			persist_unpack(rec);
+			sqlerr = db_lease_replace(persist_db, &persist_replace, &rec->lease);
+			if (rec->owned)
+				db_lease_free(&rec->lease);
+			if (sqlerr == SQLITE_DONE)
+				return true;
+			break;
+
+		case PERSIST_DEL:
+			if ((sqlerr = db_lease_delete(persist_db, &rec->lease)) == SQLITE_OK)
+				return true;
+			break;
+
+		case PERSIST_CLEAR:
+			sqlerr = sqlite3_exec(persist_db, "DELETE FROM leases;", NULL, NULL,
+				NULL);
+			if (sqlerr == SQLITE_OK)
+				return true;
+			break;
+
+		default:
+			return true;
+	}
+
+	log_printf("Could not write lease %u: %s", rec->lease.id,
+		sqlite3_errstr(sqlerr));
+	return false;
+}
+
+/**
+ * Write queued mutations in one transaction
+ *
+ * @return false if the queue was empty
+ */
+static bool persist_batch(void)
+{
+	struct persist_rec rec;
+	uint64_t ticket = 0;
+	uint64_t written = 0, errors = 0;
+
+	if (!persist_pop(&rec))
+		return false;
+
+	pthread_mutex_lock(&persist_db_mutex);
+	sqlite3_exec(persist_db, "BEGIN;", NULL, NULL, NULL);
+
+	do
+	{
+		/* A sync ends the batch, so waiting never takes longer than one */
+		if (rec.op == PERSIST_SYNC)
+		{
+			ticket = rec.ticket;
+			break;
+		}
+
+		if (persist_apply(&rec))
+			++written;
+		else
+			++errors;
+	}
+	while (written + errors < PERSIST_BATCH && persist_pop(&rec));
+
+	if (sqlite3_exec(persist_db, "COMMIT;", NULL, NULL, NULL) != SQLITE_OK &&
+			sqlite3_get_autocommit(persist_db) == 0)
+	{
+		log_printf("Could not commit %llu leases: %s",
+			(unsigned long long)written, sqlite3_errmsg(persist_db));
+		sqlite3_exec(persist_db, "ROLLBACK;", NULL, NULL, NULL);
+		errors += written;
+		written = 0;
+	}
+
+	pthread_mutex_unlock(&persist_db_mutex);
+
+	__atomic_add_fetch(&persist_counters.batches, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&persist_counters.written, written, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&persist_counters.errors, errors, __ATOMIC_RELAXED);
+
+	if (ticket != 0)
+	{
+		pthread_mutex_lock(&persist_mutex);
+		__atomic_store_n(&persist_synced, ticket, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&persist_space_cond);
+		pthread_mutex_unlock(&persist_mutex);
+	}
+
+	return true;
+}
+
+static void *persist_thread_main(void *arg)
+{
+	(void)arg;
+
+	for (;;)
+	{
+		if (persist_batch())
+			continue;
+
+		if (__atomic_load_n(&persist_stop, __ATOMIC_ACQUIRE))
+			break;
+
+		__atomic_store_n(&persist_sleeping, 1, __ATOMIC_RELEASE);
+
+		/* A record might have been published before the flag was visible */
+		if (persist_batch())
+		{
+			__atomic_store_n(&persist_sleeping, 0, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		if (!__atomic_load_n(&persist_stop, __ATOMIC_ACQUIRE))
+			persist_wait(&persist_cond, &persist_sleeping);
+
+		__atomic_store_n(&persist_sleeping, 0, __ATOMIC_RELEASE);
+	}
+
+	while (persist_batch())
+		;
+
+	pthread_mutex_lock(&persist_db_mutex);
+	sqlite3_finalize(persist_replace);
+	persist_replace = NULL;
+	pthread_mutex_unlock(&persist_db_mutex);
+
+	return NULL;
+}
+
+bool persist_init(sqlite3 *db)
+{
+	if (persist_running)
+		return true;
+
+	persist_ring = calloc(PERSIST_QUEUE_LEN, sizeof *persist_ring);
+	if (persist_ring == NULL)
+		return false;
+
+	for (uint64_t i = 0; i < PERSIST_QUEUE_LEN; ++i)
+		persist_ring[i].seq = i;
+
+	persist_db = db;
+	persist_stop = false;
+
+	/* Signals are handled by the event loop, never by this thread */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+
+	int err = pthread_create(&persist_thread, NULL, persist_thread_main, NULL);
+
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err != 0)
+	{
+		free(persist_ring);
+		persist_ring = NULL;
+		errno = err;
+		return false;
+	}
+
+	persist_running = true;
+	return true;
+}
+
+/**
+ * Duplicate string, which may be NULL
+ */
+static char *persist_strdup(const char *s)
+{
+	return s != NULL ? strdup(s) : NULL;
+}
+
+void persist_put(const struct db_lease *lease)
+{
+	struct persist_rec rec = {
+		.op = PERSIST_PUT,
+		.lease = *lease,
+		.owned = false
+	};
+	const char *strs[PERSIST_STRS] = {
+		[PERSIST_STR_ADDRESS] = lease->address,
+		[PERSIST_STR_HWADDR] = lease->hwaddr,
+		[PERSIST_STR_ROUTERS] = lease->routers,
+		[PERSIST_STR_NAMESERVERS] = lease->nameservers
+	};
+	size_t off = 0;
+
+	/* Usual leases fit into the record, so queueing doesn't allocate */
+	for (size_t i = 0; i < PERSIST_STRS && !rec.owned; ++i)
+	{
+		size_t len;
+
+		if (strs[i] == NULL)
+			rec.strs_off[i] = PERSIST_STR_NULL;
+		else if ((len = strlen(strs[i]) + 1) <= PERSIST_STRS_LEN - off)
+		{
+			memcpy(rec.strs + off, strs[i], len);
+			rec.strs_off[i] = off;
+			off += len;
+		}
+		else
+			rec.owned = true;
+	}
+
+	if (rec.owned)
+	{
+		rec.lease.address = persist_strdup(lease->address);
+		rec.lease.hwaddr = persist_strdup(lease->hwaddr);
+		rec.lease.routers = persist_strdup(lease->routers);
+		rec.lease.nameservers = persist_strdup(lease->nameservers);
+	}
+
+	persist_push(&rec);
+}
+
+void persist_del(uint32_t id)
+{
+	struct persist_rec rec = {
+		.op = PERSIST_DEL,
+		.lease = DB_LEASE_EMPTY
+	};
+	rec.lease.id = id;
+
+	persist_push(&rec);
+}
+
+void persist_clear(void)
+{
+	struct persist_rec rec = {
+		.op = PERSIST_CLEAR,
+		.lease = DB_LEASE_EMPTY
+	};
+
+	persist_push(&rec);
+}
+
+bool persist_sync(void)
+{
+	if (!persist_running)
+		return true;
+
+	struct persist_rec rec = {
+		.op = PERSIST_SYNC,
+		.ticket = ++persist_ticket,
+		.lease = DB_LEASE_EMPTY
+	};
+
+	persist_push(&rec);
+
+	while (__atomic_load_n(&persist_synced, __ATOMIC_ACQUIRE) < rec.ticket)
+	{
+		__atomic_store_n(&persist_waiting, 1, __ATOMIC_RELEASE);
+		if (__atomic_load_n(&persist_synced, __ATOMIC_ACQUIRE) < rec.ticket)
+			persist_wait(&persist_space_cond, &persist_waiting);
+	}
+
+	uint64_t errors = __atomic_load_n(&persist_counters.errors, __ATOMIC_RELAXED);
+	bool ok = errors == persist_sync_errors;
+	persist_sync_errors = errors;
+
+	return ok;
+}
+
+void persist_lock(void)
+{
+	pthread_mutex_lock(&persist_db_mutex);
+}
+
+void persist_unlock(void)
+{
+	pthread_mutex_unlock(&persist_db_mutex);
+}
+
+void persist_stats(struct persist_stats *ps)
+{
+	ps->queued = __atomic_load_n(&persist_tail, __ATOMIC_RELAXED) -
+		__atomic_load_n(&persist_head, __ATOMIC_RELAXED);
+	ps->queued_max = __atomic_load_n(&persist_counters.queued_max, __ATOMIC_RELAXED);
+	ps->stalls = __atomic_load_n(&persist_counters.stalls, __ATOMIC_RELAXED);
+	ps->batches = __atomic_load_n(&persist_counters.batches, __ATOMIC_RELAXED);
+	ps->written = __atomic_load_n(&persist_counters.written, __ATOMIC_RELAXED);
+	ps->errors = __atomic_load_n(&persist_counters.errors, __ATOMIC_RELAXED);
+}
+
+void persist_shutdown(void)
+{
+	if (!persist_running)
+		return;
+
+	__atomic_store_n(&persist_stop, true, __ATOMIC_RELEASE);
+	persist_wake(&persist_cond, &persist_sleeping);
+
+	pthread_join(persist_thread, NULL);
+
+	free(persist_ring);
+	persist_ring = NULL;
+	persist_running = false;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sqlite3.h>
+
+#include "db.h"
+
+#ifndef DHCPD_PERSIST_H_
+#define DHCPD_PERSIST_H_
+
+/* Write-behind persistence of lease mutations. The in-memory store is
+ * changed right away, the mutation is appended to a bounded queue and a
+ * background thread writes it to the database later, applying up to
+ * PERSIST_BATCH queued mutations in one transaction. So a slow fsync delays
+ * only the thread, and the event loop only waits when PERSIST_QUEUE_LEN
+ * mutations are queued already.
+ *
+ * The queue is a lock-free ring of slots with sequence numbers: producers
+ * claim a slot by advancing the tail with a compare-and-swap and publish it
+ * by bumping the sequence number of the slot, the thread consumes slots in
+ * order. Locks are only taken to sleep and wake up.
+ *
+ * While the thread runs, the database must only be used between
+ * persist_lock() and persist_unlock().
+ */
+
+#ifndef PERSIST_QUEUE_LEN
+#define PERSIST_QUEUE_LEN 4096
+#endif
+
+/* Most mutations applied in one transaction */
+#ifndef PERSIST_BATCH
+#define PERSIST_BATCH 512
+#endif
+
+_Static_assert((PERSIST_QUEUE_LEN & (PERSIST_QUEUE_LEN - 1)) == 0,
+	"PERSIST_QUEUE_LEN must be a power of two");
+
+struct persist_stats
+{
+	/* Mutations in the queue and most ever queued */
+	uint64_t queued;
+	uint64_t queued_max;
+	/* Times a producer waited for a full queue */
+	uint64_t stalls;
+	/* Transactions and mutations written, and mutations which failed */
+	uint64_t batches;
+	uint64_t written;
+	uint64_t errors;
+};
+
+/**
+ * Start background thread, which owns the database from now on
+ *
+ * @param[in] db Database descriptor
+ */
+extern bool persist_init(sqlite3 *db);
+
+/**
+ * Queue lease to be stored, replacing rows with the same id, address or
+ * key. All strings are copied.
+ *
+ * @param[in] lease Lease with its id
+ */
+extern void persist_put(const struct db_lease *lease);
+
+/**
+ * Queue deletion of a lease
+ *
+ * @param[in] id Row id of the lease
+ */
+extern void persist_del(uint32_t id);
+
+/**
+ * Queue deletion of all leases
+ */
+extern void persist_clear(void);
+
+/**
+ * Wait until all mutations queued before were committed
+ *
+ * @return false if a mutation failed since the last call
+ */
+extern bool persist_sync(void);
+
+/**
+ * Take database away from the thread, which waits with the next transaction
+ */
+extern void persist_lock(void);
+
+/**
+ * Give database back to the thread
+ */
+extern void persist_unlock(void);
+
+/**
+ * Fetch counters of the queue and the thread
+ */
+extern void persist_stats(struct persist_stats *ps);
+
+/**
+ * Write all queued mutations and stop background thread, the database is
+ * owned by the caller again
+ */
+extern void persist_shutdown(void);
+
+#endif
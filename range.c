@@ -0,0 +1,162 @@
+#include "range.h"
+
+#include <stdlib.h>
+
+static bool range_append(struct range **list, size_t *cnt, struct in_addr first,
+	struct in_addr last)
+{
+	struct range r = { ntohl(first.s_addr), ntohl(last.s_addr) };
+
+	if (r.first > r.last)
+		return false;
+
+	struct range *grown = realloc(*list, (*cnt + 1) * sizeof *grown);
+	if (grown == NULL)
+		return false;
+
+	grown[(*cnt)++] = r;
+	*list = grown;
+
+	return true;
+}
+
+bool range_set_add(struct range_set *rs, struct in_addr first,
+	struct in_addr last)
+{
+	return range_append(&rs->ranges, &rs->ranges_cnt, first, last);
+}
+
+bool range_set_exclude(struct range_set *rs, struct in_addr first,
+	struct in_addr last)
+{
+	return range_append(&rs->excludes, &rs->excludes_cnt, first, last);
+}
+
+static int range_cmp(const void *a, const void *b)
+{
+	const struct range *x = a, *y = b;
+
+	return x->first < y->first ? -1 : x->first > y->first;
+}
+
+/**
+ * Sort intervals and merge overlapping and adjacent ones in place
+ *
+ * @return Count of merged intervals
+ */
+static size_t range_merge(struct range *list, size_t cnt)
+{
+	if (cnt == 0)
+		return 0;
+
+	qsort(list, cnt, sizeof *list, range_cmp);
+
+	size_t n = 0;
+
+	for (size_t i = 1; i < cnt; ++i)
+	{
+		if (list[n].last == UINT32_MAX || list[i].first <= list[n].last + 1)
+		{
+			if (list[i].last > list[n].last)
+				list[n].last = list[i].last;
+		}
+		else
+			list[++n] = list[i];
+	}
+
+	return n + 1;
+}
+
+bool range_set_build(struct range_set *rs)
+{
+	rs->ranges_cnt = range_merge(rs->ranges, rs->ranges_cnt);
+	rs->excludes_cnt = range_merge(rs->excludes, rs->excludes_cnt);
+
+	if (rs->ranges_cnt == 0 || rs->excludes_cnt == 0)
+		return true;
+
+	/* An exclusion splits at most one interval in two, because the
+	 * exclusions are disjoint as well */
+	struct range *cut = malloc((rs->ranges_cnt + rs->excludes_cnt) *
+		sizeof *cut);
+	if (cut == NULL)
+		return false;
+
+	size_t n = 0;
+	size_t e = 0;
+
+	for (size_t i = 0; i < rs->ranges_cnt; ++i)
+	{
+		struct range r = rs->ranges[i];
+		bool rest = true;
+
+		/* Exclusions before this interval are before all later ones too */
+		while (e < rs->excludes_cnt && rs->excludes[e].last < r.first)
+			++e;
+
+		for (size_t x = e; x < rs->excludes_cnt && rs->excludes[x].first <= r.last; ++x)
+		{
+			const struct range *ex = &rs->excludes[x];
+
+			if (ex->first > r.first)
+				cut[n++] = (struct range){ r.first, ex->first - 1 };
+
+			if (ex->last >= r.last)
+			{
+				rest = false;
+				break;
+			}
+			r.first = ex->last + 1;
+		}
+
+		if (rest)
+			cut[n++] = r;
+	}
+
+	free(rs->ranges);
+	rs->ranges = cut;
+	rs->ranges_cnt = n;
+
+	return true;
+}
+
+size_t range_set_find(const struct range_set *rs, uint32_t address)
+{
+	size_t lo = 0, hi = rs->ranges_cnt;
+
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (rs->ranges[mid].last < address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+bool range_set_covers(const struct range_set *rs,
+	const struct range_set *sub)
+{
+	for (size_t i = 0; i < sub->ranges_cnt; ++i)
+	{
+		const struct range *r = &sub->ranges[i];
+		size_t j = range_set_find(rs, r->first);
+
+		if (j == rs->ranges_cnt || rs->ranges[j].first > r->first ||
+				rs->ranges[j].last < r->last)
+			return false;
+	}
+
+	return true;
+}
+
+void range_set_free(struct range_set *rs)
+{
+	free(rs->ranges);
+	free(rs->excludes);
+
+	*rs = (struct range_set)RANGE_SET_EMPTY;
+}
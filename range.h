@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef DHCPD_RANGE_H_
+#define DHCPD_RANGE_H_
+
+/* Set of address ranges, from which a scope allocates. Ranges and excluded
+ * ranges are collected while the configuration is read, in any order and
+ * overlapping each other. range_set_build() then normalizes them once:
+ * ranges are sorted and merged and the excluded addresses are cut out, so
+ * only sorted, disjoint and non-adjacent intervals remain.
+ *
+ * As the intervals don't overlap, an interval tree over them degenerates
+ * into a search tree ordered by the first address. It is kept implicitly as
+ * the sorted array of intervals and searched by bisection, so finding the
+ * interval of an address costs O(log n) without any pointers to chase.
+ */
+
+/* Inclusive interval of addresses in host byte order */
+struct range
+{
+	uint32_t first;
+	uint32_t last;
+};
+
+struct range_set
+{
+	/* Normalized intervals after range_set_build(), the ranges as added
+	 * before */
+	struct range *ranges;
+	size_t ranges_cnt;
+
+	/* Excluded intervals, also normalized by range_set_build() */
+	struct range *excludes;
+	size_t excludes_cnt;
+};
+
+#define RANGE_SET_EMPTY {\
+		.ranges = NULL,\
+		.ranges_cnt = 0,\
+		.excludes = NULL,\
+		.excludes_cnt = 0\
+	}
+
+/**
+ * Add range of addresses
+ *
+ * @param[in,out] rs Set
+ * @param[in] first First address of the range
+ * @param[in] last Last address of the range
+ * @return false if the range is empty or on allocation failures
+ */
+extern bool range_set_add(struct range_set *rs, struct in_addr first,
+	struct in_addr last);
+
+/**
+ * Exclude range of addresses, which may overlap any number of ranges
+ *
+ * @param[in,out] rs Set
+ * @param[in] first First excluded address
+ * @param[in] last Last excluded address
+ * @return false if the range is empty or on allocation failures
+ */
+extern bool range_set_exclude(struct range_set *rs, struct in_addr first,
+	struct in_addr last);
+
+/**
+ * Merge ranges and cut out the excluded addresses, further ranges and
+ * exclusions may be added and the set built again
+ *
+ * @return false on allocation failures
+ */
+extern bool range_set_build(struct range_set *rs);
+
+/**
+ * Find first interval, which doesn't end before an address
+ *
+ * @param[in] rs Built set
+ * @param[in] address Address in host byte order
+ * @return Index of the interval or the count of intervals if there is none
+ */
+extern size_t range_set_find(const struct range_set *rs, uint32_t address);
+
+/**
+ * Check whether an address is part of a built set
+ */
+static inline bool range_set_has(const struct range_set *rs,
+	struct in_addr address)
+{
+	uint32_t a = ntohl(address.s_addr);
+	size_t i = range_set_find(rs, a);
+
+	return i < rs->ranges_cnt && rs->ranges[i].first <= a;
+}
+
+/**
+ * Check whether all addresses of a built set are part of another one
+ *
+ * @param[in] rs Built set
+ * @param[in] sub Built set, which is checked
+ */
+extern bool range_set_covers(const struct range_set *rs,
+	const struct range_set *sub);
+
+/**
+ * Free all memory of a set
+ */
+extern void range_set_free(struct range_set *rs);
+
+#endif
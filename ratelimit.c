@@ -0,0 +1,97 @@
+#include "ratelimit.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * FNV-1a hash of key
+ */
+static uint32_t ratelimit_hash(const uint8_t *key, size_t keylen)
+{
+	uint32_t h = 2166136261U;
+
+	for (size_t i = 0; i < keylen; ++i)
+		h = (h ^ key[i]) * 16777619U;
+
+	return h;
+}
+
+bool ratelimit_init(struct ratelimit *rl, double rate, double burst)
+{
+	*rl = (struct ratelimit)RATELIMIT_EMPTY;
+
+	rl->buckets = calloc(RATELIMIT_SETS * RATELIMIT_WAYS, sizeof *rl->buckets);
+	rl->hands = calloc(RATELIMIT_SETS, sizeof *rl->hands);
+	if (rl->buckets == NULL || rl->hands == NULL)
+	{
+		ratelimit_free(rl);
+		return false;
+	}
+
+	rl->rate = rate;
+	rl->burst = burst < 1 ? 1 : burst;
+
+	return true;
+}
+
+bool ratelimit_admit(struct ratelimit *rl, const uint8_t *key,
+	size_t keylen, double now)
+{
+	if (rl->buckets == NULL || rl->rate <= 0 || keylen == 0)
+		return true;
+
+	if (keylen > RATELIMIT_KEY_MAX)
+		keylen = RATELIMIT_KEY_MAX;
+
+	size_t set = ratelimit_hash(key, keylen) % RATELIMIT_SETS;
+	struct ratelimit_bucket *ways = rl->buckets + set * RATELIMIT_WAYS;
+	struct ratelimit_bucket *b = NULL;
+
+	for (size_t i = 0; i < RATELIMIT_WAYS; ++i)
+		if (ways[i].keylen == keylen && memcmp(ways[i].key, key, keylen) == 0)
+		{
+			b = &ways[i];
+			break;
+		}
+
+	if (b == NULL)
+	{
+		/* Second chance for every bucket, which was used since the hand
+		 * passed it the last time */
+		uint8_t *hand = &rl->hands[set];
+		while (ways[*hand].ref)
+		{
+			ways[*hand].ref = false;
+			*hand = (*hand + 1) % RATELIMIT_WAYS;
+		}
+
+		b = &ways[*hand];
+		*hand = (*hand + 1) % RATELIMIT_WAYS;
+
+		memcpy(b->key, key, keylen);
+		b->keylen = keylen;
+		b->tokens = rl->burst;
+		b->stamp = now;
+	}
+
+	b->ref = true;
+
+	b->tokens += (now - b->stamp) * rl->rate;
+	if (b->tokens > rl->burst)
+		b->tokens = rl->burst;
+	b->stamp = now;
+
+	if (b->tokens < 1)
+		return false;
+
+	b->tokens -= 1;
+	return true;
+}
+
+void ratelimit_free(struct ratelimit *rl)
+{
+	free(rl->buckets);
+	free(rl->hands);
+	rl->buckets = NULL;
+	rl->hands = NULL;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifndef DHCPD_RATELIMIT_H_
+#define DHCPD_RATELIMIT_H_
+
+/* Token buckets limit how many messages a single client or relay agent may
+ * have processed per second. Buckets live in a fixed-size, set-associative
+ * hash table, which is allocated once. A key is hashed to a set of
+ * RATELIMIT_WAYS buckets, and if none of them holds the key, a victim in
+ * that set is chosen with the clock algorithm: recently used buckets get a
+ * second chance, so a busy flooder keeps its (empty) bucket while idle
+ * clients are evicted.
+ */
+
+#ifndef RATELIMIT_SETS
+#define RATELIMIT_SETS 4096
+#endif
+
+#define RATELIMIT_WAYS 8
+#define RATELIMIT_KEY_MAX 16
+
+struct ratelimit_bucket
+{
+	double tokens;
+	double stamp;
+	uint8_t key[RATELIMIT_KEY_MAX];
+	uint8_t keylen;
+	bool ref;
+};
+
+struct ratelimit
+{
+	struct ratelimit_bucket *buckets;
+	uint8_t *hands;
+
+	/* Tokens per second and bucket size, a rate of zero disables limiting */
+	double rate;
+	double burst;
+};
+
+#define RATELIMIT_EMPTY {\
+		.buckets = NULL,\
+		.hands = NULL,\
+		.rate = 0,\
+		.burst = 0\
+	}
+
+/**
+ * Allocate bucket table of a rate limiter
+ *
+ * @param[out] rl Rate limiter
+ * @param[in] rate Messages per second
+ * @param[in] burst Count of messages, which may exceed the rate at once
+ */
+extern bool ratelimit_init(struct ratelimit *rl, double rate, double burst);
+
+/**
+ * Take a token from the bucket of key
+ *
+ * @param[in] rl Rate limiter
+ * @param[in] key Key of the bucket
+ * @param[in] keylen Length of key, at most RATELIMIT_KEY_MAX bytes are used
+ * @param[in] now Current time in seconds
+ * @return false if the bucket is empty and the message shall be dropped
+ */
+extern bool ratelimit_admit(struct ratelimit *rl, const uint8_t *key,
+	size_t keylen, double now);
+
+/**
+ * Free bucket table of a rate limiter
+ */
+extern void ratelimit_free(struct ratelimit *rl);
+
+#endif
@@ -0,0 +1,525 @@
+#include "repl.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+/* Record, which is being encoded */
+static uint8_t repl_record[REPL_PAYLOAD_MAX];
+
+static void repl_put64(uint8_t *p, uint64_t v)
+{
+	uint32_t hi = htonl(v >> 32), lo = htonl((uint32_t)v);
+	memcpy(p, &hi, 4);
+	memcpy(p + 4, &lo, 4);
+}
+
+static uint64_t repl_get64(const uint8_t *p)
+{
+	uint32_t hi, lo;
+	memcpy(&hi, p, 4);
+	memcpy(&lo, p + 4, 4);
+	return (uint64_t)ntohl(hi) << 32 | ntohl(lo);
+}
+
+static void repl_hdr_pack(uint8_t *p, uint8_t type, uint16_t count,
+	uint32_t len, uint64_t seq)
+{
+	uint16_t c = htons(count);
+	uint32_t l = htonl(len);
+
+	p[0] = REPL_VERSION;
+	p[1] = type;
+	memcpy(p + 2, &c, 2);
+	memcpy(p + 4, &l, 4);
+	repl_put64(p + 8, seq);
+}
+
+static void repl_hdr_unpack(const uint8_t *p, struct repl_hdr *hdr)
+{
+	uint16_t c;
+	uint32_t l;
+
+	memcpy(&c, p + 2, 2);
+	memcpy(&l, p + 4, 4);
+	hdr->version = p[0];
+	hdr->type = p[1];
+	hdr->count = ntohs(c);
+	hdr->len = ntohl(l);
+	hdr->seq = repl_get64(p + 8);
+}
+
+int repl_listen(const struct sockaddr_in *addr)
+{
+	int fd;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (int[]){1}, sizeof(int)) != 0 ||
+			bind(fd, (const struct sockaddr *)addr, sizeof *addr) != 0 ||
+			listen(fd, 1) != 0)
+	{
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+int repl_accept(int fd)
+{
+	int conn;
+
+	if ((conn = accept(fd, NULL, NULL)) < 0)
+		return -1;
+
+	fcntl(conn, F_SETFL, O_NONBLOCK);
+	fcntl(conn, F_SETFD, FD_CLOEXEC);
+	setsockopt(conn, IPPROTO_TCP, TCP_NODELAY, (int[]){1}, sizeof(int));
+
+	return conn;
+}
+
+int repl_connect(const struct sockaddr_in *addr)
+{
+	int fd;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+		return -1;
+
+	/* Messages are batched already, don't delay them any further */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (int[]){1}, sizeof(int));
+
+	if (connect(fd, (const struct sockaddr *)addr, sizeof *addr) != 0 &&
+			errno != EINPROGRESS)
+	{
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+
+	return fd;
+}
+
+bool repl_connected(int fd)
+{
+	int err = 0;
+	socklen_t len = sizeof err;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0)
+		return false;
+
+	errno = err;
+	return err == 0;
+}
+
+bool repl_log_init(struct repl_log *log, size_t size, uint32_t records)
+{
+	struct timespec now;
+
+	*log = (struct repl_log)REPL_LOG_EMPTY;
+
+	log->buf = malloc(size);
+	log->offs = malloc(records * sizeof *log->offs);
+	if (log->buf == NULL || log->offs == NULL)
+	{
+		repl_log_free(log);
+		return false;
+	}
+
+	log->size = size;
+	log->offs_mask = records - 1;
+
+	/* A restarted primary must never be mistaken for the old one */
+	clock_gettime(CLOCK_REALTIME, &now);
+	log->epoch = ((uint64_t)now.tv_sec << 32 ^ (uint64_t)now.tv_nsec << 8 ^
+		(uint64_t)getpid()) | 1;
+
+	return true;
+}
+
+/**
+ * Copy bytes of the log, which start at a position of written
+ */
+static void repl_log_copy(const struct repl_log *log, uint64_t from,
+	uint8_t *dst, size_t len)
+{
+	size_t pos = from % log->size;
+	size_t part = len < log->size - pos ? len : log->size - pos;
+
+	memcpy(dst, log->buf + pos, part);
+	memcpy(dst + part, log->buf, len - part);
+}
+
+static bool repl_log_append(struct repl_log *log, const uint8_t *rec,
+	size_t len)
+{
+	if (len > log->size)
+		return false;
+
+	/* Drop the oldest records until the new one fits */
+	while (log->first_seq < log->next_seq &&
+			(log->next_seq - log->first_seq > log->offs_mask ||
+			 log->written + len - log->offs[log->first_seq & log->offs_mask] > log->size))
+		++log->first_seq;
+
+	size_t pos = log->written % log->size;
+	size_t part = len < log->size - pos ? len : log->size - pos;
+
+	memcpy(log->buf + pos, rec, part);
+	memcpy(log->buf, rec + part, len - part);
+
+	log->offs[log->next_seq & log->offs_mask] = log->written;
+	log->written += len;
+	++log->next_seq;
+
+	return true;
+}
+
+/**
+ * Encode lease as record into repl_record
+ *
+ * @return Length of the record, 0 if it is too long
+ */
+static size_t repl_put_pack(const struct control_lease *l)
+{
+	size_t len = control_lease_pack(repl_record + REPL_RECORD_HDRLEN,
+		sizeof repl_record - REPL_RECORD_HDRLEN, l);
+	uint16_t n = htons(len);
+
+	if (len == 0)
+		return 0;
+
+	memcpy(repl_record, &n, 2);
+	repl_record[2] = REPL_PUT;
+
+	return REPL_RECORD_HDRLEN + len;
+}
+
+bool repl_log_put(struct repl_log *log, const struct control_lease *l)
+{
+	size_t len = repl_put_pack(l);
+
+	if (len == 0)
+	{
+		errno = EMSGSIZE;
+		return false;
+	}
+
+	return repl_log_append(log, repl_record, len);
+}
+
+bool repl_log_del(struct repl_log *log, uint32_t id,
+	const struct dhcp_key *key)
+{
+	uint8_t rec[REPL_RECORD_HDRLEN + REPL_DELLEN];
+	size_t len = 5 + key->len;
+	uint16_t n = htons(len);
+
+	id = htonl(id);
+
+	memcpy(rec, &n, 2);
+	rec[2] = REPL_DEL;
+	memcpy(rec + REPL_RECORD_HDRLEN, &id, 4);
+	rec[REPL_RECORD_HDRLEN + 4] = key->len;
+	memcpy(rec + REPL_RECORD_HDRLEN + 5, key->data, key->len);
+
+	return repl_log_append(log, rec, REPL_RECORD_HDRLEN + len);
+}
+
+void repl_log_free(struct repl_log *log)
+{
+	free(log->buf);
+	free(log->offs);
+
+	*log = (struct repl_log)REPL_LOG_EMPTY;
+}
+
+void repl_conn_init(struct repl_conn *c, int fd)
+{
+	c->fd = fd;
+	c->in_len = c->in_off = 0;
+	c->out = NULL;
+	c->out_len = c->out_off = c->out_cap = 0;
+	c->msg_off = SIZE_MAX;
+	c->broken = false;
+}
+
+bool repl_conn_read(struct repl_conn *c)
+{
+	/* Move the unhandled rest to the front */
+	if (c->in_off > 0)
+	{
+		memmove(c->in, c->in + c->in_off, c->in_len - c->in_off);
+		c->in_len -= c->in_off;
+		c->in_off = 0;
+	}
+
+	if (c->in_len == sizeof c->in)
+		return true;
+
+	ssize_t n = recv(c->fd, c->in + c->in_len, sizeof c->in - c->in_len,
+		MSG_DONTWAIT);
+
+	if (n == 0)
+		return false;
+	if (n < 0)
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+	c->in_len += n;
+	return true;
+}
+
+bool repl_conn_next(struct repl_conn *c, struct repl_hdr *hdr,
+	const uint8_t **payload)
+{
+	size_t avail = c->in_len - c->in_off;
+
+	if (avail < REPL_HDRLEN)
+		return false;
+
+	repl_hdr_unpack(c->in + c->in_off, hdr);
+
+	if (hdr->version != REPL_VERSION || hdr->len > REPL_PAYLOAD_MAX)
+	{
+		c->broken = true;
+		return false;
+	}
+
+	if (avail < REPL_HDRLEN + hdr->len)
+		return false;
+
+	*payload = c->in + c->in_off + REPL_HDRLEN;
+	c->in_off += REPL_HDRLEN + hdr->len;
+	return true;
+}
+
+/**
+ * Make room for len more bytes in the send buffer
+ */
+static bool repl_conn_reserve(struct repl_conn *c, size_t len)
+{
+	if (c->out_len + len <= c->out_cap)
+		return true;
+
+	if (c->out_off > 0)
+	{
+		memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+		c->out_len -= c->out_off;
+		if (c->msg_off != SIZE_MAX)
+			c->msg_off -= c->out_off;
+		c->out_off = 0;
+
+		if (c->out_len + len <= c->out_cap)
+			return true;
+	}
+
+	size_t cap = c->out_cap ? c->out_cap : REPL_BUF_SIZE;
+	while (cap < c->out_len + len)
+		cap *= 2;
+
+	uint8_t *out = realloc(c->out, cap);
+	if (out == NULL)
+		return false;
+
+	c->out = out;
+	c->out_cap = cap;
+	return true;
+}
+
+bool repl_conn_hello(struct repl_conn *c, uint8_t type, uint64_t epoch,
+	uint64_t seq)
+{
+	if (!repl_conn_reserve(c, REPL_HDRLEN + 8))
+		return false;
+
+	repl_hdr_pack(c->out + c->out_len, type, 0, 8, seq);
+	repl_put64(c->out + c->out_len + REPL_HDRLEN, epoch);
+	c->out_len += REPL_HDRLEN + 8;
+	c->msg_off = SIZE_MAX;
+
+	return true;
+}
+
+bool repl_conn_send(struct repl_conn *c, uint8_t type, uint64_t seq)
+{
+	if (!repl_conn_reserve(c, REPL_HDRLEN))
+		return false;
+
+	repl_hdr_pack(c->out + c->out_len, type, 0, 0, seq);
+	c->out_len += REPL_HDRLEN;
+	c->msg_off = SIZE_MAX;
+
+	return true;
+}
+
+bool repl_conn_load(struct repl_conn *c, const struct control_lease *l)
+{
+	struct repl_hdr hdr = { .count = 0, .len = 0 };
+	size_t len = repl_put_pack(l);
+
+	if (len == 0)
+	{
+		errno = EMSGSIZE;
+		return false;
+	}
+
+	if (c->msg_off != SIZE_MAX)
+		repl_hdr_unpack(c->out + c->msg_off, &hdr);
+
+	if (c->msg_off == SIZE_MAX || hdr.count == UINT16_MAX ||
+			hdr.len + len > REPL_PAYLOAD_MAX)
+	{
+		if (!repl_conn_reserve(c, REPL_HDRLEN + len))
+			return false;
+
+		hdr.count = hdr.len = 0;
+		c->msg_off = c->out_len;
+		c->out_len += REPL_HDRLEN;
+	}
+	else if (!repl_conn_reserve(c, len))
+		return false;
+
+	memcpy(c->out + c->out_len, repl_record, len);
+	c->out_len += len;
+	repl_hdr_pack(c->out + c->msg_off, REPL_LOAD, hdr.count + 1, hdr.len + len, 0);
+
+	return true;
+}
+
+bool repl_conn_fill(struct repl_conn *c, const struct repl_log *log,
+	uint64_t *seq)
+{
+	c->msg_off = SIZE_MAX;
+
+	while (*seq < log->next_seq && c->out_len - c->out_off < REPL_PAYLOAD_MAX)
+	{
+		uint64_t start = log->offs[*seq & log->offs_mask];
+		uint64_t end = start;
+		uint64_t last = *seq;
+
+		/* As many records as fit into one message */
+		while (last < log->next_seq && last - *seq < UINT16_MAX)
+		{
+			uint64_t next = last + 1 < log->next_seq ?
+				log->offs[(last + 1) & log->offs_mask] : log->written;
+
+			if (next - start > REPL_PAYLOAD_MAX)
+				break;
+
+			end = next;
+			++last;
+		}
+
+		size_t len = end - start;
+
+		if (!repl_conn_reserve(c, REPL_HDRLEN + len))
+			return false;
+
+		repl_hdr_pack(c->out + c->out_len, REPL_BATCH, last - *seq, len, *seq);
+		repl_log_copy(log, start, c->out + c->out_len + REPL_HDRLEN, len);
+		c->out_len += REPL_HDRLEN + len;
+
+		*seq = last;
+	}
+
+	return true;
+}
+
+bool repl_conn_flush(struct repl_conn *c)
+{
+	/* Records must not be appended to a partially sent message */
+	c->msg_off = SIZE_MAX;
+
+	while (c->out_off < c->out_len)
+	{
+		ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off,
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+
+		c->out_off += n;
+	}
+
+	c->out_len = c->out_off = 0;
+
+	/* Give back the memory of a snapshot */
+	if (c->out_cap > 4 * REPL_BUF_SIZE)
+	{
+		free(c->out);
+		c->out = NULL;
+		c->out_cap = 0;
+	}
+
+	return true;
+}
+
+void repl_conn_close(struct repl_conn *c)
+{
+	if (c->fd >= 0)
+		close(c->fd);
+	free(c->out);
+
+	repl_conn_init(c, -1);
+}
+
+bool repl_epoch_unpack(const uint8_t *payload, size_t len, uint64_t *epoch)
+{
+	if (len != 8)
+		return false;
+
+	*epoch = repl_get64(payload);
+	return true;
+}
+
+bool repl_record_next(const uint8_t *payload, size_t len, size_t *off,
+	uint8_t *kind, const uint8_t **body, size_t *body_len)
+{
+	uint16_t n;
+
+	if (len - *off < REPL_RECORD_HDRLEN)
+		return false;
+
+	memcpy(&n, payload + *off, 2);
+	n = ntohs(n);
+
+	if (len - *off - REPL_RECORD_HDRLEN < n)
+		return false;
+
+	*kind = payload[*off + 2];
+	*body = payload + *off + REPL_RECORD_HDRLEN;
+	*body_len = n;
+	*off += REPL_RECORD_HDRLEN + n;
+
+	return true;
+}
+
+bool repl_del_unpack(const uint8_t *body, size_t len, uint32_t *id,
+	struct dhcp_key *key)
+{
+	if (len < 5 || body[4] > DHCP_KEY_MAX || len != 5u + body[4])
+		return false;
+
+	memcpy(id, body, 4);
+	*id = ntohl(*id);
+	key->len = body[4];
+	memcpy(key->data, body + 5, key->len);
+
+	return true;
+}
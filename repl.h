@@ -0,0 +1,308 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <netinet/in.h>
+
+#include "control.h"
+
+#ifndef DHCPD_REPL_H_
+#define DHCPD_REPL_H_
+
+/* Asynchronous replication of lease mutations from a primary dhcpd to a
+ * standby over TCP. The primary numbers every mutation and appends it to an
+ * in-memory log, the standby keeps a warm copy of the store and its own
+ * database and takes over when the primary stops sending.
+ *
+ * Every message starts with a header in network byte order
+ *
+ *   0      1      2             4                      8
+ *   +------+------+-------------+----------------------+
+ *   | ver  | type |    count    |    payload length    |
+ *   +------+------+-------------+----------------------+
+ *   |                 sequence number                  |
+ *   +--------------------------------------------------+
+ *
+ * After connecting, the standby sends REPL_HELLO with the epoch of the log
+ * it followed last and the sequence number of the next record it needs. If
+ * the primary still has that record, it continues from there, otherwise it
+ * sends the whole store with REPL_SNAPSHOT and REPL_LOAD first.
+ *
+ * REPL_BATCH and REPL_LOAD carry count records of the form
+ *
+ *   length(2) kind(1) body
+ *
+ * where the body of REPL_PUT is a lease in the encoding of the control
+ * socket and the body of REPL_DEL is the id (4), the key length (1) and the
+ * lease key.
+ */
+
+#define REPL_VERSION 2
+#define REPL_HDRLEN 16
+#define REPL_RECORD_HDRLEN 3
+
+/* Largest payload of a message */
+#define REPL_PAYLOAD_MAX (64 * 1024)
+/* Size of the receive buffer of a connection */
+#define REPL_BUF_SIZE (2 * (REPL_HDRLEN + REPL_PAYLOAD_MAX))
+
+/* Capacity of the log of the primary */
+#define REPL_LOG_RECORDS (1 << 16)
+#define REPL_LOG_BYTES (8 << 20)
+
+/* Interval of heartbeats and reconnection attempts in seconds */
+#define REPL_INTERVAL 1.
+
+enum repl_type
+{
+	/* Standby: epoch(8) as payload, sequence number of the next record */
+	REPL_HELLO = 1,
+	/* Primary: epoch(8) as payload, sequence number of the next record,
+	 * the standby drops all leases */
+	REPL_SNAPSHOT = 2,
+	/* Primary: records of a snapshot without sequence numbers */
+	REPL_LOAD = 3,
+	/* Primary: records starting at the sequence number */
+	REPL_BATCH = 4,
+	/* Primary: sequence number of the next record */
+	REPL_HEARTBEAT = 5,
+	/* Standby: sequence number of the next record it needs */
+	REPL_ACK = 6
+};
+
+enum repl_record
+{
+	REPL_PUT = 1,
+	REPL_DEL = 2
+};
+
+/* Longest body of REPL_DEL */
+#define REPL_DELLEN (5 + DHCP_KEY_MAX)
+
+struct repl_hdr
+{
+	uint8_t version;
+	uint8_t type;
+	uint16_t count;
+	uint32_t len;
+	uint64_t seq;
+};
+
+/* Log of the primary, the oldest records are dropped when it is full */
+struct repl_log
+{
+	/* Identifies the sequence numbers of one primary process */
+	uint64_t epoch;
+	/* Records first_seq up to next_seq - 1 are kept */
+	uint64_t first_seq;
+	uint64_t next_seq;
+
+	/* Records back to back, wrapping around at size */
+	uint8_t *buf;
+	size_t size;
+	/* Count of bytes ever appended */
+	uint64_t written;
+
+	/* Value of written before each kept record */
+	uint64_t *offs;
+	uint32_t offs_mask;
+};
+
+#define REPL_LOG_EMPTY {\
+		.epoch = 0,\
+		.first_seq = 1,\
+		.next_seq = 1,\
+		.buf = NULL,\
+		.size = 0,\
+		.written = 0,\
+		.offs = NULL,\
+		.offs_mask = 0\
+	}
+
+/* Buffered connection between primary and standby */
+struct repl_conn
+{
+	int fd;
+
+	uint8_t in[REPL_BUF_SIZE];
+	size_t in_len;
+	/* Start of the next unhandled message in in */
+	size_t in_off;
+
+	/* Grows while a snapshot is queued */
+	uint8_t *out;
+	size_t out_len;
+	size_t out_off;
+	size_t out_cap;
+	/* Offset of the header of the message records are appended to, or
+	 * SIZE_MAX */
+	size_t msg_off;
+
+	/* Set on protocol errors, the connection must be closed */
+	bool broken;
+};
+
+/**
+ * Create listening TCP socket
+ *
+ * @param[in] addr Local address
+ * @return Non-blocking socket or -1 on errors
+ */
+extern int repl_listen(const struct sockaddr_in *addr);
+
+/**
+ * Accept connection of a standby
+ *
+ * @param[in] fd Listening socket
+ * @return Non-blocking socket or -1 on errors
+ */
+extern int repl_accept(int fd);
+
+/**
+ * Start connecting to a primary
+ *
+ * @param[in] addr Address of the primary
+ * @return Non-blocking socket, which becomes writable once the connection
+ * was established or failed, or -1 on errors
+ */
+extern int repl_connect(const struct sockaddr_in *addr);
+
+/**
+ * Check whether a connection started by repl_connect() was established
+ */
+extern bool repl_connected(int fd);
+
+/**
+ * Allocate log with a new epoch
+ *
+ * @param[out] log Log
+ * @param[in] size Capacity in bytes
+ * @param[in] records Capacity in records, a power of two
+ */
+extern bool repl_log_init(struct repl_log *log, size_t size, uint32_t records);
+
+/**
+ * Append record, which stores a lease
+ */
+extern bool repl_log_put(struct repl_log *log, const struct control_lease *l);
+
+/**
+ * Append record, which deletes a lease
+ */
+extern bool repl_log_del(struct repl_log *log, uint32_t id,
+	const struct dhcp_key *key);
+
+/**
+ * Check whether the log can be replayed starting at a sequence number
+ */
+static inline bool repl_log_has(const struct repl_log *log, uint64_t seq)
+{
+	return seq >= log->first_seq && seq <= log->next_seq;
+}
+
+/**
+ * Free all memory of a log
+ */
+extern void repl_log_free(struct repl_log *log);
+
+/**
+ * Initialize connection buffers
+ */
+extern void repl_conn_init(struct repl_conn *c, int fd);
+
+/**
+ * Read what the peer sent into the receive buffer
+ *
+ * @return false on end of file and errors other than EAGAIN
+ */
+extern bool repl_conn_read(struct repl_conn *c);
+
+/**
+ * Take next complete message out of the receive buffer
+ *
+ * @param[in] c Connection
+ * @param[out] hdr Header of the message
+ * @param[out] payload Payload, which stays valid until the next read
+ * @return false if no complete message is buffered or the connection is
+ * broken
+ */
+extern bool repl_conn_next(struct repl_conn *c, struct repl_hdr *hdr,
+	const uint8_t **payload);
+
+/**
+ * Queue REPL_HELLO or REPL_SNAPSHOT
+ */
+extern bool repl_conn_hello(struct repl_conn *c, uint8_t type, uint64_t epoch,
+	uint64_t seq);
+
+/**
+ * Queue message without payload
+ */
+extern bool repl_conn_send(struct repl_conn *c, uint8_t type, uint64_t seq);
+
+/**
+ * Queue lease of a snapshot, consecutive leases are batched into REPL_LOAD
+ * messages
+ */
+extern bool repl_conn_load(struct repl_conn *c, const struct control_lease *l);
+
+/**
+ * Queue REPL_BATCH messages with the records of the log starting at seq,
+ * until a full message is waiting to be sent
+ *
+ * @param[in] c Connection
+ * @param[in] log Log, which has seq
+ * @param[in,out] seq Next record to send
+ */
+extern bool repl_conn_fill(struct repl_conn *c, const struct repl_log *log,
+	uint64_t *seq);
+
+/**
+ * Check whether queued messages wait to be sent
+ */
+static inline bool repl_conn_pending(const struct repl_conn *c)
+{
+	return c->out_off < c->out_len;
+}
+
+/**
+ * Send as much of the queued messages as possible without blocking
+ *
+ * @return false on errors other than EAGAIN
+ */
+extern bool repl_conn_flush(struct repl_conn *c);
+
+/**
+ * Free buffers and close the socket of a connection
+ */
+extern void repl_conn_close(struct repl_conn *c);
+
+/**
+ * Decode epoch of REPL_HELLO and REPL_SNAPSHOT
+ */
+extern bool repl_epoch_unpack(const uint8_t *payload, size_t len,
+	uint64_t *epoch);
+
+/**
+ * Decode next record of a REPL_BATCH or REPL_LOAD payload
+ *
+ * @param[in] payload Payload
+ * @param[in] len Length of the payload
+ * @param[in,out] off Offset of the record, which is advanced
+ * @param[out] kind Kind of the record
+ * @param[out] body Body of the record
+ * @param[out] body_len Length of the body
+ * @return false at the end of the payload or on invalid records
+ */
+extern bool repl_record_next(const uint8_t *payload, size_t len, size_t *off,
+	uint8_t *kind, const uint8_t **body, size_t *body_len);
+
+/**
+ * Decode body of REPL_DEL
+ */
+extern bool repl_del_unpack(const uint8_t *body, size_t len, uint32_t *id,
+	struct dhcp_key *key);
+
+#endif
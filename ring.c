@@ -0,0 +1,225 @@
+#include "ring.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+#ifdef __linux__
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#endif
+
+#include "packet.h"
+#include "filter.h"
+
+#ifdef __linux__
+
+#define RING_BLOCK(rx, i) ((struct tpacket_block_desc *)((rx)->map + (i) * RING_BLOCK_SIZE))
+
+bool ring_rx_open(struct ring_rx *rx, int ifindex)
+{
+	*rx = (struct ring_rx)RING_RX_EMPTY;
+
+	int fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+	if (fd < 0)
+		return false;
+
+	if (!filter_attach_packet(fd))
+		goto error;
+
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, (int[]){TPACKET_V3}, sizeof(int)) != 0)
+		goto error;
+
+#ifdef PACKET_IGNORE_OUTGOING
+	/* Replies to relay agents are sent to port 67 as well */
+	setsockopt(fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, (int[]){1}, sizeof(int));
+#endif
+
+	struct tpacket_req3 req = {
+		.tp_block_size = RING_BLOCK_SIZE,
+		.tp_block_nr = RING_BLOCK_CNT,
+		.tp_frame_size = RING_FRAME_SIZE,
+		.tp_frame_nr = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCK_CNT,
+		.tp_retire_blk_tov = RING_BLOCK_TIMEOUT,
+		.tp_sizeof_priv = 0,
+		.tp_feature_req_word = 0
+	};
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof req) != 0)
+		goto error;
+
+	size_t map_len = (size_t)RING_BLOCK_SIZE * RING_BLOCK_CNT;
+	uint8_t *map = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_LOCKED | MAP_POPULATE, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		/* MAP_LOCKED fails without CAP_IPC_LOCK or with a tight memlock limit */
+		map = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, fd, 0);
+		if (map == MAP_FAILED)
+			goto error;
+	}
+
+	struct sockaddr_ll ll = {
+		.sll_family = AF_PACKET,
+		.sll_protocol = htons(ETH_P_IP),
+		.sll_ifindex = ifindex
+	};
+	if (bind(fd, (struct sockaddr *)&ll, sizeof ll) != 0)
+	{
+		munmap(map, map_len);
+		goto error;
+	}
+
+	rx->fd = fd;
+	rx->map = map;
+	rx->map_len = map_len;
+
+	return true;
+
+error:
+	{
+		int _errno = errno;
+		close(fd);
+		errno = _errno;
+	}
+	return false;
+}
+
+/**
+ * Give the current block back to the kernel and advance to the next one
+ */
+static void ring_rx_release(struct ring_rx *rx)
+{
+	struct tpacket_block_desc *desc = RING_BLOCK(rx, rx->block);
+
+	__atomic_store_n(&desc->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+	rx->block = (rx->block + 1) % RING_BLOCK_CNT;
+	rx->frame = NULL;
+}
+
+uint8_t *ring_rx_next(struct ring_rx *rx, size_t *len, struct sockaddr_in *src,
+	struct timespec *stamp)
+{
+	for (;;)
+	{
+		if (rx->frame == NULL)
+		{
+			struct tpacket_block_desc *desc = RING_BLOCK(rx, rx->block);
+
+			if (!(__atomic_load_n(&desc->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+				return NULL;
+
+			rx->frames_left = desc->hdr.bh1.num_pkts;
+			rx->frame = (uint8_t *)desc + desc->hdr.bh1.offset_to_first_pkt;
+		}
+
+		if (rx->frames_left == 0)
+		{
+			ring_rx_release(rx);
+			continue;
+		}
+
+		struct tpacket3_hdr *hdr = (struct tpacket3_hdr *)rx->frame;
+		rx->frame += hdr->tp_next_offset;
+		--rx->frames_left;
+
+		struct sockaddr_ll *ll = (struct sockaddr_ll *)((uint8_t *)hdr +
+			TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+		if (ll->sll_pkttype == PACKET_OUTGOING)
+			continue;
+
+		uint8_t *frame = (uint8_t *)hdr + hdr->tp_mac;
+		size_t caplen = hdr->tp_snaplen;
+
+		if (caplen < PACKET_FRAME_HDRLEN)
+			continue;
+
+		uint8_t *ip = PACKET_F_IP(frame);
+		size_t ihl = (ip[0] & 0x0F) * 4;
+		if (ihl < PACKET_IP_HDRLEN || PACKET_ETH_HDRLEN + ihl + PACKET_UDP_HDRLEN > caplen)
+			continue;
+
+		uint8_t *udp = ip + ihl;
+		size_t udp_len = ntohs(*(uint16_t *)(udp + 4));
+		size_t avail = caplen - PACKET_ETH_HDRLEN - ihl;
+
+		if (udp_len < PACKET_UDP_HDRLEN)
+			continue;
+		if (udp_len > avail)
+			udp_len = avail;
+
+		*src = (struct sockaddr_in){
+			.sin_family = AF_INET,
+			.sin_port = *(uint16_t *)udp,
+			.sin_addr = { *(uint32_t *)(ip + 12) }
+		};
+		*len = udp_len - PACKET_UDP_HDRLEN;
+		*stamp = (struct timespec){
+			.tv_sec = hdr->tp_sec,
+			.tv_nsec = hdr->tp_nsec
+		};
+
+		return udp + PACKET_UDP_HDRLEN;
+	}
+}
+
+uint64_t ring_rx_drops(struct ring_rx *rx)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof st;
+
+	if (rx->fd < 0)
+		return 0;
+
+	/* Reading the statistics resets them */
+	if (getsockopt(rx->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) != 0)
+		return 0;
+
+	return st.tp_drops;
+}
+
+void ring_rx_close(struct ring_rx *rx)
+{
+	if (rx->map)
+		munmap(rx->map, rx->map_len);
+	if (rx->fd >= 0)
+		close(rx->fd);
+
+	*rx = (struct ring_rx)RING_RX_EMPTY;
+}
+
+#else
+
+bool ring_rx_open(struct ring_rx *rx, int ifindex)
+{
+	(void)ifindex;
+	*rx = (struct ring_rx)RING_RX_EMPTY;
+	errno = ENOTSUP;
+	return false;
+}
+
+uint8_t *ring_rx_next(struct ring_rx *rx, size_t *len, struct sockaddr_in *src,
+	struct timespec *stamp)
+{
+	(void)rx, (void)len, (void)src, (void)stamp;
+	return NULL;
+}
+
+uint64_t ring_rx_drops(struct ring_rx *rx)
+{
+	(void)rx;
+	return 0;
+}
+
+void ring_rx_close(struct ring_rx *rx)
+{
+	(void)rx;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <netinet/in.h>
+
+#ifndef DHCPD_RING_H_
+#define DHCPD_RING_H_
+
+/* Instead of receiving every datagram with recvfrom, the receive ring maps
+ * a TPACKET_V3 ring of an AF_PACKET socket into our address space. The
+ * kernel fills whole blocks with frames, which passed the
+ * filter_attach_packet filter, and hands them over to us without a system
+ * call per message. The DHCP message of a frame is located in place and
+ * copied into the ingress queues, and a block is given back to the kernel
+ * after all of its frames have been copied, so queued messages never pin
+ * blocks of the ring.
+ */
+
+#ifndef RING_BLOCK_SIZE
+#define RING_BLOCK_SIZE (1 << 16)
+#endif
+
+#ifndef RING_BLOCK_CNT
+#define RING_BLOCK_CNT 64
+#endif
+
+#ifndef RING_FRAME_SIZE
+#define RING_FRAME_SIZE 2048
+#endif
+
+/* Milliseconds until a partially filled block is handed over */
+#ifndef RING_BLOCK_TIMEOUT
+#define RING_BLOCK_TIMEOUT 2
+#endif
+
+struct ring_rx
+{
+	int fd;
+
+	uint8_t *map;
+	size_t map_len;
+
+	/* Index of the current block */
+	unsigned int block;
+	/* Next frame in the current block and count of remaining frames */
+	uint8_t *frame;
+	uint32_t frames_left;
+};
+
+#define RING_RX_EMPTY {\
+		.fd = -1,\
+		.map = NULL,\
+		.map_len = 0,\
+		.block = 0,\
+		.frame = NULL,\
+		.frames_left = 0\
+	}
+
+/**
+ * Open AF_PACKET socket on interface, set up and map the receive ring
+ *
+ * @param[out] rx Receive ring
+ * @param[in] ifindex Index of the interface
+ */
+extern bool ring_rx_open(struct ring_rx *rx, int ifindex);
+
+/**
+ * Fetch next DHCP message from the ring
+ *
+ * The returned buffer points into the ring and stays valid until the next
+ * call. Blocks are given back to the kernel when all their frames were
+ * fetched.
+ *
+ * @param[in] rx Receive ring
+ * @param[out] len Length of the DHCP message
+ * @param[out] src Source address and port of the message
+ * @param[out] stamp Time the kernel received the frame
+ * @return Pointer to the DHCP message or NULL if the ring is empty
+ */
+extern uint8_t *ring_rx_next(struct ring_rx *rx, size_t *len,
+	struct sockaddr_in *src, struct timespec *stamp);
+
+/**
+ * Fetch count of frames, which were dropped because the ring was full, since
+ * the last call
+ *
+ * @param[in] rx Receive ring
+ */
+extern uint64_t ring_rx_drops(struct ring_rx *rx);
+
+/**
+ * Unmap ring and close AF_PACKET socket
+ */
+extern void ring_rx_close(struct ring_rx *rx);
+
+#endif
@@ -0,0 +1,51 @@
+#include "stats.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#ifdef __linux__
+#include <linux/sock_diag.h>
+#endif
+
+struct stats stats = {0};
+
+uint64_t stats_sock_drops(int sock)
+{
+#if defined(__linux__) && defined(SO_MEMINFO)
+	uint32_t meminfo[SK_MEMINFO_VARS];
+	socklen_t len = sizeof meminfo;
+
+	if (getsockopt(sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len) != 0)
+		return 0;
+	if (len < (SK_MEMINFO_DROPS + 1) * sizeof *meminfo)
+		return 0;
+
+	return meminfo[SK_MEMINFO_DROPS];
+#else
+	(void)sock;
+	return 0;
+#endif
+}
+
+void stats_dump(FILE *stream)
+{
+#define STATS_DUMP(name, desc) fprintf(stream, "%s %llu\n", #name, \
+		(unsigned long long)stats.name);
+	STATS_COUNTERS(STATS_DUMP)
+#undef STATS_DUMP
+
+	for (unsigned int i = 0; i < STATS_LATENCY_BUCKETS; ++i)
+	{
+		if (stats.latency[i] == 0)
+			continue;
+
+		if (i < STATS_LATENCY_BUCKETS - 1)
+			fprintf(stream, "latency_lt_%lluus %llu\n", 1ULL << i,
+				(unsigned long long)stats.latency[i]);
+		else
+			fprintf(stream, "latency_more %llu\n",
+				(unsigned long long)stats.latency[i]);
+	}
+
+	fflush(stream);
+}
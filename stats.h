@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef DHCPD_STATS_H_
+#define DHCPD_STATS_H_
+
+/* Counters of the daemon. Every counter is declared once in STATS_COUNTERS,
+ * which generates the struct members and the dump code.
+ */
+#define STATS_COUNTERS(X) \
+	X(rx_packets,      "DHCP messages received") \
+	X(rx_invalid,      "Messages dropped in userspace as invalid") \
+	X(rx_kernel_drops, "Messages dropped by socket filter or full queue") \
+	X(rx_queue_drops,  "Kernel drops reported with the last received message") \
+	X(rx_burst_max,    "Most messages received before the socket ran empty") \
+	X(rx_rcvbuf,       "Receive buffer of the UDP socket in bytes") \
+	X(rx_ring_drops,   "Frames dropped, because the receive ring was full") \
+	X(rx_ratelimited_client, "Messages dropped by the per-client rate limit") \
+	X(rx_ratelimited_relay,  "Messages dropped by the per-relay rate limit") \
+	X(rx_loadbalanced, "Messages ignored, because a peer serves the client") \
+	X(rx_class_ignored, "Messages ignored, because their class is ignored") \
+	X(rx_shed_renew,   "Messages of clients with a lease shed under overload") \
+	X(rx_shed_known,   "DISCOVERs of clients with a lease shed under overload") \
+	X(rx_shed_request, "Other messages of clients without a lease shed") \
+	X(rx_shed_discover, "DISCOVERs of new clients shed under overload") \
+	X(rx_stale,        "Messages dropped, because they were older than -maxage") \
+	X(tx_packets,      "Replies sent") \
+	X(tx_unicast,      "Replies sent unicast through the AF_PACKET socket") \
+	X(tx_errors,       "Replies, which couldn't be sent") \
+	X(tx_submits,      "io_uring_enter calls, which submitted queued replies") \
+	X(log_drops,       "Log records dropped, because a log ring was full") \
+	X(heap_allocs,     "Heap allocations of the event loop, only with ALLOC_STATS") \
+	X(arena_overflows, "Allocations for a message, which didn't fit the arena") \
+	X(db_queued,       "Lease mutations waiting to be written to the database") \
+	X(db_queued_max,   "Most lease mutations ever waiting") \
+	X(db_stalls,       "Times the event loop waited for a full write queue") \
+	X(db_batches,      "Transactions written by the persistence thread") \
+	X(db_written,      "Lease mutations written to the database") \
+	X(db_errors,       "Lease mutations, which couldn't be written") \
+	X(repl_records,    "Lease mutations appended to the replication log") \
+	X(repl_snapshots,  "Snapshots of the store sent to a standby") \
+	X(repl_lag_drops,  "Standby connections dropped for lagging behind") \
+	X(repl_applied,    "Replicated lease mutations applied as standby")
+
+/* Buckets of the reply latency histogram, the time from the kernel receiving
+ * a message until its reply was sent. Bucket i counts latencies of less than
+ * 2^i microseconds, which no lower bucket counts, and the last bucket counts
+ * all longer ones.
+ */
+#ifndef STATS_LATENCY_BUCKETS
+#define STATS_LATENCY_BUCKETS 24
+#endif
+
+struct stats
+{
+#define STATS_MEMBER(name, desc) uint64_t name;
+	STATS_COUNTERS(STATS_MEMBER)
+#undef STATS_MEMBER
+
+	uint64_t latency[STATS_LATENCY_BUCKETS];
+};
+
+extern struct stats stats;
+
+/**
+ * Count reply latency in its histogram bucket
+ *
+ * @param[in] usec Latency in microseconds
+ */
+static inline void stats_latency(uint64_t usec)
+{
+	unsigned int bucket = usec == 0 ? 0 : 64 - __builtin_clzll(usec);
+
+	if (bucket >= STATS_LATENCY_BUCKETS)
+		bucket = STATS_LATENCY_BUCKETS - 1;
+	++stats.latency[bucket];
+}
+
+/**
+ * Fetch count of messages dropped by the kernel for a socket. This includes
+ * messages rejected by the socket filter.
+ *
+ * @param[in] sock Socket
+ */
+extern uint64_t stats_sock_drops(int sock);
+
+/**
+ * Write all counters as "name value" lines to stream, followed by the
+ * non-empty buckets of the latency histogram as "latency_lt_USECus value" and
+ * "latency_more value"
+ *
+ * @param[in] stream Destination stream
+ */
+extern void stats_dump(FILE *stream);
+
+#endif
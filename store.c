@@ -0,0 +1,1134 @@
+#include "store.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#include "dhcp.h"
+#include "db.h"
+#include "iplist.h"
+#include "log.h"
+
+#define STORE_CACHE_MAGIC "DHCPDLS3"
+
+struct store_cache_hdr
+{
+	char magic[8];
+	uint32_t lease_size;
+
+	/* State of the database file, when the cache was written */
+	uint32_t db_counter;
+	uint64_t db_size;
+	uint64_t db_ino;
+	int64_t db_mtime_sec;
+	int64_t db_mtime_nsec;
+
+	uint64_t leases_cnt;
+	uint64_t profiles_cnt;
+	uint64_t strings_len;
+};
+
+typedef uint64_t (*store_keyfn)(const struct store_lease *l);
+
+static inline uint32_t store_hash(uint64_t k)
+{
+	return (k * 0x9E3779B97F4A7C15ULL) >> 32;
+}
+
+static uint64_t store_key_hash(const struct store_lease *l)
+{
+	return l->key_hash;
+}
+
+static uint64_t store_key_address(const struct store_lease *l)
+{
+	return l->address;
+}
+
+/**
+ * Find slot of key in an index, the slot is empty if the key is missing
+ */
+static uint32_t store_index_find(struct store *s, uint32_t *tab,
+	store_keyfn keyfn, uint64_t key)
+{
+	uint32_t i = store_hash(key) & s->index_mask;
+
+	while (tab[i] && keyfn(&s->leases[tab[i] - 1]) != key)
+		i = (i + 1) & s->index_mask;
+
+	return i;
+}
+
+/**
+ * Find slot of a lease key in the key index, the slot is empty if the key is
+ * missing
+ */
+static uint32_t store_key_find(struct store *s, const struct dhcp_key *key,
+	uint32_t hash)
+{
+	uint32_t i = store_hash(hash) & s->index_mask;
+
+	for (; s->by_key[i]; i = (i + 1) & s->index_mask)
+	{
+		const struct store_lease *l = &s->leases[s->by_key[i] - 1];
+
+		if (l->key_hash == hash && dhcp_key_eq(&l->key, key))
+			break;
+	}
+
+	return i;
+}
+
+/**
+ * Clear slot of an index and move following entries back, so that lookups
+ * never need tombstones
+ */
+static void store_index_del(struct store *s, uint32_t *tab, store_keyfn keyfn,
+	uint32_t i)
+{
+	uint32_t j = i;
+
+	for (;;)
+	{
+		j = (j + 1) & s->index_mask;
+		if (!tab[j])
+			break;
+
+		uint32_t h = store_hash(keyfn(&s->leases[tab[j] - 1])) & s->index_mask;
+
+		/* Entry stays, if its home slot lies cyclically in (i, j] */
+		if (i <= j ? (i < h && h <= j) : (i < h || h <= j))
+			continue;
+
+		tab[i] = tab[j];
+		i = j;
+	}
+
+	tab[i] = 0;
+}
+
+/**
+ * Add lease at index idx to both indexes
+ *
+ * @return false if key or address is already used
+ */
+static bool store_index_add(struct store *s, uint32_t idx)
+{
+	struct store_lease *l = &s->leases[idx];
+
+	uint32_t ki = store_key_find(s, &l->key, l->key_hash);
+	uint32_t ai = store_index_find(s, s->by_address, store_key_address,
+		store_key_address(l));
+
+	if (s->by_key[ki] || s->by_address[ai])
+		return false;
+
+	s->by_key[ki] = idx + 1;
+	s->by_address[ai] = idx + 1;
+
+	return true;
+}
+
+static inline void store_bitmap_set(struct store *s, uint32_t address, bool used)
+{
+	if (s->bitmap == NULL)
+		return;
+
+	uint32_t a = ntohl(address);
+	if (a < s->range_first || a > s->range_last)
+		return;
+
+	uint32_t bit = a - s->range_first;
+
+	if (used)
+		s->bitmap[bit / 64] |= 1ULL << (bit % 64);
+	else
+	{
+		s->bitmap[bit / 64] &= ~(1ULL << (bit % 64));
+		if (bit < s->bitmap_hint)
+			s->bitmap_hint = bit;
+	}
+}
+
+static inline bool store_heap_less(struct store *s, uint32_t a, uint32_t b)
+{
+	return store_expiry(s, &s->leases[s->heap[a]]) <
+		store_expiry(s, &s->leases[s->heap[b]]);
+}
+
+static inline void store_heap_swap(struct store *s, uint32_t a, uint32_t b)
+{
+	uint32_t tmp = s->heap[a];
+	s->heap[a] = s->heap[b];
+	s->heap[b] = tmp;
+
+	s->leases[s->heap[a]].heap_pos = a;
+	s->leases[s->heap[b]].heap_pos = b;
+}
+
+static void store_heap_up(struct store *s, uint32_t i)
+{
+	while (i > 0 && store_heap_less(s, i, (i - 1) / 2))
+	{
+		store_heap_swap(s, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void store_heap_down(struct store *s, uint32_t i)
+{
+	for (;;)
+	{
+		uint32_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+
+		if (l < s->heap_cnt && store_heap_less(s, l, min))
+			min = l;
+		if (r < s->heap_cnt && store_heap_less(s, r, min))
+			min = r;
+		if (min == i)
+			break;
+
+		store_heap_swap(s, i, min);
+		i = min;
+	}
+}
+
+/**
+ * Grow lease array and heap to hold at least cnt leases, and the indexes to
+ * stay at most half full
+ */
+static bool store_reserve(struct store *s, uint32_t cnt)
+{
+	if (cnt > s->leases_cap)
+	{
+		uint32_t cap = s->leases_cap ? s->leases_cap : 64;
+		while (cap < cnt)
+			cap *= 2;
+
+		struct store_lease *leases = realloc(s->leases, cap * sizeof *leases);
+		if (leases == NULL)
+			return false;
+		s->leases = leases;
+
+		uint32_t *heap = realloc(s->heap, cap * sizeof *heap);
+		if (heap == NULL)
+			return false;
+		s->heap = heap;
+
+		s->leases_cap = cap;
+	}
+
+	if (s->by_key != NULL && cnt <= (s->index_mask + 1) / 2)
+		return true;
+
+	uint32_t size = 128;
+	while (size / 2 < cnt)
+		size *= 2;
+
+	uint32_t *by_key = calloc(size, sizeof *by_key);
+	uint32_t *by_address = calloc(size, sizeof *by_address);
+	if (by_key == NULL || by_address == NULL)
+	{
+		free(by_key);
+		free(by_address);
+		return false;
+	}
+
+	free(s->by_key);
+	free(s->by_address);
+	s->by_key = by_key;
+	s->by_address = by_address;
+	s->index_mask = size - 1;
+
+	for (uint32_t i = 0; i < s->leases_cnt; ++i)
+		store_index_add(s, i);
+
+	return true;
+}
+
+static uint32_t store_str_hash(const char *str)
+{
+	uint32_t h = 2166136261U;
+
+	for (; *str; ++str)
+		h = (h ^ (uint8_t)*str) * 16777619U;
+
+	return h;
+}
+
+/**
+ * Add offset of an existing string of the string table to the intern index
+ */
+static bool store_str_index(struct store *s, uint32_t off)
+{
+	if ((s->strings_cnt + 1) * 2 > s->strings_mask + 1)
+	{
+		uint32_t size = (s->strings_mask + 1) * 2;
+		uint32_t *index = calloc(size, sizeof *index);
+		if (index == NULL)
+			return false;
+
+		for (uint32_t i = 0; i <= s->strings_mask; ++i)
+		{
+			if (!s->strings_index[i])
+				continue;
+
+			uint32_t j = store_str_hash(s->strings + s->strings_index[i]) & (size - 1);
+			while (index[j])
+				j = (j + 1) & (size - 1);
+			index[j] = s->strings_index[i];
+		}
+
+		free(s->strings_index);
+		s->strings_index = index;
+		s->strings_mask = size - 1;
+	}
+
+	uint32_t i = store_str_hash(s->strings + off) & s->strings_mask;
+	while (s->strings_index[i])
+		i = (i + 1) & s->strings_mask;
+	s->strings_index[i] = off;
+	++s->strings_cnt;
+
+	return true;
+}
+
+/**
+ * Offset of str in the string table, str is added if it isn't stored yet
+ *
+ * @return Offset or zero for empty strings and on allocation failures
+ */
+static uint32_t store_str_intern(struct store *s, const char *str)
+{
+	if (str == NULL || *str == 0)
+		return 0;
+
+	uint32_t i = store_str_hash(str) & s->strings_mask;
+	while (s->strings_index[i])
+	{
+		if (strcmp(s->strings + s->strings_index[i], str) == 0)
+			return s->strings_index[i];
+		i = (i + 1) & s->strings_mask;
+	}
+
+	size_t len = strlen(str) + 1;
+	if (s->strings_len + len > UINT32_MAX)
+		return 0;
+
+	if (s->strings_len + len > s->strings_cap)
+	{
+		size_t cap = s->strings_cap * 2;
+		while (cap < s->strings_len + len)
+			cap *= 2;
+
+		char *strings = realloc(s->strings, cap);
+		if (strings == NULL)
+			return 0;
+		s->strings = strings;
+		s->strings_cap = cap;
+	}
+
+	uint32_t off = s->strings_len;
+	memcpy(s->strings + off, str, len);
+	s->strings_len += len;
+
+	if (!store_str_index(s, off))
+		return 0;
+
+	return off;
+}
+
+static inline uint32_t store_profile_hash(uint32_t routers,
+	uint32_t nameservers)
+{
+	return store_hash((uint64_t)routers << 32 | nameservers);
+}
+
+static void store_profile_free(struct store_profile *p)
+{
+	free(p->routers_addrs);
+	free(p->nameservers_addrs);
+	/* Both options share one buffer */
+	free(p->routers_opt != NULL ? p->routers_opt : p->nameservers_opt);
+}
+
+/**
+ * Parse lists of a profile and encode their options, a profile with a list,
+ * which can't be parsed, is marked invalid and gets no lists at all
+ */
+static bool store_profile_fill(struct store *s, struct store_profile *p)
+{
+	p->valid =
+		(!p->routers || iplist_parse(s->strings + p->routers,
+			&p->routers_addrs, &p->routers_cnt, NULL)) &&
+		(!p->nameservers || iplist_parse(s->strings + p->nameservers,
+			&p->nameservers_addrs, &p->nameservers_cnt, NULL));
+
+	if (!p->valid)
+	{
+		store_profile_free(p);
+		p->routers_addrs = p->nameservers_addrs = NULL;
+		p->routers_cnt = p->nameservers_cnt = 0;
+		return true;
+	}
+
+	uint8_t opts[2 * (2 + 252)];
+	size_t len = 0;
+	uint8_t *opt = opts;
+
+	if (p->routers_cnt > 0)
+		opt = dhcp_opt_put_addrs(opt, &len, DHCP_OPT_ROUTER,
+			p->routers_addrs, p->routers_cnt);
+
+	size_t routers_len = len;
+
+	if (p->nameservers_cnt > 0)
+		opt = dhcp_opt_put_addrs(opt, &len, DHCP_OPT_DNS,
+			p->nameservers_addrs, p->nameservers_cnt);
+
+	if (len == 0)
+		return true;
+
+	uint8_t *buf = malloc(len);
+	if (buf == NULL)
+	{
+		store_profile_free(p);
+		return false;
+	}
+	memcpy(buf, opts, len);
+
+	p->routers_opt = routers_len > 0 ? buf : NULL;
+	p->nameservers_opt = len > routers_len ? buf + routers_len : NULL;
+
+	return true;
+}
+
+/**
+ * Add profile of two lists of the string table, which isn't interned yet
+ *
+ * @return Id of the profile or zero on allocation failures
+ */
+static uint32_t store_profile_add(struct store *s, uint32_t routers,
+	uint32_t nameservers)
+{
+	if (s->profiles_cnt == s->profiles_cap)
+	{
+		uint32_t cap = s->profiles_cap * 2;
+		struct store_profile *profiles = realloc(s->profiles,
+			cap * sizeof *profiles);
+		if (profiles == NULL)
+			return 0;
+		s->profiles = profiles;
+		s->profiles_cap = cap;
+	}
+
+	if (s->profiles_cnt * 2 > s->profiles_mask + 1)
+	{
+		uint32_t size = (s->profiles_mask + 1) * 2;
+		uint32_t *index = calloc(size, sizeof *index);
+		if (index == NULL)
+			return 0;
+
+		for (uint32_t id = 1; id < s->profiles_cnt; ++id)
+		{
+			const struct store_profile *p = &s->profiles[id];
+			uint32_t j = store_profile_hash(p->routers, p->nameservers) & (size - 1);
+			while (index[j])
+				j = (j + 1) & (size - 1);
+			index[j] = id;
+		}
+
+		free(s->profiles_index);
+		s->profiles_index = index;
+		s->profiles_mask = size - 1;
+	}
+
+	uint32_t id = s->profiles_cnt;
+	struct store_profile *p = &s->profiles[id];
+
+	*p = (struct store_profile){
+		.routers = routers,
+		.nameservers = nameservers
+	};
+
+	if (!store_profile_fill(s, p))
+		return 0;
+
+	uint32_t i = store_profile_hash(routers, nameservers) & s->profiles_mask;
+	while (s->profiles_index[i])
+		i = (i + 1) & s->profiles_mask;
+	s->profiles_index[i] = id;
+	++s->profiles_cnt;
+
+	return id;
+}
+
+/**
+ * Find profile of two lists, the profile is added if it doesn't exist yet
+ *
+ * @param[in] s Store
+ * @param[in] routers Comma separated router list or NULL
+ * @param[in] nameservers Comma separated nameserver list or NULL
+ * @param[out] id Id of the profile
+ * @return false on allocation failures
+ */
+static bool store_profile_intern(struct store *s, const char *routers,
+	const char *nameservers, uint32_t *id)
+{
+	uint32_t r = store_str_intern(s, routers);
+	uint32_t n = store_str_intern(s, nameservers);
+
+	if ((r == 0 && routers != NULL && *routers != 0) ||
+			(n == 0 && nameservers != NULL && *nameservers != 0))
+		return false;
+
+	if (r == 0 && n == 0)
+	{
+		*id = 0;
+		return true;
+	}
+
+	uint32_t i = store_profile_hash(r, n) & s->profiles_mask;
+	while (s->profiles_index[i])
+	{
+		const struct store_profile *p = &s->profiles[s->profiles_index[i]];
+
+		if (p->routers == r && p->nameservers == n)
+		{
+			*id = s->profiles_index[i];
+			return true;
+		}
+		i = (i + 1) & s->profiles_mask;
+	}
+
+	*id = store_profile_add(s, r, n);
+
+	return *id != 0;
+}
+
+bool store_init(struct store *s, const struct range_set *ranges,
+	uint32_t grace)
+{
+	*s = (struct store)STORE_EMPTY;
+
+	s->grace = grace;
+	s->ranges = ranges;
+
+	s->strings_cap = 4096;
+	s->strings = malloc(s->strings_cap);
+	s->strings_mask = 63;
+	s->strings_index = calloc(s->strings_mask + 1, sizeof *s->strings_index);
+	if (s->strings == NULL || s->strings_index == NULL)
+		goto error;
+
+	/* Offset zero is reserved for unset strings */
+	s->strings[0] = 0;
+	s->strings_len = 1;
+
+	s->profiles_cap = 16;
+	s->profiles = malloc(s->profiles_cap * sizeof *s->profiles);
+	s->profiles_mask = 15;
+	s->profiles_index = calloc(s->profiles_mask + 1, sizeof *s->profiles_index);
+	if (s->profiles == NULL || s->profiles_index == NULL)
+		goto error;
+
+	/* Profile zero has no lists and isn't part of the hash table */
+	s->profiles[0] = (struct store_profile){ .valid = true };
+	s->profiles_cnt = 1;
+
+	if (!store_reserve(s, 0))
+		goto error;
+
+	if (ranges->ranges_cnt > 0)
+	{
+		s->range_first = ranges->ranges[0].first;
+		s->range_last = ranges->ranges[ranges->ranges_cnt - 1].last;
+	}
+
+	if (ranges->ranges_cnt > 0 &&
+			s->range_last - s->range_first < STORE_RANGE_MAX)
+	{
+		uint32_t bits = s->range_last - s->range_first + 1;
+		uint32_t words = (bits + 63) / 64;
+
+		s->bitmap = calloc(words, sizeof *s->bitmap);
+		if (s->bitmap == NULL)
+			goto error;
+
+		/* Bits behind the range are never free */
+		if (bits % 64)
+			s->bitmap[words - 1] = ~0ULL << (bits % 64);
+	}
+
+	return true;
+
+error:
+	store_free(s);
+	return false;
+}
+
+/**
+ * Build heap from scratch and mark all addresses in the bitmap, after the
+ * lease array was filled in bulk
+ */
+static void store_build(struct store *s)
+{
+	s->heap_cnt = 0;
+
+	for (uint32_t i = 0; i < s->leases_cnt; ++i)
+	{
+		struct store_lease *l = &s->leases[i];
+
+		store_bitmap_set(s, l->address, true);
+
+		if (l->allocated)
+		{
+			l->heap_pos = s->heap_cnt;
+			s->heap[s->heap_cnt++] = i;
+		}
+	}
+
+	for (uint32_t i = s->heap_cnt / 2; i-- > 0;)
+		store_heap_down(s, i);
+}
+
+int store_load(struct store *s, sqlite3 *db)
+{
+	sqlite3_stmt *stmt;
+	int sqlerr = sqlite3_prepare_v2(db,
+		"SELECT COUNT(*) FROM leases;", -1, &stmt, NULL);
+	if (sqlerr != SQLITE_OK)
+		return sqlerr;
+
+	uint32_t cnt = 0;
+	if (sqlite3_step(stmt) == SQLITE_ROW)
+		cnt = sqlite3_column_int(stmt, 0);
+	sqlite3_finalize(stmt);
+
+	if (!store_reserve(s, s->leases_cnt + cnt))
+		return SQLITE_NOMEM;
+
+	sqlerr = sqlite3_prepare_v2(db,
+		"SELECT " DB_COLUMNS " FROM leases\n"
+		"ORDER BY id;", -1, &stmt, NULL);
+	if (sqlerr != SQLITE_OK)
+		return sqlerr;
+
+	while ((sqlerr = sqlite3_step(stmt)) == SQLITE_ROW)
+	{
+		if (s->leases_cnt == s->leases_cap && !store_reserve(s, s->leases_cnt + 1))
+		{
+			sqlerr = SQLITE_NOMEM;
+			break;
+		}
+
+		struct store_lease *l = &s->leases[s->leases_cnt];
+		const char *address = (const char *)sqlite3_column_text(stmt, 1);
+		const char *hwaddr = (const char *)sqlite3_column_text(stmt, 3);
+		const void *key = sqlite3_column_blob(stmt, 9);
+		int key_len = sqlite3_column_bytes(stmt, 9);
+
+		*l = (struct store_lease){
+			.id = sqlite3_column_int(stmt, 0),
+			.prefixlen = sqlite3_column_int(stmt, 2),
+			.leasetime = sqlite3_column_int(stmt, 6),
+			.allocated = sqlite3_column_int(stmt, 7) != 0,
+			.allocated_at = sqlite3_column_int64(stmt, 8)
+		};
+
+		if (!store_profile_intern(s, (const char *)sqlite3_column_text(stmt, 4),
+				(const char *)sqlite3_column_text(stmt, 5), &l->profile))
+		{
+			sqlerr = SQLITE_NOMEM;
+			break;
+		}
+
+		/* Ids of skipped rows are taken as well */
+		if (l->id >= s->next_id)
+			s->next_id = l->id + 1;
+
+		if (address == NULL || hwaddr == NULL || key == NULL ||
+				key_len > DHCP_KEY_MAX ||
+				inet_pton(AF_INET, address, &l->address) != 1 ||
+				!mac_pton(hwaddr, l->hwaddr))
+		{
+			log_printf("Skipping invalid lease %u", l->id);
+			continue;
+		}
+
+		l->key.len = key_len;
+		memcpy(l->key.data, key, key_len);
+		l->key_hash = dhcp_key_hash(&l->key);
+
+		if (!store_index_add(s, s->leases_cnt))
+		{
+			log_printf("Skipping invalid lease %u", l->id);
+			continue;
+		}
+
+		++s->leases_cnt;
+	}
+
+	sqlite3_finalize(stmt);
+
+	if (sqlerr != SQLITE_DONE)
+		return sqlerr;
+
+	store_build(s);
+
+	return SQLITE_OK;
+}
+
+/**
+ * Fill database related fields of a cache header from the database file
+ */
+static bool store_db_state(const char *db_path, struct store_cache_hdr *hdr)
+{
+	struct stat st;
+
+	/* Committed changes in a write-ahead log don't show up in the header */
+	size_t wal_len = strlen(db_path) + sizeof "-wal";
+	char wal_path[wal_len];
+	snprintf(wal_path, wal_len, "%s-wal", db_path);
+
+	if (stat(wal_path, &st) == 0 && st.st_size > 0)
+		return false;
+
+	int fd = open(db_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	uint8_t db_hdr[100];
+	bool ok = fstat(fd, &st) == 0 &&
+		pread(fd, db_hdr, sizeof db_hdr, 0) == sizeof db_hdr;
+
+	close(fd);
+
+	if (!ok)
+		return false;
+
+	/* File change counter, big endian at offset 24 */
+	hdr->db_counter = (uint32_t)db_hdr[24] << 24 | (uint32_t)db_hdr[25] << 16 |
+		(uint32_t)db_hdr[26] << 8 | db_hdr[27];
+	hdr->db_size = st.st_size;
+	hdr->db_ino = st.st_ino;
+	hdr->db_mtime_sec = st.st_mtim.tv_sec;
+	hdr->db_mtime_nsec = st.st_mtim.tv_nsec;
+
+	return true;
+}
+
+bool store_load_cache(struct store *s, const char *path, const char *db_path)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	bool ok = store_load_fd(s, fd, db_path);
+	close(fd);
+
+	return ok;
+}
+
+bool store_load_fd(struct store *s, int fd, const char *db_path)
+{
+	struct store_cache_hdr db_state;
+	if (!store_db_state(db_path, &db_state))
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct store_cache_hdr))
+		return false;
+
+	uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (map == MAP_FAILED)
+		return false;
+
+	bool ok = false;
+	struct store_cache_hdr *hdr = (struct store_cache_hdr *)map;
+	struct store_lease *leases = (struct store_lease *)(hdr + 1);
+	uint32_t (*profiles)[2] = (uint32_t (*)[2])(leases + hdr->leases_cnt);
+	char *strings = (char *)(profiles + hdr->profiles_cnt);
+
+	if (memcmp(hdr->magic, STORE_CACHE_MAGIC, sizeof hdr->magic) != 0 ||
+			hdr->lease_size != sizeof(struct store_lease) ||
+			hdr->db_counter != db_state.db_counter ||
+			hdr->db_size != db_state.db_size ||
+			hdr->db_ino != db_state.db_ino ||
+			hdr->db_mtime_sec != db_state.db_mtime_sec ||
+			hdr->db_mtime_nsec != db_state.db_mtime_nsec ||
+			hdr->leases_cnt > UINT32_MAX / 2 ||
+			hdr->profiles_cnt == 0 || hdr->profiles_cnt > UINT32_MAX / 2 ||
+			hdr->strings_len == 0 || hdr->strings_len > UINT32_MAX ||
+			(size_t)st.st_size != sizeof *hdr +
+				hdr->leases_cnt * sizeof *leases +
+				hdr->profiles_cnt * sizeof *profiles + hdr->strings_len ||
+			strings[hdr->strings_len - 1] != 0)
+		goto finalize;
+
+	if (!store_reserve(s, hdr->leases_cnt))
+		goto finalize;
+
+	if (hdr->strings_len > s->strings_cap)
+	{
+		char *buf = realloc(s->strings, hdr->strings_len);
+		if (buf == NULL)
+			goto finalize;
+		s->strings = buf;
+		s->strings_cap = hdr->strings_len;
+	}
+
+	memcpy(s->strings, strings, hdr->strings_len);
+	s->strings_len = hdr->strings_len;
+
+	for (uint32_t off = 1; off < s->strings_len; off += strlen(s->strings + off) + 1)
+		if (!store_str_index(s, off))
+			goto finalize;
+
+	/* Profiles are added in the order of their ids, which keeps the ids of
+	 * the leases valid */
+	for (uint32_t id = 1; id < hdr->profiles_cnt; ++id)
+		if (profiles[id][0] >= s->strings_len ||
+				profiles[id][1] >= s->strings_len ||
+				store_profile_add(s, profiles[id][0], profiles[id][1]) != id)
+			goto finalize;
+
+	memcpy(s->leases, leases, hdr->leases_cnt * sizeof *leases);
+	s->leases_cnt = hdr->leases_cnt;
+
+	for (uint32_t i = 0; i < s->leases_cnt; ++i)
+	{
+		struct store_lease *l = &s->leases[i];
+
+		if (l->profile >= s->profiles_cnt ||
+				l->key.len > DHCP_KEY_MAX ||
+				l->key_hash != dhcp_key_hash(&l->key) ||
+				!store_index_add(s, i))
+			goto finalize;
+
+		if (l->id >= s->next_id)
+			s->next_id = l->id + 1;
+	}
+
+	store_build(s);
+	ok = true;
+
+finalize:
+	munmap(map, st.st_size);
+
+	if (!ok)
+	{
+		/* Start over with an empty store */
+		struct store empty;
+		const struct range_set *ranges = s->ranges;
+		uint32_t grace = s->grace;
+
+		store_free(s);
+		if (store_init(&empty, ranges, grace))
+			*s = empty;
+	}
+
+	return ok;
+}
+
+bool store_save_cache(struct store *s, const char *path, const char *db_path)
+{
+	size_t tmp_len = strlen(path) + sizeof ".tmp";
+	char tmp_path[tmp_len];
+	snprintf(tmp_path, tmp_len, "%s.tmp", path);
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return false;
+
+	bool ok = store_save_fd(s, fd, db_path);
+
+	if (close(fd) != 0 || !ok || rename(tmp_path, path) != 0)
+	{
+		unlink(tmp_path);
+		return false;
+	}
+
+	return true;
+}
+
+bool store_save_fd(struct store *s, int fd, const char *db_path)
+{
+	struct store_cache_hdr hdr = {
+		.lease_size = sizeof(struct store_lease),
+		.leases_cnt = s->leases_cnt,
+		.profiles_cnt = s->profiles_cnt,
+		.strings_len = s->strings_len
+	};
+
+	memcpy(hdr.magic, STORE_CACHE_MAGIC, sizeof hdr.magic);
+
+	if (!store_db_state(db_path, &hdr))
+		return false;
+
+	/* Only the lists of the profiles are written, the rest is derived */
+	uint32_t (*profiles)[2] = malloc(s->profiles_cnt * sizeof *profiles);
+	if (profiles == NULL)
+		return false;
+
+	for (uint32_t id = 0; id < s->profiles_cnt; ++id)
+	{
+		profiles[id][0] = s->profiles[id].routers;
+		profiles[id][1] = s->profiles[id].nameservers;
+	}
+
+	struct iovec iov[4] = {
+		{ .iov_base = &hdr, .iov_len = sizeof hdr },
+		{ .iov_base = s->leases, .iov_len = s->leases_cnt * sizeof *s->leases },
+		{ .iov_base = profiles, .iov_len = s->profiles_cnt * sizeof *profiles },
+		{ .iov_base = s->strings, .iov_len = s->strings_len }
+	};
+
+	size_t total = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len +
+		iov[3].iov_len;
+	int iovcnt = 4;
+	struct iovec *cur = iov;
+
+	while (iovcnt > 0)
+	{
+		ssize_t written = writev(fd, cur, iovcnt);
+		if (written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		total -= written;
+		while (iovcnt > 0 && (size_t)written >= cur->iov_len)
+		{
+			written -= cur->iov_len;
+			++cur;
+			--iovcnt;
+		}
+		if (iovcnt > 0)
+		{
+			cur->iov_base = (uint8_t *)cur->iov_base + written;
+			cur->iov_len -= written;
+		}
+	}
+
+	free(profiles);
+
+	return total == 0;
+}
+
+struct store_lease *store_by_key(struct store *s, const struct dhcp_key *key,
+	uint32_t hash)
+{
+	uint32_t i = store_key_find(s, key, hash);
+
+	return s->by_key[i] ? &s->leases[s->by_key[i] - 1] : NULL;
+}
+
+struct store_lease *store_by_hwaddr(struct store *s, const uint8_t hwaddr[6])
+{
+	struct dhcp_key key;
+	dhcp_key_from_hwaddr(&key, hwaddr);
+
+	struct store_lease *l = store_by_key(s, &key, dhcp_key_hash(&key));
+	if (l != NULL)
+		return l;
+
+	for (uint32_t i = 0; i < s->leases_cnt; ++i)
+		if (!memcmp(s->leases[i].hwaddr, hwaddr, 6))
+			return &s->leases[i];
+
+	return NULL;
+}
+
+struct store_lease *store_by_address(struct store *s, struct in_addr address)
+{
+	uint32_t i = store_index_find(s, s->by_address, store_key_address,
+		address.s_addr);
+
+	return s->by_address[i] ? &s->leases[s->by_address[i] - 1] : NULL;
+}
+
+struct store_lease *store_insert(struct store *s, const struct store_lease *l,
+	const char *routers, const char *nameservers)
+{
+	if (!store_reserve(s, s->leases_cnt + 1))
+		return NULL;
+
+	uint32_t idx = s->leases_cnt;
+	struct store_lease *n = &s->leases[idx];
+
+	*n = *l;
+	n->key_hash = dhcp_key_hash(&n->key);
+
+	if (!store_profile_intern(s, routers, nameservers, &n->profile))
+		return NULL;
+
+	if (!store_index_add(s, idx))
+		return NULL;
+
+	++s->leases_cnt;
+	if (n->id >= s->next_id)
+		s->next_id = n->id + 1;
+
+	store_bitmap_set(s, n->address, true);
+
+	if (n->allocated)
+	{
+		n->heap_pos = s->heap_cnt;
+		s->heap[s->heap_cnt++] = idx;
+		store_heap_up(s, n->heap_pos);
+	}
+
+	return n;
+}
+
+void store_remove(struct store *s, struct store_lease *l)
+{
+	uint32_t idx = l - s->leases;
+	uint32_t last = s->leases_cnt - 1;
+
+	store_index_del(s, s->by_key, store_key_hash,
+		store_key_find(s, &l->key, l->key_hash));
+	store_index_del(s, s->by_address, store_key_address,
+		store_index_find(s, s->by_address, store_key_address, store_key_address(l)));
+
+	store_bitmap_set(s, l->address, false);
+
+	if (l->allocated)
+	{
+		uint32_t pos = l->heap_pos;
+
+		if (pos != --s->heap_cnt)
+		{
+			store_heap_swap(s, pos, s->heap_cnt);
+			store_heap_down(s, pos);
+			store_heap_up(s, pos);
+		}
+	}
+
+	/* Move last lease into the gap, so the array stays dense */
+	if (idx != last)
+	{
+		struct store_lease *m = &s->leases[last];
+
+		s->by_key[store_key_find(s, &m->key, m->key_hash)] = idx + 1;
+		s->by_address[store_index_find(s, s->by_address, store_key_address,
+			store_key_address(m))] = idx + 1;
+
+		if (m->allocated)
+			s->heap[m->heap_pos] = idx;
+
+		*l = *m;
+	}
+
+	--s->leases_cnt;
+}
+
+/**
+ * Find lowest unused bit of the bitmap between two bits
+ */
+static bool store_free_bit(struct store *s, uint32_t from, uint32_t to,
+	uint32_t *bit)
+{
+	for (uint32_t b = from; b <= to; )
+	{
+		uint64_t used = s->bitmap[b / 64] | ((UINT64_C(1) << (b % 64)) - 1);
+
+		if (used == ~0ULL)
+		{
+			b = (b / 64 + 1) * 64;
+			continue;
+		}
+
+		b = b / 64 * 64 + __builtin_ctzll(~used);
+		if (b > to)
+			break;
+
+		*bit = b;
+		return true;
+	}
+
+	return false;
+}
+
+bool store_free_address_in(struct store *s, const struct range_set *ranges,
+	struct in_addr *address)
+{
+	/* An exhausted scope, which ends at the last address, would wrap
+	 * around to the first interval */
+	if (s->bitmap == NULL || s->bitmap_hint > s->range_last - s->range_first)
+		return false;
+
+	/* Nothing below the hint is free, the ranges before it are skipped
+	 * right away */
+	for (size_t i = range_set_find(ranges, s->range_first + s->bitmap_hint);
+			i < ranges->ranges_cnt; ++i)
+	{
+		const struct range *r = &ranges->ranges[i];
+		uint32_t bit;
+
+		if (r->first > s->range_last)
+			break;
+		if (r->last < s->range_first)
+			continue;
+
+		uint32_t from = r->first > s->range_first ? r->first - s->range_first : 0;
+		uint32_t to = (r->last < s->range_last ? r->last : s->range_last) -
+			s->range_first;
+
+		if (from < s->bitmap_hint)
+			from = s->bitmap_hint;
+
+		if (store_free_bit(s, from, to, &bit))
+		{
+			address->s_addr = htonl(s->range_first + bit);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool store_free_address(struct store *s, struct in_addr *address)
+{
+	if (s->bitmap == NULL)
+		return false;
+
+	if (!store_free_address_in(s, s->ranges, address))
+	{
+		s->bitmap_hint = s->range_last - s->range_first + 1;
+		return false;
+	}
+
+	s->bitmap_hint = ntohl(address->s_addr) - s->range_first;
+	return true;
+}
+
+void store_free(struct store *s)
+{
+	free(s->leases);
+	free(s->by_key);
+	free(s->by_address);
+	free(s->heap);
+	free(s->strings);
+	free(s->strings_index);
+	for (uint32_t i = 0; i < s->profiles_cnt; ++i)
+		store_profile_free(&s->profiles[i]);
+	free(s->profiles);
+	free(s->profiles_index);
+	free(s->bitmap);
+
+	*s = (struct store)STORE_EMPTY;
+}
@@ -0,0 +1,348 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <sqlite3.h>
+
+#include "dhcp.h"
+#include "range.h"
+
+#ifndef DHCPD_STORE_H_
+#define DHCPD_STORE_H_
+
+/* In-memory copy of the leases table, so that handling a message never has
+ * to wait for SQLite. The database stays the persistent copy, every
+ * mutation is queued for the persistence thread, which writes it later
+ * together with other ones in one transaction, see persist.h.
+ *
+ * Leases are kept densely in one array and referenced by their index. On
+ * top of that there are
+ *
+ *  - two open addressing hash tables, which map lease key and IP address to
+ *    the index of a lease,
+ *  - a bitmap of all addresses from the first to the last address of the
+ *    allocation scope, where a set bit means that some lease uses the
+ *    address. Addresses between the ranges of the scope have bits as well,
+ *    but they are never searched,
+ *  - a binary min-heap of all allocated leases ordered by the time they may
+ *    be collected.
+ *
+ * Router and nameserver lists are stored once in a string table, because
+ * most leases share the same few lists. Every distinct pair of lists is
+ * interned as an immutable profile, which holds the parsed addresses and
+ * options 3 and 6 already encoded for replies, and leases reference their
+ * profile by id. Profiles are never removed, profile 0 has no lists.
+ *
+ * The lease array, the lists of the profiles and the string table have a
+ * fixed layout, which is written as is into the cache file. A warm start maps that file and
+ * rebuilds the indexes from it, instead of reading the whole table through
+ * SQLite.
+ */
+
+/* Largest span of the allocation scope, which is tracked in the bitmap */
+#define STORE_RANGE_MAX (1U << 24)
+
+struct store_lease
+{
+	/* Row id in the database */
+	uint32_t id;
+	/* Network byte order */
+	uint32_t address;
+	/* Hardware address of the client, the key identifies the lease */
+	uint8_t hwaddr[6];
+	uint8_t prefixlen;
+	uint8_t allocated;
+	uint32_t leasetime;
+	int64_t allocated_at;
+
+	/* Id of the profile with the router and nameserver lists */
+	uint32_t profile;
+
+	/* Position in the expiry heap, only valid if allocated */
+	uint32_t heap_pos;
+	/* Hash of key, set by the store */
+	uint32_t key_hash;
+	struct dhcp_key key;
+};
+
+struct store_profile
+{
+	/* Offsets of the lists into the string table, zero if not set */
+	uint32_t routers;
+	uint32_t nameservers;
+
+	/* Set if both lists could be parsed */
+	bool valid;
+
+	/* Parsed lists and their options with code and length, NULL if a list
+	 * is empty. They are allocated once and never move. */
+	struct in_addr *routers_addrs;
+	size_t routers_cnt;
+	struct in_addr *nameservers_addrs;
+	size_t nameservers_cnt;
+	uint8_t *routers_opt;
+	uint8_t *nameservers_opt;
+};
+
+struct store
+{
+	struct store_lease *leases;
+	uint32_t leases_cnt;
+	uint32_t leases_cap;
+
+	/* Index + 1 of a lease, zero marks an empty slot */
+	uint32_t *by_key;
+	uint32_t *by_address;
+	uint32_t index_mask;
+
+	/* Indexes of allocated leases */
+	uint32_t *heap;
+	uint32_t heap_cnt;
+
+	/* Grace period, after which expired leases are collected */
+	uint32_t grace;
+
+	/* Id of the next new lease, above the ids of all rows ever loaded or
+	 * inserted, so leases can be written behind with their id */
+	uint32_t next_id;
+
+	/* Zero terminated strings, offset 0 holds the empty string */
+	char *strings;
+	size_t strings_len;
+	size_t strings_cap;
+	uint32_t *strings_index;
+	uint32_t strings_mask;
+	uint32_t strings_cnt;
+
+	/* Profiles by id and an open addressing hash table of the ids, zero
+	 * marks an empty slot */
+	struct store_profile *profiles;
+	uint32_t profiles_cnt;
+	uint32_t profiles_cap;
+	uint32_t *profiles_index;
+	uint32_t profiles_mask;
+
+	/* Allocation scope, its first and last address in host byte order and
+	 * the usage bitmap */
+	const struct range_set *ranges;
+	uint32_t range_first;
+	uint32_t range_last;
+	uint64_t *bitmap;
+	/* No address below this bit is free */
+	uint32_t bitmap_hint;
+};
+
+#define STORE_EMPTY {\
+		.leases = NULL,\
+		.leases_cnt = 0,\
+		.leases_cap = 0,\
+		.by_key = NULL,\
+		.by_address = NULL,\
+		.index_mask = 0,\
+		.heap = NULL,\
+		.heap_cnt = 0,\
+		.grace = 0,\
+		.next_id = 1,\
+		.strings = NULL,\
+		.strings_len = 0,\
+		.strings_cap = 0,\
+		.strings_index = NULL,\
+		.strings_mask = 0,\
+		.strings_cnt = 0,\
+		.profiles = NULL,\
+		.profiles_cnt = 0,\
+		.profiles_cap = 0,\
+		.profiles_index = NULL,\
+		.profiles_mask = 0,\
+		.ranges = NULL,\
+		.range_first = 1,\
+		.range_last = 0,\
+		.bitmap = NULL,\
+		.bitmap_hint = 0\
+	}
+
+/**
+ * Initialize empty store
+ *
+ * @param[out] s Store
+ * @param[in] ranges Built allocation scope, which must outlive the store
+ * @param[in] grace Maximum grace period before expired leases are collected
+ */
+extern bool store_init(struct store *s, const struct range_set *ranges,
+	uint32_t grace);
+
+/**
+ * Load all leases from the database in a single scan over the rowid order
+ *
+ * @param[in] s Store initialized with store_init()
+ * @param[in] db Database descriptor
+ */
+extern int store_load(struct store *s, sqlite3 *db);
+
+/**
+ * Load all leases from cache file, if it is consistent with the database
+ *
+ * @param[in] s Store initialized with store_init()
+ * @param[in] path Path of the cache file
+ * @param[in] db_path Path of the database
+ * @return false if the cache file is missing, stale or invalid
+ */
+extern bool store_load_cache(struct store *s, const char *path,
+	const char *db_path);
+
+/**
+ * Load all leases from an image written by store_save_fd(), if it is
+ * consistent with the database
+ *
+ * @param[in] s Store initialized with store_init()
+ * @param[in] fd Descriptor of the image
+ * @param[in] db_path Path of the database
+ */
+extern bool store_load_fd(struct store *s, int fd, const char *db_path);
+
+/**
+ * Write cache file, which reflects the current state of the database
+ *
+ * This must be called after all changes were committed and the database was
+ * closed.
+ *
+ * @param[in] s Store
+ * @param[in] path Path of the cache file
+ * @param[in] db_path Path of the database
+ */
+extern bool store_save_cache(struct store *s, const char *path,
+	const char *db_path);
+
+/**
+ * Write image of the store to a descriptor, the same requirements as for
+ * store_save_cache() apply, except that the database may stay open
+ *
+ * @param[in] s Store
+ * @param[in] fd Destination descriptor
+ * @param[in] db_path Path of the database
+ */
+extern bool store_save_fd(struct store *s, int fd, const char *db_path);
+
+/**
+ * Find lease by key
+ *
+ * @param[in] s Store
+ * @param[in] key Lease key
+ * @param[in] hash Hash of key
+ */
+extern struct store_lease *store_by_key(struct store *s,
+	const struct dhcp_key *key, uint32_t hash);
+
+/**
+ * Find lease by Ethernet hardware address, leases with a client identifier
+ * as key are searched by a linear scan
+ */
+extern struct store_lease *store_by_hwaddr(struct store *s,
+	const uint8_t hwaddr[6]);
+
+/**
+ * Find lease by IP address
+ */
+extern struct store_lease *store_by_address(struct store *s,
+	struct in_addr address);
+
+/**
+ * Insert lease, which must not conflict with an existing one
+ *
+ * @param[in] s Store
+ * @param[in] l Lease to copy into the store
+ * @param[in] routers Comma separated router list or NULL
+ * @param[in] nameservers Comma separated nameserver list or NULL
+ */
+extern struct store_lease *store_insert(struct store *s,
+	const struct store_lease *l, const char *routers, const char *nameservers);
+
+/**
+ * Remove lease, any pointer into the store is invalid afterwards
+ */
+extern void store_remove(struct store *s, struct store_lease *l);
+
+/**
+ * Find lowest unused address of the allocation scope
+ *
+ * @param[in] s Store
+ * @param[out] address Unused address
+ * @return false if the scope is exhausted
+ */
+extern bool store_free_address(struct store *s, struct in_addr *address);
+
+/**
+ * Find lowest unused address of a scope within the allocation scope, only
+ * the ranges of the scope are searched
+ *
+ * @param[in] s Store
+ * @param[in] ranges Built scope
+ * @param[out] address Unused address
+ * @return false if the scope is exhausted
+ */
+extern bool store_free_address_in(struct store *s,
+	const struct range_set *ranges, struct in_addr *address);
+
+/**
+ * Allocated lease, which is collected first, or NULL if the heap is empty
+ */
+static inline struct store_lease *store_next_expiry(struct store *s)
+{
+	return s->heap_cnt ? &s->leases[s->heap[0]] : NULL;
+}
+
+/**
+ * Time when an allocated lease may be collected
+ */
+static inline int64_t store_expiry(const struct store *s,
+	const struct store_lease *l)
+{
+	return l->allocated_at + l->leasetime +
+		(l->leasetime > s->grace ? s->grace : l->leasetime);
+}
+
+/**
+ * String of the string table, NULL for offset zero
+ */
+static inline const char *store_str(const struct store *s, uint32_t off)
+{
+	return off ? s->strings + off : NULL;
+}
+
+/**
+ * Profile of a lease
+ */
+static inline const struct store_profile *store_profile(const struct store *s,
+	const struct store_lease *l)
+{
+	return &s->profiles[l->profile];
+}
+
+/**
+ * Router list of a lease, NULL if not set
+ */
+static inline const char *store_routers(const struct store *s,
+	const struct store_lease *l)
+{
+	return store_str(s, store_profile(s, l)->routers);
+}
+
+/**
+ * Nameserver list of a lease, NULL if not set
+ */
+static inline const char *store_nameservers(const struct store *s,
+	const struct store_lease *l)
+{
+	return store_str(s, store_profile(s, l)->nameservers);
+}
+
+/**
+ * Free all memory of a store
+ */
+extern void store_free(struct store *s);
+
+#endif
@@ -0,0 +1,538 @@
+#include "uring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+/* Multishot receive with provided-buffer rings needs Linux 6.0 */
+#ifdef IORING_RECV_MULTISHOT
+
+/* Received messages are preceded by the header of the multishot receive,
+ * the source address, the drop counter and the receive timestamp */
+#define URING_BUF_LEN (URING_MSG_LEN + 128)
+
+#define URING_CONTROL_LEN (CMSG_SPACE(sizeof(uint32_t)) + \
+	CMSG_SPACE(sizeof(struct timespec)))
+
+/* Buffer group of the provided-buffer ring */
+#define URING_BGID 0
+
+/* User data of the multishot receive and its cancellation, replies carry
+ * the index of their send slot */
+#define URING_RECV UINT64_MAX
+#define URING_CANCEL (UINT64_MAX - 1)
+
+struct uring_send
+{
+	struct uring_send *next;
+
+	struct sockaddr_in dst;
+	struct iovec iov;
+	struct msghdr msg;
+	uint8_t data[URING_MSG_LEN];
+};
+
+/**
+ * Enter the kernel to submit entries and wait for completions
+ */
+static int uring_enter(struct uring *u, uint32_t submit, uint32_t wait,
+	uint32_t flags)
+{
+	int ret;
+
+	do
+		ret = syscall(__NR_io_uring_enter, u->fd, submit, wait, flags, NULL, 0);
+	while (ret < 0 && errno == EINTR);
+
+	return ret;
+}
+
+/**
+ * Prepare next submission entry, queued entries are submitted first if the
+ * submission queue is full
+ *
+ * @return Cleared entry or NULL if the queue stays full
+ */
+static struct io_uring_sqe *uring_sqe(struct uring *u)
+{
+	if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+	{
+		uring_submit(u);
+
+		if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+			return NULL;
+	}
+
+	uint32_t idx = u->sq_local++ & u->sq_mask;
+	struct io_uring_sqe *sqe = (struct io_uring_sqe *)u->sqes + idx;
+
+	memset(sqe, 0, sizeof *sqe);
+	u->sq_array[idx] = idx;
+
+	return sqe;
+}
+
+/**
+ * Hand buffer to the kernel again
+ */
+static void uring_buf_add(struct uring *u, uint16_t bid)
+{
+	struct io_uring_buf_ring *br = u->br;
+	struct io_uring_buf *buf = &br->bufs[u->br_tail & (URING_BUFS - 1)];
+
+	/* The tail of the ring overlays the reserved field of the first buffer,
+	 * so the fields are set one by one */
+	buf->addr = (uintptr_t)(u->bufs + (size_t)bid * URING_BUF_LEN);
+	buf->len = URING_BUF_LEN;
+	buf->bid = bid;
+
+	__atomic_store_n(&br->tail, ++u->br_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * Queue multishot receive on the UDP socket
+ */
+static bool uring_arm(struct uring *u)
+{
+	struct io_uring_sqe *sqe = uring_sqe(u);
+	if (sqe == NULL)
+		return false;
+
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = u->sock;
+	sqe->addr = (uintptr_t)&u->recv_msg;
+	sqe->len = 1;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = URING_RECV;
+
+	u->armed = true;
+	return true;
+}
+
+bool uring_open(struct uring *u, int sock)
+{
+	*u = (struct uring)URING_EMPTY;
+	u->sock = sock;
+
+	/* Every provided buffer and send slot completes at most once before the
+	 * completions are reaped, so the completion queue can't overflow */
+	struct io_uring_params p = {
+		.flags = IORING_SETUP_CQSIZE,
+		.cq_entries = URING_BUFS + URING_SENDS + 2
+	};
+
+	u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+	if (u->fd < 0)
+		goto error;
+
+	u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+	u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (u->cq_map_len > u->sq_map_len)
+			u->sq_map_len = u->cq_map_len;
+		u->cq_map_len = u->sq_map_len;
+	}
+
+	u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_map == MAP_FAILED)
+	{
+		u->sq_map = NULL;
+		goto error;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->cq_map = u->sq_map;
+	else
+	{
+		u->cq_map = mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_map == MAP_FAILED)
+		{
+			u->cq_map = NULL;
+			goto error;
+		}
+	}
+
+	u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+	{
+		u->sqes = NULL;
+		goto error;
+	}
+
+	uint8_t *sq = u->sq_map, *cq = u->cq_map;
+
+	u->sq_head = (uint32_t *)(sq + p.sq_off.head);
+	u->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+	u->sq_flags = (uint32_t *)(sq + p.sq_off.flags);
+	u->sq_array = (uint32_t *)(sq + p.sq_off.array);
+	u->sq_mask = *(uint32_t *)(sq + p.sq_off.ring_mask);
+	u->sq_entries = p.sq_entries;
+	u->sq_local = *u->sq_tail;
+
+	u->cq_head = (uint32_t *)(cq + p.cq_off.head);
+	u->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+	u->cq_mask = *(uint32_t *)(cq + p.cq_off.ring_mask);
+	u->cqes = cq + p.cq_off.cqes;
+
+	/* The provided-buffer ring has to be page aligned */
+	u->br_len = URING_BUFS * sizeof(struct io_uring_buf);
+	u->br = mmap(NULL, u->br_len, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (u->br == MAP_FAILED)
+	{
+		u->br = NULL;
+		goto error;
+	}
+
+	u->bufs = malloc((size_t)URING_BUFS * URING_BUF_LEN);
+	u->sends = calloc(URING_SENDS, sizeof *u->sends);
+	if (u->bufs == NULL || u->sends == NULL)
+		goto error;
+
+	struct io_uring_buf_reg reg = {
+		.ring_addr = (uintptr_t)u->br,
+		.ring_entries = URING_BUFS,
+		.bgid = URING_BGID
+	};
+	if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0)
+		goto error;
+
+	for (uint16_t bid = 0; bid < URING_BUFS; ++bid)
+		uring_buf_add(u, bid);
+
+	for (size_t i = URING_SENDS; i > 0; --i)
+	{
+		u->sends[i - 1].next = u->sends_free;
+		u->sends_free = &u->sends[i - 1];
+	}
+
+	u->recv_msg = (struct msghdr){
+		.msg_namelen = sizeof(struct sockaddr_in),
+		.msg_controllen = URING_CONTROL_LEN
+	};
+
+	if (!uring_arm(u) || !uring_submit(u))
+		goto error;
+
+	return true;
+
+error:
+	{
+		int _errno = errno;
+		uring_close(u);
+		errno = _errno;
+	}
+	return false;
+}
+
+/**
+ * Take the drop counter of the socket and the receive timestamp out of the
+ * control messages
+ */
+static void uring_cmsg(struct uring *u, struct io_uring_recvmsg_out *out,
+	struct timespec *stamp)
+{
+	struct msghdr mh = {
+		.msg_control = (uint8_t *)(out + 1) + u->recv_msg.msg_namelen,
+		.msg_controllen = out->controllen
+	};
+
+	*stamp = (struct timespec){0};
+
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm != NULL;
+			cm = CMSG_NXTHDR(&mh, cm))
+	{
+		if (cm->cmsg_level != SOL_SOCKET)
+			continue;
+#ifdef SO_RXQ_OVFL
+		if (cm->cmsg_type == SO_RXQ_OVFL)
+			memcpy(&u->drops, CMSG_DATA(cm), sizeof u->drops);
+#endif
+#ifdef SCM_TIMESTAMPNS
+		if (cm->cmsg_type == SCM_TIMESTAMPNS)
+			memcpy(stamp, CMSG_DATA(cm), sizeof *stamp);
+#endif
+	}
+}
+
+uint8_t *uring_next(struct uring *u, size_t *len, struct sockaddr_in *src,
+	struct timespec *stamp)
+{
+	if (u->fd < 0)
+		return NULL;
+
+	if (u->held >= 0)
+	{
+		uring_buf_add(u, u->held);
+		u->held = -1;
+	}
+
+	for (;;)
+	{
+		uint32_t head = *u->cq_head;
+
+		if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+		{
+			/* Messages may still complete until the cancelled receive
+			 * ended, so they're waited for */
+			if (u->armed && u->cancelling)
+			{
+				if (uring_enter(u, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+					return NULL;
+				continue;
+			}
+			if (!u->armed && !u->stopping)
+				uring_arm(u);
+			return NULL;
+		}
+
+		struct io_uring_cqe *cqe = (struct io_uring_cqe *)u->cqes + (head & u->cq_mask);
+		uint64_t user_data = cqe->user_data;
+		int32_t res = cqe->res;
+		uint32_t flags = cqe->flags;
+
+		__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+
+		if (user_data == URING_CANCEL)
+			continue;
+
+		if (user_data != URING_RECV)
+		{
+			struct uring_send *s = &u->sends[user_data];
+
+			if (res < 0)
+				++u->send_errors;
+			s->next = u->sends_free;
+			u->sends_free = s;
+			continue;
+		}
+
+		/* The receive ends on errors and when it ran out of buffers */
+		if (!(flags & IORING_CQE_F_MORE))
+		{
+			u->armed = false;
+			u->cancelling = false;
+		}
+
+		if (!(flags & IORING_CQE_F_BUFFER))
+			continue;
+
+		uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+		uint8_t *buf = u->bufs + (size_t)bid * URING_BUF_LEN;
+		struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+		size_t off = sizeof *out + u->recv_msg.msg_namelen + u->recv_msg.msg_controllen;
+
+		if (res < 0 || (size_t)res < off)
+		{
+			uring_buf_add(u, bid);
+			continue;
+		}
+
+		*src = (struct sockaddr_in){
+			.sin_addr = {INADDR_ANY}
+		};
+		memcpy(src, out + 1, out->namelen < sizeof *src ? out->namelen : sizeof *src);
+		uring_cmsg(u, out, stamp);
+
+		/* Longer messages were cut off, the result counts what was kept */
+		*len = res - off;
+		u->held = bid;
+
+		return buf + off;
+	}
+}
+
+bool uring_send(struct uring *u, const void *data, size_t len,
+	const struct sockaddr_in *dst)
+{
+	struct uring_send *s = u->sends_free;
+
+	if (s == NULL || len > URING_MSG_LEN)
+		return false;
+
+	struct io_uring_sqe *sqe = uring_sqe(u);
+	if (sqe == NULL)
+		return false;
+
+	u->sends_free = s->next;
+
+	memcpy(s->data, data, len);
+	s->dst = *dst;
+	s->iov = (struct iovec){
+		.iov_base = s->data,
+		.iov_len = len
+	};
+	s->msg = (struct msghdr){
+		.msg_name = &s->dst,
+		.msg_namelen = sizeof s->dst,
+		.msg_iov = &s->iov,
+		.msg_iovlen = 1
+	};
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = u->sock;
+	sqe->addr = (uintptr_t)&s->msg;
+	sqe->len = 1;
+	sqe->user_data = s - u->sends;
+
+	return true;
+}
+
+bool uring_submit(struct uring *u)
+{
+	if (u->fd < 0 || u->sq_head == NULL)
+		return true;
+
+	uint32_t pending = u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	if (pending == 0)
+		return true;
+
+	__atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+	++u->submits;
+
+	return uring_enter(u, pending, 0, 0) >= 0;
+}
+
+void uring_stop(struct uring *u)
+{
+	if (u->fd < 0)
+		return;
+
+	u->stopping = true;
+
+	if (u->armed && !u->cancelling)
+	{
+		struct io_uring_sqe *sqe = uring_sqe(u);
+
+		if (sqe != NULL)
+		{
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = URING_RECV;
+			sqe->user_data = URING_CANCEL;
+			u->cancelling = true;
+		}
+	}
+
+	/* Cancelling an idle receive completes right away */
+	uring_submit(u);
+}
+
+bool uring_start(struct uring *u)
+{
+	if (u->fd < 0)
+		return false;
+
+	u->stopping = false;
+
+	/* The receive may still be armed, if it wasn't cancelled at all */
+	if (!u->armed && !uring_arm(u))
+		return false;
+
+	return uring_submit(u);
+}
+
+uint64_t uring_send_errors(struct uring *u)
+{
+	uint64_t errors = u->send_errors;
+
+	u->send_errors = 0;
+	return errors;
+}
+
+void uring_close(struct uring *u)
+{
+	/* Closing the instance cancels the receive */
+	if (u->fd >= 0)
+		close(u->fd);
+
+	if (u->sqes)
+		munmap(u->sqes, u->sqes_len);
+	if (u->cq_map && u->cq_map != u->sq_map)
+		munmap(u->cq_map, u->cq_map_len);
+	if (u->sq_map)
+		munmap(u->sq_map, u->sq_map_len);
+	if (u->br)
+		munmap(u->br, u->br_len);
+	free(u->bufs);
+	free(u->sends);
+
+	*u = (struct uring)URING_EMPTY;
+}
+
+#else
+
+bool uring_open(struct uring *u, int sock)
+{
+	*u = (struct uring)URING_EMPTY;
+	u->sock = sock;
+	errno = ENOTSUP;
+	return false;
+}
+
+uint8_t *uring_next(struct uring *u, size_t *len, struct sockaddr_in *src,
+	struct timespec *stamp)
+{
+	(void)u;
+	(void)len;
+	(void)src;
+	(void)stamp;
+	return NULL;
+}
+
+bool uring_send(struct uring *u, const void *data, size_t len,
+	const struct sockaddr_in *dst)
+{
+	(void)u;
+	(void)data;
+	(void)len;
+	(void)dst;
+	return false;
+}
+
+bool uring_submit(struct uring *u)
+{
+	(void)u;
+	return true;
+}
+
+void uring_stop(struct uring *u)
+{
+	(void)u;
+}
+
+bool uring_start(struct uring *u)
+{
+	(void)u;
+	return false;
+}
+
+uint64_t uring_send_errors(struct uring *u)
+{
+	(void)u;
+	return 0;
+}
+
+void uring_close(struct uring *u)
+{
+	*u = (struct uring)URING_EMPTY;
+}
+
+#endif
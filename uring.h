@@ -0,0 +1,189 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <netinet/in.h>
+
+#ifndef DHCPD_URING_H_
+#define DHCPD_URING_H_
+
+/* Network engine on io_uring, used with -engine io_uring. A multishot
+ * IORING_OP_RECVMSG stays armed on the UDP socket and the kernel receives
+ * every message into a buffer of a registered provided-buffer ring, so
+ * receiving costs no system call at all. Replies are copied into send slots
+ * and queued as IORING_OP_SENDMSG, all queued replies are submitted with a
+ * single io_uring_enter call.
+ *
+ * The ring descriptor becomes readable whenever completions are pending, so
+ * it is simply watched by the event loop, which keeps running the timers.
+ * The io_uring interface is used directly, liburing isn't needed.
+ */
+
+/* Entries of the submission queue */
+#ifndef URING_ENTRIES
+#define URING_ENTRIES 256
+#endif
+
+/* Provided buffers for received messages */
+#ifndef URING_BUFS
+#define URING_BUFS 512
+#endif
+
+/* Replies, which may be in flight at once */
+#ifndef URING_SENDS
+#define URING_SENDS 256
+#endif
+
+/* Longest message, the rest of longer ones is cut off */
+#ifndef URING_MSG_LEN
+#define URING_MSG_LEN 2048
+#endif
+
+_Static_assert((URING_BUFS & (URING_BUFS - 1)) == 0 && URING_BUFS <= 32768,
+	"URING_BUFS must be a power of two up to 32768");
+
+struct uring_send;
+
+struct uring
+{
+	int fd;
+	int sock;
+
+	/* Mapped submission queue, completion queue and submission entries */
+	void *sq_map;
+	size_t sq_map_len;
+	void *cq_map;
+	size_t cq_map_len;
+	void *sqes;
+	size_t sqes_len;
+
+	uint32_t *sq_head;
+	uint32_t *sq_tail;
+	uint32_t *sq_flags;
+	uint32_t *sq_array;
+	uint32_t sq_mask;
+	uint32_t sq_entries;
+	/* Tail including prepared entries, which weren't submitted yet */
+	uint32_t sq_local;
+
+	uint32_t *cq_head;
+	uint32_t *cq_tail;
+	uint32_t cq_mask;
+	void *cqes;
+
+	/* Provided-buffer ring, the buffers and the tail of the ring */
+	void *br;
+	size_t br_len;
+	uint8_t *bufs;
+	uint16_t br_tail;
+	/* Buffer of the message returned last or -1 */
+	int held;
+
+	/* Name and control lengths of the multishot receive, whether it is
+	 * armed, whether it shall be re-armed and whether it is being
+	 * cancelled */
+	struct msghdr recv_msg;
+	bool armed;
+	bool stopping;
+	bool cancelling;
+
+	struct uring_send *sends;
+	struct uring_send *sends_free;
+
+	/* Drop counter of the socket reported with the last message */
+	uint32_t drops;
+	/* Replies, which failed, since the last uring_send_errors() */
+	uint64_t send_errors;
+	/* io_uring_enter calls, which submitted entries */
+	uint64_t submits;
+};
+
+#define URING_EMPTY {\
+		.fd = -1,\
+		.sock = -1,\
+		.sq_map = NULL,\
+		.cq_map = NULL,\
+		.sqes = NULL,\
+		.br = NULL,\
+		.bufs = NULL,\
+		.held = -1,\
+		.armed = false,\
+		.stopping = false,\
+		.cancelling = false,\
+		.sends = NULL,\
+		.sends_free = NULL,\
+		.drops = 0,\
+		.send_errors = 0,\
+		.submits = 0\
+	}
+
+/**
+ * Set up io_uring instance for a UDP socket and arm the multishot receive
+ *
+ * @param[out] u io_uring instance
+ * @param[in] sock Bound UDP socket
+ */
+extern bool uring_open(struct uring *u, int sock);
+
+/**
+ * Fetch next received message, completions of replies are reaped on the way
+ *
+ * The returned buffer is a provided buffer, which stays valid until the next
+ * call. The multishot receive is re-armed, when it ran out of buffers.
+ *
+ * @param[in] u io_uring instance
+ * @param[out] len Length of the DHCP message
+ * @param[out] src Source address and port of the message
+ * @param[out] stamp Time the kernel received the message, zero if unknown
+ * @return Pointer to the DHCP message or NULL if no message is pending
+ */
+extern uint8_t *uring_next(struct uring *u, size_t *len,
+	struct sockaddr_in *src, struct timespec *stamp);
+
+/**
+ * Queue reply, which is copied, the reply is sent with the next
+ * uring_submit()
+ *
+ * @param[in] u io_uring instance
+ * @param[in] data Reply
+ * @param[in] len Length of the reply
+ * @param[in] dst Destination address and port
+ * @return false if all send slots are in flight, send the reply otherwise
+ */
+extern bool uring_send(struct uring *u, const void *data, size_t len,
+	const struct sockaddr_in *dst);
+
+/**
+ * Submit all queued entries with a single system call, does nothing if the
+ * instance isn't set up
+ */
+extern bool uring_submit(struct uring *u);
+
+/**
+ * Cancel the multishot receive, messages received before are still
+ * returned by uring_next(), which waits until the receive ended, so once it
+ * returns NULL no further message was taken from the socket
+ */
+extern void uring_stop(struct uring *u);
+
+/**
+ * Arm the multishot receive again after uring_stop()
+ */
+extern bool uring_start(struct uring *u);
+
+/**
+ * Fetch count of replies, which failed, since the last call
+ */
+extern uint64_t uring_send_errors(struct uring *u);
+
+/**
+ * Tear down io_uring instance, the UDP socket is left open
+ */
+extern void uring_close(struct uring *u);
+
+#endif